@@ -2,13 +2,14 @@ from fastapi import FastAPI, File, UploadFile, HTTPException, Depends
 from fastapi.middleware.cors import CORSMiddleware
 from fastapi.responses import JSONResponse
 from pydantic import BaseModel
-from typing import Optional, List
+from typing import Optional, List, Union
 from sqlalchemy.orm import Session
 import uvicorn
 import cv2
 import numpy as np
 from datetime import datetime
 import os
+import time
 from image_classifier import MaterialClassifier
 from database import get_db, engine, Base
 from models import Bin, DetectionLog, BinEvent
@@ -35,12 +36,17 @@ classifier = MaterialClassifier(model_path=model_path)
 class BinUpdate(BaseModel):
     bin_organic_id: str
     bin_non_organic_id: str
-    organic_weight: float
-    non_organic_weight: float
+    organic_weight: Optional[float] = None       # None: no scale reading, keep the last one
+    non_organic_weight: Optional[float] = None
     organic_full: bool
     non_organic_full: bool
     timestamp: Optional[int] = None
 
+class BinBatch(BaseModel):
+    """Updates a station gateway collected from the bins around it."""
+    gateway: Optional[int] = None
+    bins: List[BinUpdate]
+
 class BinStatus(BaseModel):
     id: str
     type: str
@@ -101,6 +107,7 @@ async def detect_material(file: UploadFile = File(...), db: Session = Depends(ge
     try:
         # Read image file
         contents = await file.read()
+        started = time.perf_counter()
         
         # Convert to numpy array
         nparr = np.frombuffer(contents, np.uint8)
@@ -111,6 +118,7 @@ async def detect_material(file: UploadFile = File(...), db: Session = Depends(ge
         
         # Classify material using advanced image recognition
         result = classifier.classify(image)
+        classify_ms = (time.perf_counter() - started) * 1000
         
         # Log detection to database
         detection_log = DetectionLog(
@@ -126,68 +134,81 @@ async def detect_material(file: UploadFile = File(...), db: Session = Depends(ge
         print(f"[{datetime.now()}] Material detected: {result['material']} "
               f"(confidence: {result['confidence']:.2f}, method: {method})")
         
-        return JSONResponse(content=result)
+        # Lets the camera tell classification time from upload time when
+        # it tunes its image size
+        return JSONResponse(content=result, headers={"Server-Timing": f"classify;dur={classify_ms:.1f}"})
     
     except Exception as e:
         raise HTTPException(status_code=500, detail=f"Detection error: {str(e)}")
 
-@app.post("/api/bins/update")
-async def update_bins(data: BinUpdate, db: Session = Depends(get_db)):
+def apply_bin_update(data: BinUpdate, db: Session):
     """
-    Update bin status from ESP32.
+    Apply one station's update to its two bins; the caller commits.
     """
-    try:
-        # Update organic bin
-        organic_bin = db.query(Bin).filter(Bin.id == data.bin_organic_id).first()
-        if organic_bin:
+    # Update organic bin
+    organic_bin = db.query(Bin).filter(Bin.id == data.bin_organic_id).first()
+    if organic_bin:
+        if data.organic_weight is not None:
             organic_bin.weight = data.organic_weight
             organic_bin.level = int((data.organic_weight / 10.0) * 100)
-            organic_bin.full = data.organic_full
-            organic_bin.last_update = datetime.now()
-            
-            # Log event if bin became full
-            if data.organic_full and not organic_bin.full:
-                event = BinEvent(bin_id=data.bin_organic_id, event_type="full")
-                db.add(event)
-        else:
-            # Create new bin if it doesn't exist
-            organic_bin = Bin(
-                id=data.bin_organic_id,
-                type="organic",
-                weight=data.organic_weight,
-                level=int((data.organic_weight / 10.0) * 100),
-                full=data.organic_full
-            )
-            db.add(organic_bin)
+        organic_bin.full = data.organic_full
+        organic_bin.last_update = datetime.now()
         
-        # Update non-organic bin
-        non_organic_bin = db.query(Bin).filter(Bin.id == data.bin_non_organic_id).first()
-        if non_organic_bin:
+        # Log event if bin became full
+        if data.organic_full and not organic_bin.full:
+            event = BinEvent(bin_id=data.bin_organic_id, event_type="full")
+            db.add(event)
+    else:
+        # Create new bin if it doesn't exist
+        organic_bin = Bin(
+            id=data.bin_organic_id,
+            type="organic",
+            weight=data.organic_weight or 0.0,
+            level=int(((data.organic_weight or 0.0) / 10.0) * 100),
+            full=data.organic_full
+        )
+        db.add(organic_bin)
+    
+    # Update non-organic bin
+    non_organic_bin = db.query(Bin).filter(Bin.id == data.bin_non_organic_id).first()
+    if non_organic_bin:
+        if data.non_organic_weight is not None:
             non_organic_bin.weight = data.non_organic_weight
             non_organic_bin.level = int((data.non_organic_weight / 10.0) * 100)
-            non_organic_bin.full = data.non_organic_full
-            non_organic_bin.last_update = datetime.now()
-            
-            # Log event if bin became full
-            if data.non_organic_full and not non_organic_bin.full:
-                event = BinEvent(bin_id=data.bin_non_organic_id, event_type="full")
-                db.add(event)
-        else:
-            # Create new bin if it doesn't exist
-            non_organic_bin = Bin(
-                id=data.bin_non_organic_id,
-                type="non_organic",
-                weight=data.non_organic_weight,
-                level=int((data.non_organic_weight / 10.0) * 100),
-                full=data.non_organic_full
-            )
-            db.add(non_organic_bin)
+        non_organic_bin.full = data.non_organic_full
+        non_organic_bin.last_update = datetime.now()
+        
+        # Log event if bin became full
+        if data.non_organic_full and not non_organic_bin.full:
+            event = BinEvent(bin_id=data.bin_non_organic_id, event_type="full")
+            db.add(event)
+    else:
+        # Create new bin if it doesn't exist
+        non_organic_bin = Bin(
+            id=data.bin_non_organic_id,
+            type="non_organic",
+            weight=data.non_organic_weight or 0.0,
+            level=int(((data.non_organic_weight or 0.0) / 10.0) * 100),
+            full=data.non_organic_full
+        )
+        db.add(non_organic_bin)
+
+@app.post("/api/bins/update")
+async def update_bins(data: Union[BinBatch, BinUpdate], db: Session = Depends(get_db)):
+    """
+    Update bin status from ESP32, one station or a gateway's batch.
+    """
+    try:
+        updates = data.bins if isinstance(data, BinBatch) else [data]
+        for update in updates:
+            apply_bin_update(update, db)
         
         db.commit()
         
         return {
             "status": "success",
-            "message": "Bins updated successfully"
+            "message": "Bins updated successfully",
+            "updated": len(updates)
         }
     
     except Exception as e:
@@ -299,4 +320,6 @@ async def log_bin_event(bin_id: str, event_type: str, db: Session = Depends(get_
     }
 
 if __name__ == "__main__":
-    uvicorn.run(app, host="0.0.0.0", port=8000)
+    # Cameras keep their connection open between detections; uvicorn's
+    # default 5 s would close it before the next one
+    uvicorn.run(app, host="0.0.0.0", port=8000, timeout_keep_alive=120)
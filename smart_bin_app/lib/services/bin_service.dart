@@ -10,7 +10,7 @@ class BinService {
 
   BinService({
     this.baseUrl = 'http://192.168.1.100:8000',
-    this.wsUrl = 'ws://192.168.1.100:81',
+    this.wsUrl = 'ws://192.168.1.100/ws',
   });
 
   // HTTP API Methods
@@ -110,7 +110,7 @@ class BinService {
   // WebSocket Methods
   WebSocketChannel? connectWebSocket(String ip) {
     try {
-      _channel = WebSocketChannel.connect(Uri.parse('ws://$ip:81'));
+      _channel = WebSocketChannel.connect(Uri.parse('ws://$ip/ws'));
       return _channel;
     } catch (e) {
       return null;
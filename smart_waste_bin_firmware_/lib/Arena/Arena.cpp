@@ -0,0 +1,81 @@
+#include "Arena.h"
+
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+static const size_t ARENA_ALIGN = 8;
+
+void Arena::begin(void* memory, size_t size) {
+  // Align the start so every allocation is aligned
+  uintptr_t start = ((uintptr_t)memory + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1);
+  size_t skip = start - (uintptr_t)memory;
+  base = (uint8_t*)start;
+  capacity = size > skip ? size - skip : 0;
+  used = 0;
+  peak = 0;
+  failures = 0;
+  last = nullptr;
+}
+
+#if defined(ESP32)
+bool Arena::beginPreferPsram(size_t psramSize, size_t internalSize) {
+  void* memory = heap_caps_malloc(psramSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  psram = memory != nullptr;
+  if (psram) {
+    begin(memory, psramSize);
+    return true;
+  }
+  memory = heap_caps_malloc(internalSize, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  if (!memory) {
+    return false;
+  }
+  begin(memory, internalSize);
+  return true;
+}
+#endif
+
+void* Arena::allocate(size_t size) {
+  size_t rounded = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (rounded < size || rounded > capacity - used) {
+    failures++;
+    return nullptr;
+  }
+  last = base + used;
+  used += rounded;
+  if (used > peak) {
+    peak = used;
+  }
+  return last;
+}
+
+void* Arena::reallocate(void* ptr, size_t size) {
+  if (!ptr) {
+    return allocate(size);
+  }
+  if (ptr != last) {
+    failures++;
+    return nullptr;
+  }
+  size_t offset = last - base;
+  size_t rounded = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+  if (rounded < size || rounded > capacity - offset) {
+    failures++;
+    return nullptr;
+  }
+  used = offset + rounded;
+  if (used > peak) {
+    peak = used;
+  }
+  return ptr;
+}
+
+void Arena::rewind(size_t position) {
+  if (position < used) {
+    used = position;
+    // Anything past the mark is gone, including the last allocation
+    if (last && (size_t)(last - base) >= position) {
+      last = nullptr;
+    }
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Bump-pointer arena for per-request scratch memory (JSON documents,
+// response bodies). Nothing is freed individually; an ArenaScope rewinds
+// the arena when the request is done, so a request costs no general heap
+// allocations and leaves no holes behind.
+//
+// An arena belongs to one task: the loop has its own and the async web
+// server's callbacks share another.
+
+class Arena {
+public:
+  Arena() : base(nullptr), capacity(0), used(0), peak(0), failures(0), last(nullptr) {}
+
+  // Uses `size` bytes at `memory` for the arena's lifetime.
+  void begin(void* memory, size_t size);
+
+#if defined(ESP32)
+  // Claims `psramSize` bytes of PSRAM, or `internalSize` bytes of internal
+  // RAM when there is no PSRAM. Done once at boot, so the block never
+  // moves and never fragments anything. Returns false if both fail.
+  bool beginPreferPsram(size_t psramSize, size_t internalSize);
+  bool inPsram() const { return psram; }
+#endif
+
+  // 8-byte aligned; nullptr when the arena is exhausted.
+  void* allocate(size_t size);
+  // Grows or shrinks the most recent allocation in place; nullptr otherwise.
+  void* reallocate(void* ptr, size_t size);
+
+  size_t mark() const { return used; }
+  void rewind(size_t position);
+
+  size_t size() const { return capacity; }
+  size_t inUse() const { return used; }
+  size_t highWater() const { return peak; }
+  uint32_t failedAllocations() const { return failures; }
+
+private:
+  uint8_t* base;
+  size_t capacity;
+  size_t used;
+  size_t peak;
+  uint32_t failures;
+  uint8_t* last;
+#if defined(ESP32)
+  bool psram = false;
+#endif
+};
+
+// Rewinds the arena to where it was when the scope was entered.
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena& a) : arena(a), start(a.mark()) {}
+  ~ArenaScope() { arena.rewind(start); }
+private:
+  Arena& arena;
+  size_t start;
+};
+
+// Allocator for ArduinoJson's BasicJsonDocument:
+//   typedef BasicJsonDocument<ArenaAllocator> ArenaJsonDocument;
+//   ArenaJsonDocument doc(2048, ArenaAllocator(webArena));
+// A document that does not fit gets zero capacity, like a failed
+// DynamicJsonDocument, and serialises as null.
+struct ArenaAllocator {
+  explicit ArenaAllocator(Arena& a) : arena(&a) {}
+  void* allocate(size_t size) { return arena->allocate(size); }
+  void deallocate(void*) {}
+  void* reallocate(void* ptr, size_t size) { return arena->reallocate(ptr, size); }
+  Arena* arena;
+};
+
+#endif
@@ -0,0 +1,289 @@
+#include "BinController.h"
+#include <string.h>
+#include <stdlib.h>
+
+BinController::BinController(const BinControllerConfig& config, BinHardware& hardware)
+    : cfg(config),
+      hw(hardware),
+      currentState(IDLE),
+      selectedBin(BIN_ORGANIC),
+      fill{ FillEstimator(config.fill), FillEstimator(config.fill) },
+      samplingPolicy(config.sampling),
+      lastGrams(0),
+      lastMotionTime(0),
+      binOpenTime(0),
+      materialDetectionStartTime(0),
+      materialDetectionComplete(false),
+      material(MATERIAL_UNKNOWN),
+      detectionTimedOut(false),
+      detectionId(0),
+      lastDebounceTime(0) {
+  memset(&counters, 0, sizeof(counters));
+  keypadOpen[0] = keypadOpen[1] = false;
+  keypadOpenTime[0] = keypadOpenTime[1] = 0;
+}
+
+void BinController::setState(BinState next) {
+  if (next != currentState) {
+    hw.trace(TRACE_STATE, currentState, next);
+    currentState = next;
+  }
+}
+
+// ==================== STATE MACHINE ====================
+void BinController::runStateMachine() {
+  ManualCommand command;
+  while (hw.receiveCommand(command)) {
+    manualCommand(command);
+  }
+  
+  switch(currentState) {
+    case IDLE:
+      handleMotionDetection();
+      break;
+      
+    case DETECTING_MOTION:
+      if (hw.millis() - lastMotionTime > cfg.motionTimeoutMs) {
+        setState(IDLE);
+      } else {
+        setState(ANALYZING_MATERIAL);
+        materialDetectionStartTime = hw.millis();
+        // Request material detection from ESP32-CAM via CAN, tagged so the
+        // reply (and the camera's stage reports) can be matched to it
+        if (++detectionId == 0) {
+          detectionId = 1;
+        }
+        CanMessage request;
+        makeDetectRequest(request, detectionId);
+        hw.sendCan(request);
+      }
+      break;
+      
+    case ANALYZING_MATERIAL:
+      handleMaterialDetection();
+      if (materialDetectionComplete) {
+        counters.detections++;
+        detectionTimedOut = false;
+        if (material == MATERIAL_ORGANIC) {
+          selectedBin = BIN_ORGANIC;
+        } else if (material == MATERIAL_NON_ORGANIC) {
+          selectedBin = BIN_NON_ORGANIC;
+        }
+        hw.trace(TRACE_DETECTION, material, hw.millis() - materialDetectionStartTime);
+        if (material == MATERIAL_NONE) {
+          // Someone walked past; nothing to sort
+          counters.emptyDetections++;
+          setState(IDLE);
+        } else {
+          setState(OPENING_BIN);
+        }
+        materialDetectionComplete = false;
+      }
+      // Timeout after 5 seconds
+      if (currentState == ANALYZING_MATERIAL && hw.millis() - materialDetectionStartTime > cfg.detectionTimeoutMs) {
+        counters.detectionTimeouts++;
+        detectionTimedOut = true;
+        hw.trace(TRACE_DETECTION_TIMEOUT, 0, hw.millis() - materialDetectionStartTime);
+        material = MATERIAL_UNKNOWN;
+        selectedBin = BIN_ORGANIC; // Default to organic
+        setState(OPENING_BIN);
+      }
+      break;
+      
+    case OPENING_BIN:
+      if (!fill[selectedBin].isFull()) {
+        openBin(selectedBin);
+        setState(BIN_OPEN);
+        binOpenTime = hw.millis();
+      } else {
+        // Bin is full, cannot open
+        counters.fullRefusals++;
+        hw.playTone(TONE_ERROR);
+        setState(BIN_FULL);
+      }
+      break;
+      
+    case BIN_OPEN:
+      samplingPolicy.boost(hw.millis());
+      // Check if motion is still detected
+      if (!hw.motion() || hw.millis() - lastMotionTime > cfg.motionTimeoutMs) {
+        if (hw.millis() - binOpenTime > cfg.binCloseDelayMs) {
+          setState(CLOSING_BIN);
+        }
+      } else {
+        lastMotionTime = hw.millis();
+      }
+      break;
+      
+    case CLOSING_BIN:
+      closeBin(selectedBin);
+      setState(IDLE);
+      // Send data to backend
+      hw.uploadBinData();
+      break;
+      
+    case BIN_FULL:
+      // Fill estimate uses hysteresis, so this only clears once the bin is emptied
+      if (!fill[BIN_ORGANIC].isFull() && !fill[BIN_NON_ORGANIC].isFull()) {
+        setState(IDLE);
+      }
+      break;
+      
+    case MAINTENANCE_MODE:
+      // Manual override mode
+      break;
+  }
+}
+
+// ==================== MOTION DETECTION ====================
+void BinController::handleMotionDetection() {
+  if (hw.motion()) {
+    lastMotionTime = hw.millis();
+    samplingPolicy.boost(lastMotionTime);
+    if (currentState == IDLE) {
+      counters.motionEvents++;
+      hw.trace(TRACE_MOTION, 0, 0);
+      setState(DETECTING_MOTION);
+    }
+  } else if (cfg.presenceTrigger && presenceReported()) {
+    lastMotionTime = hw.millis();
+    samplingPolicy.boost(lastMotionTime);
+    counters.motionEvents++;
+    counters.presenceTriggers++;
+    hw.trace(TRACE_MOTION, 1, 0);
+    setState(DETECTING_MOTION);
+  }
+}
+
+// Drains the bus while idle; true if the camera's latest report has an
+// item in the chute. Reports queued during the last cycle are superseded
+// by later ones, and anything else received now is a late reply to an old
+// request.
+bool BinController::presenceReported() {
+  bool present = false;
+  CanMessage msg;
+  while (hw.receiveCan(msg)) {
+    uint8_t node;
+    PresenceReport report;
+    if (parsePresence(msg, node, report)) {
+      present = report.present;
+    }
+  }
+  return present;
+}
+
+// ==================== MATERIAL DETECTION ====================
+void BinController::handleMaterialDetection() {
+  CanMessage msg;
+  if (hw.receiveCan(msg)) {
+    hw.trace(TRACE_CAN_RX, msg.length, msg.id);
+    // Response from ESP32-CAM; untagged replies come from older cameras,
+    // tagged ones for an earlier request arrived after its timeout
+    Material result;
+    uint16_t traceId;
+    if (parseMaterialResult(msg, result, traceId) && (traceId == 0 || traceId == detectionId)) {
+      material = result;
+      materialDetectionComplete = true;
+    }
+  }
+}
+
+// ==================== BIN CONTROL ====================
+void BinController::manualCommand(ManualCommand command) {
+  switch (command) {
+    case MANUAL_OPEN_ORGANIC:
+    case MANUAL_OPEN_NON_ORGANIC: {
+      uint8_t bin = command == MANUAL_OPEN_ORGANIC ? BIN_ORGANIC : BIN_NON_ORGANIC;
+      if (!isFull(bin)) {
+        openBin(bin);
+      }
+      break;
+    }
+    case MANUAL_CLOSE_ORGANIC:
+      closeBin(BIN_ORGANIC);
+      break;
+    case MANUAL_CLOSE_NON_ORGANIC:
+      closeBin(BIN_NON_ORGANIC);
+      break;
+    case MANUAL_MAINTENANCE_ON:
+      setState(MAINTENANCE_MODE);
+      break;
+    case MANUAL_MAINTENANCE_OFF:
+      if (currentState == MAINTENANCE_MODE) {
+        setState(IDLE);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+void BinController::openBin(uint8_t bin) {
+  hw.setLid(bin, true);
+  counters.lidOpens++;
+  hw.trace(TRACE_LID_OPEN, bin, 0);
+  samplingPolicy.boost(hw.millis());
+  hw.playTone(TONE_CHIRP);
+}
+
+void BinController::closeBin(uint8_t bin) {
+  hw.setLid(bin, false);
+  hw.trace(TRACE_LID_CLOSE, bin, 0);
+  samplingPolicy.boost(hw.millis());
+}
+
+// ==================== BIN LEVEL MONITORING ====================
+void BinController::updateBinLevel() {
+  // Idle bins are sampled slowly; see SamplingPolicy
+  if (!samplingPolicy.shouldSample(hw.millis())) {
+    return;
+  }
+
+  // Read load cell (simplified - in real implementation, you'd have separate load cells)
+  int32_t grams = hw.massGrams();
+
+  // Ultrasonic sensor gives the volume estimate
+  int32_t distanceMm = hw.distanceMm();
+
+  // Both bins share the sensors until each has its own
+  fill[BIN_ORGANIC].update(distanceMm, grams);
+  fill[BIN_NON_ORGANIC].update(distanceMm, grams);
+
+  // A change in weight means someone is using the bin
+  if (grams != FillEstimator::INVALID) {
+    if (abs(grams - lastGrams) > cfg.weightChangeBoostGrams) {
+      samplingPolicy.boost(hw.millis());
+    }
+    lastGrams = grams;
+  }
+
+  // Only lock out from idle; never interrupt a lid cycle or maintenance
+  if ((fill[BIN_ORGANIC].isFull() || fill[BIN_NON_ORGANIC].isFull()) && currentState == IDLE) {
+    setState(BIN_FULL);
+  }
+}
+
+// ==================== KEYPAD CONTROL ====================
+void BinController::checkKeypad() {
+  // Close lids opened from the keypad once their hold time is up
+  for (uint8_t bin = 0; bin < 2; bin++) {
+    if (keypadOpen[bin] && hw.millis() - keypadOpenTime[bin] >= cfg.keypadOpenMs) {
+      keypadOpen[bin] = false;
+      closeBin(bin);
+    }
+  }
+  
+  if (hw.millis() - lastDebounceTime > cfg.keypadDebounceMs) {
+    for (uint8_t bin = 0; bin < 2; bin++) {
+      // Button 1: organic, Button 2: non-organic (if not full)
+      if (hw.keypadPressed(bin)) {
+        if (!fill[bin].isFull() && !keypadOpen[bin]) {
+          openBin(bin);
+          keypadOpen[bin] = true;
+          keypadOpenTime[bin] = hw.millis();
+        }
+        lastDebounceTime = hw.millis();
+      }
+    }
+  }
+}
@@ -0,0 +1,150 @@
+#ifndef BIN_CONTROLLER_H
+#define BIN_CONTROLLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <FillEstimator.h>
+#include <SamplingPolicy.h>
+#include <PatternEngine.h>
+#include <EventTrace.h>
+#include <BinProtocol.h>
+
+// Control logic of the bin: state machine, fill level tracking and keypad.
+//
+// Everything the logic reads or drives goes through BinHardware, so the
+// same code runs on the ESP32 (GPIO, servos, HX711, CAN) and on a host
+// replaying recorded inputs (tools/replay).
+
+enum BinState {
+  IDLE,
+  DETECTING_MOTION,
+  ANALYZING_MATERIAL,
+  OPENING_BIN,
+  BIN_OPEN,
+  CLOSING_BIN,
+  BIN_FULL,
+  MAINTENANCE_MODE
+};
+
+const uint8_t BIN_STATE_COUNT = MAINTENANCE_MODE + 1;
+
+const uint8_t BIN_ORGANIC = 0;
+const uint8_t BIN_NON_ORGANIC = 1;
+
+// Manual control from the web API and WebSocket. The web server task only
+// queues these; runStateMachine() takes them from BinHardware, so they never
+// race a transition and are recorded like any other input.
+enum ManualCommand {
+  MANUAL_OPEN_ORGANIC,
+  MANUAL_OPEN_NON_ORGANIC,
+  MANUAL_CLOSE_ORGANIC,
+  MANUAL_CLOSE_NON_ORGANIC,
+  MANUAL_MAINTENANCE_ON,
+  MANUAL_MAINTENANCE_OFF,
+  MANUAL_COMMAND_COUNT
+};
+
+class BinHardware {
+public:
+  virtual ~BinHardware() {}
+
+  // Inputs
+  virtual uint32_t millis() = 0;
+  virtual bool motion() = 0;                       // PIR output high
+  virtual bool keypadPressed(uint8_t button) = 0;  // 0 or 1
+  virtual int32_t distanceMm() = 0;                // FillEstimator::INVALID if no echo
+  virtual int32_t massGrams() = 0;                 // FillEstimator::INVALID if not ready
+  // False if nothing was received
+  virtual bool receiveCan(CanMessage& msg) = 0;
+  // False if no manual command is waiting
+  virtual bool receiveCommand(ManualCommand& command) = 0;
+
+  // Outputs
+  virtual void setLid(uint8_t bin, bool open) = 0;
+  virtual void sendCan(const CanMessage& msg) = 0;
+  virtual void playTone(TonePattern tone) = 0;
+  virtual void uploadBinData() = 0;
+  virtual void trace(uint8_t event, uint8_t a, uint16_t b) = 0;
+};
+
+struct BinControllerConfig {
+  uint32_t organicBinId;
+  uint32_t nonOrganicBinId;
+  uint32_t motionTimeoutMs;
+  uint32_t binCloseDelayMs;
+  uint32_t detectionTimeoutMs;
+  uint32_t keypadDebounceMs;
+  uint32_t keypadOpenMs;            // How long a keypad open holds the lid
+  int32_t weightChangeBoostGrams;   // Weight change that counts as activity
+  bool presenceTrigger;             // An item seen by the camera starts a cycle like the PIR
+  FillEstimatorConfig fill;
+  SamplingConfig sampling;
+};
+
+struct ControllerCounters {
+  uint32_t motionEvents;
+  uint32_t detections;
+  uint32_t detectionTimeouts;
+  uint32_t emptyDetections;   // Camera saw nothing in the chute
+  uint32_t presenceTriggers;  // Cycles started by the camera instead of the PIR
+  uint32_t lidOpens;
+  uint32_t fullRefusals;
+  uint32_t uploads;
+  uint32_t uploadFailures;
+};
+
+class BinController {
+public:
+  BinController(const BinControllerConfig& config, BinHardware& hardware);
+
+  // Loop phases, called in this order every pass
+  void checkKeypad();
+  void updateBinLevel();
+  void runStateMachine();
+
+  // Manual control; a full bin refuses to open
+  void manualCommand(ManualCommand command);
+  void openBin(uint8_t bin);
+  void closeBin(uint8_t bin);
+  void setState(BinState next);
+
+  BinState state() const { return currentState; }
+  bool isFull(uint8_t bin) const { return fill[bin].isFull(); }
+  const FillEstimator& fillEstimate(uint8_t bin) const { return fill[bin]; }
+  float weightKg(uint8_t bin) const { return fill[bin].massGrams() / 1000.0f; }
+  const SamplingPolicy& sampling() const { return samplingPolicy; }
+  Material detectedMaterial() const { return material; }
+  bool lastDetectionTimedOut() const { return detectionTimedOut; }
+  uint16_t lastDetectionId() const { return detectionId; }
+  uint32_t binId(uint8_t bin) const { return bin == BIN_ORGANIC ? cfg.organicBinId : cfg.nonOrganicBinId; }
+
+  ControllerCounters counters;
+
+private:
+  void handleMotionDetection();
+  bool presenceReported();
+  void handleMaterialDetection();
+
+  BinControllerConfig cfg;
+  BinHardware& hw;
+
+  BinState currentState;
+  uint8_t selectedBin;
+  FillEstimator fill[2];
+  SamplingPolicy samplingPolicy;
+  int32_t lastGrams;
+
+  uint32_t lastMotionTime;
+  uint32_t binOpenTime;
+  uint32_t materialDetectionStartTime;
+  bool materialDetectionComplete;
+  Material material;
+  bool detectionTimedOut;
+  uint16_t detectionId;   // Trace id of the last request, never 0
+
+  uint32_t lastDebounceTime;
+  bool keypadOpen[2];
+  uint32_t keypadOpenTime[2];
+};
+
+#endif
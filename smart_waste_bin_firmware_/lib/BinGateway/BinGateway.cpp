@@ -0,0 +1,372 @@
+#include "BinGateway.h"
+#include <stdio.h>
+#include <string.h>
+
+const uint8_t RADIO_BROADCAST[RADIO_ADDRESS_SIZE] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };
+
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t* p) {
+  return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+size_t packLeafReport(uint8_t* out, const LeafReport& report) {
+  out[0] = GATEWAY_FRAME_REPORT;
+  out[1] = GATEWAY_VERSION;
+  put16(out + 2, report.sequence);
+  out[4] = report.state;
+  out[5] = report.flags;
+  uint8_t* p = out + 6;
+  for (uint8_t i = 0; i < 2; i++) {
+    put32(p, report.binIds[i]);
+    put32(p + 4, (uint32_t)report.grams[i]);
+    put16(p + 8, report.fillPermille[i]);
+    put16(p + 10, (uint16_t)report.ratePerHour[i]);
+    put32(p + 12, (uint32_t)report.secondsToFull[i]);
+    p += 16;
+  }
+  return LEAF_REPORT_SIZE;
+}
+
+bool parseLeafReport(const uint8_t* data, size_t len, LeafReport& report) {
+  if (len < LEAF_REPORT_SIZE || data[0] != GATEWAY_FRAME_REPORT || data[1] != GATEWAY_VERSION) {
+    return false;
+  }
+  report.sequence = get16(data + 2);
+  report.state = data[4];
+  report.flags = data[5];
+  const uint8_t* p = data + 6;
+  for (uint8_t i = 0; i < 2; i++) {
+    report.binIds[i] = get32(p);
+    report.grams[i] = (int32_t)get32(p + 4);
+    report.fillPermille[i] = get16(p + 8);
+    report.ratePerHour[i] = (int16_t)get16(p + 10);
+    report.secondsToFull[i] = (int32_t)get32(p + 12);
+    p += 16;
+  }
+  return true;
+}
+
+static size_t packAck(uint8_t* out, uint16_t sequence, uint32_t station, uint32_t unixTime) {
+  out[0] = GATEWAY_FRAME_ACK;
+  out[1] = GATEWAY_VERSION;
+  put16(out + 2, sequence);
+  put32(out + 4, station);
+  put32(out + 8, unixTime);
+  return GATEWAY_ACK_SIZE;
+}
+
+// ==================== GATEWAY ====================
+BinGateway::BinGateway(RadioTransport& gatewayRadio, const GatewayConfig& config)
+    : radio(gatewayRadio),
+      cfg(config),
+      localSequence(0),
+      urgent(false),
+      retryAtMs(0),
+      retrying(false),
+      reportCount(0),
+      duplicateCount(0),
+      rejectedCount(0),
+      uploadCount(0),
+      failureCount(0),
+      uploadedCount(0) {
+  memset(table, 0, sizeof(table));
+}
+
+// Stations are keyed by their organic bin id; a new one takes a free slot
+// or the longest-silent one past staleMs that has nothing pending
+BinGateway::Station* BinGateway::find(uint32_t stationId, uint32_t nowMs) {
+  Station* free = nullptr;
+  Station* stale = nullptr;
+  for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+    Station& s = table[i];
+    if (!s.used) {
+      if (!free) {
+        free = &s;
+      }
+    } else if (s.report.binIds[0] == stationId) {
+      return &s;
+    } else if (!s.pending && !s.inBatch && nowMs - s.lastSeenMs >= cfg.staleMs &&
+               (!stale || nowMs - s.lastSeenMs > nowMs - stale->lastSeenMs)) {
+      stale = &s;
+    }
+  }
+  Station* s = free ? free : stale;
+  if (s) {
+    memset(s, 0, sizeof(*s));
+  }
+  return s;
+}
+
+bool BinGateway::store(const LeafReport& report, uint32_t nowMs) {
+  Station* s = find(report.binIds[0], nowMs);
+  if (!s) {
+    rejectedCount++;
+    return false;
+  }
+  s->lastSeenMs = nowMs;
+  if (s->used && s->report.sequence == report.sequence) {
+    duplicateCount++;
+    return true;
+  }
+  uint8_t newlyFull = report.flags & ~(s->used ? s->report.flags : 0) &
+                      (LEAF_FLAG_ORGANIC_FULL | LEAF_FLAG_NON_ORGANIC_FULL);
+  if (newlyFull) {
+    urgent = true;
+  }
+  if (!s->pending) {
+    s->pendingSinceMs = nowMs;
+  }
+  s->used = true;
+  s->pending = true;
+  s->report = report;
+  reportCount++;
+  return true;
+}
+
+void BinGateway::receive(const uint8_t* peer, const uint8_t* data, size_t len, uint32_t nowMs, uint32_t unixTime) {
+  LeafReport report;
+  if (!parseLeafReport(data, len, report)) {
+    rejectedCount++;
+    return;
+  }
+  // No slot, no ack: the leaf keeps its report and tries again later
+  if (!store(report, nowMs)) {
+    return;
+  }
+  uint8_t ack[GATEWAY_ACK_SIZE];
+  radio.send(peer, ack, packAck(ack, report.sequence, report.binIds[0], unixTime));
+}
+
+void BinGateway::submit(const LeafReport& report, uint32_t nowMs) {
+  LeafReport local = report;
+  local.sequence = ++localSequence;
+  store(local, nowMs);
+}
+
+uint8_t BinGateway::stations() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+    n += table[i].used;
+  }
+  return n;
+}
+
+uint8_t BinGateway::pending() const {
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+    n += table[i].pending;
+  }
+  return n;
+}
+
+bool BinGateway::uploadDue(uint32_t nowMs) const {
+  if (retrying && (int32_t)(nowMs - retryAtMs) < 0) {
+    return false;
+  }
+  uint8_t count = 0;
+  bool old = false;
+  for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+    const Station& s = table[i];
+    if (s.pending) {
+      count++;
+      old = old || nowMs - s.pendingSinceMs >= cfg.maxDelayMs;
+    }
+  }
+  return count > 0 && (urgent || old || count >= cfg.batchSize);
+}
+
+uint8_t BinGateway::takeBatch(GatewayEntry* out, uint8_t maxCount, uint32_t nowMs) {
+  if (maxCount > MAX_BATCH) {
+    maxCount = MAX_BATCH;
+  }
+  uint8_t n = 0;
+  while (n < maxCount) {
+    Station* oldest = nullptr;
+    for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+      Station& s = table[i];
+      if (s.pending && !s.inBatch &&
+          (!oldest || nowMs - s.pendingSinceMs > nowMs - oldest->pendingSinceMs)) {
+        oldest = &s;
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+    oldest->inBatch = true;
+    oldest->batchSequence = oldest->report.sequence;
+    out[n].report = oldest->report;
+    out[n].ageMs = nowMs - oldest->lastSeenMs;
+    n++;
+  }
+  return n;
+}
+
+void BinGateway::uploaded(bool ok, uint32_t nowMs) {
+  for (uint8_t i = 0; i < MAX_STATIONS; i++) {
+    Station& s = table[i];
+    if (!s.inBatch) {
+      continue;
+    }
+    s.inBatch = false;
+    // A report that arrived during the upload is still news
+    if (ok && s.report.sequence == s.batchSequence) {
+      s.pending = false;
+      uploadedCount++;
+    }
+  }
+  if (ok) {
+    uploadCount++;
+    urgent = false;
+    retrying = false;
+  } else {
+    failureCount++;
+    retrying = true;
+    retryAtMs = nowMs + cfg.retryMs;
+  }
+}
+
+size_t BinGateway::formatBatch(char* out, size_t maxLen, uint32_t gatewayId, const GatewayEntry* entries, uint8_t count) {
+  size_t n = snprintf(out, maxLen, "{\"gateway\":%lu,\"bins\":[", (unsigned long)gatewayId);
+  for (uint8_t i = 0; i < count && n < maxLen; i++) {
+    const LeafReport& r = entries[i].report;
+    // null weight: the backend keeps the last one it had
+    char kg[2][16];
+    for (uint8_t b = 0; b < 2; b++) {
+      if (r.grams[b] == LEAF_NO_READING) {
+        snprintf(kg[b], sizeof(kg[b]), "null");
+      } else {
+        snprintf(kg[b], sizeof(kg[b]), "%.2f", r.grams[b] / 1000.0f);
+      }
+    }
+    n += snprintf(out + n, maxLen - n,
+                  "%s{\"bin_organic_id\":\"%lu\",\"bin_non_organic_id\":\"%lu\","
+                  "\"organic_weight\":%s,\"non_organic_weight\":%s,"
+                  "\"organic_full\":%s,\"non_organic_full\":%s,"
+                  "\"organic_fill\":%.1f,\"non_organic_fill\":%.1f,"
+                  "\"organic_rate\":%.2f,\"non_organic_rate\":%.2f,"
+                  "\"organic_time_to_full\":%ld,\"non_organic_time_to_full\":%ld,"
+                  "\"state\":%u,\"age_ms\":%lu}",
+                  i ? "," : "", (unsigned long)r.binIds[0], (unsigned long)r.binIds[1],
+                  kg[0], kg[1],
+                  r.flags & LEAF_FLAG_ORGANIC_FULL ? "true" : "false",
+                  r.flags & LEAF_FLAG_NON_ORGANIC_FULL ? "true" : "false",
+                  r.fillPermille[0] / 10.0f, r.fillPermille[1] / 10.0f,
+                  r.ratePerHour[0] / 100.0f, r.ratePerHour[1] / 100.0f,
+                  (long)r.secondsToFull[0], (long)r.secondsToFull[1],
+                  (unsigned)r.state, (unsigned long)entries[i].ageMs);
+  }
+  if (n < maxLen) {
+    n += snprintf(out + n, maxLen - n, "]}");
+  }
+  return n < maxLen ? n : 0;
+}
+
+// ==================== LEAF ====================
+LeafLink::LeafLink(RadioTransport& leafRadio, const LeafConfig& config, uint16_t firstSequence)
+    : radio(leafRadio),
+      cfg(config),
+      knowGateway(false),
+      radioChannel(config.firstChannel >= 1 && config.firstChannel <= CHANNELS ? config.firstChannel : 1),
+      nextSequence(firstSequence),
+      frameSequence(0),
+      stationId(0),
+      sending(false),
+      triesLeft(0),
+      channelsLeft(0),
+      sentAtMs(0),
+      onSinceMs(0),
+      onMs(0),
+      ackTime(0),
+      ackAtMs(0),
+      deliveredSequence(0),
+      sentCount(0),
+      deliveredCount(0),
+      failedCount(0),
+      hopCount(0) {
+  memcpy(gateway, RADIO_BROADCAST, RADIO_ADDRESS_SIZE);
+}
+
+void LeafLink::report(const LeafReport& report, uint32_t nowMs) {
+  LeafReport r = report;
+  r.sequence = nextSequence++;
+  packLeafReport(frame, r);
+  frameSequence = r.sequence;
+  stationId = r.binIds[0];
+  if (!sending) {
+    radio.power(true, radioChannel);
+    onSinceMs = nowMs;
+    sending = true;
+  }
+  triesLeft = cfg.attempts;
+  channelsLeft = knowGateway ? 0 : CHANNELS - 1;
+  transmit(nowMs);
+}
+
+void LeafLink::transmit(uint32_t nowMs) {
+  triesLeft--;
+  sentAtMs = nowMs;
+  sentCount++;
+  radio.send(gateway, frame, sizeof(frame));
+}
+
+void LeafLink::finish(uint32_t nowMs) {
+  sending = false;
+  onMs += nowMs - onSinceMs;
+  radio.power(false, radioChannel);
+}
+
+void LeafLink::receive(const uint8_t* peer, const uint8_t* data, size_t len, uint32_t nowMs) {
+  if (!sending || len < GATEWAY_ACK_SIZE || data[0] != GATEWAY_FRAME_ACK || data[1] != GATEWAY_VERSION ||
+      get16(data + 2) != frameSequence || get32(data + 4) != stationId) {
+    return;
+  }
+  memcpy(gateway, peer, RADIO_ADDRESS_SIZE);
+  knowGateway = true;
+  ackTime = get32(data + 8);
+  ackAtMs = nowMs;
+  deliveredSequence = frameSequence;
+  deliveredCount++;
+  finish(nowMs);
+}
+
+void LeafLink::update(uint32_t nowMs) {
+  if (!sending || nowMs - sentAtMs < cfg.ackTimeoutMs) {
+    return;
+  }
+  if (triesLeft > 0) {
+    transmit(nowMs);
+    return;
+  }
+  if (channelsLeft > 0) {
+    channelsLeft--;
+    radioChannel = radioChannel % CHANNELS + 1;
+    hopCount++;
+    radio.power(true, radioChannel);
+    triesLeft = cfg.attempts;
+    transmit(nowMs);
+    return;
+  }
+  failedCount++;
+  finish(nowMs);
+  // A gateway that stopped answering may have moved with the AP; the next
+  // report sweeps the channels again
+  if (knowGateway) {
+    knowGateway = false;
+    memcpy(gateway, RADIO_BROADCAST, RADIO_ADDRESS_SIZE);
+  }
+}
@@ -0,0 +1,210 @@
+#ifndef BIN_GATEWAY_H
+#define BIN_GATEWAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Gateway mode: neighbouring bins report to one controller over a short
+// range radio (ESP-NOW on the ESP32) instead of each joining the site WiFi,
+// and the gateway uploads their news together in one request.
+//
+// A leaf sends a LeafReport and keeps its radio on only until the gateway
+// acknowledges it or `attempts` tries have gone unanswered. Until it has
+// heard an ack a leaf broadcasts, trying `attempts` times on each channel
+// in turn, so it finds a gateway on whatever channel the site AP put it;
+// afterwards it sends to the gateway's address on that channel and only
+// sweeps again once the gateway stops answering.
+//
+// The gateway keeps the newest report per station. A retransmission (same
+// station and sequence, because an ack was lost) is acknowledged again
+// but not counted as news. An upload is due once `batchSize` stations
+// have news, the oldest news is `maxDelayMs` old, or a bin has just
+// turned full. Reports stay pending until an upload carrying them
+// succeeds, so a failed upload loses nothing, and a station that reports
+// again meanwhile is sent once with its newest report.
+//
+// Frames, little endian:
+//   report  u8 type 1, u8 version, u16 sequence, u8 state, u8 flags,
+//           per bin: u32 id, i32 grams, u16 fill permille,
+//           i16 rate (hundredths of % per hour), i32 seconds to full
+//   ack     u8 type 2, u8 version, u16 sequence, u32 station,
+//           u32 gateway unix time (0 before NTP)
+// The radio is abstracted so the same code runs against a simulated link
+// on a host (tools/gateway_sim).
+
+static const uint8_t GATEWAY_FRAME_REPORT = 1;
+static const uint8_t GATEWAY_FRAME_ACK = 2;
+static const uint8_t GATEWAY_VERSION = 1;
+static const size_t LEAF_REPORT_SIZE = 6 + 2 * 16;
+static const size_t GATEWAY_ACK_SIZE = 12;
+
+static const uint8_t LEAF_FLAG_ORGANIC_FULL = 0x01;
+static const uint8_t LEAF_FLAG_NON_ORGANIC_FULL = 0x02;
+static const int32_t LEAF_NO_READING = INT32_MIN;   // Grams when the load cell had none
+
+static const uint8_t RADIO_ADDRESS_SIZE = 6;
+extern const uint8_t RADIO_BROADCAST[RADIO_ADDRESS_SIZE];
+
+struct LeafReport {
+  uint16_t sequence;        // Assigned by LeafLink
+  uint8_t state;            // BinState
+  uint8_t flags;            // LEAF_FLAG_*
+  uint32_t binIds[2];       // Indexed like BIN_ORGANIC / BIN_NON_ORGANIC
+  int32_t grams[2];
+  uint16_t fillPermille[2];
+  int16_t ratePerHour[2];   // Hundredths of a percent per hour
+  int32_t secondsToFull[2]; // -1 if not filling
+};
+
+size_t packLeafReport(uint8_t* out, const LeafReport& report);
+bool parseLeafReport(const uint8_t* data, size_t len, LeafReport& report);
+
+// The radio under both roles
+class RadioTransport {
+public:
+  // Tunes the radio to `channel` and turns it on, or turns it off. Leaves
+  // call it around each report; a gateway leaves its radio on.
+  virtual void power(bool on, uint8_t channel) = 0;
+  // Queues `len` bytes for `peer` (RADIO_BROADCAST for everyone); false if
+  // the radio refused them
+  virtual bool send(const uint8_t* peer, const uint8_t* data, size_t len) = 0;
+};
+
+// ==================== GATEWAY ====================
+struct GatewayConfig {
+  uint8_t batchSize;       // Stations with news that make an upload due
+  uint32_t maxDelayMs;     // Oldest news that makes an upload due
+  uint32_t retryMs;        // Wait after a failed upload
+  uint32_t staleMs;        // Silent stations this old give up their slot
+};
+
+struct GatewayEntry {
+  LeafReport report;
+  uint32_t ageMs;          // Since the gateway received it
+};
+
+class BinGateway {
+public:
+  static const uint8_t MAX_STATIONS = 64;
+  static const uint8_t MAX_BATCH = 16;
+
+  BinGateway(RadioTransport& radio, const GatewayConfig& config);
+
+  // A frame off the radio. `unixTime` goes into the ack so leaves, which
+  // never reach NTP, can set their clocks.
+  void receive(const uint8_t* peer, const uint8_t* data, size_t len, uint32_t nowMs, uint32_t unixTime);
+  // The gateway's own bins; sequenced here
+  void submit(const LeafReport& report, uint32_t nowMs);
+
+  bool uploadDue(uint32_t nowMs) const;
+  // Copies up to `maxCount` stations with news, oldest first; they stay
+  // pending until uploaded(true)
+  uint8_t takeBatch(GatewayEntry* out, uint8_t maxCount, uint32_t nowMs);
+  void uploaded(bool ok, uint32_t nowMs);
+
+  // {"gateway":<id>,"bins":[{...},...]}; each bin object has the fields of
+  // a single-station /api/bins/update body, ids as strings like the
+  // backend's model and null weights for LEAF_NO_READING. 0 if it
+  // doesn't fit.
+  static size_t formatBatch(char* out, size_t maxLen, uint32_t gatewayId, const GatewayEntry* entries, uint8_t count);
+
+  uint8_t stations() const;
+  uint8_t pending() const;
+  uint32_t reports() const { return reportCount; }
+  uint32_t duplicates() const { return duplicateCount; }
+  uint32_t rejected() const { return rejectedCount; }       // Malformed, or no free slot
+  uint32_t uploads() const { return uploadCount; }
+  uint32_t uploadFailures() const { return failureCount; }
+  uint32_t uploadedReports() const { return uploadedCount; }
+
+private:
+  struct Station {
+    bool used;
+    bool pending;          // News not yet uploaded
+    bool inBatch;
+    uint16_t batchSequence;
+    uint32_t lastSeenMs;
+    uint32_t pendingSinceMs;
+    LeafReport report;
+  };
+
+  Station* find(uint32_t stationId, uint32_t nowMs);
+  bool store(const LeafReport& report, uint32_t nowMs);
+
+  RadioTransport& radio;
+  GatewayConfig cfg;
+  Station table[MAX_STATIONS];
+  uint16_t localSequence;
+  bool urgent;             // A bin turned full since the last upload
+  uint32_t retryAtMs;
+  bool retrying;
+  uint32_t reportCount;
+  uint32_t duplicateCount;
+  uint32_t rejectedCount;
+  uint32_t uploadCount;
+  uint32_t failureCount;
+  uint32_t uploadedCount;
+};
+
+// ==================== LEAF ====================
+struct LeafConfig {
+  uint32_t ackTimeoutMs;   // Per try
+  uint8_t attempts;        // Tries per report
+  uint8_t firstChannel;
+};
+
+class LeafLink {
+public:
+  static const uint8_t CHANNELS = 13;
+
+  LeafLink(RadioTransport& radio, const LeafConfig& config, uint16_t firstSequence);
+
+  // Starts sending `report` (sequenced here), replacing one still unanswered
+  void report(const LeafReport& report, uint32_t nowMs);
+  void receive(const uint8_t* peer, const uint8_t* data, size_t len, uint32_t nowMs);
+  // Retries, and turns the radio off once a report is done; every loop pass
+  void update(uint32_t nowMs);
+
+  bool busy() const { return sending; }
+  bool gatewayKnown() const { return knowGateway; }
+  uint8_t channel() const { return radioChannel; }
+  // Gateway clock from the newest ack, 0 if it had none
+  uint32_t gatewayTime() const { return ackTime; }
+  uint32_t gatewayTimeAtMs() const { return ackAtMs; }
+  uint16_t lastDelivered() const { return deliveredSequence; }   // Valid once delivered() > 0
+
+  uint32_t sent() const { return sentCount; }              // Frames, retries included
+  uint32_t delivered() const { return deliveredCount; }
+  uint32_t failed() const { return failedCount; }
+  uint32_t channelChanges() const { return hopCount; }
+  uint32_t radioOnMs(uint32_t nowMs) const { return onMs + (sending ? nowMs - onSinceMs : 0); }
+
+private:
+  void transmit(uint32_t nowMs);
+  void finish(uint32_t nowMs);
+
+  RadioTransport& radio;
+  LeafConfig cfg;
+  uint8_t gateway[RADIO_ADDRESS_SIZE];
+  bool knowGateway;
+  uint8_t radioChannel;
+  uint16_t nextSequence;
+  uint8_t frame[LEAF_REPORT_SIZE];
+  uint16_t frameSequence;
+  uint32_t stationId;
+  bool sending;
+  uint8_t triesLeft;       // On this channel
+  uint8_t channelsLeft;    // Still to sweep for this report
+  uint32_t sentAtMs;
+  uint32_t onSinceMs;
+  uint32_t onMs;
+  uint32_t ackTime;
+  uint32_t ackAtMs;
+  uint16_t deliveredSequence;
+  uint32_t sentCount;
+  uint32_t deliveredCount;
+  uint32_t failedCount;
+  uint32_t hopCount;
+};
+
+#endif
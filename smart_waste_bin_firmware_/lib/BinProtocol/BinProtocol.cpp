@@ -0,0 +1,278 @@
+#include "BinProtocol.h"
+#include <string.h>
+
+static const char* const MATERIAL_NAMES[MATERIAL_COUNT] = { "UNKNOWN", "ORGANIC", "NON_ORGANIC", "NONE" };
+
+static const char DETECT_REQUEST[] = "DETECT_MATERIAL";
+static const char RESULT_PREFIX[] = "MATERIAL:";
+static const uint8_t RESULT_PREFIX_LEN = sizeof(RESULT_PREFIX) - 1;
+
+const char* materialName(Material material) {
+  return material < MATERIAL_COUNT ? MATERIAL_NAMES[material] : MATERIAL_NAMES[MATERIAL_UNKNOWN];
+}
+
+Material materialFromName(const char* name) {
+  if (name) {
+    for (uint8_t m = 0; m < MATERIAL_COUNT; m++) {
+      if (strcmp(name, MATERIAL_NAMES[m]) == 0) {
+        return (Material)m;
+      }
+    }
+  }
+  return MATERIAL_UNKNOWN;
+}
+
+// Appends "@xxxx" for a non-zero trace id
+static void putTraceId(CanMessage& msg, uint16_t traceId) {
+  static const char HEX_DIGITS[] = "0123456789abcdef";
+  if (traceId == 0) {
+    return;
+  }
+  msg.data[msg.length++] = '@';
+  for (int shift = 12; shift >= 0; shift -= 4) {
+    msg.data[msg.length++] = HEX_DIGITS[(traceId >> shift) & 0xF];
+  }
+}
+
+// Splits a trailing "@xxxx" off `length`; false if the suffix is malformed
+static bool takeTraceId(const CanMessage& msg, uint8_t& length, uint16_t& traceId) {
+  traceId = 0;
+  length = msg.length;
+  if (length < 5 || msg.data[length - 5] != '@') {
+    return true;
+  }
+  for (uint8_t i = length - 4; i < length; i++) {
+    uint8_t c = msg.data[i];
+    uint8_t digit;
+    if (c >= '0' && c <= '9') digit = c - '0';
+    else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+    else if (c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+    else return false;
+    traceId = (traceId << 4) | digit;
+  }
+  length -= 5;
+  return true;
+}
+
+void makeDetectRequest(CanMessage& msg, uint16_t traceId) {
+  msg.id = CAN_ID_DETECT_REQUEST;
+  msg.length = sizeof(DETECT_REQUEST) - 1;
+  memcpy(msg.data, DETECT_REQUEST, msg.length);
+  putTraceId(msg, traceId);
+}
+
+bool parseDetectRequest(const CanMessage& msg, uint16_t& traceId) {
+  uint8_t length;
+  return msg.id == CAN_ID_DETECT_REQUEST && takeTraceId(msg, length, traceId) &&
+         length == sizeof(DETECT_REQUEST) - 1 && memcmp(msg.data, DETECT_REQUEST, length) == 0;
+}
+
+bool isDetectRequest(const CanMessage& msg) {
+  uint16_t traceId;
+  return parseDetectRequest(msg, traceId);
+}
+
+void makeMaterialResult(CanMessage& msg, Material material, uint16_t traceId) {
+  const char* name = materialName(material);
+  uint8_t nameLen = strlen(name);
+  msg.id = CAN_ID_DETECT_RESULT;
+  msg.length = RESULT_PREFIX_LEN + nameLen;
+  memcpy(msg.data, RESULT_PREFIX, RESULT_PREFIX_LEN);
+  memcpy(msg.data + RESULT_PREFIX_LEN, name, nameLen);
+  putTraceId(msg, traceId);
+}
+
+bool parseMaterialResult(const CanMessage& msg, Material& material, uint16_t& traceId) {
+  uint8_t length;
+  if (msg.id != CAN_ID_DETECT_RESULT || msg.length < RESULT_PREFIX_LEN ||
+      memcmp(msg.data, RESULT_PREFIX, RESULT_PREFIX_LEN) != 0 || !takeTraceId(msg, length, traceId)) {
+    return false;
+  }
+  material = MATERIAL_UNKNOWN;
+  uint8_t nameLen = length - RESULT_PREFIX_LEN;
+  for (uint8_t m = 0; m < MATERIAL_COUNT; m++) {
+    if (strlen(MATERIAL_NAMES[m]) == nameLen && memcmp(msg.data + RESULT_PREFIX_LEN, MATERIAL_NAMES[m], nameLen) == 0) {
+      material = (Material)m;
+    }
+  }
+  return true;
+}
+
+bool parseMaterialResult(const CanMessage& msg, Material& material) {
+  uint16_t traceId;
+  return parseMaterialResult(msg, material, traceId);
+}
+
+// ==================== TIME SYNC ====================
+static bool nodeFrame(const CanMessage& msg, uint32_t base, uint8_t length, uint8_t& node) {
+  if ((msg.id & ~(uint32_t)CAN_NODE_MASK) != base || msg.length != length) {
+    return false;
+  }
+  node = msg.id & CAN_NODE_MASK;
+  return true;
+}
+
+void makeTimeSync(CanMessage& msg, uint8_t node, uint8_t seq) {
+  msg.id = CAN_ID_TIME_SYNC | (node & CAN_NODE_MASK);
+  msg.length = 1;
+  msg.data[0] = seq;
+}
+
+bool parseTimeSync(const CanMessage& msg, uint8_t& node, uint8_t& seq) {
+  if (!nodeFrame(msg, CAN_ID_TIME_SYNC, 1, node)) {
+    return false;
+  }
+  seq = msg.data[0];
+  return true;
+}
+
+void makeTimeFollowUp(CanMessage& msg, uint8_t node, uint8_t seq, uint64_t masterUs) {
+  msg.id = CAN_ID_TIME_FOLLOW_UP | (node & CAN_NODE_MASK);
+  msg.length = 8;
+  msg.data[0] = seq;
+  for (uint8_t i = 0; i < 7; i++) {   // 56 bits of microseconds: 2000+ years
+    msg.data[1 + i] = masterUs >> (8 * i);
+  }
+}
+
+bool parseTimeFollowUp(const CanMessage& msg, uint8_t& node, uint8_t& seq, uint64_t& masterUs) {
+  if (!nodeFrame(msg, CAN_ID_TIME_FOLLOW_UP, 8, node)) {
+    return false;
+  }
+  seq = msg.data[0];
+  masterUs = 0;
+  for (uint8_t i = 0; i < 7; i++) {
+    masterUs |= (uint64_t)msg.data[1 + i] << (8 * i);
+  }
+  return true;
+}
+
+// ==================== DETECTION STAGES ====================
+void makeStageReport(CanMessage& msg, uint8_t node, uint16_t traceId, DetectStage stage, uint32_t timeUs, bool synced) {
+  msg.id = CAN_ID_STAGE_REPORT | (node & CAN_NODE_MASK);
+  msg.length = 8;
+  msg.data[0] = traceId;
+  msg.data[1] = traceId >> 8;
+  msg.data[2] = stage;
+  msg.data[3] = synced ? 1 : 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    msg.data[4 + i] = timeUs >> (8 * i);
+  }
+}
+
+bool parseStageReport(const CanMessage& msg, uint8_t& node, uint16_t& traceId, DetectStage& stage,
+                      uint32_t& timeUs, bool& synced) {
+  if (!nodeFrame(msg, CAN_ID_STAGE_REPORT, 8, node) || msg.data[2] >= STAGE_COUNT) {
+    return false;
+  }
+  traceId = msg.data[0] | (msg.data[1] << 8);
+  stage = (DetectStage)msg.data[2];
+  synced = msg.data[3] & 1;
+  timeUs = 0;
+  for (uint8_t i = 0; i < 4; i++) {
+    timeUs |= (uint32_t)msg.data[4 + i] << (8 * i);
+  }
+  return true;
+}
+
+// ==================== PRESENCE ====================
+void makePresence(CanMessage& msg, uint8_t node, const PresenceReport& report) {
+  msg.id = CAN_ID_PRESENCE | (node & CAN_NODE_MASK);
+  msg.length = 3;
+  msg.data[0] = (report.present ? 1 : 0) | (report.ready ? 2 : 0);
+  msg.data[1] = report.changedPermille;
+  msg.data[2] = report.changedPermille >> 8;
+}
+
+bool parsePresence(const CanMessage& msg, uint8_t& node, PresenceReport& report) {
+  if (!nodeFrame(msg, CAN_ID_PRESENCE, 3, node)) {
+    return false;
+  }
+  report.present = msg.data[0] & 1;
+  report.ready = msg.data[0] & 2;
+  report.changedPermille = msg.data[1] | (msg.data[2] << 8);
+  return true;
+}
+
+// ==================== HEARTBEATS ====================
+static uint8_t clampByte(uint32_t v) {
+  return v > 255 ? 255 : (uint8_t)v;
+}
+
+static void putUptime(CanMessage& msg, uint32_t uptimeS) {
+  uint32_t t = uptimeS > 0xFFFFFF ? 0xFFFFFF : uptimeS;
+  msg.data[5] = t;
+  msg.data[6] = t >> 8;
+  msg.data[7] = t >> 16;
+}
+
+static uint32_t getUptime(const CanMessage& msg) {
+  return msg.data[5] | (msg.data[6] << 8) | ((uint32_t)msg.data[7] << 16);
+}
+
+void packControllerStatus(CanMessage& msg, uint8_t node, const ControllerStatus& status) {
+  msg.id = CAN_ID_CONTROLLER_STATUS | (node & CAN_NODE_MASK);
+  msg.length = HEARTBEAT_LENGTH;
+  msg.data[0] = (status.state & 0x0F) | (status.full[0] ? 0x10 : 0) | (status.full[1] ? 0x20 : 0) |
+                (HEARTBEAT_VERSION << 6);
+  msg.data[1] = clampByte(status.fillPercent[0]);
+  msg.data[2] = clampByte(status.fillPercent[1]);
+  msg.data[3] = status.errors;
+  msg.data[4] = status.freeHeapKb;
+  putUptime(msg, status.uptimeS);
+}
+
+bool unpackControllerStatus(const CanMessage& msg, uint8_t& node, ControllerStatus& status) {
+  if ((msg.id & ~(uint32_t)CAN_NODE_MASK) != CAN_ID_CONTROLLER_STATUS || msg.length != HEARTBEAT_LENGTH ||
+      (msg.data[0] >> 6) != HEARTBEAT_VERSION) {
+    return false;
+  }
+  node = msg.id & CAN_NODE_MASK;
+  status.state = msg.data[0] & 0x0F;
+  status.full[0] = msg.data[0] & 0x10;
+  status.full[1] = msg.data[0] & 0x20;
+  status.fillPercent[0] = msg.data[1];
+  status.fillPercent[1] = msg.data[2];
+  status.errors = msg.data[3];
+  status.freeHeapKb = msg.data[4];
+  status.uptimeS = getUptime(msg);
+  return true;
+}
+
+void packCameraHealth(CanMessage& msg, uint8_t node, const CameraHealth& health) {
+  msg.id = CAN_ID_CAMERA_HEALTH | (node & CAN_NODE_MASK);
+  msg.length = HEARTBEAT_LENGTH;
+  msg.data[0] = (health.flags & 0x0F) | (HEARTBEAT_VERSION << 6);
+  msg.data[1] = health.lastMaterial;
+  msg.data[2] = health.detectTenths;
+  msg.data[3] = health.errors;
+  msg.data[4] = health.freeHeapKb;
+  putUptime(msg, health.uptimeS);
+}
+
+bool unpackCameraHealth(const CanMessage& msg, uint8_t& node, CameraHealth& health) {
+  if ((msg.id & ~(uint32_t)CAN_NODE_MASK) != CAN_ID_CAMERA_HEALTH || msg.length != HEARTBEAT_LENGTH ||
+      (msg.data[0] >> 6) != HEARTBEAT_VERSION) {
+    return false;
+  }
+  node = msg.id & CAN_NODE_MASK;
+  health.flags = msg.data[0] & 0x0F;
+  health.lastMaterial = msg.data[1] < MATERIAL_COUNT ? (Material)msg.data[1] : MATERIAL_UNKNOWN;
+  health.detectTenths = msg.data[2];
+  health.errors = msg.data[3];
+  health.freeHeapKb = msg.data[4];
+  health.uptimeS = getUptime(msg);
+  return true;
+}
+
+bool Heartbeat::due(uint32_t nowMs, const CanMessage& frame) {
+  uint32_t since = nowMs - lastSentMs;
+  bool changed = count == 0 || memcmp(frame.data, last, compared) != 0;
+  if (count > 0 && since < interval && !(changed && since >= minGap)) {
+    return false;
+  }
+  memcpy(last, frame.data, HEARTBEAT_LENGTH);
+  lastSentMs = nowMs;
+  count++;
+  return true;
+}
@@ -0,0 +1,188 @@
+#ifndef BIN_PROTOCOL_H
+#define BIN_PROTOCOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Messages between the bin controller and the ESP32-CAM.
+//
+// Materials travel as an enum and CAN payloads as fixed-size buffers, so
+// neither firmware allocates on the detection path. Names are only used at
+// the API boundary (JSON, backend responses). Detection payloads stay the
+// text the firmwares have always exchanged ("DETECT_MATERIAL",
+// "MATERIAL:<name>"), optionally tagged with a trace id ("@1a2b").
+// Cameras accept both forms and only tag replies to tagged requests, so
+// update cameras before controllers.
+//
+// MATERIAL_NONE means the camera saw nothing in the chute and skipped the
+// classifier. Controllers that predate it read it as UNKNOWN.
+
+enum Material : uint8_t {
+  MATERIAL_UNKNOWN,
+  MATERIAL_ORGANIC,
+  MATERIAL_NON_ORGANIC,
+  MATERIAL_NONE,
+  MATERIAL_COUNT
+};
+
+const uint32_t CAN_ID_DETECT_REQUEST = 0x100;  // Controller -> camera
+const uint32_t CAN_ID_DETECT_RESULT = 0x200;   // Camera -> controller
+
+// Frames below carry the sending node in the low 7 bits of the id
+const uint32_t CAN_ID_TIME_SYNC = 0x080;       // Controller -> camera
+const uint32_t CAN_ID_TIME_FOLLOW_UP = 0x180;  // Controller -> camera
+const uint32_t CAN_ID_STAGE_REPORT = 0x280;    // Camera -> controller
+const uint32_t CAN_ID_CONTROLLER_STATUS = 0x300;
+const uint32_t CAN_ID_CAMERA_HEALTH = 0x380;
+const uint32_t CAN_ID_PRESENCE = 0x400;        // Camera -> controller
+const uint8_t CAN_NODE_MASK = 0x7F;
+
+const uint8_t CAN_PAYLOAD_MAX = 32;
+const uint8_t HEARTBEAT_LENGTH = 8;
+const uint8_t HEARTBEAT_VERSION = 1;
+
+struct CanMessage {
+  uint32_t id;
+  uint8_t length;
+  uint8_t data[CAN_PAYLOAD_MAX];
+};
+
+// "ORGANIC", "NON_ORGANIC" or "UNKNOWN", as the backend names them, or "NONE"
+const char* materialName(Material material);
+// MATERIAL_UNKNOWN for anything unrecognised, including nullptr
+Material materialFromName(const char* name);
+
+// Trace id 0 means untagged
+void makeDetectRequest(CanMessage& msg, uint16_t traceId = 0);
+bool parseDetectRequest(const CanMessage& msg, uint16_t& traceId);
+bool isDetectRequest(const CanMessage& msg);
+
+void makeMaterialResult(CanMessage& msg, Material material, uint16_t traceId = 0);
+// False if `msg` is not a detection result
+bool parseMaterialResult(const CanMessage& msg, Material& material, uint16_t& traceId);
+bool parseMaterialResult(const CanMessage& msg, Material& material);
+
+// ==================== TIME SYNC ====================
+// Two-step sync: the controller sends SYNC(seq), then FOLLOW_UP(seq, t)
+// with the time t (its esp_timer microseconds) at which SYNC went out.
+// The camera pairs them with its own receive time; see ClockSync.
+
+void makeTimeSync(CanMessage& msg, uint8_t node, uint8_t seq);
+bool parseTimeSync(const CanMessage& msg, uint8_t& node, uint8_t& seq);
+void makeTimeFollowUp(CanMessage& msg, uint8_t node, uint8_t seq, uint64_t masterUs);
+bool parseTimeFollowUp(const CanMessage& msg, uint8_t& node, uint8_t& seq, uint64_t& masterUs);
+
+// ==================== DETECTION STAGES ====================
+// Points on the path from PIR edge to lid open. The camera reports its
+// stages with the request's trace id as [trace:16][stage][synced][time:32],
+// time in the controller's timebase (low 32 bits of microseconds) when
+// synced, otherwise its own.
+
+enum DetectStage : uint8_t {
+  STAGE_PIR,              // Controller
+  STAGE_REQUEST_TX,       // Controller
+  STAGE_CAPTURE_START,    // Camera
+  STAGE_CAPTURE_END,      // Camera
+  STAGE_UPLOAD_START,     // Camera
+  STAGE_UPLOAD_END,       // Camera
+  STAGE_RESULT_TX,        // Camera
+  STAGE_RESULT_RX,        // Controller
+  STAGE_LID_OPEN,         // Controller
+  STAGE_COUNT
+};
+
+void makeStageReport(CanMessage& msg, uint8_t node, uint16_t traceId, DetectStage stage, uint32_t timeUs, bool synced);
+bool parseStageReport(const CanMessage& msg, uint8_t& node, uint16_t& traceId, DetectStage& stage,
+                      uint32_t& timeUs, bool& synced);
+
+// ==================== PRESENCE ====================
+// Whether the camera sees something in the chute, from its frame
+// difference against the empty chute (see PresenceDetector). Sent when it
+// changes and periodically as [flags][changed permille:16], flags bit 0
+// present, bit 1 background model ready.
+
+struct PresenceReport {
+  bool present;
+  bool ready;
+  uint16_t changedPermille;   // Share of chute pixels that differ
+};
+
+void makePresence(CanMessage& msg, uint8_t node, const PresenceReport& report);
+bool parsePresence(const CanMessage& msg, uint8_t& node, PresenceReport& report);
+
+// ==================== HEARTBEATS ====================
+// Packed 8-byte frames so a gateway can follow a whole station from the
+// bus. Layout (tools/can_decode.py decodes both):
+//
+//   controller  [0] state:4 organic_full:1 non_organic_full:1 version:2
+//               [1] organic fill %  [2] non-organic fill %  [3] error bits
+//               [4] free heap KB    [5..7] uptime s, little-endian
+//   camera      [0] flags:4 reserved:2 version:2
+//               [1] last material   [2] last detection round trip, 100 ms
+//               [3] error bits      [4] free heap KB   [5..7] uptime s
+
+enum ControllerError : uint8_t {
+  CONTROLLER_ERR_DISTANCE = 1 << 0,   // No ultrasonic echo
+  CONTROLLER_ERR_SCALE = 1 << 1,      // Load cell not ready
+  CONTROLLER_ERR_WIFI = 1 << 2,
+  CONTROLLER_ERR_CAMERA = 1 << 3,     // Last detection timed out
+  CONTROLLER_ERR_UPLOAD = 1 << 4      // Last backend upload failed
+};
+
+struct ControllerStatus {
+  uint8_t state;
+  uint8_t fillPercent[2];
+  bool full[2];
+  uint8_t errors;
+  uint8_t freeHeapKb;
+  uint32_t uptimeS;
+};
+
+enum CameraFlag : uint8_t {
+  CAMERA_READY = 1 << 0,
+  CAMERA_WIFI = 1 << 1,
+  CAMERA_DETECTING = 1 << 2,
+  CAMERA_PSRAM = 1 << 3
+};
+
+enum CameraError : uint8_t {
+  CAMERA_ERR_CAPTURE = 1 << 0,   // Last capture failed
+  CAMERA_ERR_BACKEND = 1 << 1,   // Last backend call failed
+  CAMERA_ERR_RESPONSE = 1 << 2   // Last backend reply was unusable
+};
+
+struct CameraHealth {
+  uint8_t flags;
+  Material lastMaterial;
+  uint8_t detectTenths;   // Saturates at 25.5 s
+  uint8_t errors;
+  uint8_t freeHeapKb;
+  uint32_t uptimeS;
+};
+
+void packControllerStatus(CanMessage& msg, uint8_t node, const ControllerStatus& status);
+bool unpackControllerStatus(const CanMessage& msg, uint8_t& node, ControllerStatus& status);
+void packCameraHealth(CanMessage& msg, uint8_t node, const CameraHealth& health);
+bool unpackCameraHealth(const CanMessage& msg, uint8_t& node, CameraHealth& health);
+
+// Decides when a heartbeat goes out: every interval, and early (but no
+// more than once per minimum gap) when the first bytes of the frame change.
+class Heartbeat {
+public:
+  Heartbeat(uint32_t intervalMs, uint32_t minGapMs, uint8_t comparedBytes = 4)
+      : interval(intervalMs), minGap(minGapMs), compared(comparedBytes), lastSentMs(0), count(0) {}
+
+  // Remembers `frame` as sent when returning true
+  bool due(uint32_t nowMs, const CanMessage& frame);
+  uint32_t sent() const { return count; }
+
+private:
+  uint32_t interval;
+  uint32_t minGap;
+  uint8_t compared;
+  uint32_t lastSentMs;
+  uint32_t count;
+  uint8_t last[HEARTBEAT_LENGTH];
+};
+
+#endif
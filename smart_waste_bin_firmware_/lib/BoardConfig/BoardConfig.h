@@ -0,0 +1,236 @@
+#ifndef BOARD_CONFIG_H
+#define BOARD_CONFIG_H
+
+#include <stdint.h>
+
+// Compile-time hardware configuration.
+//
+// Each hardware variant is a struct of static constexpr members; variants
+// that differ in a few details derive from another and shadow those
+// members. The firmware uses a variant through ValidControllerBoard<> /
+// ValidCameraBoard<>, whose static_asserts reject a bad pin map or
+// threshold when the variant is first used, and the build selects the
+// variant with -DSMARTBIN_BOARD=<struct> / -DSMARTBIN_CAMERA_BOARD=<struct>
+// (see platformio.ini).
+//
+// Everything here is a compile-time constant, so feature checks such as
+// `if (Board::HAS_KEYPAD)` fold away along with the code behind them.
+// Members are only ever read by value; binding one to a reference would
+// need an out-of-line definition under C++11.
+
+const uint8_t NO_PIN = 0xFF;
+
+// ==================== CONTROLLER VARIANTS ====================
+// Two lids, keypad, load cell: the original station
+struct StationStandard {
+  // Ultrasonic sensor
+  static constexpr uint8_t TRIG_PIN = 4;
+  static constexpr uint8_t ECHO_PIN = 5;
+  // PIR motion sensor
+  static constexpr uint8_t PIR_PIN = 2;
+  // Lid servos; a single-servo board drives a diverter flap on the first pin
+  static constexpr uint8_t LID_SERVOS = 2;
+  static constexpr uint8_t SERVO_ORGANIC_PIN = 18;
+  static constexpr uint8_t SERVO_NON_ORGANIC_PIN = 19;
+  // Load cell (HX711)
+  static constexpr bool HAS_LOAD_CELL = true;
+  static constexpr uint8_t LOAD_CELL_DOUT_PIN = 16;
+  static constexpr uint8_t LOAD_CELL_SCK_PIN = 17;
+  // Status LED and buzzer
+  static constexpr uint8_t LED_RED_PIN = 25;
+  static constexpr uint8_t LED_GREEN_PIN = 26;
+  static constexpr uint8_t LED_BLUE_PIN = 27;
+  static constexpr uint8_t BUZZER_PIN = 14;
+  // Keypad (two buttons, active low)
+  static constexpr bool HAS_KEYPAD = true;
+  static constexpr uint8_t KEYPAD_BUTTON1_PIN = 12;
+  static constexpr uint8_t KEYPAD_BUTTON2_PIN = 13;
+  // CAN (TWAI)
+  static constexpr uint8_t CAN_TX_PIN = 21;
+  static constexpr uint8_t CAN_RX_PIN = 22;
+
+  // Servo angles in degrees
+  static constexpr uint8_t LID_CLOSED_ANGLE = 0;
+  static constexpr uint8_t LID_OPEN_ANGLE = 90;
+  static constexpr uint8_t FLAP_ORGANIC_ANGLE = 45;       // Single-servo boards only
+  static constexpr uint8_t FLAP_NON_ORGANIC_ANGLE = 135;
+
+  // Load cell calibration: raw counts per gram
+  static constexpr float LOAD_CELL_SCALE = 2280.f;
+
+  // Bins
+  static constexpr uint32_t BIN_ORGANIC_ID = 0x001;
+  static constexpr uint32_t BIN_NON_ORGANIC_ID = 0x002;
+  static constexpr int32_t BIN_CAPACITY_GRAMS = 10000;
+  static constexpr int32_t BIN_FULL_GRAMS = 9000;
+  static constexpr int32_t BIN_EMPTY_DISTANCE_MM = 500;   // Sensor to empty bin floor
+  static constexpr int32_t BIN_FULL_DISTANCE_MM = 50;
+};
+
+// Public installs: lids only open for detected waste
+struct StationKiosk : StationStandard {
+  static constexpr bool HAS_KEYPAD = false;
+  static constexpr uint8_t KEYPAD_BUTTON1_PIN = NO_PIN;
+  static constexpr uint8_t KEYPAD_BUTTON2_PIN = NO_PIN;
+};
+
+// One servo tilting a flap towards either bin, no load cell, no keypad
+struct StationFlap : StationKiosk {
+  static constexpr uint8_t LID_SERVOS = 1;
+  static constexpr uint8_t SERVO_NON_ORGANIC_PIN = NO_PIN;
+  static constexpr bool HAS_LOAD_CELL = false;
+  static constexpr uint8_t LOAD_CELL_DOUT_PIN = NO_PIN;
+  static constexpr uint8_t LOAD_CELL_SCK_PIN = NO_PIN;
+  static constexpr uint8_t LID_CLOSED_ANGLE = 90;   // Flap level
+};
+
+// ==================== CAMERA VARIANTS ====================
+// AI-Thinker ESP32-CAM
+struct CameraAiThinker {
+  static constexpr int8_t PWDN_PIN = 32;
+  static constexpr int8_t RESET_PIN = -1;   // Not connected
+  static constexpr int8_t XCLK_PIN = 0;
+  static constexpr int8_t SIOD_PIN = 26;
+  static constexpr int8_t SIOC_PIN = 27;
+  static constexpr int8_t Y9_PIN = 35;
+  static constexpr int8_t Y8_PIN = 34;
+  static constexpr int8_t Y7_PIN = 39;
+  static constexpr int8_t Y6_PIN = 36;
+  static constexpr int8_t Y5_PIN = 21;
+  static constexpr int8_t Y4_PIN = 19;
+  static constexpr int8_t Y3_PIN = 18;
+  static constexpr int8_t Y2_PIN = 5;
+  static constexpr int8_t VSYNC_PIN = 25;
+  static constexpr int8_t HREF_PIN = 23;
+  static constexpr int8_t PCLK_PIN = 22;
+  static constexpr uint32_t XCLK_HZ = 20000000;
+  // CAN (TWAI) on the SD card pins, which the firmware doesn't use
+  static constexpr uint8_t CAN_TX_PIN = 14;
+  static constexpr uint8_t CAN_RX_PIN = 15;
+  // Live JPEG on /capture for aiming the camera
+  static constexpr bool HAS_PREVIEW = true;
+  // Where the chute is in the frame, in percent, for presence detection
+  static constexpr uint8_t CHUTE_LEFT_PERCENT = 15;
+  static constexpr uint8_t CHUTE_TOP_PERCENT = 15;
+  static constexpr uint8_t CHUTE_WIDTH_PERCENT = 70;
+  static constexpr uint8_t CHUTE_HEIGHT_PERCENT = 80;
+};
+
+// Sealed installs: no image ever leaves the camera except to the backend
+struct CameraAiThinkerSealed : CameraAiThinker {
+  static constexpr bool HAS_PREVIEW = false;
+};
+
+// ==================== VALIDATION ====================
+namespace board_check {
+
+// GPIO 6-11 drive the flash chip; 34-39 are input only
+constexpr bool usable(uint8_t pin) { return pin == NO_PIN || (pin <= 39 && (pin < 6 || pin > 11)); }
+constexpr bool output(uint8_t pin) { return pin == NO_PIN || (usable(pin) && pin <= 33); }
+constexpr bool cameraPin(int8_t pin) { return pin == -1 || usable((uint8_t)pin); }
+
+constexpr bool contains(uint8_t) { return false; }
+template <class... Rest>
+constexpr bool contains(uint8_t pin, uint8_t first, Rest... rest) {
+  return (pin != NO_PIN && pin == first) || contains(pin, rest...);
+}
+
+constexpr bool distinct() { return true; }
+template <class... Rest>
+constexpr bool distinct(uint8_t first, Rest... rest) {
+  return !contains(first, rest...) && distinct(rest...);
+}
+
+}  // namespace board_check
+
+template <class B>
+struct ValidControllerBoard : B {
+  static_assert(B::LID_SERVOS == 1 || B::LID_SERVOS == 2, "one flap servo or one servo per lid");
+  static_assert(B::LID_SERVOS == 2 || !B::HAS_KEYPAD, "a single flap can't hold both lids open for the keypad");
+  static_assert((B::LID_SERVOS == 2) == (B::SERVO_NON_ORGANIC_PIN != NO_PIN), "second servo pin must match LID_SERVOS");
+  static_assert(B::HAS_KEYPAD == (B::KEYPAD_BUTTON1_PIN != NO_PIN && B::KEYPAD_BUTTON2_PIN != NO_PIN),
+                "keypad pins must match HAS_KEYPAD");
+  static_assert(B::HAS_LOAD_CELL == (B::LOAD_CELL_DOUT_PIN != NO_PIN && B::LOAD_CELL_SCK_PIN != NO_PIN),
+                "load cell pins must match HAS_LOAD_CELL");
+
+  static_assert(board_check::output(B::TRIG_PIN) && board_check::output(B::SERVO_ORGANIC_PIN) &&
+                board_check::output(B::SERVO_NON_ORGANIC_PIN) && board_check::output(B::LOAD_CELL_SCK_PIN) &&
+                board_check::output(B::LED_RED_PIN) && board_check::output(B::LED_GREEN_PIN) &&
+                board_check::output(B::LED_BLUE_PIN) && board_check::output(B::BUZZER_PIN) &&
+                board_check::output(B::CAN_TX_PIN),
+                "output on an input-only or flash pin");
+  static_assert(board_check::usable(B::ECHO_PIN) && board_check::usable(B::PIR_PIN) &&
+                board_check::usable(B::LOAD_CELL_DOUT_PIN) && board_check::usable(B::CAN_RX_PIN),
+                "input on a flash pin");
+  static_assert(board_check::output(B::KEYPAD_BUTTON1_PIN) && board_check::output(B::KEYPAD_BUTTON2_PIN),
+                "keypad needs internal pull-ups, which GPIO 34-39 lack");
+  static_assert(board_check::distinct(B::TRIG_PIN, B::ECHO_PIN, B::PIR_PIN, B::SERVO_ORGANIC_PIN,
+                                      B::SERVO_NON_ORGANIC_PIN, B::LOAD_CELL_DOUT_PIN, B::LOAD_CELL_SCK_PIN,
+                                      B::LED_RED_PIN, B::LED_GREEN_PIN, B::LED_BLUE_PIN, B::BUZZER_PIN,
+                                      B::KEYPAD_BUTTON1_PIN, B::KEYPAD_BUTTON2_PIN, B::CAN_TX_PIN, B::CAN_RX_PIN),
+                "pin assigned twice");
+
+  static_assert(B::LID_CLOSED_ANGLE <= 180 && B::LID_OPEN_ANGLE <= 180 &&
+                B::FLAP_ORGANIC_ANGLE <= 180 && B::FLAP_NON_ORGANIC_ANGLE <= 180, "servo angle out of range");
+  static_assert(B::LID_SERVOS == 1 || B::LID_OPEN_ANGLE != B::LID_CLOSED_ANGLE, "lid open and closed at the same angle");
+  static_assert(B::LID_SERVOS == 2 || (B::FLAP_ORGANIC_ANGLE != B::LID_CLOSED_ANGLE &&
+                                       B::FLAP_NON_ORGANIC_ANGLE != B::LID_CLOSED_ANGLE &&
+                                       B::FLAP_ORGANIC_ANGLE != B::FLAP_NON_ORGANIC_ANGLE),
+                "flap positions must differ");
+  static_assert(B::LOAD_CELL_SCALE > 0, "load cell scale must be positive");
+
+  static_assert(B::BIN_ORGANIC_ID != B::BIN_NON_ORGANIC_ID, "bin ids must differ");
+  static_assert(B::BIN_FULL_GRAMS > 0 && B::BIN_FULL_GRAMS < B::BIN_CAPACITY_GRAMS, "full mark must be below capacity");
+  static_assert(B::BIN_FULL_DISTANCE_MM > 0 && B::BIN_FULL_DISTANCE_MM < B::BIN_EMPTY_DISTANCE_MM,
+                "full distance must be between the sensor and the empty floor");
+
+  // Per-bin lookups for the few places that index by bin
+  static constexpr uint32_t binId(uint8_t bin) { return bin == 0 ? B::BIN_ORGANIC_ID : B::BIN_NON_ORGANIC_ID; }
+  static constexpr uint8_t lidAngle(uint8_t bin, bool open) {
+    return !open ? B::LID_CLOSED_ANGLE
+         : B::LID_SERVOS == 2 ? B::LID_OPEN_ANGLE
+         : bin == 0 ? B::FLAP_ORGANIC_ANGLE : B::FLAP_NON_ORGANIC_ANGLE;
+  }
+  // Full threshold as a fraction of capacity, in permille
+  static constexpr uint16_t fullPermille() { return (uint16_t)(B::BIN_FULL_GRAMS * 1000 / B::BIN_CAPACITY_GRAMS); }
+};
+
+template <class B>
+struct ValidCameraBoard : B {
+  static_assert(board_check::cameraPin(B::PWDN_PIN) && board_check::cameraPin(B::RESET_PIN) &&
+                board_check::cameraPin(B::XCLK_PIN) && board_check::cameraPin(B::SIOD_PIN) &&
+                board_check::cameraPin(B::SIOC_PIN) && board_check::cameraPin(B::Y9_PIN) &&
+                board_check::cameraPin(B::Y8_PIN) && board_check::cameraPin(B::Y7_PIN) &&
+                board_check::cameraPin(B::Y6_PIN) && board_check::cameraPin(B::Y5_PIN) &&
+                board_check::cameraPin(B::Y4_PIN) && board_check::cameraPin(B::Y3_PIN) &&
+                board_check::cameraPin(B::Y2_PIN) && board_check::cameraPin(B::VSYNC_PIN) &&
+                board_check::cameraPin(B::HREF_PIN) && board_check::cameraPin(B::PCLK_PIN),
+                "camera on a flash pin");
+  static_assert(board_check::output(B::CAN_TX_PIN) && board_check::usable(B::CAN_RX_PIN), "bad CAN pins");
+  static_assert(board_check::distinct(B::CAN_TX_PIN, B::CAN_RX_PIN, (uint8_t)B::PWDN_PIN, (uint8_t)B::XCLK_PIN,
+                                      (uint8_t)B::SIOD_PIN, (uint8_t)B::SIOC_PIN, (uint8_t)B::Y9_PIN,
+                                      (uint8_t)B::Y8_PIN, (uint8_t)B::Y7_PIN, (uint8_t)B::Y6_PIN,
+                                      (uint8_t)B::Y5_PIN, (uint8_t)B::Y4_PIN, (uint8_t)B::Y3_PIN,
+                                      (uint8_t)B::Y2_PIN, (uint8_t)B::VSYNC_PIN, (uint8_t)B::HREF_PIN,
+                                      (uint8_t)B::PCLK_PIN),
+                "pin assigned twice");
+  static_assert(B::XCLK_HZ >= 8000000 && B::XCLK_HZ <= 20000000, "sensor clock out of range");
+  static_assert(B::CHUTE_WIDTH_PERCENT >= 10 && B::CHUTE_HEIGHT_PERCENT >= 10 &&
+                B::CHUTE_LEFT_PERCENT + B::CHUTE_WIDTH_PERCENT <= 100 &&
+                B::CHUTE_TOP_PERCENT + B::CHUTE_HEIGHT_PERCENT <= 100,
+                "chute region must be inside the frame and not tiny");
+};
+
+// ==================== SELECTION ====================
+#ifndef SMARTBIN_BOARD
+#define SMARTBIN_BOARD StationStandard
+#endif
+
+#ifndef SMARTBIN_CAMERA_BOARD
+#define SMARTBIN_CAMERA_BOARD CameraAiThinker
+#endif
+
+typedef ValidControllerBoard<SMARTBIN_BOARD> Board;
+typedef ValidCameraBoard<SMARTBIN_CAMERA_BOARD> CameraBoard;
+
+#endif
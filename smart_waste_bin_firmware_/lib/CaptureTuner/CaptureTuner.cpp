@@ -0,0 +1,101 @@
+#include "CaptureTuner.h"
+
+static const float ALPHA = 0.3f;   // Weight of the newest sample
+
+static float smooth(float average, float sample) {
+  return average == 0 ? sample : average + ALPHA * (sample - average);
+}
+
+// Bad news is believed at once, good news only gradually: one slow round
+// trip is enough to drop a step, which is what keeps the next one in budget
+static float pessimistic(float average, float sample, bool worse) {
+  return worse ? sample : smooth(average, sample);
+}
+
+CaptureTuner::CaptureTuner(const CaptureTunerConfig& config)
+    : cfg(config), first(0), current(0), lowest(0), throughput(0), server(0), changeCount(0) {
+  if (cfg.stepCount > MAX_STEPS) {
+    cfg.stepCount = MAX_STEPS;
+  }
+  start(0);
+}
+
+void CaptureTuner::start(uint8_t firstStep) {
+  first = firstStep < cfg.stepCount ? firstStep : cfg.stepCount - 1;
+  current = first;
+  lowest = first;
+  for (uint8_t i = first; i < cfg.stepCount && cfg.steps[i].width >= cfg.minWidth; i++) {
+    lowest = i;
+  }
+  throughput = 0;
+  server = 0;
+  for (uint8_t i = 0; i < MAX_STEPS; i++) {
+    bytes[i] = 0;
+  }
+  changeCount = 0;
+}
+
+// Measured size if the step has been used, otherwise scaled by pixel count
+// from the nearest measured step. Quality differences are ignored, which
+// overestimates the cheaper steps; that errs on the safe side.
+uint32_t CaptureTuner::estimatedBytes(uint8_t step) const {
+  if (bytes[step] > 0) {
+    return (uint32_t)bytes[step];
+  }
+  for (uint8_t d = 1; d < cfg.stepCount; d++) {
+    for (int8_t sign = -1; sign <= 1; sign += 2) {
+      int16_t i = step + sign * d;
+      if (i >= 0 && i < cfg.stepCount && bytes[i] > 0) {
+        float pixels = (float)cfg.steps[step].width * cfg.steps[step].height;
+        float measuredPixels = (float)cfg.steps[i].width * cfg.steps[i].height;
+        return (uint32_t)(bytes[i] * pixels / measuredPixels);
+      }
+    }
+  }
+  return 0;
+}
+
+uint32_t CaptureTuner::predictedMs(uint8_t step) const {
+  if (throughput <= 0 || step >= cfg.stepCount) {
+    return 0;
+  }
+  return (uint32_t)(estimatedBytes(step) / throughput + server);
+}
+
+void CaptureTuner::moveTo(uint8_t step) {
+  if (step != current) {
+    current = step;
+    changeCount++;
+  }
+}
+
+void CaptureTuner::record(uint8_t step, uint32_t jpegBytes, uint32_t transferMs, uint32_t serverMs) {
+  if (transferMs == 0) {
+    transferMs = 1;
+  }
+  float rate = (float)jpegBytes / transferMs;
+  throughput = pessimistic(throughput, rate, rate < throughput);
+  server = pessimistic(server, (float)serverMs, serverMs > server);
+  if (step < cfg.stepCount) {
+    bytes[step] = smooth(bytes[step], (float)jpegBytes);
+  }
+  
+  uint32_t fit = cfg.budgetMs * FIT_PERCENT / 100;
+  // Drop until a step fits, or the cheapest allowed one
+  uint8_t next = current;
+  while (next < lowest && predictedMs(next) > fit) {
+    next++;
+  }
+  // Climb one step if it fits with a clear margin
+  if (next == current && current > first &&
+      predictedMs(current - 1) <= cfg.budgetMs * CLIMB_PERCENT / 100) {
+    next = current - 1;
+  }
+  moveTo(next);
+}
+
+void CaptureTuner::recordFailure() {
+  if (current < lowest) {
+    moveTo(current + 1);
+  }
+}
@@ -0,0 +1,73 @@
+#ifndef CAPTURE_TUNER_H
+#define CAPTURE_TUNER_H
+
+#include <stdint.h>
+
+// Picks the camera's frame size and JPEG quality from measured detection
+// round trips, so a slow link trades image size for latency instead of
+// running into the controller's detection timeout.
+//
+// Settings form a ladder from best to cheapest. Each detection reports the
+// JPEG size, the transfer time and the classifier's own time; the tuner
+// tracks link throughput, server time and the JPEG size of every step it
+// has used, and predicts the round trip of each step as
+// bytes / throughput + server time. It then picks the best step that fits
+// the budget with some headroom. It drops as many steps as needed at once,
+// but climbs back one step at a time and only with a wider margin, so a
+// noisy link doesn't flap. Steps narrower than the classifier's minimum
+// width are never used, however slow the link.
+
+struct CaptureStep {
+  uint8_t frameSize;   // framesize_t
+  uint16_t width;
+  uint16_t height;
+  uint8_t quality;     // esp32-camera JPEG quality, lower is better
+};
+
+struct CaptureTunerConfig {
+  const CaptureStep* steps;   // Best first
+  uint8_t stepCount;
+  uint16_t minWidth;          // Classifier's minimum
+  uint32_t budgetMs;          // Upload plus classification
+};
+
+class CaptureTuner {
+public:
+  static const uint8_t MAX_STEPS = 12;
+  static const uint8_t FIT_PERCENT = 80;      // Stay on or drop to a step predicted within this share of the budget
+  static const uint8_t CLIMB_PERCENT = 55;    // Climb only if the better step fits in this share
+
+  explicit CaptureTuner(const CaptureTunerConfig& config);
+
+  // Starts at the step the camera was initialised with. Frame buffers are
+  // sized for it, so the tuner never goes above it.
+  void start(uint8_t firstStep);
+
+  // One completed round trip of a frame taken at `step`
+  void record(uint8_t step, uint32_t bytes, uint32_t transferMs, uint32_t serverMs);
+  // No usable reply: drop a step
+  void recordFailure();
+
+  uint8_t step() const { return current; }
+  const CaptureStep& setting() const { return cfg.steps[current]; }
+  uint32_t predictedMs(uint8_t step) const;
+  uint32_t throughputBytesPerS() const { return (uint32_t)(throughput * 1000); }
+  uint32_t serverMs() const { return (uint32_t)server; }
+  uint32_t budgetMs() const { return cfg.budgetMs; }
+  uint32_t changes() const { return changeCount; }
+
+private:
+  uint32_t estimatedBytes(uint8_t step) const;
+  void moveTo(uint8_t step);
+
+  CaptureTunerConfig cfg;
+  uint8_t first;
+  uint8_t current;
+  uint8_t lowest;            // Cheapest step still wide enough
+  float throughput;          // bytes per ms, 0 until measured
+  float server;              // ms
+  float bytes[MAX_STEPS];    // JPEG size per step, 0 until measured
+  uint32_t changeCount;
+};
+
+#endif
@@ -0,0 +1,278 @@
+#include "DeltaPatch.h"
+#include <string.h>
+
+static uint32_t readLe32(const uint8_t* p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+const char* DeltaPatcher::errorName(DeltaPatchError e) {
+  switch (e) {
+    case DELTA_OK: return "ok";
+    case DELTA_BAD_HEADER: return "bad_header";
+    case DELTA_REJECTED: return "rejected";
+    case DELTA_BAD_OP: return "bad_op";
+    case DELTA_OUT_OF_RANGE: return "out_of_range";
+    case DELTA_SOURCE_READ: return "source_read";
+    case DELTA_SINK_WRITE: return "sink_write";
+    case DELTA_TRUNCATED: return "truncated";
+  }
+  return "unknown";
+}
+
+void DeltaPatcher::reset() {
+  phase = PHASE_HEADER;
+  err = DELTA_OK;
+  memset(&hdr, 0, sizeof(hdr));
+  headerUsed = 0;
+  acc = 0;
+  accShift = 0;
+  srcPos = 0;
+  opLeft = 0;
+  runLeft = 0;
+  srcCacheStart = 0;
+  srcCacheLen = 0;
+  outUsed = 0;
+  produced = 0;
+}
+
+bool DeltaPatcher::fail(DeltaPatchError e) {
+  phase = PHASE_FAILED;
+  err = e;
+  return false;
+}
+
+bool DeltaPatcher::parseHeader() {
+  if (readLe32(headerBuf) != DELTA_PATCH_MAGIC || headerBuf[4] != DELTA_PATCH_VERSION) {
+    return fail(DELTA_BAD_HEADER);
+  }
+  hdr.sourceSize = readLe32(headerBuf + 8);
+  hdr.targetSize = readLe32(headerBuf + 12);
+  memcpy(hdr.sourceSha256, headerBuf + 16, 32);
+  memcpy(hdr.targetSha256, headerBuf + 48, 32);
+  if (hdr.targetSize == 0) {
+    return fail(DELTA_BAD_HEADER);
+  }
+  if (!out.begin(hdr)) {
+    return fail(DELTA_REJECTED);
+  }
+  phase = PHASE_OP;
+  return true;
+}
+
+bool DeltaPatcher::varint(uint8_t b, uint32_t& value) {
+  if (accShift > 28) {
+    fail(DELTA_BAD_OP);   // Longer than a uint32
+    return false;
+  }
+  acc |= (uint32_t)(b & 0x7F) << accShift;
+  accShift += 7;
+  if (b & 0x80) {
+    return false;
+  }
+  value = acc;
+  acc = 0;
+  accShift = 0;
+  return true;
+}
+
+// ==================== OUTPUT ====================
+bool DeltaPatcher::flush() {
+  if (outUsed == 0) {
+    return true;
+  }
+  if (!out.write(outBuf, outUsed)) {
+    return fail(DELTA_SINK_WRITE);
+  }
+  produced += outUsed;
+  outUsed = 0;
+  return true;
+}
+
+bool DeltaPatcher::emit(uint8_t b) {
+  outBuf[outUsed++] = b;
+  return outUsed < BLOCK || flush();
+}
+
+// Unchanged source bytes go straight into the output block
+bool DeltaPatcher::copySource(uint32_t n) {
+  while (n > 0) {
+    size_t k = BLOCK - outUsed;
+    if (k > n) {
+      k = n;
+    }
+    if (!src.read(srcPos, outBuf + outUsed, k)) {
+      return fail(DELTA_SOURCE_READ);
+    }
+    srcPos += k;
+    outUsed += k;
+    n -= k;
+    if (outUsed == BLOCK && !flush()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DeltaPatcher::sourceByte(uint32_t pos, uint8_t& b) {
+  if (pos < srcCacheStart || pos >= srcCacheStart + srcCacheLen) {
+    uint32_t len = hdr.sourceSize - pos;
+    if (len > sizeof(srcCache)) {
+      len = sizeof(srcCache);
+    }
+    if (!src.read(pos, srcCache, len)) {
+      return fail(DELTA_SOURCE_READ);
+    }
+    srcCacheStart = pos;
+    srcCacheLen = len;
+  }
+  b = srcCache[pos - srcCacheStart];
+  return true;
+}
+
+// ==================== DECODING ====================
+void DeltaPatcher::afterRun() {
+  phase = opLeft > 0 ? PHASE_ADD_SAME : PHASE_OP;
+}
+
+bool DeltaPatcher::feed(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    if (phase == PHASE_FAILED) {
+      return false;
+    }
+    if (phase == PHASE_DONE) {
+      return true;   // Trailing bytes are ignored
+    }
+
+    if (phase == PHASE_HEADER) {
+      size_t k = DELTA_PATCH_HEADER_SIZE - headerUsed;
+      if (k > len) {
+        k = len;
+      }
+      memcpy(headerBuf + headerUsed, data, k);
+      headerUsed += k;
+      data += k;
+      len -= k;
+      if (headerUsed == DELTA_PATCH_HEADER_SIZE && !parseHeader()) {
+        return false;
+      }
+      continue;
+    }
+
+    if (phase == PHASE_INSERT_BYTES) {
+      size_t k = opLeft < len ? opLeft : len;
+      for (size_t i = 0; i < k; i++) {
+        if (!emit(data[i])) {
+          return false;
+        }
+      }
+      data += k;
+      len -= k;
+      opLeft -= k;
+      if (opLeft == 0) {
+        phase = PHASE_OP;
+      }
+      continue;
+    }
+
+    uint8_t b = *data++;
+    len--;
+    uint32_t n;
+    switch (phase) {
+      case PHASE_OP:
+        if (b == 0x00) {
+          if (!flush()) {
+            return false;
+          }
+          if (produced != hdr.targetSize) {
+            return fail(DELTA_TRUNCATED);
+          }
+          phase = PHASE_DONE;
+        } else if (b == 0x01) {
+          phase = PHASE_ADD_OFFSET;
+        } else if (b == 0x02) {
+          phase = PHASE_INSERT_LENGTH;
+        } else {
+          return fail(DELTA_BAD_OP);
+        }
+        break;
+
+      case PHASE_ADD_OFFSET:
+        if (varint(b, srcPos)) {
+          phase = PHASE_ADD_LENGTH;
+        }
+        break;
+
+      case PHASE_ADD_LENGTH:
+        if (varint(b, opLeft)) {
+          if (srcPos > hdr.sourceSize || opLeft > hdr.sourceSize - srcPos ||
+              opLeft > hdr.targetSize - written()) {
+            return fail(DELTA_OUT_OF_RANGE);
+          }
+          phase = opLeft > 0 ? PHASE_ADD_SAME : PHASE_OP;
+        }
+        break;
+
+      case PHASE_ADD_SAME:
+        if (varint(b, n)) {
+          if (n > opLeft) {
+            return fail(DELTA_OUT_OF_RANGE);
+          }
+          if (!copySource(n)) {
+            return false;
+          }
+          opLeft -= n;
+          phase = PHASE_ADD_CHANGED;
+        }
+        break;
+
+      case PHASE_ADD_CHANGED:
+        if (varint(b, runLeft)) {
+          if (runLeft > opLeft) {
+            return fail(DELTA_OUT_OF_RANGE);
+          }
+          if (runLeft > 0) {
+            phase = PHASE_ADD_BYTES;
+          } else {
+            afterRun();
+          }
+        }
+        break;
+
+      case PHASE_ADD_BYTES: {
+        uint8_t s;
+        if (!sourceByte(srcPos, s) || !emit((uint8_t)(s + b))) {
+          return false;
+        }
+        srcPos++;
+        opLeft--;
+        if (--runLeft == 0) {
+          afterRun();
+        }
+        break;
+      }
+
+      case PHASE_INSERT_LENGTH:
+        if (varint(b, opLeft)) {
+          if (opLeft > hdr.targetSize - written()) {
+            return fail(DELTA_OUT_OF_RANGE);
+          }
+          phase = opLeft > 0 ? PHASE_INSERT_BYTES : PHASE_OP;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+  return phase != PHASE_FAILED;
+}
+
+bool DeltaPatcher::finish() {
+  if (phase == PHASE_FAILED) {
+    return false;
+  }
+  if (phase != PHASE_DONE) {
+    return fail(DELTA_TRUNCATED);
+  }
+  return true;
+}
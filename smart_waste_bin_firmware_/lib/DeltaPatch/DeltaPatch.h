@@ -0,0 +1,134 @@
+#ifndef DELTA_PATCH_H
+#define DELTA_PATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Streaming decoder for firmware delta patches.
+//
+// A patch rebuilds a new image from the running one. It is an 80-byte
+// header followed by ops:
+//   "SBDP" u8 version, 3 reserved bytes
+//   u32 source size, u32 target size (little endian)
+//   32 bytes SHA-256 of the source image, 32 bytes SHA-256 of the target
+//
+//   0x00                          end
+//   0x01 varint offset, varint n  add: n bytes of source from `offset`, plus
+//                                 a difference stored as runs of
+//                                   varint unchanged, varint changed,
+//                                   `changed` bytes added to the source
+//   0x02 varint n, n bytes        insert literal bytes
+//
+// Most of a rebuilt image is code that moved or whose addresses shifted by
+// a constant, so the differences are short runs between long unchanged
+// stretches. Patches are made on a host by tools/ota_delta.py.
+//
+// The decoder takes the patch in chunks of any size, as they arrive from
+// the network, and writes the target in chunks to a sink; nothing is
+// buffered beyond a small output block. Hashes are left to the caller.
+
+static const uint32_t DELTA_PATCH_MAGIC = 0x50444253;  // "SBDP"
+static const uint8_t DELTA_PATCH_VERSION = 1;
+static const size_t DELTA_PATCH_HEADER_SIZE = 80;
+
+struct DeltaPatchHeader {
+  uint32_t sourceSize;
+  uint32_t targetSize;
+  uint8_t sourceSha256[32];
+  uint8_t targetSha256[32];
+};
+
+enum DeltaPatchError {
+  DELTA_OK,
+  DELTA_BAD_HEADER,
+  DELTA_REJECTED,        // The sink refused the header
+  DELTA_BAD_OP,
+  DELTA_OUT_OF_RANGE,    // Reads past the source or writes past the target
+  DELTA_SOURCE_READ,
+  DELTA_SINK_WRITE,
+  DELTA_TRUNCATED        // finish() before the end op
+};
+
+// The running image
+class DeltaSource {
+public:
+  virtual bool read(uint32_t offset, uint8_t* buf, size_t len) = 0;
+};
+
+// Where the rebuilt image goes
+class DeltaSink {
+public:
+  // Called once the header is in, before any output; false aborts
+  virtual bool begin(const DeltaPatchHeader& header) = 0;
+  virtual bool write(const uint8_t* data, size_t len) = 0;
+};
+
+class DeltaPatcher {
+public:
+  static const size_t BLOCK = 512;
+
+  DeltaPatcher(DeltaSource& source, DeltaSink& sink) : src(source), out(sink) { reset(); }
+
+  void reset();
+  // Consumes `len` patch bytes; false once the patch is known to be bad
+  bool feed(const uint8_t* data, size_t len);
+  // Flushes the output; false unless the end op was seen and the target
+  // size matched
+  bool finish();
+
+  bool done() const { return phase == PHASE_DONE; }
+  DeltaPatchError error() const { return err; }
+  static const char* errorName(DeltaPatchError e);
+  const DeltaPatchHeader& header() const { return hdr; }
+  uint32_t written() const { return produced + outUsed; }
+
+private:
+  enum Phase {
+    PHASE_HEADER,
+    PHASE_OP,
+    PHASE_ADD_OFFSET,
+    PHASE_ADD_LENGTH,
+    PHASE_ADD_SAME,
+    PHASE_ADD_CHANGED,
+    PHASE_ADD_BYTES,
+    PHASE_INSERT_LENGTH,
+    PHASE_INSERT_BYTES,
+    PHASE_DONE,
+    PHASE_FAILED
+  };
+
+  bool fail(DeltaPatchError e);
+  bool parseHeader();
+  // Accumulates a varint; true once complete
+  bool varint(uint8_t b, uint32_t& value);
+  bool copySource(uint32_t n);
+  bool sourceByte(uint32_t pos, uint8_t& b);
+  bool emit(uint8_t b);
+  bool flush();
+  void afterRun();
+
+  DeltaSource& src;
+  DeltaSink& out;
+
+  Phase phase;
+  DeltaPatchError err;
+  DeltaPatchHeader hdr;
+  uint8_t headerBuf[DELTA_PATCH_HEADER_SIZE];
+  size_t headerUsed;
+
+  uint32_t acc;          // Varint being read
+  uint8_t accShift;
+  uint32_t srcPos;       // Next source byte for the current add
+  uint32_t opLeft;       // Target bytes left in the current add or insert
+  uint32_t runLeft;      // Changed bytes left in the current run
+
+  uint8_t srcCache[32];  // Source under the changed bytes
+  uint32_t srcCacheStart;
+  uint32_t srcCacheLen;
+
+  uint8_t outBuf[BLOCK];
+  size_t outUsed;
+  uint32_t produced;     // Bytes handed to the sink
+};
+
+#endif
@@ -0,0 +1,16 @@
+#include "EventTrace.h"
+#include <string.h>
+
+void EventTrace::begin(TraceBuffer* buffer, uint64_t nowUs, uint8_t resetReason) {
+  buf = buffer;
+  if (buf->magic != TRACE_MAGIC || buf->version != TRACE_VERSION || buf->capacity != TRACE_CAPACITY) {
+    // Power-on or layout change: RTC memory holds garbage
+    memset(buf, 0, sizeof(*buf));
+    buf->magic = TRACE_MAGIC;
+    buf->version = TRACE_VERSION;
+    buf->capacity = TRACE_CAPACITY;
+  }
+  buf->bootCount++;
+  clockHigh = (uint16_t)(nowUs >> 32);
+  store((uint32_t)nowUs, TRACE_BOOT, resetReason, (uint16_t)buf->bootCount);
+}
@@ -0,0 +1,88 @@
+#ifndef EVENT_TRACE_H
+#define EVENT_TRACE_H
+
+#include <stdint.h>
+
+// Always-on binary event trace.
+//
+// A fixed ring of 8-byte records, meant to live in RTC memory so it
+// survives a soft reset. Recording is one atomic increment and an 8-byte
+// store. The buffer layout is little-endian and is streamed as-is by the
+// firmware; tools/trace_decode.py turns it into a timeline.
+//
+// Timestamps are the low 32 bits of the microsecond clock. A TRACE_CLOCK
+// record carries the high bits whenever they change, and every boot starts
+// with a TRACE_BOOT record, so the decoder can rebuild absolute times.
+
+static const uint32_t TRACE_MAGIC = 0x52544253; // "SBTR"
+static const uint16_t TRACE_VERSION = 1;
+static const uint16_t TRACE_CAPACITY = 256;     // Must be a power of two
+
+enum TraceEvent {
+  TRACE_BOOT = 1,          // a = reset reason, b = boot count
+  TRACE_CLOCK,             // b = bits 32..47 of the microsecond clock
+  TRACE_STATE,             // a = from, b = to
+  TRACE_CAN_TX,            // a = payload length, b = CAN id
+  TRACE_CAN_RX,            // a = payload length, b = CAN id
+  TRACE_DETECTION,         // a = material, b = milliseconds since request
+  TRACE_DETECTION_TIMEOUT, // b = milliseconds since request
+  TRACE_LID_OPEN,          // a = bin (0 organic, 1 non-organic)
+  TRACE_LID_CLOSE,         // a = bin
+  TRACE_UPLOAD,            // a = 1 ok / 0 failed, b = HTTP status or error code
+  TRACE_MOTION,            // Start of a cycle: a = 0 PIR, 1 camera presence
+};
+
+struct TraceRecord {
+  uint32_t timeUs;
+  uint8_t event;
+  uint8_t a;
+  uint16_t b;
+};
+
+struct TraceBuffer {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t capacity;
+  uint32_t sequence;       // Total records written; slot = sequence % capacity
+  uint32_t bootCount;
+  TraceRecord records[TRACE_CAPACITY];
+};
+
+class EventTrace {
+public:
+  EventTrace() : buf(nullptr), clockHigh(0) {}
+
+  // Uses `buffer` for storage, keeping its contents if they are a valid
+  // trace from a previous boot, and records a TRACE_BOOT event.
+  void begin(TraceBuffer* buffer, uint64_t nowUs, uint8_t resetReason);
+
+  inline void record(uint64_t nowUs, uint8_t event, uint8_t a = 0, uint16_t b = 0) {
+    uint16_t high = (uint16_t)(nowUs >> 32);
+    if (high != clockHigh) {
+      clockHigh = high;
+      store((uint32_t)nowUs, TRACE_CLOCK, 0, high);
+    }
+    store((uint32_t)nowUs, event, a, b);
+  }
+
+  const TraceBuffer* buffer() const { return buf; }
+  uint32_t sequence() const { return buf ? buf->sequence : 0; }
+
+private:
+  inline void store(uint32_t timeUs, uint8_t event, uint8_t a, uint16_t b) {
+    if (!buf) {
+      return;
+    }
+    uint32_t seq = __atomic_fetch_add(&buf->sequence, 1, __ATOMIC_RELAXED);
+    TraceRecord& r = buf->records[seq & (TRACE_CAPACITY - 1)];
+    r.timeUs = timeUs;
+    r.event = event;
+    r.a = a;
+    r.b = b;
+  }
+
+  TraceBuffer* buf;
+  uint16_t clockHigh;
+};
+
+#endif
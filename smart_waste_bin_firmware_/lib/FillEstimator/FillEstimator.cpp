@@ -0,0 +1,133 @@
+#include "FillEstimator.h"
+
+// ==================== SLIDING MEDIAN ====================
+int32_t MedianFilter5::push(int32_t sample) {
+  window[head] = sample;
+  head = (head + 1) % 5;
+  if (count < 5) {
+    count++;
+  }
+
+  // Insertion sort of at most 5 values: bounded work, no allocation
+  int32_t sorted[5];
+  for (uint8_t i = 0; i < count; i++) {
+    int32_t v = window[i];
+    int8_t j = i - 1;
+    while (j >= 0 && sorted[j] > v) {
+      sorted[j + 1] = sorted[j];
+      j--;
+    }
+    sorted[j + 1] = v;
+  }
+  return sorted[count / 2];
+}
+
+// ==================== FUSION FILTER ====================
+FillEstimator::FillEstimator(const FillEstimatorConfig& config) : cfg(config) {
+  reset();
+}
+
+void FillEstimator::Estimate::reset() {
+  value = 0;
+  variance = 1000UL * 1000UL; // Know nothing until the first reading
+  initialized = false;
+}
+
+void FillEstimator::reset() {
+  distanceMedian.reset();
+  massMedian.reset();
+  fused.reset();
+  byVolume.reset();
+  byMass.reset();
+  mass = 0;
+  massMisses = MASS_STALE_UPDATES;
+  full = false;
+  rejected = 0;
+}
+
+void FillEstimator::Estimate::correct(int32_t measurement, uint32_t measurementVariance) {
+  if (!initialized) {
+    value = measurement;
+    variance = measurementVariance;
+    initialized = true;
+    return;
+  }
+
+  // Kalman gain in Q16: K = P / (P + R)
+  uint64_t denom = (uint64_t)variance + measurementVariance;
+  uint32_t gain = (uint32_t)(((uint64_t)variance << 16) / denom);
+  value += (int32_t)(((int64_t)gain * (measurement - value)) >> 16);
+  variance = (uint32_t)(((uint64_t)variance * measurementVariance) / denom);
+}
+
+static int32_t clampPermille(int32_t value) {
+  if (value < 0) return 0;
+  if (value > 1000) return 1000;
+  return value;
+}
+
+void FillEstimator::update(int32_t distanceMm, int32_t massGrams) {
+  // Reject readings that cannot be physical before they reach the median
+  if (distanceMm != INVALID && (distanceMm <= 0 || distanceMm > 2 * cfg.emptyDistanceMm)) {
+    distanceMm = INVALID;
+    rejected++;
+  }
+  if (massGrams != INVALID && (massGrams < -cfg.capacityGrams / 2 || massGrams > 2 * cfg.capacityGrams)) {
+    massGrams = INVALID;
+    rejected++;
+  }
+
+  fused.variance += cfg.processVariance;
+  byVolume.variance += cfg.processVariance;
+  byMass.variance += cfg.processVariance;
+
+  if (distanceMm != INVALID) {
+    int32_t d = distanceMedian.push(distanceMm);
+    int32_t span = cfg.emptyDistanceMm - cfg.fullDistanceMm;
+    int32_t volume = clampPermille((int32_t)(((int64_t)(cfg.emptyDistanceMm - d) * 1000) / span));
+    fused.correct(volume, cfg.volumeVariance);
+    byVolume.correct(volume, cfg.volumeVariance);
+  }
+
+  if (massGrams == INVALID) {
+    if (massMisses < MASS_STALE_UPDATES) {
+      massMisses++;
+    }
+  } else {
+    massMisses = 0;
+    mass = massMedian.push(massGrams);
+    if (mass < 0) {
+      mass = 0;
+    }
+    int32_t massLevel = clampPermille((int32_t)(((int64_t)mass * 1000) / cfg.capacityGrams));
+    fused.correct(massLevel, cfg.massVariance);
+    byMass.correct(massLevel, cfg.massVariance);
+  }
+
+  fused.value = clampPermille(fused.value);
+  byVolume.value = clampPermille(byVolume.value);
+  byMass.value = clampPermille(byMass.value);
+
+  // Hysteresis on the full flag; without any reading it stays as it was
+  if (!byVolume.initialized && !hasMass()) {
+    return;
+  }
+  int32_t peak = peakPermille();
+  if (full) {
+    if (peak < cfg.fullOffPermille) {
+      full = false;
+    }
+  } else if (peak >= cfg.fullOnPermille) {
+    full = true;
+  }
+}
+
+// A stale mass level is ignored, so a scale that stopped answering cannot
+// hold the bin full or empty
+uint16_t FillEstimator::peakPermille() const {
+  int32_t peak = byVolume.initialized ? byVolume.value : 0;
+  if (hasMass() && byMass.value > peak) {
+    peak = byMass.value;
+  }
+  return (uint16_t)peak;
+}
@@ -0,0 +1,103 @@
+#ifndef FILL_ESTIMATOR_H
+#define FILL_ESTIMATOR_H
+
+#include <stdint.h>
+
+// Fixed-point fill estimator for one bin.
+//
+// Fuses the ultrasonic depth reading (volume) and the load cell reading
+// (mass) into a single fill level using a scalar Kalman filter in integer
+// arithmetic. Each input first passes through a 5-sample sliding median so a
+// single bad echo or load cell spike cannot move the estimate.
+//
+// Volume and mass only agree for waste of the expected density: a bin of
+// light packaging is full by volume at a fraction of its capacity, dense
+// waste reaches capacity while there is still room. Each sensor therefore
+// also keeps its own filtered level, and the bin is full when either of
+// them is; the fused level is for display and forecasting. The full flag
+// uses separate on/off thresholds so it does not chatter at the limit.
+//
+// Fill levels are expressed in permille (0..1000). No floating point and no
+// allocation; one update is a handful of integer operations.
+
+// Sliding median over the last 5 samples. Constant time per push.
+class MedianFilter5 {
+public:
+  MedianFilter5() { reset(); }
+
+  void reset() {
+    count = 0;
+    head = 0;
+  }
+
+  // Adds a sample and returns the median of the samples currently held.
+  int32_t push(int32_t sample);
+
+  uint8_t size() const { return count; }
+
+private:
+  int32_t window[5];
+  uint8_t count;
+  uint8_t head;
+};
+
+struct FillEstimatorConfig {
+  int32_t emptyDistanceMm;   // Sensor-to-bottom distance of an empty bin
+  int32_t fullDistanceMm;    // Sensor-to-waste distance of a full bin
+  int32_t capacityGrams;     // Mass that counts as 100% full
+  uint16_t fullOnPermille;   // Fill at or above which the bin becomes full
+  uint16_t fullOffPermille;  // Fill below which a full bin is cleared
+  uint32_t volumeVariance;   // Ultrasonic measurement noise (permille^2)
+  uint32_t massVariance;     // Load cell measurement noise (permille^2)
+  uint32_t processVariance;  // Expected fill drift per update (permille^2)
+};
+
+class FillEstimator {
+public:
+  // Marks a reading as unavailable (e.g. echo timeout, HX711 not ready).
+  static const int32_t INVALID = INT32_MIN;
+  static const uint8_t MASS_STALE_UPDATES = 5;
+
+  explicit FillEstimator(const FillEstimatorConfig& config);
+
+  void reset();
+
+  // Feeds one reading of each sensor. Either may be INVALID, in which case
+  // the estimate is updated from the other sensor only.
+  void update(int32_t distanceMm, int32_t massGrams);
+
+  uint16_t fillPermille() const { return (uint16_t)fused.value; }
+  uint8_t fillPercent() const { return (uint8_t)((fused.value + 5) / 10); }
+  // The fuller of the per-sensor levels; what isFull() follows
+  uint16_t peakPermille() const;
+  // Last good median; check hasMass() before trusting it
+  int32_t massGrams() const { return mass; }
+  // A valid mass reading arrived within the median's window of updates
+  bool hasMass() const { return massMisses < MASS_STALE_UPDATES; }
+  bool isFull() const { return full; }
+  uint32_t rejectedSamples() const { return rejected; }
+
+private:
+  // One scalar Kalman filter
+  struct Estimate {
+    int32_t value;       // Fill, permille
+    uint32_t variance;   // permille^2
+    bool initialized;
+
+    void reset();
+    void correct(int32_t measurement, uint32_t measurementVariance);
+  };
+
+  FillEstimatorConfig cfg;
+  MedianFilter5 distanceMedian;
+  MedianFilter5 massMedian;
+  Estimate fused;      // Both sensors
+  Estimate byVolume;   // Ultrasonic only
+  Estimate byMass;     // Load cell only
+  int32_t mass;        // Median-filtered mass, grams
+  uint8_t massMisses;  // Updates since the last valid mass, saturating
+  bool full;
+  uint32_t rejected;   // Readings outside the physical range
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "FillForecast.h"
+#include <math.h>
+
+// Drop in fill (percent) that counts as the bin being emptied
+static const float EMPTIED_DROP_PERCENT = 20.0f;
+// Minimum samples and weight span before a rate is reported
+static const uint32_t MIN_SAMPLES = 3;
+
+// ==================== FILL RATE REGRESSION ====================
+FillForecast::FillForecast(uint32_t windowSeconds)
+    : windowHours(windowSeconds / 3600.0f) {
+  reset();
+}
+
+void FillForecast::reset() {
+  sumW = sumT = sumY = sumTT = sumTY = 0;
+  lastFill = 0;
+  lastSeconds = 0;
+  count = 0;
+}
+
+void FillForecast::addSample(uint32_t nowSeconds, float fillPercent) {
+  if (count > 0 && lastFill - fillPercent > EMPTIED_DROP_PERCENT) {
+    reset();
+  }
+
+  if (count > 0) {
+    float dt = (nowSeconds - lastSeconds) / 3600.0f;
+
+    // Shift the origin to the new sample: t -> t - dt
+    sumTT = sumTT - 2 * dt * sumT + dt * dt * sumW;
+    sumTY = sumTY - dt * sumY;
+    sumT = sumT - dt * sumW;
+
+    // Fade older samples
+    float w = expf(-dt / windowHours);
+    sumW *= w;
+    sumT *= w;
+    sumY *= w;
+    sumTT *= w;
+    sumTY *= w;
+  }
+
+  // New sample sits at t = 0
+  sumW += 1;
+  sumY += fillPercent;
+
+  lastFill = fillPercent;
+  lastSeconds = nowSeconds;
+  count++;
+}
+
+float FillForecast::ratePerHour() const {
+  if (count < MIN_SAMPLES) {
+    return 0;
+  }
+  float denom = sumW * sumTT - sumT * sumT;
+  if (denom <= 1e-9f) {
+    return 0;
+  }
+  return (sumW * sumTY - sumT * sumY) / denom;
+}
+
+int32_t FillForecast::secondsToFull(float fullPercent) const {
+  float rate = ratePerHour();
+  if (rate <= 0.01f) {
+    return -1;
+  }
+  float remaining = fullPercent - lastFill;
+  if (remaining <= 0) {
+    return 0;
+  }
+  float seconds = remaining / rate * 3600.0f;
+  return seconds > 2147483647.0f ? -1 : (int32_t)seconds;
+}
+
+// ==================== USAGE PROFILE ====================
+void UsageProfile::reset() {
+  for (uint8_t i = 0; i < 24; i++) {
+    buckets[i] = 0;
+  }
+  hourStartFill = 0;
+  lastFill = 0;
+  currentHour = -1;
+}
+
+void UsageProfile::addSample(uint8_t hour, float fillPercent) {
+  hour %= 24;
+  if (currentHour < 0) {
+    currentHour = hour;
+    hourStartFill = fillPercent;
+  } else if (hour != currentHour) {
+    // Emptying during the hour is not usage; count only what was added after
+    float gained = lastFill - hourStartFill;
+    if (gained < 0) {
+      gained = 0;
+    }
+    uint16_t tenths = (uint16_t)(gained * 10);
+    uint16_t& b = buckets[currentHour];
+    b = (uint16_t)((b * 7u + tenths) / 8u);
+    currentHour = hour;
+    hourStartFill = fillPercent;
+  }
+  if (fillPercent < lastFill - EMPTIED_DROP_PERCENT) {
+    hourStartFill = fillPercent;
+  }
+  lastFill = fillPercent;
+}
@@ -0,0 +1,67 @@
+#ifndef FILL_FORECAST_H
+#define FILL_FORECAST_H
+
+#include <stdint.h>
+
+// Incremental fill-rate regression for one bin.
+//
+// Keeps an exponentially weighted least-squares line through (time, fill)
+// samples. Older samples fade with time constant `windowSeconds`, so each
+// sample is O(1) work and the state is five floats. Sums are kept relative
+// to the newest sample to avoid losing precision over long uptimes.
+class FillForecast {
+public:
+  explicit FillForecast(uint32_t windowSeconds);
+
+  void reset();
+
+  // Adds a fill sample (percent) taken at `nowSeconds` (monotonic).
+  // A large drop in fill is treated as the bin being emptied and restarts
+  // the regression.
+  void addSample(uint32_t nowSeconds, float fillPercent);
+
+  // Fill rate in percent per hour, 0 if not enough data.
+  float ratePerHour() const;
+
+  // Seconds until fill reaches `fullPercent` at the current rate,
+  // -1 if the bin is not filling or there is not enough data.
+  int32_t secondsToFull(float fullPercent) const;
+
+  uint32_t samples() const { return count; }
+
+private:
+  float windowHours;
+  float sumW;    // sum of weights
+  float sumT;    // sum of w*t (t in hours, newest sample at 0)
+  float sumY;    // sum of w*y
+  float sumTT;   // sum of w*t*t
+  float sumTY;   // sum of w*t*y
+  float lastFill;
+  uint32_t lastSeconds;
+  uint32_t count;
+};
+
+// Average fill added per hour of day, for collection planning.
+// Each bucket is an exponential moving average over days.
+class UsageProfile {
+public:
+  UsageProfile() { reset(); }
+
+  void reset();
+
+  // Records the current fill at local hour `hour` (0..23). Fill gained
+  // since the previous hour is folded into that hour's bucket when the
+  // hour rolls over.
+  void addSample(uint8_t hour, float fillPercent);
+
+  // Average fill gained during `hour`, in tenths of a percent.
+  uint16_t bucket(uint8_t hour) const { return buckets[hour % 24]; }
+
+private:
+  uint16_t buckets[24];
+  float hourStartFill;
+  float lastFill;
+  int8_t currentHour;
+};
+
+#endif
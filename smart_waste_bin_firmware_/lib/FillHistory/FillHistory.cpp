@@ -0,0 +1,430 @@
+#include "FillHistory.h"
+#include <string.h>
+
+// Largest entry: tag, a 5-byte step and a 5-byte difference per channel
+static const size_t MAX_ENTRY = 1 + 5 + 5 * HISTORY_CHANNELS;
+static const uint8_t DIRECT_STEPS = 15;
+
+static void put16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint16_t get16(const uint8_t* p) {
+  return p[0] | (uint16_t)p[1] << 8;
+}
+
+static uint32_t get32(const uint8_t* p) {
+  return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static size_t putVarint(uint8_t* p, uint32_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return n;
+}
+
+static bool getVarint(const uint8_t* block, size_t used, size_t& pos, uint32_t& v) {
+  v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (pos >= used) {
+      return false;
+    }
+    uint8_t b = block[pos++];
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Differences wrap modulo 2^32, so a channel going to or from
+// HISTORY_MISSING costs five bytes and nothing overflows
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+FillHistory::FillHistory(HistoryStore& historyStore, uint16_t stepSeconds)
+    : store(historyStore),
+      stepS(stepSeconds ? stepSeconds : 1),
+      openUsed(0),
+      openSeq(0),
+      openDirty(false),
+      rejectedCount(0),
+      failureCount(0) {
+  memset(index, 0, sizeof(index));
+  memset(&lastSample, 0, sizeof(lastSample));
+}
+
+bool FillHistory::parseHeader(const uint8_t* block, size_t len, uint32_t& sequence, size_t& used,
+                              uint16_t& stepSeconds, HistorySample& first) {
+  if (len < HISTORY_HEADER_SIZE || get32(block) != HISTORY_MAGIC || block[16] != HISTORY_VERSION ||
+      block[17] != HISTORY_CHANNELS) {
+    return false;
+  }
+  sequence = get32(block + 4);
+  used = get16(block + 12);
+  stepSeconds = get16(block + 14);
+  if (sequence == 0 || used < HISTORY_HEADER_SIZE || used > len || stepSeconds == 0) {
+    return false;
+  }
+  first.time = get32(block + 8);
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    first.values[c] = (int32_t)get32(block + 20 + 4 * c);
+  }
+  return true;
+}
+
+bool FillHistory::decode(const uint8_t* block, size_t used, size_t& pos, uint16_t stepSeconds, HistorySample& sample) {
+  if (pos >= used) {
+    return false;
+  }
+  uint8_t tag = block[pos++];
+  uint32_t steps = tag >> 4;
+  if (steps == 0 && (!getVarint(block, used, pos, steps) || steps == 0)) {
+    return false;
+  }
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    if (!(tag & (1 << c))) {
+      continue;
+    }
+    uint32_t diff;
+    if (!getVarint(block, used, pos, diff)) {
+      return false;
+    }
+    sample.values[c] = (int32_t)((uint32_t)sample.values[c] + (uint32_t)unzigzag(diff));
+  }
+  sample.time += steps * stepSeconds;
+  return true;
+}
+
+size_t FillHistory::encode(uint8_t* out, uint32_t steps, const int32_t* from, const int32_t* to) {
+  uint8_t mask = 0;
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    if (from[c] != to[c]) {
+      mask |= 1 << c;
+    }
+  }
+  size_t n = 1;
+  if (steps <= DIRECT_STEPS) {
+    out[0] = mask | steps << 4;
+  } else {
+    out[0] = mask;
+    n += putVarint(out + n, steps);
+  }
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    if (mask & (1 << c)) {
+      n += putVarint(out + n, zigzag((int32_t)((uint32_t)to[c] - (uint32_t)from[c])));
+    }
+  }
+  return n;
+}
+
+void FillHistory::begin() {
+  memset(index, 0, sizeof(index));
+  openSeq = 0;
+  openUsed = 0;
+  openDirty = false;
+
+  // `open` is free until the newest block is known; scan the slots through it
+  for (uint16_t slot = 0; slot < BLOCKS; slot++) {
+    size_t len = store.read(slot, open, BLOCK_SIZE);
+    uint32_t sequence;
+    size_t used;
+    uint16_t stepSeconds;
+    HistorySample sample;
+    if (!parseHeader(open, len, sequence, used, stepSeconds, sample) || sequence % BLOCKS != slot ||
+        stepSeconds != stepS) {
+      continue;
+    }
+    IndexEntry& e = index[slot];
+    e.sequence = sequence;
+    e.firstTime = sample.time;
+    e.samples = 1;
+    size_t pos = HISTORY_HEADER_SIZE;
+    while (decode(open, used, pos, stepS, sample)) {
+      e.samples++;
+    }
+    e.lastTime = sample.time;
+    e.used = pos;     // Stops short of a malformed tail
+    if (sequence > openSeq) {
+      openSeq = sequence;
+      lastSample = sample;
+    }
+  }
+
+  if (openSeq != 0) {
+    const IndexEntry& e = index[openSeq % BLOCKS];
+    store.read(openSeq % BLOCKS, open, BLOCK_SIZE);
+    openUsed = e.used;
+    put16(open + 12, openUsed);
+  }
+}
+
+void FillHistory::startBlock(uint32_t sequence, const HistorySample& first) {
+  memset(open, 0, HISTORY_HEADER_SIZE);
+  put32(open, HISTORY_MAGIC);
+  put32(open + 4, sequence);
+  put32(open + 8, first.time);
+  put16(open + 12, HISTORY_HEADER_SIZE);
+  put16(open + 14, stepS);
+  open[16] = HISTORY_VERSION;
+  open[17] = HISTORY_CHANNELS;
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    put32(open + 20 + 4 * c, (uint32_t)first.values[c]);
+  }
+  openUsed = HISTORY_HEADER_SIZE;
+  openSeq = sequence;
+  openDirty = true;
+
+  // Takes over the slot, dropping the block the ring comes round to
+  IndexEntry& e = index[sequence % BLOCKS];
+  e.sequence = sequence;
+  e.firstTime = first.time;
+  e.lastTime = first.time;
+  e.samples = 1;
+  e.used = openUsed;
+}
+
+bool FillHistory::checkpoint() {
+  if (!openDirty) {
+    return true;
+  }
+  if (!store.write(openSeq % BLOCKS, open, openUsed)) {
+    failureCount++;
+    return false;
+  }
+  openDirty = false;
+  return true;
+}
+
+bool FillHistory::append(uint32_t time, const int32_t values[HISTORY_CHANNELS]) {
+  HistorySample sample;
+  sample.time = time - time % stepS;
+  memcpy(sample.values, values, sizeof(sample.values));
+
+  if (openSeq == 0) {
+    startBlock(1, sample);
+    lastSample = sample;
+    return true;
+  }
+  if (sample.time < lastSample.time + stepS) {
+    rejectedCount++;
+    return false;
+  }
+
+  uint8_t entry[MAX_ENTRY];
+  size_t n = encode(entry, (sample.time - lastSample.time) / stepS, lastSample.values, sample.values);
+  bool ok = true;
+  if (openUsed + n > BLOCK_SIZE) {
+    // The block is final; a failed write loses it, but the ring moves on
+    ok = checkpoint();
+    startBlock(openSeq + 1, sample);
+  } else {
+    memcpy(open + openUsed, entry, n);
+    openUsed += n;
+    put16(open + 12, openUsed);
+    openDirty = true;
+    IndexEntry& e = index[openSeq % BLOCKS];
+    e.lastTime = sample.time;
+    e.samples++;
+    e.used = openUsed;
+  }
+  lastSample = sample;
+  return ok;
+}
+
+size_t FillHistory::readBlock(uint32_t sequence, uint8_t* buf) {
+  if (sequence == 0 || index[sequence % BLOCKS].sequence != sequence) {
+    return 0;
+  }
+  if (sequence == openSeq) {
+    memcpy(buf, open, openUsed);
+    return openUsed;
+  }
+  size_t len = store.read(sequence % BLOCKS, buf, BLOCK_SIZE);
+  uint32_t stored;
+  size_t used;
+  uint16_t stepSeconds;
+  HistorySample first;
+  if (!parseHeader(buf, len, stored, used, stepSeconds, first) || stored != sequence) {
+    return 0;
+  }
+  return used;
+}
+
+uint32_t FillHistory::firstBlockAfter(uint32_t time) const {
+  uint32_t best = 0;
+  for (uint16_t slot = 0; slot < BLOCKS; slot++) {
+    const IndexEntry& e = index[slot];
+    if (e.sequence != 0 && e.lastTime >= time && (best == 0 || e.sequence < best)) {
+      best = e.sequence;
+    }
+  }
+  return best;
+}
+
+uint32_t FillHistory::oldestTime() const {
+  uint32_t oldest = 0;
+  uint32_t oldestSeq = 0;
+  for (uint16_t slot = 0; slot < BLOCKS; slot++) {
+    const IndexEntry& e = index[slot];
+    if (e.sequence != 0 && (oldestSeq == 0 || e.sequence < oldestSeq)) {
+      oldestSeq = e.sequence;
+      oldest = e.firstTime;
+    }
+  }
+  return oldest;
+}
+
+uint32_t FillHistory::sampleCount() const {
+  uint32_t total = 0;
+  for (uint16_t slot = 0; slot < BLOCKS; slot++) {
+    total += index[slot].samples;
+  }
+  return total;
+}
+
+uint32_t FillHistory::storedBytes() const {
+  uint32_t total = 0;
+  for (uint16_t slot = 0; slot < BLOCKS; slot++) {
+    total += index[slot].used;
+  }
+  return total;
+}
+
+// ==================== CURSOR ====================
+void HistoryCursor::begin(FillHistory& h, uint32_t from, uint32_t to, uint32_t resolution) {
+  history = &h;
+  rangeFrom = from;
+  rangeTo = to;
+  bucketS = resolution > h.step() ? resolution : 0;
+  sequence = h.firstBlockAfter(from);
+  used = 0;
+  pos = 0;
+  tail = false;
+  held = false;
+  done = sequence == 0 || from > to;
+}
+
+bool HistoryCursor::loadBlock() {
+  while (sequence != 0 && sequence <= history->newestSequence()) {
+    tail = sequence == history->newestSequence();
+    used = history->readBlock(sequence, block);
+    uint32_t stored;
+    size_t blockUsed;
+    uint16_t stepSeconds;
+    if (used != 0 && FillHistory::parseHeader(block, used, stored, blockUsed, stepSeconds, sample)) {
+      pos = 0;
+      return true;
+    }
+    used = 0;
+    sequence++;   // Overwritten while we streamed; the next one is newer
+  }
+  return false;
+}
+
+bool HistoryCursor::nextSample(HistorySample& out) {
+  while (!done) {
+    if (used == 0 && !loadBlock()) {
+      done = true;
+      return false;
+    }
+    bool have;
+    if (pos == 0) {
+      pos = HISTORY_HEADER_SIZE;
+      have = true;
+    } else {
+      have = FillHistory::decode(block, used, pos, history->step(), sample);
+      if (!have && tail) {
+        // Pick up samples appended since the open block was copied
+        tail = false;
+        size_t grown = history->readBlock(sequence, block);
+        if (grown > used) {
+          used = grown;
+          have = FillHistory::decode(block, used, pos, history->step(), sample);
+        }
+      }
+    }
+    if (!have) {
+      used = 0;
+      sequence++;
+      continue;
+    }
+    if (sample.time < rangeFrom) {
+      continue;
+    }
+    if (sample.time > rangeTo) {
+      done = true;
+      return false;
+    }
+    out = sample;
+    return true;
+  }
+  return false;
+}
+
+bool HistoryCursor::next(HistoryPoint& point) {
+  HistorySample s;
+  if (held) {
+    s = pending;
+    held = false;
+  } else if (!nextSample(s)) {
+    return false;
+  }
+
+  if (bucketS == 0) {
+    point.time = s.time;
+    memcpy(point.values, s.values, sizeof(point.values));
+    point.samples = 1;
+    return true;
+  }
+
+  uint32_t bucket = s.time - s.time % bucketS;
+  int64_t sums[HISTORY_CHANNELS] = {};
+  uint16_t counts[HISTORY_CHANNELS] = {};
+  point.samples = 0;
+  for (;;) {
+    for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+      if (s.values[c] != HISTORY_MISSING) {
+        sums[c] += s.values[c];
+        counts[c]++;
+      }
+    }
+    point.samples++;
+    if (!nextSample(s)) {
+      break;
+    }
+    if (s.time - s.time % bucketS != bucket) {
+      pending = s;
+      held = true;
+      break;
+    }
+  }
+  point.time = bucket;
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    if (counts[c] == 0) {
+      point.values[c] = HISTORY_MISSING;
+    } else {
+      int64_t half = counts[c] / 2;
+      point.values[c] = (int32_t)((sums[c] >= 0 ? sums[c] + half : sums[c] - half) / counts[c]);
+    }
+  }
+  return true;
+}
@@ -0,0 +1,161 @@
+#ifndef FILL_HISTORY_H
+#define FILL_HISTORY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// On-device time series of per-bin fill and weight, so the bin can show
+// its own history while the backend or WiFi is down.
+//
+// Samples go into fixed-size blocks kept in a ring of BLOCKS flash slots.
+// A block starts with a header holding its first sample in full; every
+// later sample is one entry:
+//   u8 tag            low nibble: channels that changed
+//                     high nibble: time step to the previous sample, in
+//                     `stepSeconds` units; 0 means a varint step follows
+//   [varint step]
+//   zigzag varint     difference for each changed channel, lowest first
+// so a minute in which nothing moved costs one byte and a typical day a
+// couple of kilobytes.
+//
+// The block being filled lives in RAM and is written to its slot by
+// checkpoint() and when it fills up; a full block is never written again
+// until the ring comes round to its slot. The RAM index has one entry per
+// block (sequence and time span), enough to find the blocks a range query
+// needs without reading the others.
+//
+// Not thread safe; the caller serialises append() and cursors.
+
+enum HistoryChannel {
+  HISTORY_FILL_ORGANIC,          // Permille
+  HISTORY_FILL_NON_ORGANIC,
+  HISTORY_WEIGHT_ORGANIC,        // 10 g steps
+  HISTORY_WEIGHT_NON_ORGANIC,
+  HISTORY_CHANNELS
+};
+
+static const int32_t HISTORY_MISSING = INT32_MIN;   // No reading for the channel
+static const uint32_t HISTORY_MAGIC = 0x48464253;   // "SBFH"
+static const uint8_t HISTORY_VERSION = 1;
+
+// Block header, little endian:
+//   u32 magic, u32 sequence, u32 time of the first sample (unix seconds),
+//   u16 bytes used (header included), u16 step seconds, u8 version,
+//   u8 channel count, u16 reserved, i32 first sample per channel
+static const size_t HISTORY_HEADER_SIZE = 20 + 4 * HISTORY_CHANNELS;
+
+// Flash behind the ring (a LittleFS file per slot on the ESP32)
+class HistoryStore {
+public:
+  // Bytes read; 0 if the slot is empty or unreadable
+  virtual size_t read(uint16_t slot, uint8_t* buf, size_t maxLen) = 0;
+  // Replaces the slot's contents
+  virtual bool write(uint16_t slot, const uint8_t* data, size_t len) = 0;
+};
+
+struct HistorySample {
+  uint32_t time;                        // Unix seconds
+  int32_t values[HISTORY_CHANNELS];
+};
+
+class FillHistory {
+public:
+  static const uint16_t BLOCKS = 64;
+  static const size_t BLOCK_SIZE = 512;
+
+  FillHistory(HistoryStore& store, uint16_t stepSeconds);
+
+  // Rebuilds the index from the store and reopens the newest block
+  void begin();
+
+  // Times are rounded down to the step. False if the time is not a step
+  // past the previous sample (clock stepped back) or a full block could
+  // not be written; the sample is dropped either way.
+  bool append(uint32_t time, const int32_t values[HISTORY_CHANNELS]);
+
+  // Writes the open block if it changed since the last write
+  bool checkpoint();
+  bool dirty() const { return openDirty; }
+
+  // Copies block `sequence` into `buf` (BLOCK_SIZE bytes) and returns the
+  // bytes used; 0 once it has been overwritten or if it was never written
+  size_t readBlock(uint32_t sequence, uint8_t* buf);
+
+  // Oldest block whose samples reach `time`; 0 if none
+  uint32_t firstBlockAfter(uint32_t time) const;
+  uint32_t newestSequence() const { return openSeq; }
+
+  uint16_t step() const { return stepS; }
+  uint32_t oldestTime() const;
+  uint32_t newestTime() const { return openSeq ? lastSample.time : 0; }
+  uint32_t sampleCount() const;
+  uint32_t storedBytes() const;
+  uint32_t rejected() const { return rejectedCount; }
+  uint32_t writeFailures() const { return failureCount; }
+
+  // Decodes the entry at `pos`, advancing `sample`; false at the end of
+  // the block or on a malformed entry
+  static bool decode(const uint8_t* block, size_t used, size_t& pos, uint16_t stepSeconds, HistorySample& sample);
+  // Header fields; false if `block` is not a valid block
+  static bool parseHeader(const uint8_t* block, size_t len, uint32_t& sequence, size_t& used, uint16_t& stepSeconds, HistorySample& first);
+
+private:
+  struct IndexEntry {
+    uint32_t sequence;     // 0: slot empty
+    uint32_t firstTime;
+    uint32_t lastTime;
+    uint16_t samples;
+    uint16_t used;
+  };
+
+  void startBlock(uint32_t sequence, const HistorySample& first);
+  static size_t encode(uint8_t* out, uint32_t steps, const int32_t* from, const int32_t* to);
+
+  HistoryStore& store;
+  uint16_t stepS;
+  IndexEntry index[BLOCKS];
+  uint8_t open[BLOCK_SIZE];   // Block being filled
+  size_t openUsed;
+  uint32_t openSeq;           // 0 until the first sample
+  bool openDirty;
+  HistorySample lastSample;
+  uint32_t rejectedCount;
+  uint32_t failureCount;
+};
+
+struct HistoryPoint {
+  uint32_t time;                        // Start of the bucket
+  int32_t values[HISTORY_CHANNELS];     // Mean over the bucket, or HISTORY_MISSING
+  uint16_t samples;
+};
+
+// Streams the samples in [from, to], averaged into buckets of
+// `resolution` seconds aligned to multiples of it (raw samples if it is at
+// most the step). Holds one block at a time.
+class HistoryCursor {
+public:
+  HistoryCursor() : history(nullptr), done(true) {}
+  void begin(FillHistory& history, uint32_t from, uint32_t to, uint32_t resolution);
+  // False once the range is exhausted
+  bool next(HistoryPoint& point);
+
+private:
+  bool nextSample(HistorySample& sample);
+  bool loadBlock();
+
+  FillHistory* history;
+  uint32_t rangeFrom;
+  uint32_t rangeTo;
+  uint32_t bucketS;
+  uint32_t sequence;         // Block in `block`
+  uint8_t block[FillHistory::BLOCK_SIZE];
+  size_t used;               // 0: no block loaded
+  size_t pos;                // 0: header sample not yet returned
+  bool tail;                 // Block was still open when loaded
+  HistorySample sample;      // Decoder state
+  HistorySample pending;     // Read but belongs to the next bucket
+  bool held;
+  bool done;
+};
+
+#endif
@@ -0,0 +1,428 @@
+#include "FirmwareUpdate.h"
+#include <Arduino.h>
+#include <HTTPClient.h>
+#include <ESPAsyncWebServer.h>
+#include <esp_image_format.h>
+#include <mbedtls/md.h>
+
+FirmwareUpdate::FirmwareUpdate(const char* key)
+    : otaKey(key ? key : ""), otaState(OTA_IDLE), otaError(OTA_ERR_NONE), running(nullptr), target(nullptr), handle(0),
+      patcher(*this, *this), flashOpen(false), formatKnown(false), isDelta(false), hasExpected(false),
+      receivedBytes(0), writtenBytes(0), totalBytes(0), startedMs(0), finishedMs(0) {
+  pullUrl[0] = '\0';
+}
+
+const char* FirmwareUpdate::stateName(OtaState s) {
+  switch (s) {
+    case OTA_IDLE: return "idle";
+    case OTA_RECEIVING: return "receiving";
+    case OTA_READY: return "ready";
+    case OTA_FAILED: return "failed";
+  }
+  return "unknown";
+}
+
+const char* FirmwareUpdate::errorName(OtaError e) {
+  switch (e) {
+    case OTA_ERR_NONE: return "none";
+    case OTA_ERR_BUSY: return "busy";
+    case OTA_ERR_NO_PARTITION: return "no_partition";
+    case OTA_ERR_FORMAT: return "format";
+    case OTA_ERR_SOURCE: return "source_mismatch";
+    case OTA_ERR_PATCH: return "patch";
+    case OTA_ERR_TOO_LARGE: return "too_large";
+    case OTA_ERR_FLASH: return "flash";
+    case OTA_ERR_HASH: return "hash_mismatch";
+    case OTA_ERR_IMAGE: return "image_invalid";
+    case OTA_ERR_DOWNLOAD: return "download";
+    case OTA_ERR_SIGNATURE: return "signature";
+  }
+  return "unknown";
+}
+
+bool FirmwareUpdate::parseSha256(const char* hex, uint8_t out[32]) {
+  for (uint8_t i = 0; i < 64; i++) {
+    char c = hex[i];
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return false;   // Also catches a short string
+    }
+    out[i / 2] = (i & 1) ? (out[i / 2] | nibble) : (uint8_t)(nibble << 4);
+  }
+  return hex[64] == '\0';
+}
+
+// ==================== SESSION ====================
+bool FirmwareUpdate::start(const uint8_t* expectedSha256, const uint8_t* imageSignature) {
+  if (!enabled() || otaState == OTA_RECEIVING || otaState == OTA_READY) {
+    return false;
+  }
+  memcpy(signature, imageSignature, sizeof(signature));
+  otaError = OTA_ERR_NONE;
+  formatKnown = false;
+  isDelta = false;
+  receivedBytes = 0;
+  writtenBytes = 0;
+  totalBytes = 0;
+  startedMs = millis();
+  finishedMs = startedMs;
+  hasExpected = expectedSha256 != nullptr;
+  if (hasExpected) {
+    memcpy(expected, expectedSha256, sizeof(expected));
+  }
+  patcher.reset();
+  otaState = OTA_RECEIVING;
+  
+  running = esp_ota_get_running_partition();
+  target = esp_ota_get_next_update_partition(nullptr);
+  if (running == nullptr || target == nullptr) {
+    abort(OTA_ERR_NO_PARTITION);
+    return false;
+  }
+  // Sectors are erased as the writes reach them rather than all up front,
+  // so no single call stalls the web server for seconds
+  if (esp_ota_begin(target, OTA_WITH_SEQUENTIAL_WRITES, &handle) != ESP_OK) {
+    abort(OTA_ERR_FLASH);
+    return false;
+  }
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+  flashOpen = true;
+  return true;
+}
+
+bool FirmwareUpdate::feed(const uint8_t* data, size_t len) {
+  if (otaState != OTA_RECEIVING) {
+    return false;
+  }
+  if (len == 0) {
+    return true;
+  }
+  receivedBytes += len;
+  if (!formatKnown) {
+    formatKnown = true;
+    if (data[0] == ESP_IMAGE_HEADER_MAGIC) {
+      isDelta = false;
+    } else if (data[0] == (DELTA_PATCH_MAGIC & 0xFF)) {
+      isDelta = true;
+    } else {
+      abort(OTA_ERR_FORMAT);
+      return false;
+    }
+  }
+  
+  if (!isDelta) {
+    return writeFlash(data, len);
+  }
+  if (!patcher.feed(data, len)) {
+    // The sink has already failed the session for a source, size or
+    // flash problem; anything else is a malformed patch
+    if (otaState == OTA_RECEIVING) {
+      abort(OTA_ERR_PATCH);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool FirmwareUpdate::finish() {
+  if (otaState != OTA_RECEIVING) {
+    return false;
+  }
+  if (!formatKnown) {
+    abort(OTA_ERR_FORMAT);
+    return false;
+  }
+  if (isDelta && !patcher.finish()) {
+    abort(OTA_ERR_PATCH);
+    return false;
+  }
+  
+  uint8_t digest[32];
+  mbedtls_sha256_finish_ret(&sha, digest);
+  if (hasExpected && memcmp(digest, expected, sizeof(digest)) != 0) {
+    abort(OTA_ERR_HASH);
+    return false;
+  }
+  if (!signatureMatches(digest)) {
+    abort(OTA_ERR_SIGNATURE);
+    return false;
+  }
+  mbedtls_sha256_free(&sha);
+  flashOpen = false;
+  
+  // Also checks the image's own checksum and appended hash
+  esp_err_t err = esp_ota_end(handle);
+  if (err != ESP_OK) {
+    abort(err == ESP_ERR_OTA_VALIDATE_FAILED ? OTA_ERR_IMAGE : OTA_ERR_FLASH);
+    return false;
+  }
+  if (esp_ota_set_boot_partition(target) != ESP_OK) {
+    abort(OTA_ERR_FLASH);
+    return false;
+  }
+  otaState = OTA_READY;
+  finishedMs = millis();
+  Serial.printf("OTA: %s of %u bytes verified, booting %s next\n",
+                isDelta ? "patch" : "image", (unsigned)writtenBytes, target->label);
+  return true;
+}
+
+void FirmwareUpdate::abort(OtaError e) {
+  if (flashOpen) {
+    esp_ota_abort(handle);
+    mbedtls_sha256_free(&sha);
+    flashOpen = false;
+  }
+  otaState = OTA_FAILED;
+  otaError = e;
+  finishedMs = millis();
+  Serial.printf("OTA: failed (%s) after %u bytes\n", errorName(e), (unsigned)receivedBytes);
+}
+
+bool FirmwareUpdate::writeFlash(const uint8_t* data, size_t len) {
+  if (writtenBytes + len > target->size) {
+    abort(OTA_ERR_TOO_LARGE);
+    return false;
+  }
+  if (esp_ota_write(handle, data, len) != ESP_OK) {
+    abort(OTA_ERR_FLASH);
+    return false;
+  }
+  mbedtls_sha256_update_ret(&sha, data, len);
+  writtenBytes += len;
+  return true;
+}
+
+// Constant time, so the reply time says nothing about how close a guess was
+bool FirmwareUpdate::signatureMatches(const uint8_t* sha256) {
+  uint8_t mac[SIGNATURE_SIZE];
+  if (mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t*)otaKey, strlen(otaKey),
+                      sha256, 32, mac) != 0) {
+    return false;
+  }
+  uint8_t diff = 0;
+  for (size_t i = 0; i < sizeof(mac); i++) {
+    diff |= mac[i] ^ signature[i];
+  }
+  return diff == 0;
+}
+
+// ==================== DELTA ====================
+bool FirmwareUpdate::read(uint32_t offset, uint8_t* buf, size_t len) {
+  return esp_partition_read(running, offset, buf, len) == ESP_OK;
+}
+
+bool FirmwareUpdate::begin(const DeltaPatchHeader& header) {
+  if (header.sourceSize > running->size || !runningImageMatches(header.sourceSize, header.sourceSha256)) {
+    abort(OTA_ERR_SOURCE);
+    return false;
+  }
+  if (header.targetSize > target->size) {
+    abort(OTA_ERR_TOO_LARGE);
+    return false;
+  }
+  if (hasExpected && memcmp(expected, header.targetSha256, sizeof(expected)) != 0) {
+    abort(OTA_ERR_HASH);
+    return false;
+  }
+  memcpy(expected, header.targetSha256, sizeof(expected));
+  hasExpected = true;
+  totalBytes = header.targetSize;
+  return true;
+}
+
+bool FirmwareUpdate::write(const uint8_t* data, size_t len) {
+  return writeFlash(data, len);
+}
+
+bool FirmwareUpdate::runningImageMatches(uint32_t size, const uint8_t* sha256) {
+  uint8_t buf[512];
+  uint8_t digest[32];
+  mbedtls_sha256_context ctx;
+  mbedtls_sha256_init(&ctx);
+  mbedtls_sha256_starts_ret(&ctx, 0);
+  bool ok = true;
+  for (uint32_t offset = 0; ok && offset < size; offset += sizeof(buf)) {
+    size_t n = size - offset < sizeof(buf) ? size - offset : sizeof(buf);
+    ok = esp_partition_read(running, offset, buf, n) == ESP_OK;
+    mbedtls_sha256_update_ret(&ctx, buf, n);
+  }
+  mbedtls_sha256_finish_ret(&ctx, digest);
+  mbedtls_sha256_free(&ctx);
+  return ok && memcmp(digest, sha256, sizeof(digest)) == 0;
+}
+
+// ==================== PULL ====================
+bool FirmwareUpdate::pull(const char* url, const uint8_t* expectedSha256, const uint8_t* imageSignature) {
+  if (strlen(url) >= sizeof(pullUrl) || !start(expectedSha256, imageSignature)) {
+    return false;
+  }
+  strcpy(pullUrl, url);
+  // Same priority as loop(), which sleeps between passes, so the control
+  // loop keeps its rate while the download fills the gaps
+  if (xTaskCreate(pullTask, "ota_pull", 8192, this, 1, nullptr) != pdPASS) {
+    abort(OTA_ERR_DOWNLOAD);
+    return false;
+  }
+  return true;
+}
+
+void FirmwareUpdate::pullTask(void* arg) {
+  FirmwareUpdate* self = (FirmwareUpdate*)arg;
+  HTTPClient http;
+  http.useHTTP10(true);   // No chunked encoding, the stream is the body
+  http.setTimeout(PULL_STALL_MS);
+  
+  int code = http.begin(self->pullUrl) ? http.GET() : -1;
+  if (code != 200) {
+    Serial.printf("OTA: GET %s returned %d\n", self->pullUrl, code);
+    self->abort(OTA_ERR_DOWNLOAD);
+  } else {
+    int size = http.getSize();   // -1 without Content-Length: read to close
+    if (size > 0) {
+      self->totalBytes = size;   // A patch replaces this with the image size
+    }
+    WiFiClient* stream = http.getStreamPtr();
+    uint8_t buf[1024];
+    uint32_t lastDataMs = millis();
+    while (self->otaState == OTA_RECEIVING) {
+      size_t avail = stream->available();
+      if (avail > 0) {
+        size_t n = stream->readBytes(buf, avail < sizeof(buf) ? avail : sizeof(buf));
+        self->feed(buf, n);
+        lastDataMs = millis();
+      } else if ((size > 0 && self->receivedBytes >= (uint32_t)size) || !stream->connected()) {
+        break;
+      } else if (millis() - lastDataMs > PULL_STALL_MS) {
+        self->abort(OTA_ERR_DOWNLOAD);
+      } else {
+        vTaskDelay(pdMS_TO_TICKS(5));
+      }
+    }
+    if (self->otaState == OTA_RECEIVING) {
+      if (size > 0 && self->receivedBytes != (uint32_t)size) {
+        self->abort(OTA_ERR_DOWNLOAD);   // Connection dropped early
+      } else {
+        self->finish();
+      }
+    }
+  }
+  http.end();
+  vTaskDelete(nullptr);
+}
+
+// ==================== ROUTES ====================
+static AsyncWebServerRequest* otaUploader = nullptr;   // Request feeding the session
+
+static void sendOtaError(AsyncWebServerRequest* request, int code, const char* message) {
+  char body[96];
+  snprintf(body, sizeof(body), "{\"status\":\"error\",\"message\":\"%s\"}", message);
+  request->send(code, "application/json", body);
+}
+
+void addOtaRoutes(AsyncWebServer& server, FirmwareUpdate& update) {
+  FirmwareUpdate* u = &update;
+  
+  server.on("/api/ota", HTTP_GET, [u](AsyncWebServerRequest *request){
+    const esp_partition_t* running = esp_ota_get_running_partition();
+    char body[224];
+    snprintf(body, sizeof(body),
+             "{\"state\":\"%s\",\"error\":\"%s\",\"delta\":%s,\"received\":%u,\"written\":%u,"
+             "\"size\":%u,\"ms\":%u,\"running\":\"%s\"}",
+             FirmwareUpdate::stateName(u->state()), FirmwareUpdate::errorName(u->error()),
+             u->delta() ? "true" : "false", (unsigned)u->received(), (unsigned)u->written(),
+             (unsigned)u->expectedSize(), (unsigned)u->durationMs(), running ? running->label : "");
+    request->send(200, "application/json", body);
+  });
+  
+  // Runs in the web server task: each chunk goes to flash as it arrives
+  server.on("/api/ota", HTTP_POST,
+    [u](AsyncWebServerRequest *request){
+      if (otaUploader != request) {
+        uint8_t sha[32];
+        uint8_t sig[FirmwareUpdate::SIGNATURE_SIZE];
+        if (!u->enabled()) {
+          sendOtaError(request, 403, "Updates disabled: no OTA key");
+        } else if (!request->hasParam("signature") || !FirmwareUpdate::parseSha256(request->getParam("signature")->value().c_str(), sig)) {
+          sendOtaError(request, 401, "Missing or invalid signature parameter");
+        } else if (request->hasParam("sha256") && !FirmwareUpdate::parseSha256(request->getParam("sha256")->value().c_str(), sha)) {
+          sendOtaError(request, 400, "Invalid sha256 parameter");
+        } else {
+          sendOtaError(request, 409, u->state() == OTA_FAILED ? FirmwareUpdate::errorName(u->error()) : "busy");
+        }
+        return;
+      }
+      otaUploader = nullptr;
+      if (u->state() != OTA_READY) {
+        sendOtaError(request, 422, FirmwareUpdate::errorName(u->error()));
+        return;
+      }
+      request->send(200, "application/json", "{\"status\":\"ok\",\"rebooting\":true}");
+    },
+    [u](AsyncWebServerRequest *request, const String& filename, size_t index, uint8_t* data, size_t len, bool final){
+      if (index == 0) {
+        uint8_t sha[32];
+        uint8_t sig[FirmwareUpdate::SIGNATURE_SIZE];
+        bool hasSha = request->hasParam("sha256");
+        if (hasSha && !FirmwareUpdate::parseSha256(request->getParam("sha256")->value().c_str(), sha)) {
+          return;
+        }
+        if (!request->hasParam("signature") || !FirmwareUpdate::parseSha256(request->getParam("signature")->value().c_str(), sig)) {
+          return;
+        }
+        if (otaUploader == nullptr && u->start(hasSha ? sha : nullptr, sig)) {
+          otaUploader = request;
+          request->onDisconnect([u, request]{
+            if (otaUploader == request) {   // Client went away mid-upload
+              otaUploader = nullptr;
+              if (u->state() == OTA_RECEIVING) {
+                u->abort(OTA_ERR_DOWNLOAD);
+              }
+            }
+          });
+        }
+      }
+      if (otaUploader != request) {
+        return;
+      }
+      u->feed(data, len);   // Failures are reported once the body is in
+      if (final) {
+        u->finish();
+      }
+    });
+  
+  // The bin fetches the file itself, e.g. from `python -m http.server`
+  server.on("/api/ota/pull", HTTP_POST, [u](AsyncWebServerRequest *request){
+    if (!u->enabled()) {
+      sendOtaError(request, 403, "Updates disabled: no OTA key");
+      return;
+    }
+    if (!request->hasParam("url", true)) {
+      sendOtaError(request, 400, "Missing url parameter");
+      return;
+    }
+    uint8_t sig[FirmwareUpdate::SIGNATURE_SIZE];
+    if (!request->hasParam("signature", true) || !FirmwareUpdate::parseSha256(request->getParam("signature", true)->value().c_str(), sig)) {
+      sendOtaError(request, 401, "Missing or invalid signature parameter");
+      return;
+    }
+    uint8_t sha[32];
+    bool hasSha = request->hasParam("sha256", true);
+    if (hasSha && !FirmwareUpdate::parseSha256(request->getParam("sha256", true)->value().c_str(), sha)) {
+      sendOtaError(request, 400, "Invalid sha256 parameter");
+      return;
+    }
+    if (otaUploader != nullptr || !u->pull(request->getParam("url", true)->value().c_str(), hasSha ? sha : nullptr, sig)) {
+      sendOtaError(request, 409, u->state() == OTA_FAILED ? FirmwareUpdate::errorName(u->error()) : "busy");
+      return;
+    }
+    request->send(202, "application/json", "{\"status\":\"started\"}");
+  });
+}
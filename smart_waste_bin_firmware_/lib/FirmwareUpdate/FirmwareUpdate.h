@@ -0,0 +1,132 @@
+#ifndef FIRMWARE_UPDATE_H
+#define FIRMWARE_UPDATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_ota_ops.h>
+#include <mbedtls/sha256.h>
+#include <DeltaPatch.h>
+
+class AsyncWebServer;
+
+// Over-the-air updates shared by the controller and camera firmwares.
+// ESP32 only; the host tools never link it.
+//
+// The update is written into the inactive OTA partition as it arrives,
+// either pushed to POST /api/ota or pulled by a background task from a URL.
+// It is a full image (starts with the ESP image magic) or a DeltaPatch
+// against the running image; patches are rebuilt on the fly from the
+// running partition. The written image must hash to the expected SHA-256
+// before it is made the boot partition. The bin keeps running throughout
+// and the caller reboots when it is safe to.
+//
+// Every update carries a signature: HMAC-SHA256, keyed with the site's OTA
+// key, of the SHA-256 of the image that ends up in flash (the rebuilt
+// image for a patch). `tools/ota_delta.py sign` makes it. Nothing is made
+// bootable without a matching signature, and a bin built with an empty key
+// refuses all updates.
+
+enum OtaState {
+  OTA_IDLE,
+  OTA_RECEIVING,
+  OTA_READY,       // Verified and set to boot; waiting for the reboot
+  OTA_FAILED
+};
+
+enum OtaError {
+  OTA_ERR_NONE,
+  OTA_ERR_BUSY,
+  OTA_ERR_NO_PARTITION,
+  OTA_ERR_FORMAT,        // Neither an image nor a patch
+  OTA_ERR_SOURCE,        // Patch made against a different image
+  OTA_ERR_PATCH,
+  OTA_ERR_TOO_LARGE,
+  OTA_ERR_FLASH,
+  OTA_ERR_HASH,
+  OTA_ERR_IMAGE,         // Rejected by the bootloader's image check
+  OTA_ERR_DOWNLOAD,
+  OTA_ERR_SIGNATURE      // Not signed with this site's key
+};
+
+class FirmwareUpdate : private DeltaSource, private DeltaSink {
+public:
+  static const uint32_t REBOOT_DELAY_MS = 2000;   // Lets the last response go out
+  static const uint32_t PULL_STALL_MS = 15000;
+
+  static const size_t SIGNATURE_SIZE = 32;
+
+  // `key` must outlive the object; empty disables updates
+  explicit FirmwareUpdate(const char* key);
+  bool enabled() const { return otaKey[0] != '\0'; }
+
+  // `expectedSha256` (32 bytes) may be null for a patch, which carries the
+  // target hash, or for an image, which the bootloader check covers.
+  // Call from the web server task. False if updates are disabled, or an
+  // update is running or waiting for its reboot.
+  bool start(const uint8_t* expectedSha256, const uint8_t* signature);
+  bool feed(const uint8_t* data, size_t len);
+  bool finish();
+  void abort(OtaError e);
+
+  // Downloads `url` in a background task; false if an update is running
+  // or waiting for its reboot
+  bool pull(const char* url, const uint8_t* expectedSha256, const uint8_t* signature);
+
+  OtaState state() const { return otaState; }
+  OtaError error() const { return otaError; }
+  static const char* stateName(OtaState s);
+  static const char* errorName(OtaError e);
+  bool delta() const { return isDelta; }
+  uint32_t received() const { return receivedBytes; }
+  uint32_t written() const { return writtenBytes; }
+  uint32_t expectedSize() const { return totalBytes; }   // 0 if not known yet
+  uint32_t durationMs() const { return finishedMs - startedMs; }
+
+  // True once a verified update has waited REBOOT_DELAY_MS
+  bool rebootDue(uint32_t nowMs) const { return otaState == OTA_READY && nowMs - finishedMs >= REBOOT_DELAY_MS; }
+
+  // Hex parser for the sha256 and signature parameters; false unless 64
+  // hex digits
+  static bool parseSha256(const char* hex, uint8_t out[32]);
+
+private:
+  // DeltaSource: the running image
+  bool read(uint32_t offset, uint8_t* buf, size_t len) override;
+  // DeltaSink: the inactive partition
+  bool begin(const DeltaPatchHeader& header) override;
+  bool write(const uint8_t* data, size_t len) override;
+
+  bool writeFlash(const uint8_t* data, size_t len);
+  bool runningImageMatches(uint32_t size, const uint8_t* sha256);
+  bool signatureMatches(const uint8_t* sha256);
+  static void pullTask(void* arg);
+
+  const char* otaKey;
+  uint8_t signature[SIGNATURE_SIZE];
+  OtaState otaState;
+  OtaError otaError;
+  const esp_partition_t* running;
+  const esp_partition_t* target;
+  esp_ota_handle_t handle;
+  mbedtls_sha256_context sha;
+  DeltaPatcher patcher;
+  bool flashOpen;        // OTA handle and hash context live
+  bool formatKnown;      // First byte seen
+  bool isDelta;
+  bool hasExpected;
+  uint8_t expected[32];
+  uint32_t receivedBytes;
+  uint32_t writtenBytes;
+  uint32_t totalBytes;
+  uint32_t startedMs;
+  uint32_t finishedMs;
+  char pullUrl[160];
+};
+
+// POST /api/ota        multipart upload of an image or patch
+//                      (?signature=<hex>[&sha256=<hex>])
+// POST /api/ota/pull   url=<http url>&signature=<hex>[&sha256=<hex>]
+// GET  /api/ota        progress
+void addOtaRoutes(AsyncWebServer& server, FirmwareUpdate& update);
+
+#endif
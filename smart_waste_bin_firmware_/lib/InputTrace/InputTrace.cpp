@@ -0,0 +1,174 @@
+#include "InputTrace.h"
+#include <string.h>
+
+static uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// ==================== WRITER ====================
+void InputTraceWriter::begin(uint8_t* buffer, size_t bufferCapacity, uint32_t nowMs) {
+  buf = buffer;
+  capacity = bufferCapacity;
+  used = 0;
+  lastMs = nowMs;
+  droppedRecords = 0;
+  for (uint8_t i = 0; i < INPUT_TYPE_COUNT; i++) {
+    haveValue[i] = false;
+  }
+
+  memcpy(buf, &INPUT_TRACE_MAGIC, 4); // Little-endian target
+  buf[4] = INPUT_TRACE_VERSION;
+  buf[5] = 0;
+  used = INPUT_TRACE_HEADER_SIZE;
+  active = true;
+}
+
+void InputTraceWriter::putVarint(uint32_t v) {
+  while (v >= 0x80) {
+    buf[used++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  buf[used++] = (uint8_t)v;
+}
+
+bool InputTraceWriter::put(uint32_t nowMs, uint8_t type, int32_t value, size_t extra) {
+  // Worst case: two 5-byte varints, the type byte and the payload
+  if (remaining() < 11 + extra) {
+    droppedRecords++;
+    return false;
+  }
+  putVarint(nowMs - lastMs);
+  buf[used++] = type;
+  putVarint(zigzag(value));
+  lastMs = nowMs;
+  return true;
+}
+
+void InputTraceWriter::level(uint32_t nowMs, InputType type, int32_t value) {
+  if (!active || (haveValue[type] && lastValue[type] == value)) {
+    return;
+  }
+  if (put(nowMs, type, value, 0)) {
+    lastValue[type] = value;
+    haveValue[type] = true;
+  }
+}
+
+void InputTraceWriter::can(uint32_t nowMs, const CanMessage& msg) {
+  if (!active) {
+    return;
+  }
+  uint8_t length = msg.length > CAN_PAYLOAD_MAX ? CAN_PAYLOAD_MAX : msg.length;
+  if (put(nowMs, INPUT_CAN_RX, (int32_t)msg.id, 1 + length)) {
+    buf[used++] = length;
+    memcpy(buf + used, msg.data, length);
+    used += length;
+  }
+}
+
+void InputTraceWriter::command(uint32_t nowMs, ManualCommand command) {
+  if (active) {
+    put(nowMs, INPUT_COMMAND, command, 0);
+  }
+}
+
+// ==================== READER ====================
+bool InputTraceReader::begin(const uint8_t* data, size_t length) {
+  buf = data;
+  len = length;
+  pos = INPUT_TRACE_HEADER_SIZE;
+  timeMs = 0;
+  uint32_t magic;
+  if (length < INPUT_TRACE_HEADER_SIZE) {
+    return false;
+  }
+  memcpy(&magic, data, 4);
+  return magic == INPUT_TRACE_MAGIC && data[4] == INPUT_TRACE_VERSION;
+}
+
+bool InputTraceReader::getVarint(uint32_t& v) {
+  v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (pos >= len) {
+      return false;
+    }
+    uint8_t b = buf[pos++];
+    v |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool InputTraceReader::next(InputEvent& event) {
+  uint32_t dt, raw;
+  if (!getVarint(dt) || pos >= len) {
+    return false;
+  }
+  event.type = buf[pos++];
+  if (!getVarint(raw)) {
+    return false;
+  }
+  timeMs += dt;
+  event.timeMs = timeMs;
+  event.value = unzigzag(raw);
+  event.length = 0;
+  if (event.type == INPUT_CAN_RX) {
+    if (pos >= len) {
+      return false;
+    }
+    event.length = buf[pos++];
+    if (event.length > CAN_PAYLOAD_MAX || pos + event.length > len) {
+      return false;
+    }
+    memcpy(event.payload, buf + pos, event.length);
+    pos += event.length;
+  }
+  return true;
+}
+
+// ==================== RECORDING HARDWARE ====================
+bool RecordingHardware::motion() {
+  bool v = hw.motion();
+  out.level(hw.millis(), INPUT_PIR, v);
+  return v;
+}
+
+bool RecordingHardware::keypadPressed(uint8_t button) {
+  bool v = hw.keypadPressed(button);
+  out.level(hw.millis(), button == 0 ? INPUT_KEYPAD_1 : INPUT_KEYPAD_2, v);
+  return v;
+}
+
+int32_t RecordingHardware::distanceMm() {
+  int32_t v = hw.distanceMm();
+  out.level(hw.millis(), INPUT_DISTANCE, v);
+  return v;
+}
+
+int32_t RecordingHardware::massGrams() {
+  int32_t v = hw.massGrams();
+  out.level(hw.millis(), INPUT_MASS, v);
+  return v;
+}
+
+bool RecordingHardware::receiveCan(CanMessage& msg) {
+  if (!hw.receiveCan(msg)) {
+    return false;
+  }
+  out.can(hw.millis(), msg);
+  return true;
+}
+
+bool RecordingHardware::receiveCommand(ManualCommand& command) {
+  if (!hw.receiveCommand(command)) {
+    return false;
+  }
+  out.command(hw.millis(), command);
+  return true;
+}
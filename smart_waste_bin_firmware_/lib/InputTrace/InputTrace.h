@@ -0,0 +1,124 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <BinController.h>
+
+// Record and replay of the controller's inputs.
+//
+// A trace is a 6-byte header followed by records:
+//   varint  milliseconds since the previous record
+//   uint8   input type
+//   varint  zigzag-encoded value
+//   (CAN only) uint8 length, then the payload bytes
+// Levels (PIR, keypad, distance, mass) are only written when they change,
+// so an idle bin costs almost nothing; CAN frames and manual commands are
+// written every time. The same encoding is read back by
+// InputTraceReader on the device or on a host.
+
+static const uint32_t INPUT_TRACE_MAGIC = 0x4e494253; // "SBIN"
+static const uint8_t INPUT_TRACE_VERSION = 1;
+static const size_t INPUT_TRACE_HEADER_SIZE = 6;
+
+enum InputType {
+  INPUT_PIR,
+  INPUT_KEYPAD_1,
+  INPUT_KEYPAD_2,
+  INPUT_DISTANCE,   // mm, FillEstimator::INVALID if no echo
+  INPUT_MASS,       // grams, FillEstimator::INVALID if not ready
+  INPUT_CAN_RX,     // value = CAN id
+  INPUT_COMMAND,    // value = ManualCommand
+  INPUT_TYPE_COUNT
+};
+
+struct InputEvent {
+  uint32_t timeMs;   // Relative to the start of the trace
+  uint8_t type;
+  int32_t value;
+  uint8_t length;    // CAN payload length
+  uint8_t payload[CAN_PAYLOAD_MAX];
+};
+
+class InputTraceWriter {
+public:
+  InputTraceWriter() : buf(nullptr), capacity(0), used(0), active(false) {}
+
+  // Starts a new trace in `buffer`, writing the header.
+  void begin(uint8_t* buffer, size_t bufferCapacity, uint32_t nowMs);
+  void stop() { active = false; }
+  bool recording() const { return active; }
+
+  // Records a level; ignored if it has not changed since the last record.
+  void level(uint32_t nowMs, InputType type, int32_t value);
+  void can(uint32_t nowMs, const CanMessage& msg);
+  void command(uint32_t nowMs, ManualCommand command);
+
+  // Bytes written since begin() or the last drain().
+  const uint8_t* data() const { return buf; }
+  size_t size() const { return used; }
+  size_t remaining() const { return capacity - used; }
+
+  // Forgets the buffered bytes (after they were flushed elsewhere); the
+  // trace continues where it left off.
+  void drain() { used = 0; }
+
+  uint32_t dropped() const { return droppedRecords; }
+
+private:
+  bool put(uint32_t nowMs, uint8_t type, int32_t value, size_t extra);
+  void putVarint(uint32_t v);
+
+  uint8_t* buf;
+  size_t capacity;
+  size_t used;
+  bool active;
+  uint32_t lastMs;
+  int32_t lastValue[INPUT_TYPE_COUNT];
+  bool haveValue[INPUT_TYPE_COUNT];
+  uint32_t droppedRecords;
+};
+
+class InputTraceReader {
+public:
+  // Returns false if `data` does not start with a valid header.
+  bool begin(const uint8_t* data, size_t length);
+
+  // Decodes the next record; false at the end or on a truncated record.
+  bool next(InputEvent& event);
+
+private:
+  bool getVarint(uint32_t& v);
+
+  const uint8_t* buf;
+  size_t len;
+  size_t pos;
+  uint32_t timeMs;
+};
+
+// BinHardware decorator that records every input the controller reads
+// while the writer is active.
+class RecordingHardware : public BinHardware {
+public:
+  RecordingHardware(BinHardware& inner, InputTraceWriter& writer) : hw(inner), out(writer) {}
+
+  uint32_t millis() override { return hw.millis(); }
+  bool motion() override;
+  bool keypadPressed(uint8_t button) override;
+  int32_t distanceMm() override;
+  int32_t massGrams() override;
+  bool receiveCan(CanMessage& msg) override;
+  bool receiveCommand(ManualCommand& command) override;
+
+  void setLid(uint8_t bin, bool open) override { hw.setLid(bin, open); }
+  void sendCan(const CanMessage& msg) override { hw.sendCan(msg); }
+  void playTone(TonePattern tone) override { hw.playTone(tone); }
+  void uploadBinData() override { hw.uploadBinData(); }
+  void trace(uint8_t event, uint8_t a, uint16_t b) override { hw.trace(event, a, b); }
+
+private:
+  BinHardware& hw;
+  InputTraceWriter& out;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "LatencyTrace.h"
+
+// ==================== CLOCK SYNC ====================
+void ClockSync::onSync(uint8_t seq, uint64_t localUs) {
+  pending = true;
+  pendingSeq = seq;
+  pendingLocalUs = localUs;
+}
+
+bool ClockSync::onFollowUp(uint8_t seq, uint64_t masterUs) {
+  if (!pending || seq != pendingSeq) {
+    return false;   // SYNC lost or out of order
+  }
+  pending = false;
+  samples[next] = (int64_t)(pendingLocalUs - masterUs);
+  next = (next + 1) % WINDOW;
+  if (count < WINDOW) {
+    count++;
+  }
+  offset = samples[0];
+  for (uint8_t i = 1; i < count; i++) {
+    if (samples[i] < offset) {
+      offset = samples[i];
+    }
+  }
+  lastSampleUs = pendingLocalUs;
+  rounds++;
+  return true;
+}
+
+// ==================== DETECTION LATENCY ====================
+struct SegmentSpec {
+  const char* name;
+  DetectStage from;
+  DetectStage to;
+};
+
+static const SegmentSpec SEGMENTS[SEGMENT_COUNT] = {
+  { "pir_to_request", STAGE_PIR, STAGE_REQUEST_TX },
+  { "request_to_capture", STAGE_REQUEST_TX, STAGE_CAPTURE_START },
+  { "capture", STAGE_CAPTURE_START, STAGE_CAPTURE_END },
+  { "capture_to_upload", STAGE_CAPTURE_END, STAGE_UPLOAD_START },
+  { "upload", STAGE_UPLOAD_START, STAGE_UPLOAD_END },
+  { "upload_to_result", STAGE_UPLOAD_END, STAGE_RESULT_TX },
+  { "result_to_rx", STAGE_RESULT_TX, STAGE_RESULT_RX },
+  { "rx_to_lid", STAGE_RESULT_RX, STAGE_LID_OPEN },
+  { "detection", STAGE_REQUEST_TX, STAGE_RESULT_RX },
+  { "end_to_end", STAGE_PIR, STAGE_LID_OPEN },
+};
+
+const char* DetectionLatency::segmentName(uint8_t s) {
+  return s < SEGMENT_COUNT ? SEGMENTS[s].name : "unknown";
+}
+
+void DetectionLatency::motion(uint32_t us) {
+  if (open) {
+    finish();
+  }
+  open = true;
+  traceId = 0;
+  seen = 0;
+  cameraClock = 0;
+  mark(STAGE_PIR, us);
+}
+
+void DetectionLatency::requestSent(uint16_t id, uint32_t us) {
+  if (open) {
+    traceId = id;
+    mark(STAGE_REQUEST_TX, us);
+  }
+}
+
+void DetectionLatency::mark(DetectStage stage, uint32_t us) {
+  if (open && stage < STAGE_COUNT) {
+    times[stage] = us;
+    seen |= 1 << stage;
+  }
+}
+
+void DetectionLatency::lidOpened(uint32_t us) {
+  if (open) {
+    mark(STAGE_LID_OPEN, us);
+    finish();
+  }
+}
+
+void DetectionLatency::remoteStage(uint16_t id, DetectStage stage, uint32_t us, bool synced) {
+  if (!open || id == 0 || id != traceId) {
+    staleCount++;
+    return;
+  }
+  if (!synced) {
+    unsyncedCount++;
+    cameraClock |= 1 << stage;
+  }
+  mark(stage, us);
+}
+
+void DetectionLatency::finish() {
+  open = false;
+  for (uint8_t s = 0; s < SEGMENT_COUNT; s++) {
+    uint16_t from = 1 << SEGMENTS[s].from;
+    uint16_t to = 1 << SEGMENTS[s].to;
+    // Both ends seen and stamped by the same clock
+    if (!(seen & from) || !(seen & to) || !(cameraClock & from) != !(cameraClock & to)) {
+      continue;
+    }
+    // A negative span means the offset estimate is off by more than the
+    // segment; drop it rather than record a 71 minute wrap
+    int32_t span = (int32_t)(times[SEGMENTS[s].to] - times[SEGMENTS[s].from]);
+    if (span >= 0) {
+      histograms[s].record(span);
+    }
+  }
+  if (seen == (1 << STAGE_COUNT) - 1 && cameraClock == 0) {
+    completeCount++;
+  } else {
+    partialCount++;
+  }
+}
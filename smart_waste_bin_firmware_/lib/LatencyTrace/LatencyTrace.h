@@ -0,0 +1,107 @@
+#ifndef LATENCY_TRACE_H
+#define LATENCY_TRACE_H
+
+#include <stdint.h>
+#include <BinProtocol.h>
+#include <Metrics.h>
+
+// Detection latency across the controller and the camera.
+//
+// The controller is the bus time master. ClockSync runs on the camera and
+// maps its microsecond clock onto the controller's, so the camera can
+// timestamp its stages in a timebase the controller understands.
+// DetectionLatency runs on the controller and stitches its own stages and
+// the camera's reports into one record per detection, keyed by the trace
+// id carried in the request.
+
+// ==================== CLOCK SYNC ====================
+// Each SYNC/FOLLOW_UP pair gives offset + delay, where delay is the time
+// between the controller sending SYNC and the camera reading it. Delay is
+// never negative and mostly polling jitter, so the smallest of the last few
+// samples is the best estimate of the offset. The window is short enough
+// that crystal drift stays well under a millisecond.
+class ClockSync {
+public:
+  static const uint8_t WINDOW = 8;
+  static const uint32_t STALE_US = 5000000;   // Unsynced after 5 missed rounds
+
+  ClockSync() : pending(false), pendingSeq(0), pendingLocalUs(0), count(0), next(0),
+                offset(0), lastSampleUs(0), rounds(0) {}
+
+  // Local time at which SYNC `seq` was read
+  void onSync(uint8_t seq, uint64_t localUs);
+  // Master time at which SYNC `seq` was sent; true if it completed a round
+  bool onFollowUp(uint8_t seq, uint64_t masterUs);
+
+  bool synced(uint64_t localUs) const { return count > 0 && localUs - lastSampleUs < STALE_US; }
+  uint64_t toMaster(uint64_t localUs) const { return localUs - offset; }
+  int64_t offsetUs() const { return offset; }
+  uint32_t completedRounds() const { return rounds; }
+
+private:
+  bool pending;
+  uint8_t pendingSeq;
+  uint64_t pendingLocalUs;
+  int64_t samples[WINDOW];
+  uint8_t count;
+  uint8_t next;
+  int64_t offset;
+  uint64_t lastSampleUs;
+  uint32_t rounds;
+};
+
+// ==================== DETECTION LATENCY ====================
+enum LatencySegment {
+  SEGMENT_PIR_TO_REQUEST,       // Controller reacting to the PIR
+  SEGMENT_REQUEST_TO_CAPTURE,   // Bus + camera loop pickup
+  SEGMENT_CAPTURE,
+  SEGMENT_CAPTURE_TO_UPLOAD,
+  SEGMENT_UPLOAD,               // HTTP round trip to the classifier
+  SEGMENT_UPLOAD_TO_RESULT,     // Response parsing on the camera
+  SEGMENT_RESULT_TO_RX,         // Bus + controller loop pickup
+  SEGMENT_RX_TO_LID,
+  SEGMENT_DETECTION,            // Request sent to result received
+  SEGMENT_END_TO_END,           // PIR to lid open
+  SEGMENT_COUNT
+};
+
+class DetectionLatency {
+public:
+  DetectionLatency()
+      : open(false), traceId(0), seen(0), cameraClock(0),
+        completeCount(0), partialCount(0), unsyncedCount(0), staleCount(0) {}
+
+  // Controller stages, timestamps are the low 32 bits of esp_timer
+  void motion(uint32_t us);                 // Starts a record, closing any open one
+  void requestSent(uint16_t traceId, uint32_t us);
+  void mark(DetectStage stage, uint32_t us);
+  void lidOpened(uint32_t us);              // Closes the record
+
+  // Camera stage report; ignored unless it belongs to the open record
+  void remoteStage(uint16_t traceId, DetectStage stage, uint32_t us, bool synced);
+
+  const LatencyHistogram& segment(uint8_t s) const { return histograms[s]; }
+  static const char* segmentName(uint8_t s);
+
+  uint32_t complete() const { return completeCount; }   // Every stage, one timebase
+  uint32_t partial() const { return partialCount; }
+  uint32_t unsyncedReports() const { return unsyncedCount; }
+  uint32_t staleReports() const { return staleCount; }  // Wrong or expired trace id
+
+private:
+  void finish();
+
+  bool open;
+  uint16_t traceId;
+  uint16_t seen;        // Bit per DetectStage
+  uint16_t cameraClock; // Stages stamped with the camera's own clock
+  uint32_t times[STAGE_COUNT];
+
+  LatencyHistogram histograms[SEGMENT_COUNT];
+  uint32_t completeCount;
+  uint32_t partialCount;
+  uint32_t unsyncedCount;
+  uint32_t staleCount;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "Metrics.h"
+
+const uint32_t LATENCY_BOUNDS_US[LATENCY_BUCKETS] = {
+  10, 50, 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000
+};
+
+void LatencyHistogram::reset() {
+  for (uint8_t i = 0; i <= LATENCY_BUCKETS; i++) {
+    buckets[i] = 0;
+  }
+  total = 0;
+  sum = 0;
+  max = 0;
+}
+
+void LatencyHistogram::record(uint32_t micros) {
+  uint8_t i = 0;
+  while (i < LATENCY_BUCKETS && micros > LATENCY_BOUNDS_US[i]) {
+    i++;
+  }
+  buckets[i]++;
+  total++;
+  sum += micros;
+  if (micros > max) {
+    max = micros;
+  }
+}
+
+uint32_t LatencyHistogram::cumulative(uint8_t i) const {
+  uint32_t n = 0;
+  for (uint8_t b = 0; b <= i && b <= LATENCY_BUCKETS; b++) {
+    n += buckets[b];
+  }
+  return n;
+}
+
+void OccupancyMeter::reset(uint64_t nowUs) {
+  sinceUs = nowUs;
+  busyUs = 0;
+  startedUs = nowUs;
+  active = false;
+  durations.reset();
+}
+
+void OccupancyMeter::begin(uint64_t nowUs) {
+  startedUs = nowUs;
+  active = true;
+}
+
+void OccupancyMeter::end(uint64_t nowUs) {
+  if (!active) {
+    return;
+  }
+  active = false;
+  busyUs += nowUs - startedUs;
+  durations.record((uint32_t)(nowUs - startedUs));
+}
+
+float OccupancyMeter::occupancy(uint64_t nowUs) const {
+  uint64_t wall = nowUs - sinceUs;
+  if (wall == 0) {
+    return 0;
+  }
+  uint64_t busy = busyUs + (active ? nowUs - startedUs : 0);
+  return (float)busy / wall;
+}
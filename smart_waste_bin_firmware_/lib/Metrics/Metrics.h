@@ -0,0 +1,64 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+
+// Fixed-bucket latency histogram, Prometheus style.
+//
+// Bucket bounds are shared by every histogram so the exporter can print
+// them once per series. Recording is a short linear scan and two adds;
+// nothing is allocated.
+static const uint8_t LATENCY_BUCKETS = 12;
+
+// Upper bounds in microseconds; a final +Inf bucket is implied.
+extern const uint32_t LATENCY_BOUNDS_US[LATENCY_BUCKETS];
+
+class LatencyHistogram {
+public:
+  LatencyHistogram() { reset(); }
+
+  void reset();
+
+  void record(uint32_t micros);
+
+  // Count of samples <= LATENCY_BOUNDS_US[i] (cumulative, as exported).
+  // i == LATENCY_BUCKETS gives the +Inf bucket, i.e. count().
+  uint32_t cumulative(uint8_t i) const;
+
+  uint32_t count() const { return total; }
+  uint64_t sumMicros() const { return sum; }
+  uint32_t maxMicros() const { return max; }
+
+private:
+  uint32_t buckets[LATENCY_BUCKETS + 1];
+  uint32_t total;
+  uint64_t sum;
+  uint32_t max;
+};
+
+// Busy time of one pipeline stage. begin()/end() bracket each job; the
+// occupancy is busy time over wall time since reset(), so a stage at 1.0
+// is the bottleneck and one near 0 is waiting on the others.
+class OccupancyMeter {
+public:
+  OccupancyMeter() { reset(0); }
+
+  void reset(uint64_t nowUs);
+  void begin(uint64_t nowUs);
+  void end(uint64_t nowUs);
+
+  // Counts a job still in progress up to `nowUs`
+  float occupancy(uint64_t nowUs) const;
+  bool busy() const { return active; }
+  uint32_t jobs() const { return durations.count(); }
+  const LatencyHistogram& jobDurations() const { return durations; }
+
+private:
+  uint64_t sinceUs;
+  uint64_t busyUs;
+  uint64_t startedUs;
+  bool active;
+  LatencyHistogram durations;
+};
+
+#endif
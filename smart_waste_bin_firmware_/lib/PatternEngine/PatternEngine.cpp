@@ -0,0 +1,144 @@
+#include "PatternEngine.h"
+
+enum Waveform { WAVE_SOLID, WAVE_BLINK, WAVE_BREATHE };
+
+struct LedSpec {
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  Waveform wave;
+  uint16_t periodMs;
+};
+
+static const LedSpec LED_SPECS[LED_PATTERN_COUNT] = {
+  { 0, 0, 0, WAVE_SOLID, 0 },          // LED_OFF
+  { 0, 0, 255, WAVE_SOLID, 0 },        // LED_IDLE
+  { 0, 255, 0, WAVE_SOLID, 0 },        // LED_OPEN
+  { 255, 96, 0, WAVE_SOLID, 0 },       // LED_NEARLY_FULL
+  { 0, 0, 255, WAVE_BREATHE, 1500 },   // LED_ANALYZING
+  { 255, 0, 0, WAVE_BLINK, 1000 },     // LED_FULL
+  { 255, 96, 0, WAVE_BREATHE, 3000 },  // LED_MAINTENANCE
+};
+
+struct ToneStep {
+  uint16_t hz;
+  uint16_t durationMs;
+};
+
+static const uint8_t MAX_TONE_STEPS = 3;
+
+struct ToneSpec {
+  uint8_t steps;
+  ToneStep step[MAX_TONE_STEPS];
+};
+
+static const ToneSpec TONE_SPECS[TONE_PATTERN_COUNT] = {
+  { 0, {} },                                          // TONE_NONE
+  { 1, { { 2700, 100 } } },                           // TONE_CHIRP
+  { 3, { { 800, 200 }, { 0, 100 }, { 800, 200 } } },  // TONE_ERROR
+};
+
+static_assert(LED_PATTERN_COUNT <= 16 && TONE_PATTERN_COUNT <= 16, "patterns must fit in PATTERN_BITS");
+
+static uint32_t toneDurationMs(uint8_t pattern) {
+  uint32_t total = 0;
+  for (uint8_t i = 0; i < TONE_SPECS[pattern].steps; i++) {
+    total += TONE_SPECS[pattern].step[i].durationMs;
+  }
+  return total;
+}
+
+PatternEngine::PatternEngine() {
+  ledWord = pack(LED_OFF, 0);
+  toneWord = pack(TONE_NONE, 0);
+}
+
+bool PatternEngine::setLed(LedPattern pattern, uint32_t nowMs) {
+  if (pattern == led()) {
+    return false;
+  }
+  ledWord = pack(pattern, nowMs);
+  return true;
+}
+
+bool PatternEngine::playTone(TonePattern pattern, uint32_t nowMs) {
+  expireTone(nowMs);
+  if (pattern == (TonePattern)(toneWord & PATTERN_MASK)) {
+    return false;
+  }
+  toneWord = pack(pattern, nowMs);
+  return true;
+}
+
+void PatternEngine::expireTone(uint32_t nowMs) {
+  uint32_t word = toneWord;
+  uint8_t pattern = word & PATTERN_MASK;
+  if (pattern != TONE_NONE && elapsedMs(word, nowMs) >= toneDurationMs(pattern)) {
+    toneWord = pack(TONE_NONE, nowMs);
+  }
+}
+
+// Brightness scale 0..255 for a waveform at `phaseMs` into its period
+static uint8_t waveLevel(const LedSpec& spec, uint32_t phaseMs) {
+  switch (spec.wave) {
+    case WAVE_BLINK:
+      return phaseMs < spec.periodMs / 2 ? 255 : 0;
+    case WAVE_BREATHE: {
+      // Triangle wave, squared for a perceptually smoother fade
+      uint32_t half = spec.periodMs / 2;
+      uint32_t ramp = phaseMs < half ? phaseMs : spec.periodMs - phaseMs;
+      uint32_t level = ramp * 255 / half;
+      return (uint8_t)(level * level / 255);
+    }
+    case WAVE_SOLID:
+    default:
+      return 255;
+  }
+}
+
+// Timer side: reads each word once and writes nothing back
+void PatternEngine::frame(uint32_t nowMs, PatternFrame& out) const {
+  uint32_t ledNow = ledWord;
+  uint32_t toneNow = toneWord;
+
+  const LedSpec& spec = LED_SPECS[ledNow & PATTERN_MASK];
+  uint8_t level = 255;
+  if (spec.wave != WAVE_SOLID) {
+    level = waveLevel(spec, elapsedMs(ledNow, nowMs) % spec.periodMs);
+  }
+  out.red = (uint8_t)(spec.red * level / 255);
+  out.green = (uint8_t)(spec.green * level / 255);
+  out.blue = (uint8_t)(spec.blue * level / 255);
+
+  out.toneHz = 0;
+  const ToneSpec& tone = TONE_SPECS[toneNow & PATTERN_MASK];
+  uint32_t elapsed = elapsedMs(toneNow, nowMs);
+  for (uint8_t i = 0; i < tone.steps; i++) {
+    if (elapsed < tone.step[i].durationMs) {
+      out.toneHz = tone.step[i].hz;
+      return;
+    }
+    elapsed -= tone.step[i].durationMs;
+  }
+}
+
+const char* PatternEngine::ledName(LedPattern pattern) {
+  switch (pattern) {
+    case LED_OFF:
+      return "off";
+    case LED_IDLE:
+      return "idle";
+    case LED_OPEN:
+      return "open";
+    case LED_NEARLY_FULL:
+      return "nearly_full";
+    case LED_ANALYZING:
+      return "analyzing";
+    case LED_FULL:
+      return "full";
+    case LED_MAINTENANCE:
+      return "maintenance";
+    default:
+      return "unknown";
+  }
+}
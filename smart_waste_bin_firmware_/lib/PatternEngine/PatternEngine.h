@@ -0,0 +1,75 @@
+#ifndef PATTERN_ENGINE_H
+#define PATTERN_ENGINE_H
+
+#include <stdint.h>
+
+// Named LED and buzzer patterns for the status indicators.
+//
+// The state machine selects a pattern with setLed()/playTone(); a periodic
+// timer calls frame() to get the PWM duties and buzzer frequency for the
+// current instant. The engine only holds the pattern and its start time,
+// so selecting the same pattern again costs nothing.
+//
+// The timer runs in another task, so each pattern and its start time are
+// published together as one 32-bit word and frame() only reads them. The
+// loop retires finished tones with expireTone().
+
+enum LedPattern {
+  LED_OFF,
+  LED_IDLE,          // Solid blue
+  LED_OPEN,          // Solid green
+  LED_NEARLY_FULL,   // Solid amber
+  LED_ANALYZING,     // Breathing blue
+  LED_FULL,          // Blinking red
+  LED_MAINTENANCE,   // Breathing amber
+  LED_PATTERN_COUNT
+};
+
+enum TonePattern {
+  TONE_NONE,
+  TONE_CHIRP,        // Short high beep (lid opened)
+  TONE_ERROR,        // Two low beeps (bin full / refused)
+  TONE_PATTERN_COUNT
+};
+
+struct PatternFrame {
+  uint8_t red;       // LED duty, 0..255
+  uint8_t green;
+  uint8_t blue;
+  uint16_t toneHz;   // 0 = buzzer silent
+};
+
+class PatternEngine {
+public:
+  PatternEngine();
+
+  // Both return false if the pattern was already active.
+  bool setLed(LedPattern pattern, uint32_t nowMs);
+  bool playTone(TonePattern pattern, uint32_t nowMs);
+
+  LedPattern led() const { return (LedPattern)(ledWord & PATTERN_MASK); }
+
+  // Loop side: clears a tone that has finished, so the same tone can be
+  // played again and an old one never restarts when the clock wraps.
+  void expireTone(uint32_t nowMs);
+
+  // Computes the outputs at `nowMs`. Finished tones fall back to silence.
+  void frame(uint32_t nowMs, PatternFrame& out) const;
+
+  static const char* ledName(LedPattern pattern);
+
+private:
+  // Pattern in the low bits, start time (ms, wrapping) above it
+  static const uint8_t PATTERN_BITS = 4;
+  static const uint32_t PATTERN_MASK = (1UL << PATTERN_BITS) - 1;
+
+  static uint32_t pack(uint8_t pattern, uint32_t startMs) { return (startMs << PATTERN_BITS) | pattern; }
+  static uint32_t elapsedMs(uint32_t word, uint32_t nowMs) {
+    return ((nowMs << PATTERN_BITS) - (word & ~PATTERN_MASK)) >> PATTERN_BITS;
+  }
+
+  volatile uint32_t ledWord;
+  volatile uint32_t toneWord;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "PresenceDetector.h"
+#include <string.h>
+#include <stdlib.h>
+
+PresenceDetector::PresenceDetector(const PresenceConfig& config) : cfg(config) {
+  if (cfg.roiX >= GRID_W) cfg.roiX = 0;
+  if (cfg.roiY >= GRID_H) cfg.roiY = 0;
+  if (cfg.roiW == 0 || cfg.roiX + cfg.roiW > GRID_W) cfg.roiW = GRID_W - cfg.roiX;
+  if (cfg.roiH == 0 || cfg.roiY + cfg.roiH > GRID_H) cfg.roiH = GRID_H - cfg.roiY;
+  reset();
+}
+
+void PresenceDetector::reset() {
+  memset(background, 0, sizeof(background));
+  isPresent = false;
+  changed = 0;
+  frameCount = 0;
+}
+
+// Cell (x * GRID_W / width, y * GRID_H / height) averages every pixel that
+// maps to it. Rows map to cells in order, so one grid row is summed at a time.
+void PresenceDetector::downsample(const uint8_t* luma, uint16_t width, uint16_t height) {
+  uint16_t cols[GRID_W];
+  uint32_t sum[GRID_W];
+  memset(cols, 0, sizeof(cols));
+  memset(sum, 0, sizeof(sum));
+  for (uint16_t x = 0; x < width; x++) {
+    cols[(uint32_t)x * GRID_W / width]++;
+  }
+  uint16_t rows = 0;
+  for (uint16_t y = 0; y < height; y++) {
+    const uint8_t* in = luma + (size_t)y * width;
+    for (uint16_t x = 0; x < width; x++) {
+      sum[(uint32_t)x * GRID_W / width] += in[x];
+    }
+    rows++;
+    uint8_t cy = (uint32_t)y * GRID_H / height;
+    if (y + 1 == height || (uint32_t)(y + 1) * GRID_H / height != cy) {
+      for (uint8_t cx = 0; cx < GRID_W; cx++) {
+        cell[cy * GRID_W + cx] = sum[cx] / ((uint32_t)rows * cols[cx]);
+      }
+      memset(sum, 0, sizeof(sum));
+      rows = 0;
+    }
+  }
+}
+
+bool PresenceDetector::update(const uint8_t* luma, uint16_t width, uint16_t height) {
+  if (luma == nullptr || width < GRID_W || height < GRID_H) {
+    return isPresent;
+  }
+  downsample(luma, width, height);
+
+  if (frameCount == 0) {
+    for (uint16_t i = 0; i < GRID_W * GRID_H; i++) {
+      background[i] = cell[i] << 8;
+    }
+  }
+  frameCount++;
+
+  // Mean difference over the chute: a lighting change, not an item
+  int32_t total = 0;
+  for (uint8_t y = cfg.roiY; y < cfg.roiY + cfg.roiH; y++) {
+    for (uint8_t x = cfg.roiX; x < cfg.roiX + cfg.roiW; x++) {
+      uint16_t i = y * GRID_W + x;
+      total += (int32_t)cell[i] - (background[i] >> 8);
+    }
+  }
+  uint16_t area = (uint16_t)cfg.roiW * cfg.roiH;
+  int32_t offset = total / area;
+
+  uint16_t changedCells = 0;
+  bool warming = !ready();
+  for (uint8_t y = 0; y < GRID_H; y++) {
+    for (uint8_t x = 0; x < GRID_W; x++) {
+      uint16_t i = y * GRID_W + x;
+      bool inRoi = x >= cfg.roiX && x < cfg.roiX + cfg.roiW && y >= cfg.roiY && y < cfg.roiY + cfg.roiH;
+      int32_t diff = (int32_t)cell[i] - (background[i] >> 8) - offset;
+      bool cellChanged = inRoi && abs(diff) > cfg.pixelThreshold;
+      if (cellChanged) {
+        changedCells++;
+      }
+      // Warm-up learns fast so the first frames settle quickly
+      uint8_t shift = warming ? 1 : cfg.learnShift + (cellChanged ? SLOW_LEARN_SHIFT : 0);
+      int32_t step = (((int32_t)cell[i] << 8) - background[i]) >> shift;
+      background[i] += step;
+    }
+  }
+  changed = (uint32_t)changedCells * 1000 / area;
+
+  if (!ready()) {
+    isPresent = false;
+  } else if (isPresent) {
+    isPresent = changed >= cfg.leavePermille;
+  } else {
+    isPresent = changed >= cfg.enterPermille;
+  }
+  return isPresent;
+}
+
+void PresenceDetector::lumaFromRgb565(const uint8_t* rgb565, uint8_t* luma, size_t pixels) {
+  for (size_t i = 0; i < pixels; i++) {
+    uint16_t c = (rgb565[2 * i] << 8) | rgb565[2 * i + 1];
+    uint8_t r = (c >> 8) & 0xF8;
+    uint8_t g = (c >> 3) & 0xFC;
+    uint8_t b = (c << 3) & 0xF8;
+    // BT.601 weights in 1/256ths
+    luma[i] = (77 * r + 150 * g + 29 * b) >> 8;
+  }
+}
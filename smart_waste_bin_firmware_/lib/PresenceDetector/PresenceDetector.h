@@ -0,0 +1,67 @@
+#ifndef PRESENCE_DETECTOR_H
+#define PRESENCE_DETECTOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Tells whether something is in the camera's chute by comparing each frame
+// with a learned picture of the empty chute.
+//
+// Frames come in as 8-bit luma of any size (the camera decodes its JPEG at
+// 1/8 scale) and are box-averaged down to a fixed GRID_W x GRID_H grid, so
+// frame size changes don't disturb the model. Within the chute region, a
+// cell has changed when it differs from the background by more than the
+// threshold after the region's mean difference is taken out, which keeps
+// exposure and lighting shifts from looking like an item. The item is
+// present once the changed share reaches `enterPermille` and stays present
+// until it falls below `leavePermille`.
+//
+// The background follows the scene with an exponential average; changed
+// cells are learned much more slowly, so an item that stays in view is
+// only absorbed after a long while and a passing hand never is.
+
+struct PresenceConfig {
+  uint8_t roiX;              // Chute region, in grid cells
+  uint8_t roiY;
+  uint8_t roiW;
+  uint8_t roiH;
+  uint8_t pixelThreshold;    // Luma difference that counts as changed
+  uint16_t enterPermille;
+  uint16_t leavePermille;
+  uint8_t learnShift;        // Background moves 1/2^shift of the way per frame
+  uint16_t warmupFrames;     // Frames learned before reporting anything
+};
+
+class PresenceDetector {
+public:
+  static const uint8_t GRID_W = 32;
+  static const uint8_t GRID_H = 24;
+  static const uint8_t SLOW_LEARN_SHIFT = 4;   // Extra shift for changed cells
+
+  explicit PresenceDetector(const PresenceConfig& config);
+
+  void reset();
+  // One frame; returns present(). Frames smaller than the grid are ignored.
+  bool update(const uint8_t* luma, uint16_t width, uint16_t height);
+
+  bool present() const { return isPresent; }
+  bool ready() const { return frameCount >= cfg.warmupFrames; }
+  uint16_t changedPermille() const { return changed; }
+  uint32_t frames() const { return frameCount; }
+
+  // Big-endian RGB565 (as esp32-camera's decoder writes it) to luma; `luma`
+  // may be the same buffer as `rgb565`
+  static void lumaFromRgb565(const uint8_t* rgb565, uint8_t* luma, size_t pixels);
+
+private:
+  void downsample(const uint8_t* luma, uint16_t width, uint16_t height);
+
+  PresenceConfig cfg;
+  uint8_t cell[GRID_W * GRID_H];          // Current frame
+  uint16_t background[GRID_W * GRID_H];   // Luma << 8
+  bool isPresent;
+  uint16_t changed;
+  uint32_t frameCount;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#include "RateLimiter.h"
+#include <string.h>
+
+RateLimiter::RateLimiter(const RateLimit* limits, uint8_t classCount, uint8_t maxInFlight)
+    : classes(classCount > MAX_CLASSES ? MAX_CLASSES : classCount),
+      maxActive(maxInFlight),
+      used(0),
+      active(0),
+      peak(0),
+      evicted(0) {
+  memset(limit, 0, sizeof(limit));
+  memcpy(limit, limits, classes * sizeof(RateLimit));
+  memset(allowedCount, 0, sizeof(allowedCount));
+  memset(limitedCount, 0, sizeof(limitedCount));
+  memset(busyCount, 0, sizeof(busyCount));
+}
+
+// Finds the client's entry, making one with full buckets if it is new
+RateLimiter::Client& RateLimiter::lookup(uint32_t key, uint32_t nowMs) {
+  uint8_t oldest = 0;
+  for (uint8_t i = 0; i < used; i++) {
+    if (table[i].key == key) {
+      return table[i];
+    }
+    if (nowMs - table[i].lastMs > nowMs - table[oldest].lastMs) {
+      oldest = i;
+    }
+  }
+  uint8_t slot;
+  if (used < MAX_CLIENTS) {
+    slot = used++;
+  } else {
+    slot = oldest;
+    evicted++;
+  }
+  Client& c = table[slot];
+  c.key = key;
+  c.lastMs = nowMs;
+  for (uint8_t k = 0; k < classes; k++) {
+    c.credit[k] = limit[k].refillMs * limit[k].burst;
+  }
+  return c;
+}
+
+void RateLimiter::refill(Client& c, uint32_t nowMs) {
+  uint32_t elapsed = nowMs - c.lastMs;
+  c.lastMs = nowMs;
+  for (uint8_t k = 0; k < classes; k++) {
+    uint32_t full = limit[k].refillMs * limit[k].burst;
+    c.credit[k] = elapsed >= full - c.credit[k] ? full : c.credit[k] + elapsed;
+  }
+}
+
+RateVerdict RateLimiter::admit(uint32_t client, uint8_t cls, uint32_t nowMs, bool tracked) {
+  if (cls >= classes) {
+    return RATE_ALLOWED;
+  }
+  Client& c = lookup(client, nowMs);
+  refill(c, nowMs);
+  if (c.credit[cls] < limit[cls].refillMs) {
+    limitedCount[cls]++;
+    return RATE_LIMITED;
+  }
+  if (tracked && active >= maxActive) {
+    busyCount[cls]++;
+    return RATE_BUSY;
+  }
+  c.credit[cls] -= limit[cls].refillMs;
+  allowedCount[cls]++;
+  if (tracked && ++active > peak) {
+    peak = active;
+  }
+  return RATE_ALLOWED;
+}
+
+void RateLimiter::finished() {
+  if (active > 0) {
+    active--;
+  }
+}
+
+uint32_t RateLimiter::retryAfterMs(uint32_t client, uint8_t cls, uint32_t nowMs) {
+  if (cls >= classes) {
+    return 0;
+  }
+  Client& c = lookup(client, nowMs);
+  refill(c, nowMs);
+  return c.credit[cls] >= limit[cls].refillMs ? 0 : limit[cls].refillMs - c.credit[cls];
+}
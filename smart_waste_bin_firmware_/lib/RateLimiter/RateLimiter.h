@@ -0,0 +1,75 @@
+#ifndef RATE_LIMITER_H
+#define RATE_LIMITER_H
+
+#include <stdint.h>
+
+// Token buckets per client and route class, plus a cap on requests in
+// flight, so a chatty client on the site network can't keep the web
+// server's task busy.
+//
+// Each bucket holds up to `burst` tokens and gains one every `refillMs`.
+// Tokens are kept as milliseconds of credit, capped at burst * refillMs,
+// and a request costs refillMs, so refilling is one add. Clients are
+// keyed by IPv4 address in a small fixed table; when it is full the client
+// seen longest ago is forgotten, which only ever hands it a full bucket.
+//
+// Not thread safe; the web server calls it from its one task.
+
+enum RateVerdict {
+  RATE_ALLOWED,
+  RATE_LIMITED,   // The client's bucket for this class is empty
+  RATE_BUSY       // Too many requests in flight
+};
+
+struct RateLimit {
+  uint32_t refillMs;   // One token per refillMs
+  uint16_t burst;
+};
+
+class RateLimiter {
+public:
+  static const uint8_t MAX_CLIENTS = 16;
+  static const uint8_t MAX_CLASSES = 4;
+
+  RateLimiter(const RateLimit* limits, uint8_t classCount, uint8_t maxInFlight);
+
+  // Takes a token from the client's bucket for `cls`. A tracked request
+  // also takes an in-flight slot, to be given back with finished(); a
+  // busy server doesn't cost the client a token.
+  RateVerdict admit(uint32_t client, uint8_t cls, uint32_t nowMs, bool tracked = true);
+  void finished();
+  // Until the client's bucket has a token again; 0 if it has one
+  uint32_t retryAfterMs(uint32_t client, uint8_t cls, uint32_t nowMs);
+
+  uint8_t inFlight() const { return active; }
+  uint8_t peakInFlight() const { return peak; }
+  uint8_t clients() const { return used; }
+  uint32_t evictions() const { return evicted; }
+  uint32_t allowed(uint8_t cls) const { return cls < classes ? allowedCount[cls] : 0; }
+  uint32_t limited(uint8_t cls) const { return cls < classes ? limitedCount[cls] : 0; }
+  uint32_t busy(uint8_t cls) const { return cls < classes ? busyCount[cls] : 0; }
+
+private:
+  struct Client {
+    uint32_t key;
+    uint32_t lastMs;                 // Credit is current as of this time
+    uint32_t credit[MAX_CLASSES];    // ms
+  };
+
+  Client& lookup(uint32_t key, uint32_t nowMs);
+  void refill(Client& c, uint32_t nowMs);
+
+  RateLimit limit[MAX_CLASSES];
+  uint8_t classes;
+  uint8_t maxActive;
+  Client table[MAX_CLIENTS];
+  uint8_t used;
+  uint8_t active;
+  uint8_t peak;
+  uint32_t evicted;
+  uint32_t allowedCount[MAX_CLASSES];
+  uint32_t limitedCount[MAX_CLASSES];
+  uint32_t busyCount[MAX_CLASSES];
+};
+
+#endif
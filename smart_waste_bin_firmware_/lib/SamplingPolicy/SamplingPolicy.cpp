@@ -0,0 +1,58 @@
+#include "SamplingPolicy.h"
+
+SamplingPolicy::SamplingPolicy(const SamplingConfig& config) : cfg(config) {
+  currentMode = SAMPLING_ACTIVE;
+  currentInterval = cfg.activeIntervalMs;
+  lastSampleMs = 0;
+  lastActivityMs = 0;
+  sampleDue = true; // Take a reading straight after boot
+  for (uint8_t i = 0; i < SAMPLING_MODE_COUNT; i++) {
+    counts[i] = 0;
+  }
+}
+
+void SamplingPolicy::boost(uint32_t nowMs) {
+  if (currentMode != SAMPLING_ACTIVE) {
+    sampleDue = true;
+  }
+  currentMode = SAMPLING_ACTIVE;
+  currentInterval = cfg.activeIntervalMs;
+  lastActivityMs = nowMs;
+}
+
+bool SamplingPolicy::shouldSample(uint32_t nowMs) {
+  if (!sampleDue && nowMs - lastSampleMs < currentInterval) {
+    return false;
+  }
+  sampleDue = false;
+  lastSampleMs = nowMs;
+  counts[currentMode]++;
+
+  // Work out the interval until the next sample
+  if (currentMode == SAMPLING_ACTIVE) {
+    if (nowMs - lastActivityMs >= cfg.activeHoldMs) {
+      currentMode = SAMPLING_SETTLING;
+    }
+  }
+  if (currentMode == SAMPLING_SETTLING) {
+    currentInterval *= 2;
+    if (currentInterval >= cfg.idleIntervalMs) {
+      currentInterval = cfg.idleIntervalMs;
+      currentMode = SAMPLING_IDLE;
+    }
+  }
+  return true;
+}
+
+const char* SamplingPolicy::modeName(SamplingMode m) {
+  switch (m) {
+    case SAMPLING_ACTIVE:
+      return "active";
+    case SAMPLING_SETTLING:
+      return "settling";
+    case SAMPLING_IDLE:
+      return "idle";
+    default:
+      return "unknown";
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef SAMPLING_POLICY_H
+#define SAMPLING_POLICY_H
+
+#include <stdint.h>
+
+// Activity-aware sensor sampling schedule.
+//
+// ACTIVE:   fixed fast rate while something is happening (lid cycle, PIR,
+//           weight change) and for a hold time afterwards.
+// SETTLING: interval doubles after every sample until it reaches the
+//           idle interval.
+// IDLE:     slow background rate.
+//
+// Any boost() jumps straight back to ACTIVE.
+enum SamplingMode {
+  SAMPLING_ACTIVE,
+  SAMPLING_SETTLING,
+  SAMPLING_IDLE,
+  SAMPLING_MODE_COUNT
+};
+
+struct SamplingConfig {
+  uint32_t activeIntervalMs;
+  uint32_t activeHoldMs;
+  uint32_t idleIntervalMs;
+};
+
+class SamplingPolicy {
+public:
+  explicit SamplingPolicy(const SamplingConfig& config);
+
+  // Reports activity; the next call to shouldSample() returns true.
+  void boost(uint32_t nowMs);
+
+  // Returns true if a sample is due now, and counts it against the
+  // current mode.
+  bool shouldSample(uint32_t nowMs);
+
+  SamplingMode mode() const { return currentMode; }
+  uint32_t interval() const { return currentInterval; }
+  uint32_t samples(SamplingMode m) const { return counts[m]; }
+
+  static const char* modeName(SamplingMode m);
+
+private:
+  SamplingConfig cfg;
+  SamplingMode currentMode;
+  uint32_t currentInterval;
+  uint32_t lastSampleMs;
+  uint32_t lastActivityMs;
+  bool sampleDue;
+  uint32_t counts[SAMPLING_MODE_COUNT];
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef STATION_CONFIG_H
+#define STATION_CONFIG_H
+
+#include <BoardConfig.h>
+#include <BinController.h>
+
+// Controller settings shared by the firmware (src/main.cpp) and the host
+// tools that run the same logic (tools/replay, tools/fleet_sim,
+// tools/fill_bench), so a simulation always matches what ships. Values
+// that depend on the hardware come from the selected Board.
+
+// Fill estimation (ultrasonic + load cell fusion)
+const FillEstimatorConfig FILL_CONFIG = {
+  Board::BIN_EMPTY_DISTANCE_MM,
+  Board::BIN_FULL_DISTANCE_MM,
+  Board::BIN_CAPACITY_GRAMS,
+  Board::fullPermille(), // fullOnPermille
+  800,   // fullOffPermille
+  2500,  // volumeVariance (ultrasonic is noisy on uneven waste)
+  900,   // massVariance
+  4      // processVariance
+};
+
+// Sensor sampling (fast while active, backing off to slow when idle)
+const SamplingConfig SAMPLING_CONFIG = {
+  100,    // activeIntervalMs
+  5000,   // activeHoldMs
+  30000   // idleIntervalMs
+};
+
+// Controller timing
+const unsigned long MOTION_TIMEOUT = 5000; // 5 seconds
+const unsigned long BIN_CLOSE_DELAY = 3000; // 3 seconds
+
+const BinControllerConfig CONTROLLER_CONFIG = {
+  Board::BIN_ORGANIC_ID,
+  Board::BIN_NON_ORGANIC_ID,
+  MOTION_TIMEOUT,
+  BIN_CLOSE_DELAY,
+  5000,   // detectionTimeoutMs
+  200,    // keypadDebounceMs
+  3000,   // keypadOpenMs
+  50,     // weightChangeBoostGrams
+  true,   // presenceTrigger: the camera's chute check also starts a cycle
+  FILL_CONFIG,
+  SAMPLING_CONFIG
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "StationLink.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+
+bool connectWiFi(const char* ssid, const char* password, uint8_t attempts) {
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid, password);
+  
+  Serial.print("Connecting to WiFi");
+  while (WiFi.status() != WL_CONNECTED && attempts > 0) {
+    delay(500);
+    Serial.print(".");
+    attempts--;
+  }
+  
+  if (WiFi.status() != WL_CONNECTED) {
+    Serial.println("\nWiFi Connection Failed");
+    return false;
+  }
+  Serial.println("\nWiFi Connected!");
+  Serial.print("IP Address: ");
+  Serial.println(WiFi.localIP());
+  return true;
+}
+
+// ==================== BACKGROUND WIFI ====================
+static const char* WIFI_PREFS = "wifi";
+
+void WiFiLink::begin(const WiFiLinkConfig& config, uint32_t nowMs) {
+  cfg = config;
+  WiFi.persistent(false);   // Our own cache; don't rewrite the SDK's on every begin()
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(true);
+  if ((uint32_t)cfg.staticIp != 0) {
+    WiFi.config(cfg.staticIp, cfg.gateway, cfg.subnet, cfg.dns);
+  }
+  
+  uint8_t bssid[6];
+  Preferences prefs;
+  prefs.begin(WIFI_PREFS, true);
+  uint8_t channel = prefs.getUChar("channel", 0);
+  bool cached = channel != 0 && prefs.getBytes("bssid", bssid, sizeof(bssid)) == sizeof(bssid);
+  prefs.end();
+  
+  if (cached) {
+    WiFi.begin(cfg.ssid, cfg.password, channel, bssid);
+    linkState = WIFI_LINK_FAST;
+    stateSinceMs = nowMs;
+  } else {
+    startScan(nowMs);
+  }
+}
+
+void WiFiLink::startScan(uint32_t nowMs) {
+  WiFi.disconnect();
+  WiFi.begin(cfg.ssid, cfg.password);
+  linkState = WIFI_LINK_SCANNING;
+  stateSinceMs = nowMs;
+}
+
+bool WiFiLink::update(uint32_t nowMs) {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  switch (linkState) {
+    case WIFI_LINK_OFF:
+      break;
+      
+    case WIFI_LINK_FAST:
+    case WIFI_LINK_SCANNING:
+      if (connected) {
+        if (linkState == WIFI_LINK_FAST) {
+          fastCount++;
+        }
+        linkState = WIFI_LINK_ONLINE;
+        stateSinceMs = nowMs;
+        connectCount++;
+        saveAp();
+        return true;
+      }
+      // The AP moved or changed channel: forget the shortcut and scan
+      if (linkState == WIFI_LINK_FAST && nowMs - stateSinceMs > cfg.fastTimeoutMs) {
+        startScan(nowMs);
+      }
+      break;
+      
+    case WIFI_LINK_ONLINE:
+      if (!connected) {
+        // The driver reconnects on its own (setAutoReconnect)
+        linkState = WIFI_LINK_SCANNING;
+        stateSinceMs = nowMs;
+      }
+      break;
+  }
+  return false;
+}
+
+void WiFiLink::saveAp() {
+  uint8_t cachedBssid[6];
+  const uint8_t* bssid = WiFi.BSSID();
+  uint8_t channel = WiFi.channel();
+  if (!bssid) {
+    return;
+  }
+  Preferences prefs;
+  prefs.begin(WIFI_PREFS, false);
+  if (prefs.getUChar("channel", 0) != channel ||
+      prefs.getBytes("bssid", cachedBssid, sizeof(cachedBssid)) != sizeof(cachedBssid) ||
+      memcmp(cachedBssid, bssid, sizeof(cachedBssid)) != 0) {
+    prefs.putUChar("channel", channel);
+    prefs.putBytes("bssid", bssid, 6);
+  }
+  prefs.end();
+}
+
+// ==================== CAN ====================
+void setupCAN(uint8_t txPin, uint8_t rxPin) {
+  // Initialize TWAI (CAN) on ESP32
+  // Note: ESP32 uses TWAI instead of traditional CAN
+  // This is a simplified implementation
+  Serial.printf("CAN/TWAI initialized (TX %u, RX %u)\n", txPin, rxPin);
+}
+
+void sendCANMessage(const CanMessage& msg) {
+  // Simplified CAN message sending
+  // In real implementation, use ESP32 TWAI library
+}
+
+bool receiveCANMessage(CanMessage& msg) {
+  // Simplified CAN message receiving
+  // In real implementation, use ESP32 TWAI library
+  return false;
+}
@@ -0,0 +1,66 @@
+#ifndef STATION_LINK_H
+#define STATION_LINK_H
+
+#include <stdint.h>
+#include <IPAddress.h>
+#include <BinProtocol.h>
+
+// WiFi and CAN bring-up shared by the controller and camera firmwares.
+// ESP32 only; the host tools never link it.
+
+// Joins `ssid` in station mode, waiting up to `attempts` x 500 ms.
+// Prints progress and the address; returns false if it didn't connect.
+bool connectWiFi(const char* ssid, const char* password, uint8_t attempts);
+
+// ==================== BACKGROUND WIFI ====================
+struct WiFiLinkConfig {
+  const char* ssid;
+  const char* password;
+  IPAddress staticIp;      // 0.0.0.0 for DHCP
+  IPAddress gateway;
+  IPAddress subnet;
+  IPAddress dns;
+  uint32_t fastTimeoutMs;  // How long to try the cached AP before scanning
+};
+
+enum WiFiLinkState {
+  WIFI_LINK_OFF,
+  WIFI_LINK_FAST,       // Joining the cached BSSID on its channel, no scan
+  WIFI_LINK_SCANNING,   // Full scan, or the driver's own reconnect
+  WIFI_LINK_ONLINE
+};
+
+// Connects without blocking. The BSSID and channel of the last AP joined
+// are kept in NVS and tried first, which skips the scan; with a static IP
+// it also skips DHCP. The cache is only rewritten when the AP changes.
+class WiFiLink {
+public:
+  WiFiLink() : cfg(), linkState(WIFI_LINK_OFF), stateSinceMs(0), connectCount(0), fastCount(0) {}
+
+  void begin(const WiFiLinkConfig& config, uint32_t nowMs);
+  // Call every loop pass; true on the pass the link comes up
+  bool update(uint32_t nowMs);
+
+  WiFiLinkState state() const { return linkState; }
+  bool online() const { return linkState == WIFI_LINK_ONLINE; }
+  uint32_t connects() const { return connectCount; }
+  uint32_t fastConnects() const { return fastCount; }   // Joined without a scan
+
+private:
+  void startScan(uint32_t nowMs);
+  void saveAp();
+
+  WiFiLinkConfig cfg;
+  WiFiLinkState linkState;
+  uint32_t stateSinceMs;
+  uint32_t connectCount;
+  uint32_t fastCount;
+};
+
+// ==================== CAN ====================
+void setupCAN(uint8_t txPin, uint8_t rxPin);
+void sendCANMessage(const CanMessage& msg);
+// False if nothing was received
+bool receiveCANMessage(CanMessage& msg);
+
+#endif
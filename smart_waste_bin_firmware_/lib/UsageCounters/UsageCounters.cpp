@@ -0,0 +1,129 @@
+#include "UsageCounters.h"
+#include <string.h>
+
+static const char* const USAGE_NAMES[USAGE_COUNT] = {
+  "lid_opens_organic", "lid_opens_non_organic", "items_organic", "items_non_organic",
+  "items_unknown", "empty_detections", "detection_timeouts", "full_events"
+};
+
+UsageCounters::UsageCounters(UsageStore& usageStore, uint32_t intervalMs, uint16_t batch)
+    : store(usageStore),
+      interval(intervalMs),
+      batchSize(batch),
+      stage(nullptr),
+      nextSlot(0),
+      waiting(false),
+      waitingSinceMs(0),
+      flushCount(0),
+      failureCount(0),
+      recoveredCount(0) {
+  memset(&persisted, 0, sizeof(persisted));
+}
+
+const char* UsageCounters::name(UsageCounter c) {
+  return c < USAGE_COUNT ? USAGE_NAMES[c] : "unknown";
+}
+
+void UsageCounters::begin(UsageStage* usageStage, uint32_t nowMs) {
+  stage = usageStage;
+
+  // Newest valid slot; sequence numbers compare modulo 2^32
+  bool found = false;
+  UsageRecord record;
+  for (uint8_t slot = 0; slot < SLOTS; slot++) {
+    if (!store.read(slot, record) || record.version != USAGE_VERSION || record.count != USAGE_COUNT ||
+        record.crc != recordCrc(record)) {
+      continue;
+    }
+    if (!found || (int32_t)(record.sequence - persisted.sequence) > 0) {
+      persisted = record;
+      nextSlot = (slot + 1) % SLOTS;
+      found = true;
+    }
+  }
+  if (!found) {
+    memset(&persisted, 0, sizeof(persisted));
+    persisted.version = USAGE_VERSION;
+    persisted.count = USAGE_COUNT;
+    nextSlot = 0;
+  }
+
+  bool carried = stage->magic == USAGE_MAGIC && stage->version == USAGE_VERSION && stage->count == USAGE_COUNT;
+  for (uint8_t c = 0; carried && c < USAGE_COUNT; c++) {
+    carried = stage->values[c] >= persisted.values[c] && stage->values[c] - persisted.values[c] <= MAX_UNFLUSHED;
+  }
+  if (!carried) {
+    stage->magic = USAGE_MAGIC;
+    stage->version = USAGE_VERSION;
+    stage->count = USAGE_COUNT;
+    memcpy(stage->values, persisted.values, sizeof(stage->values));
+  }
+  recoveredCount = pending();
+  if (recoveredCount > 0) {
+    flush(nowMs);
+  }
+}
+
+uint32_t UsageCounters::pending() const {
+  if (!stage) {
+    return 0;
+  }
+  uint32_t n = 0;
+  for (uint8_t c = 0; c < USAGE_COUNT; c++) {
+    n += stage->values[c] - persisted.values[c];
+  }
+  return n;
+}
+
+bool UsageCounters::flushDue(uint32_t nowMs) {
+  uint32_t n = pending();
+  if (n == 0) {
+    waiting = false;
+    return false;
+  }
+  if (!waiting) {
+    waiting = true;
+    waitingSinceMs = nowMs;
+  }
+  return n >= batchSize || nowMs - waitingSinceMs >= interval;
+}
+
+bool UsageCounters::flush(uint32_t nowMs) {
+  if (!stage) {
+    return false;
+  }
+  UsageRecord record;
+  memset(&record, 0, sizeof(record));
+  record.version = USAGE_VERSION;
+  record.count = USAGE_COUNT;
+  record.sequence = persisted.sequence + 1;
+  for (uint8_t c = 0; c < USAGE_COUNT; c++) {
+    record.values[c] = __atomic_load_n(&stage->values[c], __ATOMIC_RELAXED);
+  }
+  record.crc = recordCrc(record);
+  if (!store.write(nextSlot, record)) {
+    failureCount++;
+    waitingSinceMs = nowMs;   // Retry after another interval, not every pass
+    return false;
+  }
+  persisted = record;
+  nextSlot = (nextSlot + 1) % SLOTS;
+  flushCount++;
+  waiting = false;
+  return true;
+}
+
+uint32_t UsageCounters::crc32(const uint8_t* data, size_t len) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+uint32_t UsageCounters::recordCrc(const UsageRecord& record) {
+  return crc32((const uint8_t*)&record, offsetof(UsageRecord, crc));
+}
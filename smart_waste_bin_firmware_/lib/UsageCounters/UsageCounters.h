@@ -0,0 +1,114 @@
+#ifndef USAGE_COUNTERS_H
+#define USAGE_COUNTERS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Lifetime usage counters that survive reboots without a flash write per
+// event.
+//
+// Counting is an atomic increment in a UsageStage, meant to live in RTC
+// memory like the event trace, so soft resets, panics and brownout resets
+// keep it. From time to time the totals are written to flash as a
+// UsageRecord. Records go round-robin into SLOTS slots, each with a
+// sequence number and CRC, so a write cut short by a power loss leaves the
+// previous record intact and no slot takes every write.
+//
+// At boot the newest valid record is the floor. The RTC totals replace it
+// if they are a plausible continuation: every counter at or above the
+// record and by no more than MAX_UNFLUSHED. Otherwise the RTC memory holds
+// garbage from a power-on. Counters never go backwards, and a power loss
+// costs at most the increments since the last flush.
+
+enum UsageCounter {
+  USAGE_LID_OPENS_ORGANIC,      // Servo cycles, however the lid was opened
+  USAGE_LID_OPENS_NON_ORGANIC,
+  USAGE_ITEMS_ORGANIC,          // Detections by material
+  USAGE_ITEMS_NON_ORGANIC,
+  USAGE_ITEMS_UNKNOWN,
+  USAGE_EMPTY_DETECTIONS,       // Camera saw nothing in the chute
+  USAGE_DETECTION_TIMEOUTS,
+  USAGE_FULL_EVENTS,            // Times the bin locked out as full
+  USAGE_COUNT
+};
+
+static const uint32_t USAGE_MAGIC = 0x55474253;  // "SBGU"
+static const uint16_t USAGE_VERSION = 1;
+
+// RTC-resident running totals
+struct UsageStage {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t count;
+  uint32_t values[USAGE_COUNT];
+};
+
+// One flash slot
+struct UsageRecord {
+  uint16_t version;
+  uint16_t count;
+  uint32_t sequence;
+  uint32_t values[USAGE_COUNT];
+  uint32_t crc;        // CRC-32 of everything above
+};
+
+// Flash behind the slots (NVS on the ESP32)
+class UsageStore {
+public:
+  // False if the slot is empty or unreadable
+  virtual bool read(uint8_t slot, UsageRecord& record) = 0;
+  virtual bool write(uint8_t slot, const UsageRecord& record) = 0;
+};
+
+class UsageCounters {
+public:
+  static const uint8_t SLOTS = 4;
+  static const uint32_t MAX_UNFLUSHED = 100000;
+
+  // A flush is due `intervalMs` after the first unflushed increment, or
+  // once `batch` increments are pending
+  UsageCounters(UsageStore& store, uint32_t intervalMs, uint16_t batch);
+
+  // Recovers the totals from flash and `stage`. Totals carried over in RTC
+  // memory are flushed straight away: the reset may have been a brownout
+  // that is about to turn into a power loss.
+  void begin(UsageStage* stage, uint32_t nowMs);
+
+  inline void increment(UsageCounter c) {
+    if (stage) {
+      __atomic_fetch_add(&stage->values[c], 1, __ATOMIC_RELAXED);
+    }
+  }
+
+  uint32_t value(UsageCounter c) const { return stage ? stage->values[c] : 0; }
+  static const char* name(UsageCounter c);
+
+  // Increments not yet in flash
+  uint32_t pending() const;
+  bool flushDue(uint32_t nowMs);
+  // False if the store refused the write; the totals stay pending
+  bool flush(uint32_t nowMs);
+
+  uint32_t sequence() const { return persisted.sequence; }
+  uint32_t flushes() const { return flushCount; }
+  uint32_t flushFailures() const { return failureCount; }
+  uint32_t recovered() const { return recoveredCount; }   // Pending totals RTC memory carried over at boot
+
+private:
+  static uint32_t crc32(const uint8_t* data, size_t len);
+  static uint32_t recordCrc(const UsageRecord& record);
+
+  UsageStore& store;
+  uint32_t interval;
+  uint16_t batchSize;
+  UsageStage* stage;
+  UsageRecord persisted;      // Last record written or recovered
+  uint8_t nextSlot;
+  bool waiting;               // Pending increments seen; timer running
+  uint32_t waitingSinceMs;
+  uint32_t flushCount;
+  uint32_t failureCount;
+  uint32_t recoveredCount;
+};
+
+#endif
@@ -4,48 +4,154 @@
 #include <ArduinoJson.h>
 #include "esp_camera.h"
 #include "esp_http_server.h"
-#include <WebSocketsServer.h>
-
-// ==================== CAMERA PINS (ESP32-CAM) ====================
-#define PWDN_GPIO_NUM     32
-#define RESET_GPIO_NUM    -1
-#define XCLK_GPIO_NUM      0
-#define SIOD_GPIO_NUM     26
-#define SIOC_GPIO_NUM     27
-#define Y9_GPIO_NUM       35
-#define Y8_GPIO_NUM       34
-#define Y7_GPIO_NUM       39
-#define Y6_GPIO_NUM       36
-#define Y5_GPIO_NUM       21
-#define Y4_GPIO_NUM       19
-#define Y3_GPIO_NUM       18
-#define Y2_GPIO_NUM        5
-#define VSYNC_GPIO_NUM    25
-#define HREF_GPIO_NUM     23
-#define PCLK_GPIO_NUM     22
+#include "img_converters.h"
+#include <HTTPClient.h>
+#include <esp_timer.h>
+#include <Metrics.h>
+#include <CaptureTuner.h>
+#include <PresenceDetector.h>
+#include <BinProtocol.h>
+#include <LatencyTrace.h>
+#include <BoardConfig.h>
+#include <StationLink.h>
+#include <FirmwareUpdate.h>
 
 // ==================== GLOBAL VARIABLES ====================
 const char* ssid = "YOUR_WIFI_SSID";
 const char* password = "YOUR_WIFI_PASSWORD";
 const char* backend_url = "http://your-backend-url.com";
+// Signs firmware updates (tools/ota_delta.py sign); empty refuses them all
+const char* ota_key = "";
+char detectUrl[128];   // Built once in setup() instead of on every detection
 
-WebSocketsServer webSocket(81);
 AsyncWebServer server(80);
+AsyncWebSocket ws("/ws");
+
+// CAN health heartbeat (decode with tools/can_decode.py)
+const uint8_t CAN_NODE_ID = 0x01;                 // Same node id as the station's controller
+const uint32_t CAN_HEARTBEAT_INTERVAL_MS = 1000;
+const uint32_t CAN_HEARTBEAT_MIN_GAP_MS = 100;
+Heartbeat canHeartbeat(CAN_HEARTBEAT_INTERVAL_MS, CAN_HEARTBEAT_MIN_GAP_MS);
+
+// Controller's clock, for stage reports it can line up with its own
+ClockSync clockSync;
+
+// OTA: written by the web server or a download task, reboot decided by the loop
+FirmwareUpdate firmwareUpdate(ota_key);
 
 // Material detection state
-bool isDetecting = false;
-String lastDetectedMaterial = "UNKNOWN";
+bool cameraReady = false;
+uint8_t captureErrors = 0;            // CameraError bits from the last detection, per stage
+uint8_t uploadErrors = 0;
+uint32_t lastDetectDurationMs = 0;
+volatile bool detectRequested = false;   // Set by the web API, handled in loop()
+Material lastDetectedMaterial = MATERIAL_UNKNOWN;
+
+// Detection pipeline: loop() queues requests, the capture task (app core)
+// grabs frames and the upload task (protocol core, next to WiFi) runs the
+// classifier round trip. The frame queue holds as many frames as the driver
+// has buffers, so one is captured while the previous one is in flight.
+struct DetectJob {
+  uint16_t traceId;   // From the CAN request; 0 for web API detections
+};
+struct CapturedFrame {
+  camera_fb_t* fb;
+  uint16_t traceId;
+  uint32_t startMs;
+  uint8_t step;       // CAPTURE_STEPS entry it was taken with
+};
+const uint8_t DETECT_QUEUE_LENGTH = 4;
+const uint8_t CAPTURE_CORE = 1;
+const uint8_t UPLOAD_CORE = 0;
+QueueHandle_t detectQueue = nullptr;
+QueueHandle_t frameQueue = nullptr;
+uint8_t frameBuffers = 1;             // fb_count chosen in setupCamera()
+OccupancyMeter captureStage;
+OccupancyMeter uploadStage;
+uint32_t droppedRequests = 0;         // Arrived with the request queue full
+
+// Frame size and JPEG quality, best first; the tuner walks down this
+// ladder when uploads get slow. Frame buffers are sized for the step the
+// camera starts at, so it never goes above that.
+const CaptureStep CAPTURE_STEPS[] = {
+  { FRAMESIZE_SVGA, 800, 600, 12 },   // Without PSRAM
+  { FRAMESIZE_VGA, 640, 480, 10 },    // With PSRAM
+  { FRAMESIZE_VGA, 640, 480, 14 },
+  { FRAMESIZE_CIF, 400, 296, 12 },
+  { FRAMESIZE_CIF, 400, 296, 16 },
+  { FRAMESIZE_QVGA, 320, 240, 14 },
+  { FRAMESIZE_QVGA, 320, 240, 20 },
+};
+const uint8_t DRAM_CAPTURE_STEP = 0;
+const uint8_t PSRAM_CAPTURE_STEP = 1;
+const CaptureTunerConfig CAPTURE_TUNER_CONFIG = {
+  CAPTURE_STEPS,
+  sizeof(CAPTURE_STEPS) / sizeof(CAPTURE_STEPS[0]),
+  320,    // minWidth: the classifier's smallest input
+  2500,   // budgetMs: half the controller's detection timeout, the rest is capture, bus and queueing
+};
+CaptureTuner captureTuner(CAPTURE_TUNER_CONFIG);
+uint8_t appliedStep = 0;   // Capture task only
+
+// Presence: between detections the capture task decodes a frame at 1/8
+// scale every PRESENCE_INTERVAL_MS and compares it with the empty chute.
+// Changes go to the controller, which can use them as a trigger, and a
+// detection with nothing in the chute is answered MATERIAL_NONE without
+// calling the classifier.
+const uint32_t PRESENCE_INTERVAL_MS = 200;
+const uint32_t PRESENCE_WAIT_MS = 1500;   // The PIR fires as someone walks up, before the item is in view
+const uint32_t PRESENCE_POLL_MS = 100;
+const PresenceConfig PRESENCE_CONFIG = {
+  CameraBoard::CHUTE_LEFT_PERCENT * PresenceDetector::GRID_W / 100,
+  CameraBoard::CHUTE_TOP_PERCENT * PresenceDetector::GRID_H / 100,
+  CameraBoard::CHUTE_WIDTH_PERCENT * PresenceDetector::GRID_W / 100,
+  CameraBoard::CHUTE_HEIGHT_PERCENT * PresenceDetector::GRID_H / 100,
+  20,    // pixelThreshold
+  60,    // enterPermille
+  30,    // leavePermille
+  5,     // learnShift: follows a slow change in about 32 samples
+  25,    // warmupFrames: 5 s after boot
+};
+PresenceDetector presence(PRESENCE_CONFIG);
+Heartbeat presenceBeat(2000, 100, 1);   // Compares the flags byte only
+uint8_t* presenceBuffer = nullptr;      // Decoded frame; capture task only
+size_t presenceBufferSize = 0;
+LatencyHistogram presenceCost;          // Decode plus model update, per frame
+uint32_t suppressedDetections = 0;      // Answered without the classifier
+
+// Backend connection, kept open between detections (upload task only).
+// Replies are parsed straight off the socket into a DetectReply; only the
+// fields in the filter are kept, so nothing is allocated per detection.
+HTTPClient detectHttp;
+const size_t MAX_RESPONSE_SIZE = 2048;   // Classifier replies are a few hundred bytes
+uint32_t backendRequests = 0;
+uint32_t reusedConnections = 0;
+
+struct DetectReply {
+  Material material;
+  float confidence;
+};
 
 // ==================== FUNCTION DECLARATIONS ====================
 void setupCamera();
 void setupWiFi();
 void setupWebServer();
-void setupCAN();
-void sendCANMessage(uint32_t id, String message);
-bool receiveCANMessage(uint32_t* id, String* message);
-void detectMaterial();
-void sendToBackend(uint8_t* image, size_t len);
-void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length);
+void setupPipeline();
+bool queueDetection(uint16_t traceId);
+bool detecting();
+void captureTask(void* arg);
+void uploadTask(void* arg);
+void applyCaptureStep();
+camera_fb_t* captureItem(bool& empty);
+void samplePresence();
+bool checkPresence(camera_fb_t* fb);
+void sendMaterialResult(uint16_t traceId, Material material);
+void reportStage(uint16_t traceId, DetectStage stage);
+void handleTimeSync(const CanMessage& msg);
+void updateHeartbeat();
+void sendToBackend(const CapturedFrame& frame);
+bool readDetectReply(Stream& body, DetectReply& reply);
+void webSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t length);
 
 // ==================== SETUP ====================
 void setup() {
@@ -55,38 +161,57 @@ void setup() {
   // Initialize Camera
   setupCamera();
   
+  snprintf(detectUrl, sizeof(detectUrl), "%s/api/detect", backend_url);
+  detectHttp.setReuse(true);
+  
+  // Capture and upload tasks, fed from loop()
+  setupPipeline();
+  
   // Initialize WiFi
   setupWiFi();
   
   // Initialize CAN
-  setupCAN();
+  setupCAN(CameraBoard::CAN_TX_PIN, CameraBoard::CAN_RX_PIN);
+  
+  // Initialize WebSocket (served by the web server on /ws)
+  ws.onEvent(webSocketEvent);
+  server.addHandler(&ws);
   
   // Initialize Web Server
   setupWebServer();
   
-  // Initialize WebSocket
-  webSocket.begin();
-  webSocket.onEvent(webSocketEvent);
-  
   Serial.println("ESP32-CAM Material Detection System Initialized");
 }
 
 // ==================== MAIN LOOP ====================
 void loop() {
-  webSocket.loop();
-  
   // Check for CAN messages requesting material detection
-  uint32_t canId;
-  String canMessage;
+  CanMessage canMessage;
+  
+  uint16_t traceId;
   
-  if (receiveCANMessage(&canId, &canMessage)) {
-    if (canId == 0x100 && canMessage == "DETECT_MATERIAL") {
+  while (receiveCANMessage(canMessage)) {
+    if (parseDetectRequest(canMessage, traceId)) {
       Serial.println("Material detection requested");
-      isDetecting = true;
-      detectMaterial();
+      queueDetection(traceId);
+    } else {
+      handleTimeSync(canMessage);
     }
   }
   
+  if (detectRequested) {
+    detectRequested = false;
+    queueDetection(0);
+  }
+  
+  updateHeartbeat();
+  
+  // Only between detections
+  if (firmwareUpdate.rebootDue(millis()) && !detecting()) {
+    Serial.println("Rebooting into the new firmware");
+    ESP.restart();
+  }
+  
   delay(100);
 }
 
@@ -95,34 +220,37 @@ void setupCamera() {
   camera_config_t config;
   config.ledc_channel = LEDC_CHANNEL_0;
   config.ledc_timer = LEDC_TIMER_0;
-  config.pin_d0 = Y2_GPIO_NUM;
-  config.pin_d1 = Y3_GPIO_NUM;
-  config.pin_d2 = Y4_GPIO_NUM;
-  config.pin_d3 = Y5_GPIO_NUM;
-  config.pin_d4 = Y6_GPIO_NUM;
-  config.pin_d5 = Y7_GPIO_NUM;
-  config.pin_d6 = Y8_GPIO_NUM;
-  config.pin_d7 = Y9_GPIO_NUM;
-  config.pin_xclk = XCLK_GPIO_NUM;
-  config.pin_pclk = PCLK_GPIO_NUM;
-  config.pin_vsync = VSYNC_GPIO_NUM;
-  config.pin_href = HREF_GPIO_NUM;
-  config.pin_sscb_sda = SIOD_GPIO_NUM;
-  config.pin_sscb_scl = SIOC_GPIO_NUM;
-  config.pin_pwdn = PWDN_GPIO_NUM;
-  config.pin_reset = RESET_GPIO_NUM;
-  config.xclk_freq_hz = 20000000;
+  config.pin_d0 = CameraBoard::Y2_PIN;
+  config.pin_d1 = CameraBoard::Y3_PIN;
+  config.pin_d2 = CameraBoard::Y4_PIN;
+  config.pin_d3 = CameraBoard::Y5_PIN;
+  config.pin_d4 = CameraBoard::Y6_PIN;
+  config.pin_d5 = CameraBoard::Y7_PIN;
+  config.pin_d6 = CameraBoard::Y8_PIN;
+  config.pin_d7 = CameraBoard::Y9_PIN;
+  config.pin_xclk = CameraBoard::XCLK_PIN;
+  config.pin_pclk = CameraBoard::PCLK_PIN;
+  config.pin_vsync = CameraBoard::VSYNC_PIN;
+  config.pin_href = CameraBoard::HREF_PIN;
+  config.pin_sscb_sda = CameraBoard::SIOD_PIN;
+  config.pin_sscb_scl = CameraBoard::SIOC_PIN;
+  config.pin_pwdn = CameraBoard::PWDN_PIN;
+  config.pin_reset = CameraBoard::RESET_PIN;
+  config.xclk_freq_hz = CameraBoard::XCLK_HZ;
   config.pixel_format = PIXFORMAT_JPEG;
   
-  // Frame size
+  // Frame size; frame buffers stay out of internal RAM when PSRAM is fitted
+  uint8_t step = psramFound() ? PSRAM_CAPTURE_STEP : DRAM_CAPTURE_STEP;
+  config.frame_size = (framesize_t)CAPTURE_STEPS[step].frameSize;
+  config.jpeg_quality = CAPTURE_STEPS[step].quality;
   if(psramFound()){
-    config.frame_size = FRAMESIZE_VGA;
-    config.jpeg_quality = 10;
     config.fb_count = 2;
+    config.fb_location = CAMERA_FB_IN_PSRAM;
+    config.grab_mode = CAMERA_GRAB_LATEST;   // A queued frame is never older than the request
   } else {
-    config.frame_size = FRAMESIZE_SVGA;
-    config.jpeg_quality = 12;
     config.fb_count = 1;
+    config.fb_location = CAMERA_FB_IN_DRAM;
+    config.grab_mode = CAMERA_GRAB_WHEN_EMPTY;
   }
   
   // Initialize camera
@@ -131,114 +259,327 @@ void setupCamera() {
     Serial.printf("Camera init failed with error 0x%x", err);
     return;
   }
+  cameraReady = true;
+  frameBuffers = config.fb_count;
+  captureTuner.start(step);
+  appliedStep = step;
+  
+  // Presence frames are decoded at 1/8 scale as RGB565, never larger than
+  // the starting step
+  presenceBufferSize = (CAPTURE_STEPS[step].width / 8) * (CAPTURE_STEPS[step].height / 8) * 2;
+  presenceBuffer = (uint8_t*)(psramFound() ? ps_malloc(presenceBufferSize) : malloc(presenceBufferSize));
   
   Serial.println("Camera initialized successfully");
 }
 
 // ==================== WIFI SETUP ====================
 void setupWiFi() {
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  
-  Serial.print("Connecting to WiFi");
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
+  connectWiFi(ssid, password, 20);
+}
+
+// ==================== CAN ====================
+// SYNC is stamped on arrival; the follow-up says when the controller sent it
+void handleTimeSync(const CanMessage& msg) {
+  uint8_t node;
+  uint8_t seq;
+  uint64_t masterUs;
+  if (parseTimeSync(msg, node, seq)) {
+    if (node == CAN_NODE_ID) {
+      clockSync.onSync(seq, esp_timer_get_time());
+    }
+  } else if (parseTimeFollowUp(msg, node, seq, masterUs)) {
+    if (node == CAN_NODE_ID) {
+      clockSync.onFollowUp(seq, masterUs);
+    }
   }
+}
+
+// Tells the controller when a stage of the current detection happened,
+// in its timebase once synced
+void reportStage(uint16_t traceId, DetectStage stage) {
+  if (traceId == 0) {
+    return;
+  }
+  uint64_t nowUs = esp_timer_get_time();
+  bool synced = clockSync.synced(nowUs);
+  CanMessage msg;
+  makeStageReport(msg, CAN_NODE_ID, traceId, stage,
+                  (uint32_t)(synced ? clockSync.toMaster(nowUs) : nowUs), synced);
+  sendCANMessage(msg);
+}
+
+// Sends the packed health frame every interval and soon after a change
+void updateHeartbeat() {
+  CameraHealth health;
+  health.flags = (cameraReady ? CAMERA_READY : 0) |
+                 (WiFi.status() == WL_CONNECTED ? CAMERA_WIFI : 0) |
+                 (detecting() ? CAMERA_DETECTING : 0) |
+                 (psramFound() ? CAMERA_PSRAM : 0);
+  health.lastMaterial = lastDetectedMaterial;
+  uint32_t tenths = lastDetectDurationMs / 100;
+  health.detectTenths = tenths > 255 ? 255 : tenths;
+  health.errors = captureErrors | uploadErrors;
+  uint32_t heapKb = ESP.getFreeHeap() / 1024;
+  health.freeHeapKb = heapKb > 255 ? 255 : heapKb;
+  health.uptimeS = millis() / 1000;
   
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi Connected!");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-    Serial.println("\nWiFi Connection Failed");
+  CanMessage frame;
+  packCameraHealth(frame, CAN_NODE_ID, health);
+  if (canHeartbeat.due(millis(), frame)) {
+    sendCANMessage(frame);
+  }
+}
+
+// ==================== DETECTION PIPELINE ====================
+void setupPipeline() {
+  detectQueue = xQueueCreate(DETECT_QUEUE_LENGTH, sizeof(DetectJob));
+  frameQueue = xQueueCreate(frameBuffers, sizeof(CapturedFrame));
+  uint64_t nowUs = esp_timer_get_time();
+  captureStage.reset(nowUs);
+  uploadStage.reset(nowUs);
+  // Above loop() so a request is picked up even while loop() is busy
+  xTaskCreatePinnedToCore(captureTask, "capture", 4096, nullptr, 2, nullptr, CAPTURE_CORE);
+  xTaskCreatePinnedToCore(uploadTask, "upload", 8192, nullptr, 2, nullptr, UPLOAD_CORE);
+}
+
+bool queueDetection(uint16_t traceId) {
+  DetectJob job = { traceId };
+  if (xQueueSend(detectQueue, &job, 0) != pdTRUE) {
+    droppedRequests++;   // The controller times out and falls back
+    return false;
   }
+  return true;
 }
 
-// ==================== CAN SETUP ====================
-void setupCAN() {
-  // Initialize TWAI (CAN) on ESP32
-  Serial.println("CAN/TWAI initialized");
+// Anything queued or in a stage
+bool detecting() {
+  return uxQueueMessagesWaiting(detectQueue) > 0 || uxQueueMessagesWaiting(frameQueue) > 0 ||
+         captureStage.busy() || uploadStage.busy();
 }
 
-void sendCANMessage(uint32_t id, String message) {
-  // Simplified CAN message sending
-  Serial.printf("CAN TX: ID=0x%03X, Message=%s\n", id, message.c_str());
+// Blocks in esp_camera_fb_get() while every frame buffer is queued or
+// uploading, which is what bounds the pipeline
+void captureTask(void* arg) {
+  DetectJob job;
+  while (true) {
+    if (xQueueReceive(detectQueue, &job, pdMS_TO_TICKS(PRESENCE_INTERVAL_MS)) != pdTRUE) {
+      samplePresence();
+      continue;
+    }
+    CapturedFrame frame;
+    frame.traceId = job.traceId;
+    frame.startMs = millis();
+    captureStage.begin(esp_timer_get_time());
+    reportStage(job.traceId, STAGE_CAPTURE_START);
+    applyCaptureStep();
+    frame.step = appliedStep;
+    bool empty;
+    frame.fb = captureItem(empty);
+    reportStage(job.traceId, STAGE_CAPTURE_END);
+    captureStage.end(esp_timer_get_time());
+    if (!frame.fb) {
+      Serial.println("Camera capture failed");
+      captureErrors = CAMERA_ERR_CAPTURE;
+      continue;
+    }
+    captureErrors = 0;
+    if (empty) {
+      esp_camera_fb_return(frame.fb);
+      suppressedDetections++;
+      lastDetectedMaterial = MATERIAL_NONE;
+      lastDetectDurationMs = millis() - frame.startMs;
+      Serial.println("Chute empty, classifier skipped");
+      sendMaterialResult(job.traceId, MATERIAL_NONE);
+      continue;
+    }
+    xQueueSend(frameQueue, &frame, portMAX_DELAY);
+  }
+}
+
+void uploadTask(void* arg) {
+  CapturedFrame frame;
+  while (true) {
+    if (xQueueReceive(frameQueue, &frame, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    uploadStage.begin(esp_timer_get_time());
+    Serial.printf("Captured image: %d bytes\n", frame.fb->len);
+    sendToBackend(frame);
+    esp_camera_fb_return(frame.fb);
+    uploadStage.end(esp_timer_get_time());
+    lastDetectDurationMs = millis() - frame.startMs;
+  }
 }
 
-bool receiveCANMessage(uint32_t* id, String* message) {
-  // Simplified CAN message receiving
-  // In real implementation, use ESP32 TWAI library
-  return false;
+// Takes frames until something is in the chute or PRESENCE_WAIT_MS has
+// passed, and sets `empty` in the second case. Without a usable presence
+// model every frame counts as an item.
+camera_fb_t* captureItem(bool& empty) {
+  uint32_t startMs = millis();
+  empty = false;
+  while (true) {
+    camera_fb_t* fb = esp_camera_fb_get();
+    if (!fb || !checkPresence(fb) || !presence.ready() || presence.present()) {
+      return fb;
+    }
+    if (millis() - startMs >= PRESENCE_WAIT_MS) {
+      empty = true;
+      return fb;
+    }
+    esp_camera_fb_return(fb);
+    vTaskDelay(pdMS_TO_TICKS(PRESENCE_POLL_MS));
+  }
 }
 
-// ==================== MATERIAL DETECTION ====================
-void detectMaterial() {
-  // Capture image
-  camera_fb_t * fb = esp_camera_fb_get();
-  if (!fb) {
-    Serial.println("Camera capture failed");
-    isDetecting = false;
+void samplePresence() {
+  if (!cameraReady || presenceBuffer == nullptr) {
     return;
   }
+  camera_fb_t* fb = esp_camera_fb_get();
+  if (fb) {
+    checkPresence(fb);
+    esp_camera_fb_return(fb);
+  }
+}
+
+// Runs `fb` through the presence model and tells the controller about
+// changes; false if the frame couldn't be decoded
+bool checkPresence(camera_fb_t* fb) {
+  uint16_t width = fb->width / 8;
+  uint16_t height = fb->height / 8;
+  size_t pixels = (size_t)width * height;
+  if (presenceBuffer == nullptr || pixels * 2 > presenceBufferSize) {
+    return false;
+  }
+  uint64_t startUs = esp_timer_get_time();
+  if (!jpg2rgb565(fb->buf, fb->len, presenceBuffer, JPG_SCALE_8X)) {
+    return false;
+  }
+  PresenceDetector::lumaFromRgb565(presenceBuffer, presenceBuffer, pixels);
+  presence.update(presenceBuffer, width, height);
+  presenceCost.record((uint32_t)(esp_timer_get_time() - startUs));
   
-  Serial.printf("Captured image: %d bytes\n", fb->len);
-  
-  // Send image to backend for detection
-  sendToBackend(fb->buf, fb->len);
-  
-  // Return frame buffer
-  esp_camera_fb_return(fb);
-  
-  isDetecting = false;
+  PresenceReport report = { presence.present(), presence.ready(), presence.changedPermille() };
+  CanMessage msg;
+  makePresence(msg, CAN_NODE_ID, report);
+  if (presenceBeat.due(millis(), msg)) {
+    sendCANMessage(msg);
+  }
+  return true;
+}
+
+// Switches the sensor to the tuner's current setting without restarting
+// the camera. The frame already buffered is still the old size, so it is
+// dropped.
+void applyCaptureStep() {
+  uint8_t step = captureTuner.step();
+  sensor_t* sensor = esp_camera_sensor_get();
+  if (step == appliedStep || sensor == nullptr) {
+    return;
+  }
+  const CaptureStep& setting = CAPTURE_STEPS[step];
+  if (sensor->set_framesize(sensor, (framesize_t)setting.frameSize) != 0) {
+    return;
+  }
+  sensor->set_quality(sensor, setting.quality);
+  appliedStep = step;
+  camera_fb_t* stale = esp_camera_fb_get();
+  if (stale) {
+    esp_camera_fb_return(stale);
+  }
+  Serial.printf("Capture now %ux%u q%u\n", setting.width, setting.height, setting.quality);
 }
 
 // ==================== BACKEND COMMUNICATION ====================
-void sendToBackend(uint8_t* image, size_t len) {
+// Classifier time from the backend's `Server-Timing: classify;dur=<ms>`
+static uint32_t serverTimingMs(const String& header) {
+  const char* dur = strstr(header.c_str(), "dur=");
+  return dur ? (uint32_t)atof(dur + 4) : 0;
+}
+
+void sendToBackend(const CapturedFrame& frame) {
+  uint16_t traceId = frame.traceId;
+  uploadErrors = 0;
   if (WiFi.status() != WL_CONNECTED) {
     Serial.println("WiFi not connected, cannot send to backend");
+    uploadErrors = CAMERA_ERR_BACKEND;
     // Send CAN message with default response
-    sendCANMessage(0x200, "MATERIAL:UNKNOWN");
+    sendMaterialResult(traceId, MATERIAL_UNKNOWN);
     return;
   }
   
-  HTTPClient http;
-  http.begin(String(backend_url) + "/api/detect");
-  http.addHeader("Content-Type", "image/jpeg");
+  // begin() keeps the open connection when it is to the same host
+  static const char* TIMING_HEADERS[] = { "Server-Timing" };
+  backendRequests++;
+  if (detectHttp.connected()) {
+    reusedConnections++;
+  }
+  detectHttp.begin(detectUrl);
+  detectHttp.addHeader("Content-Type", "image/jpeg");
+  detectHttp.collectHeaders(TIMING_HEADERS, 1);
   
-  int httpResponseCode = http.POST(image, len);
+  // The body is written from the frame buffer as is
+  reportStage(traceId, STAGE_UPLOAD_START);
+  uint32_t postStart = millis();
+  int httpResponseCode = detectHttp.POST(frame.fb->buf, frame.fb->len);
+  uint32_t postMs = millis() - postStart;
+  reportStage(traceId, STAGE_UPLOAD_END);
   
   if (httpResponseCode > 0) {
-    String response = http.getString();
-    Serial.printf("Backend response: %d - %s\n", httpResponseCode, response.c_str());
-    
-    // Parse response
-    DynamicJsonDocument doc(1024);
-    DeserializationError error = deserializeJson(doc, response);
+    // Without the header the whole round trip counts as transfer, which
+    // only makes the tuner more cautious
+    uint32_t serverMs = serverTimingMs(detectHttp.header("Server-Timing"));
+    captureTuner.record(frame.step, frame.fb->len, serverMs < postMs ? postMs - serverMs : 1, serverMs);
     
-    if (!error) {
-      String material = doc["material"];
-      float confidence = doc["confidence"];
-      
-      Serial.printf("Detected material: %s (confidence: %.2f)\n", material.c_str(), confidence);
+    // Chunked or oversized bodies are not from the classifier
+    int size = detectHttp.getSize();
+    DetectReply reply;
+    if (httpResponseCode == HTTP_CODE_OK && size > 0 && size <= (int)MAX_RESPONSE_SIZE &&
+        readDetectReply(detectHttp.getStream(), reply)) {
+      Serial.printf("Detected material: %s (confidence: %.2f)\n", materialName(reply.material), reply.confidence);
       
       // Send result via CAN
-      String canMessage = "MATERIAL:" + material;
-      sendCANMessage(0x200, canMessage);
+      sendMaterialResult(traceId, reply.material);
       
-      lastDetectedMaterial = material;
+      lastDetectedMaterial = reply.material;
     } else {
-      Serial.println("Failed to parse backend response");
-      sendCANMessage(0x200, "MATERIAL:UNKNOWN");
+      Serial.printf("Unusable backend response: %d, %d bytes\n", httpResponseCode, size);
+      uploadErrors = CAMERA_ERR_RESPONSE;
+      sendMaterialResult(traceId, MATERIAL_UNKNOWN);
     }
   } else {
-    Serial.printf("Backend error: %s\n", http.errorToString(httpResponseCode).c_str());
-    sendCANMessage(0x200, "MATERIAL:UNKNOWN");
+    Serial.printf("Backend error: %s\n", detectHttp.errorToString(httpResponseCode).c_str());
+    uploadErrors = CAMERA_ERR_BACKEND;
+    captureTuner.recordFailure();
+    sendMaterialResult(traceId, MATERIAL_UNKNOWN);
   }
   
-  http.end();
+  // Drains whatever the parser left and keeps the socket if the server allows it
+  detectHttp.end();
+}
+
+// Parses `{"material": ..., "confidence": ...}` off the response stream,
+// skipping everything else the classifier sends
+bool readDetectReply(Stream& body, DetectReply& reply) {
+  static StaticJsonDocument<64> filter;
+  if (filter.isNull()) {
+    filter["material"] = true;
+    filter["confidence"] = true;
+  }
+  StaticJsonDocument<128> doc;
+  if (deserializeJson(doc, body, DeserializationOption::Filter(filter))) {
+    return false;
+  }
+  reply.material = materialFromName(doc["material"]);
+  reply.confidence = doc["confidence"] | 0.0f;
+  return true;
+}
+
+void sendMaterialResult(uint16_t traceId, Material material) {
+  reportStage(traceId, STAGE_RESULT_TX);
+  CanMessage msg;
+  makeMaterialResult(msg, material, traceId);
+  sendCANMessage(msg);
 }
 
 // ==================== WEB SERVER SETUP ====================
@@ -248,51 +589,114 @@ void setupWebServer() {
     request->send(200, "text/html", "<html><body><h1>ESP32-CAM Material Detection</h1></body></html>");
   });
   
-  // Capture and send image
-  server.on("/capture", HTTP_GET, [](AsyncWebServerRequest *request){
-    camera_fb_t * fb = esp_camera_fb_get();
-    if (!fb) {
-      request->send(500, "text/plain", "Camera capture failed");
-      return;
-    }
-    
-    request->send_P(200, "image/jpeg", (const uint8_t*)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
-  });
+  // Live frame for aiming the camera; sealed boards never serve images
+  if (CameraBoard::HAS_PREVIEW) {
+    server.on("/capture", HTTP_GET, [](AsyncWebServerRequest *request){
+      camera_fb_t * fb = esp_camera_fb_get();
+      if (!fb) {
+        request->send(500, "text/plain", "Camera capture failed");
+        return;
+      }
+      
+      request->send_P(200, "image/jpeg", (const uint8_t*)fb->buf, fb->len);
+      esp_camera_fb_return(fb);
+    });
+  }
   
   // Get last detected material
   server.on("/api/material", HTTP_GET, [](AsyncWebServerRequest *request){
-    DynamicJsonDocument doc(256);
-    doc["material"] = lastDetectedMaterial;
-    doc["detecting"] = isDetecting;
+    StaticJsonDocument<128> doc;
+    doc["material"] = materialName(lastDetectedMaterial);
+    doc["detecting"] = detecting();
     
-    String response;
-    serializeJson(doc, response);
+    char response[128];
+    serializeJson(doc, response, sizeof(response));
+    request->send(200, "application/json", response);
+  });
+  
+  // Health: heap fragmentation shows as a shrinking largest block
+  server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request){
+    StaticJsonDocument<1536> doc;
+    doc["material"] = materialName(lastDetectedMaterial);
+    doc["detecting"] = detecting();
+    doc["free_heap"] = ESP.getFreeHeap();
+    JsonObject heap = doc.createNestedObject("heap");
+    heap["free"] = ESP.getFreeHeap();
+    heap["largest_block"] = ESP.getMaxAllocHeap();
+    heap["min_free"] = ESP.getMinFreeHeap();
+    heap["psram_free"] = ESP.getFreePsram();
+    JsonObject backend = doc.createNestedObject("backend");
+    backend["requests"] = backendRequests;
+    backend["reused_connections"] = reusedConnections;
+    JsonObject clock = doc.createNestedObject("clock");
+    clock["synced"] = clockSync.synced(esp_timer_get_time());
+    clock["offset_us"] = clockSync.offsetUs();
+    clock["rounds"] = clockSync.completedRounds();
+    // Share of wall time each stage was working; the busier one bounds throughput
+    uint64_t nowUs = esp_timer_get_time();
+    JsonObject pipeline = doc.createNestedObject("pipeline");
+    pipeline["frame_buffers"] = frameBuffers;
+    pipeline["capture_occupancy"] = captureStage.occupancy(nowUs);
+    pipeline["upload_occupancy"] = uploadStage.occupancy(nowUs);
+    pipeline["requests_queued"] = uxQueueMessagesWaiting(detectQueue);
+    pipeline["frames_queued"] = uxQueueMessagesWaiting(frameQueue);
+    pipeline["captures"] = captureStage.jobs();
+    pipeline["uploads"] = uploadStage.jobs();
+    pipeline["dropped"] = droppedRequests;
+    const CaptureStep& setting = captureTuner.setting();
+    JsonObject capture = doc.createNestedObject("capture");
+    capture["width"] = setting.width;
+    capture["height"] = setting.height;
+    capture["quality"] = setting.quality;
+    capture["step"] = captureTuner.step();
+    capture["throughput_bps"] = captureTuner.throughputBytesPerS();
+    capture["server_ms"] = captureTuner.serverMs();
+    capture["predicted_ms"] = captureTuner.predictedMs(captureTuner.step());
+    capture["budget_ms"] = captureTuner.budgetMs();
+    capture["changes"] = captureTuner.changes();
+    // Detections answered without the classifier against those sent to it
+    JsonObject chute = doc.createNestedObject("presence");
+    chute["present"] = presence.present();
+    chute["ready"] = presence.ready();
+    chute["changed_permille"] = presence.changedPermille();
+    chute["frames"] = presence.frames();
+    chute["suppressed"] = suppressedDetections;
+    chute["classified"] = uploadStage.jobs();
+    chute["cost_avg_us"] = presenceCost.count() ? (uint32_t)(presenceCost.sumMicros() / presenceCost.count()) : 0;
+    chute["cost_max_us"] = presenceCost.maxMicros();
+    doc["uptime"] = millis() / 1000;
+    
+    char response[1536];
+    serializeJson(doc, response, sizeof(response));
     request->send(200, "application/json", response);
   });
   
   // Trigger detection
   server.on("/api/detect", HTTP_POST, [](AsyncWebServerRequest *request){
-    isDetecting = true;
-    detectMaterial();
+    // Queued from loop(); the web server task never waits on the pipeline
+    detectRequested = true;
     request->send(200, "application/json", "{\"status\":\"detecting\"}");
   });
   
+  // Firmware updates, full image or delta patch (tools/ota_delta.py)
+  addOtaRoutes(server, firmwareUpdate);
+  
   server.begin();
 }
 
 // ==================== WEBSOCKET ====================
-void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
+void webSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t length) {
   switch(type) {
-    case WStype_DISCONNECTED:
-      Serial.printf("Client [%u] disconnected\n", num);
+    case WS_EVT_DISCONNECT:
+      Serial.printf("Client [%u] disconnected\n", client->id());
       break;
       
-    case WStype_CONNECTED:
-      Serial.printf("Client [%u] connected\n", num);
+    case WS_EVT_CONNECT:
+      Serial.printf("Client [%u] connected\n", client->id());
+      ws.cleanupClients();
       break;
       
-    case WStype_TEXT:
+    case WS_EVT_DATA:
       // Handle commands
       break;
       
@@ -300,4 +704,3 @@ void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length
       break;
   }
 }
-
@@ -4,333 +4,860 @@
 #include <ArduinoJson.h>
 #include <ESP32Servo.h>
 #include <HX711.h>
-#include <WebSocketsServer.h>
 #include <HTTPClient.h>
+#include <FillEstimator.h>
+#include <FillForecast.h>
+#include <SamplingPolicy.h>
+#include <PatternEngine.h>
+#include <esp_timer.h>
+#include <Metrics.h>
+#include <EventTrace.h>
+#include <BinProtocol.h>
+#include <BinController.h>
+#include <InputTrace.h>
+#include <Arena.h>
+#include <LatencyTrace.h>
+#include <BoardConfig.h>
+#include <StationConfig.h>
+#include <StationLink.h>
+#include <FirmwareUpdate.h>
+#include <RateLimiter.h>
+#include <UsageCounters.h>
+#include <FillHistory.h>
+#include <BinGateway.h>
+#include <esp_now.h>
+#include <esp_wifi.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <time.h>
+#include <sys/time.h>
 
 // ==================== PIN DEFINITIONS ====================
-// Ultrasonic Sensor
-#define TRIG_PIN 4
-#define ECHO_PIN 5
+// Pins, servo angles, calibration and bin geometry come from the board
+// variant selected at build time; see lib/BoardConfig/BoardConfig.h
 
-// PIR Motion Sensor
-#define PIR_PIN 2
-
-// Servo Motors (for bin lids)
-#define SERVO_ORGANIC_PIN 18
-#define SERVO_NON_ORGANIC_PIN 19
-
-// Load Cell
-#define LOAD_CELL_DOUT_PIN 16
-#define LOAD_CELL_SCK_PIN 17
-
-// LEDs (RGB or individual)
-#define LED_RED_PIN 25
-#define LED_GREEN_PIN 26
-#define LED_BLUE_PIN 27
-
-// Buzzer
-#define BUZZER_PIN 14
-
-// Keypad (using 2 buttons for simplicity, can be expanded)
-#define KEYPAD_BUTTON1_PIN 12
-#define KEYPAD_BUTTON2_PIN 13
-
-// CAN (using ESP32's TWAI - Two-Wire Automotive Interface)
-#define CAN_TX_PIN 21
-#define CAN_RX_PIN 22
+// LEDC PWM channels for LEDs and buzzer. 8..15 are the low-speed group and
+// channel pairs share a timer, so the buzzer gets its own pair to change
+// frequency freely. ESP32Servo allocates from the low channels.
+#define LEDC_RED_CHANNEL 8
+#define LEDC_GREEN_CHANNEL 9
+#define LEDC_BLUE_CHANNEL 10
+#define LEDC_BUZZER_CHANNEL 12
 
 // ==================== GLOBAL VARIABLES ====================
 // WiFi Credentials
 const char* ssid = "YOUR_WIFI_SSID";
 const char* password = "YOUR_WIFI_PASSWORD";
 const char* backend_url = "http://your-backend-url.com";
+// Signs firmware updates (tools/ota_delta.py sign); empty refuses them all
+const char* ota_key = "";
+char binUpdateUrl[128];   // Built once in setup() instead of on every upload
+
+// WiFi comes up in the background; the bin works without it
+const WiFiLinkConfig WIFI_CONFIG = {
+  ssid,
+  password,
+  IPAddress(),   // Static IP, e.g. IPAddress(192, 168, 1, 50); empty for DHCP
+  IPAddress(),   // Gateway
+  IPAddress(),   // Subnet
+  IPAddress(),   // DNS
+  3000           // fastTimeoutMs: cached AP before a full scan
+};
+const uint32_t WIFI_AP_FALLBACK_MS = 20000;   // Open the setup AP if still offline
+
+// Fill estimation (ultrasonic + load cell fusion); FILL_CONFIG and the
+// rest of the controller settings are in lib/StationConfig
+const unsigned long ECHO_TIMEOUT_US = 30000; // ~5 m round trip, no echo beyond this
+
+// Status indicators
+const uint32_t LED_PWM_FREQ = 5000;
+const uint8_t LED_PWM_RESOLUTION = 8;
+const uint64_t PATTERN_TICK_US = 20000; // 50 Hz pattern update
+
+// CAN status heartbeat (decode with tools/can_decode.py)
+const uint8_t CAN_NODE_ID = 0x01;                 // Unique per station on the bus
+const uint32_t CAN_HEARTBEAT_INTERVAL_MS = 1000;
+const uint32_t CAN_HEARTBEAT_MIN_GAP_MS = 100;    // Limits change-triggered frames
+const uint32_t CAN_TIME_SYNC_INTERVAL_MS = 1000;  // Camera clock sync for latency tracing
 
-// Bin Configuration
-const uint32_t BIN_ORGANIC_ID = 0x001;
-const uint32_t BIN_NON_ORGANIC_ID = 0x002;
-const float MAX_BIN_CAPACITY = 10.0; // kg
-const float BIN_FULL_THRESHOLD = 9.0; // kg (90% full)
+// Fill forecasting
+const unsigned long FORECAST_SAMPLE_INTERVAL = 60000; // 1 minute
+const uint32_t FORECAST_SHORT_WINDOW_S = 3600;        // 1 hour
+const uint32_t FORECAST_LONG_WINDOW_S = 24 * 3600;    // 1 day
+const float BIN_FULL_PERCENT = Board::fullPermille() / 10.0f;
+const long GMT_OFFSET_SEC = 0;                        // Local time for usage profile
+const char* ntpServer = "pool.ntp.org";
 
-// Servo Objects
-Servo servoOrganic;
-Servo servoNonOrganic;
+// Lid servos: one per bin, or a single diverter flap
+Servo lidServos[Board::LID_SERVOS];
 
-// Load Cell
+// Load Cell; tare offset and counts-per-gram live in NVS so a reboot
+// doesn't re-zero on whatever is in the bin
 HX711 scale;
+const char* SCALE_PREFS = "scale";
+const uint8_t SCALE_SAMPLES = 10;
+enum ScaleCommand { SCALE_NONE, SCALE_TARE, SCALE_CALIBRATE };
+volatile ScaleCommand scaleCommand = SCALE_NONE;   // Set by the web API, handled in loop()
+volatile float calibrationGrams = 0;
+
+// LED/buzzer patterns, advanced from an esp_timer callback
+PatternEngine patterns;
+esp_timer_handle_t patternTimer = nullptr;
+
+// Fill forecasts (index 0 = organic, 1 = non-organic)
+struct BinForecast {
+  FillForecast shortTerm;
+  FillForecast longTerm;
+  UsageProfile profile;
+};
+BinForecast binForecasts[2] = {
+  { FillForecast(FORECAST_SHORT_WINDOW_S), FillForecast(FORECAST_LONG_WINDOW_S), UsageProfile() },
+  { FillForecast(FORECAST_SHORT_WINDOW_S), FillForecast(FORECAST_LONG_WINDOW_S), UsageProfile() }
+};
 
 // Web Server
 AsyncWebServer server(80);
-WebSocketsServer webSocket(81);
-
-// State Variables
-enum BinState {
-  IDLE,
-  DETECTING_MOTION,
-  ANALYZING_MATERIAL,
-  OPENING_BIN,
-  BIN_OPEN,
-  CLOSING_BIN,
-  BIN_FULL,
-  MAINTENANCE_MODE
+AsyncWebSocket ws("/ws");
+AsyncEventSource events("/api/events");
+
+// Loop instrumentation (exported on /api/metrics)
+enum LoopPhase {
+  PHASE_KEYPAD,
+  PHASE_BIN_LEVEL,
+  PHASE_STATE_MACHINE,
+  PHASE_OUTPUTS,
+  PHASE_LOOP,         // Whole loop body, excluding the trailing delay
+  PHASE_COUNT
+};
+const char* const PHASE_NAMES[PHASE_COUNT] = { "keypad", "bin_level", "state_machine", "outputs", "loop" };
+const char* const STATE_NAMES[BIN_STATE_COUNT] = {
+  "idle", "detecting_motion", "analyzing_material", "opening_bin",
+  "bin_open", "closing_bin", "bin_full", "maintenance"
+};
+
+LatencyHistogram phaseHistograms[PHASE_COUNT];
+LatencyHistogram stateHistograms[BIN_STATE_COUNT];
+uint32_t cpuMhz = 240;
+
+// Times a scope with the CPU cycle counter and records it in microseconds
+class PhaseTimer {
+public:
+  explicit PhaseTimer(LatencyHistogram& histogram) : hist(histogram), start(ESP.getCycleCount()) {}
+  ~PhaseTimer() { hist.record((ESP.getCycleCount() - start) / cpuMhz); }
+private:
+  LatencyHistogram& hist;
+  uint32_t start;
+};
+
+// Event trace ring; RTC memory keeps it across soft resets
+RTC_NOINIT_ATTR TraceBuffer traceBuffer;
+EventTrace eventTrace;
+
+inline void trace(uint8_t event, uint8_t a = 0, uint16_t b = 0) {
+  eventTrace.record(esp_timer_get_time(), event, a, b);
+}
+
+// Lifetime usage (see UsageCounters.h): counted in RTC memory next to the
+// trace, written to NVS at most every USAGE_FLUSH_INTERVAL_MS or
+// USAGE_FLUSH_BATCH events, and never during a lid cycle
+const char* USAGE_PREFS = "usage";
+const uint32_t USAGE_FLUSH_INTERVAL_MS = 15 * 60 * 1000UL;
+const uint16_t USAGE_FLUSH_BATCH = 50;
+
+class NvsUsageStore : public UsageStore {
+public:
+  bool read(uint8_t slot, UsageRecord& record) override {
+    char key[8];
+    snprintf(key, sizeof(key), "slot%u", slot);
+    Preferences prefs;
+    prefs.begin(USAGE_PREFS, true);
+    bool ok = prefs.getBytesLength(key) == sizeof(record) && prefs.getBytes(key, &record, sizeof(record)) == sizeof(record);
+    prefs.end();
+    return ok;
+  }
+  bool write(uint8_t slot, const UsageRecord& record) override {
+    char key[8];
+    snprintf(key, sizeof(key), "slot%u", slot);
+    Preferences prefs;
+    prefs.begin(USAGE_PREFS, false);
+    bool ok = prefs.putBytes(key, &record, sizeof(record)) == sizeof(record);
+    prefs.end();
+    return ok;
+  }
+};
+
+NvsUsageStore usageStore;
+RTC_NOINIT_ATTR UsageStage usageStage;
+UsageCounters usageCounters(usageStore, USAGE_FLUSH_INTERVAL_MS, USAGE_FLUSH_BATCH);
+
+// Fill and weight history (see FillHistory.h): one sample a minute once NTP
+// has synced, a LittleFS file per block. The open block is written every
+// HISTORY_CHECKPOINT_MS, so a power loss costs at most that much.
+// historyMutex serialises the loop's appends and /api/history streams.
+const uint16_t HISTORY_STEP_S = 60;
+const uint32_t HISTORY_CHECKPOINT_MS = 30 * 60 * 1000UL;
+const uint32_t HISTORY_STREAM_IDLE_MS = 10000;   // An unread stream gives up its cursor
+
+class LittleFsHistoryStore : public HistoryStore {
+public:
+  size_t read(uint16_t slot, uint8_t* buf, size_t maxLen) override {
+    char path[16];
+    snprintf(path, sizeof(path), "/hist%02u.bin", slot);
+    if (!LittleFS.exists(path)) {
+      return 0;
+    }
+    File f = LittleFS.open(path, FILE_READ);
+    if (!f) {
+      return 0;
+    }
+    size_t len = f.read(buf, maxLen);
+    f.close();
+    return len;
+  }
+  bool write(uint16_t slot, const uint8_t* data, size_t len) override {
+    char path[16];
+    snprintf(path, sizeof(path), "/hist%02u.bin", slot);
+    File f = LittleFS.open(path, FILE_WRITE);
+    if (!f) {
+      return false;
+    }
+    bool ok = f.write(data, len) == len;
+    f.close();
+    return ok;
+  }
+};
+
+LittleFsHistoryStore historyStore;
+FillHistory fillHistory(historyStore, HISTORY_STEP_S);
+SemaphoreHandle_t historyMutex = nullptr;
+
+// One /api/history response at a time; the cursor holds a block
+struct HistoryStream {
+  HistoryCursor cursor;
+  uint32_t generation;       // Bumped when a new request takes the slot
+  uint32_t lastPullMs;
+  bool active;
+  bool ended;                // Closing bracket formatted
+  bool first;
+  char line[256];            // Formatted but not yet sent
+  size_t lineLen;
+  size_t lineSent;
+};
+HistoryStream historyStream;
+
+// Status versioning (ETag for /api/status, deltas for /api/events); the
+// version covers every field of buildStatusCore()
+struct StatusCore {
+  uint8_t state;
+  uint8_t organicFill;
+  uint8_t nonOrganicFill;
+  bool organicFull;
+  bool nonOrganicFull;
+  int32_t organicWeight10g;   // Weight in 10 g steps so load cell noise is ignored
+  int32_t nonOrganicWeight10g;
+};
+StatusCore lastStatus;
+uint32_t statusVersion = 0;
+uint32_t bootId = 0;                   // Keeps ETags from matching across reboots
+
+// Input recording for host replay (tools/replay); staged in RAM and
+// appended to LittleFS from the loop
+const char* INPUT_TRACE_PATH = "/inputs.bin";
+const size_t INPUT_TRACE_BUFFER_SIZE = 4096;
+uint8_t inputTraceBuffer[INPUT_TRACE_BUFFER_SIZE];
+enum RecordCommand { RECORD_NONE, RECORD_START, RECORD_STOP };
+volatile RecordCommand recordCommand = RECORD_NONE;
+
+// Lid and maintenance commands from the web server task, taken by the
+// controller in runStateMachine() so they never run alongside it on the
+// other core
+const uint8_t MANUAL_QUEUE_LENGTH = 8;
+QueueHandle_t manualCommands;
+
+// Per-request scratch memory (see Arena.h): webArena is only touched from
+// the async web server task, loopArena only from loop()
+Arena webArena;
+Arena loopArena;
+typedef BasicJsonDocument<ArenaAllocator> ArenaJsonDocument;
+const size_t WEB_ARENA_PSRAM = 32768;
+const size_t WEB_ARENA_INTERNAL = 8192;
+const size_t LOOP_ARENA_PSRAM = 16384;
+const size_t LOOP_ARENA_INTERNAL = 4096;
+
+// WebSocket commands; names are only compared when a message arrives
+enum WsCommand {
+  WS_OPEN_ORGANIC,
+  WS_OPEN_NON_ORGANIC,
+  WS_CLOSE_ORGANIC,
+  WS_CLOSE_NON_ORGANIC,
+  WS_GET_STATUS,
+  WS_COMMAND_COUNT
+};
+const char* const WS_COMMAND_NAMES[WS_COMMAND_COUNT] = {
+  "open_organic", "open_non_organic", "close_organic", "close_non_organic", "get_status"
+};
+
+// Web API limits per client IP and route class (see RateLimiter.h). A
+// dashboard polling at 50 Hz gets 429s for most of its requests instead of
+// starving the loop of the CPU it shares with the web server.
+enum RateClass {
+  RATE_READ,      // Status, metrics, scale readings
+  RATE_CONTROL,   // Lids, maintenance, calibration, recording
+  RATE_BULK,      // Trace and recording downloads, firmware updates
+  RATE_SOCKET,    // WebSocket and event stream connects, WebSocket commands
+  RATE_CLASS_COUNT
+};
+const char* const RATE_CLASS_NAMES[RATE_CLASS_COUNT] = { "read", "control", "bulk", "socket" };
+const RateLimit RATE_LIMITS[RATE_CLASS_COUNT] = {
+  { 100, 20 },     // 10/s
+  { 500, 6 },      // 2/s
+  { 10000, 3 },    // 1 per 10 s
+  { 100, 20 },
+};
+const uint8_t MAX_REQUESTS_IN_FLIGHT = 4;
+RateLimiter rateLimiter(RATE_LIMITS, RATE_CLASS_COUNT, MAX_REQUESTS_IN_FLIGHT);
+
+// First handler on the server: it sees each request once its headers are
+// in and either lets the route handlers have it or claims it to send 429
+class RequestGuard : public AsyncWebHandler {
+public:
+  bool canHandle(AsyncWebServerRequest* request) override;
+  void handleRequest(AsyncWebServerRequest* request) override;
 };
+RequestGuard requestGuard;
 
-BinState currentState = IDLE;
-  uint32_t selectedBin = 0; // BIN_ORGANIC_ID or BIN_NON_ORGANIC_ID
-float organicBinWeight = 0.0;
-float nonOrganicBinWeight = 0.0;
-bool isOrganicBinFull = false;
-bool isNonOrganicBinFull = false;
-unsigned long lastMotionTime = 0;
-unsigned long binOpenTime = 0;
-const unsigned long MOTION_TIMEOUT = 5000; // 5 seconds
-const unsigned long BIN_OPEN_TIMEOUT = 10000; // 10 seconds
-const unsigned long BIN_CLOSE_DELAY = 3000; // 3 seconds
-
-// Material Detection
-String detectedMaterial = "";
-bool materialDetectionComplete = false;
-unsigned long materialDetectionStartTime = 0;
+// ==================== HARDWARE ====================
+// BinHardware on the real pins; the control logic lives in BinController
+class DeviceHardware : public BinHardware {
+public:
+  // Last reading failed; reported in the CAN heartbeat
+  bool distanceFault = false;
+  bool scaleFault = false;
+
+  uint32_t millis() override { return ::millis(); }
+  bool motion() override { return digitalRead(Board::PIR_PIN) == HIGH; }
+  bool keypadPressed(uint8_t button) override {
+    return Board::HAS_KEYPAD &&
+           digitalRead(button == 0 ? Board::KEYPAD_BUTTON1_PIN : Board::KEYPAD_BUTTON2_PIN) == LOW;
+  }
+  int32_t distanceMm() override;
+  int32_t massGrams() override;
+  bool receiveCan(CanMessage& msg) override;
+  bool receiveCommand(ManualCommand& command) override {
+    return xQueueReceive(manualCommands, &command, 0) == pdTRUE;
+  }
+  void setLid(uint8_t bin, bool open) override;
+  void sendCan(const CanMessage& msg) override;
+  void playTone(TonePattern tone) override { patterns.playTone(tone, ::millis()); }
+  void uploadBinData() override;
+  void trace(uint8_t event, uint8_t a, uint16_t b) override;
+};
+
+DeviceHardware deviceHardware;
+InputTraceWriter inputRecorder;
+RecordingHardware recordingHardware(deviceHardware, inputRecorder);
+BinController controller(CONTROLLER_CONFIG, recordingHardware);
+Heartbeat canHeartbeat(CAN_HEARTBEAT_INTERVAL_MS, CAN_HEARTBEAT_MIN_GAP_MS);
+bool lastUploadFailed = false;
+
+// PIR-to-lid latency, stitched from our stages and the camera's reports
+DetectionLatency detectionLatency;
+uint8_t timeSyncSeq = 0;
+uint32_t lastTimeSyncMs = 0;
+
+WiFiLink wifiLink;
+bool wifiApStarted = false;
+uint64_t bootReadyUs = 0;    // esp_timer at the end of setup()
+uint64_t bootOnlineUs = 0;   // esp_timer when WiFi first came up, 0 until then
+
+// OTA: written by the web server or a download task, reboot decided by the loop
+FirmwareUpdate firmwareUpdate(ota_key);
+
+// How reports reach the backend, chosen at build time (see platformio.ini):
+// a standalone bin posts its own; a gateway also collects its neighbours'
+// over ESP-NOW and posts them in batches; a leaf never joins the WiFi and
+// hands its reports to a gateway, with the radio off in between
+enum UplinkRole { ROLE_STANDALONE, ROLE_GATEWAY, ROLE_LEAF };
+#if defined(SMARTBIN_ROLE_GATEWAY)
+const UplinkRole UPLINK_ROLE = ROLE_GATEWAY;
+#elif defined(SMARTBIN_ROLE_LEAF)
+const UplinkRole UPLINK_ROLE = ROLE_LEAF;
+#else
+const UplinkRole UPLINK_ROLE = ROLE_STANDALONE;
+#endif
+const char* const UPLINK_ROLE_NAMES[] = { "standalone", "gateway", "leaf" };
+
+// ESP-NOW under lib/BinGateway. Frames arrive in the WiFi task and wait in
+// a queue for the loop.
+struct RadioFrame {
+  uint8_t peer[RADIO_ADDRESS_SIZE];
+  uint8_t len;
+  uint8_t data[LEAF_REPORT_SIZE];   // Largest frame
+};
+
+class EspNowTransport : public RadioTransport {
+public:
+  // A gateway serves more leaves than ESP-NOW has peer slots (20), so it
+  // broadcasts its acks; leaves match them on station and sequence
+  explicit EspNowTransport(bool broadcastOnly) : broadcastOnly(broadcastOnly) {}
+  // Channel 0 stays on the channel WiFi picked for the site AP
+  void power(bool on, uint8_t channel) override;
+  bool send(const uint8_t* peer, const uint8_t* data, size_t len) override;
+
+private:
+  bool broadcastOnly;
+  bool started = false;
+};
+
+const GatewayConfig GATEWAY_CONFIG = {
+  16,        // batchSize
+  30000,     // maxDelayMs
+  10000,     // retryMs after a failed upload
+  3600000    // staleMs: leaves report every 5 min
+};
+const LeafConfig LEAF_CONFIG = {
+  30,        // ackTimeoutMs, checked once per loop pass
+  3,         // attempts per channel
+  1          // firstChannel
+};
+const uint32_t LEAF_REPORT_INTERVAL_MS = 300000;   // Besides lid cycles; keeps the gateway slot and clock fresh
+const size_t GATEWAY_BIN_JSON_MAX = 360;           // One bin in BinGateway::formatBatch, worst case
+const uint8_t RADIO_QUEUE_LENGTH = 16;
+
+EspNowTransport espNow(UPLINK_ROLE == ROLE_GATEWAY);
+QueueHandle_t radioFrames;
+volatile uint32_t radioFramesDropped = 0;
+BinGateway gateway(espNow, GATEWAY_CONFIG);
+// Random first sequence so a rebooted leaf's reports aren't taken for
+// retransmissions of its last ones
+LeafLink leafLink(espNow, LEAF_CONFIG, (uint16_t)esp_random());
+uint32_t lastLeafReportMs = 0;
 
 // ==================== FUNCTION DECLARATIONS ====================
 void setupWiFi();
-void setupCAN();
+void updateWiFi();
+void setupScale();
+void updateScaleCalibration();
+void updateFirmwareUpdate();
+void updateUsageCounters();
+void saveScaleCalibration();
 void setupWebServer();
 void setupWebSocket();
-void handleMotionDetection();
-void handleMaterialDetection();
-void openBin(uint8_t binType);
-void closeBin(uint8_t binType);
-void updateBinLevel();
+uint8_t rateClass(AsyncWebServerRequest* request, bool& tracked);
+void updateForecasts();
+void updateFillHistory();
+void handleHistory(AsyncWebServerRequest* request);
+void updateInputRecording();
+void updateHeartbeat();
+void updateTimeSync();
+void sendBinDataToBackend();
+void setupUplink();
+void updateUplink();
+void makeLocalReport(LeafReport& report);
+void buildStatusJson(JsonDocument& doc);
+void buildStatusCore(JsonDocument& doc);
+void buildStatusDetails(JsonDocument& doc);
+float statusWeightKg(uint8_t bin);
+void sendManualCommand(AsyncWebServerRequest* request, ManualCommand command, const char* body);
+void setupEvents();
+void handleMetrics(AsyncWebServerRequest* request);
+void updateStatusVersion();
+void formatStatusETag(char* buf, size_t len);
+void setupIndicators();
+void patternTick(void* arg);
 void updateLEDs();
-void sendToBackend(String endpoint, JsonDocument& doc);
-void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length);
+void webSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t length);
+void sendWebSocketStatus(AsyncWebSocketClient* client);
+void handleWebSocketMessage(AsyncWebSocketClient* client, const char* message, size_t length);
 float getDistance();
-void checkKeypad();
 
 // ==================== SETUP ====================
 void setup() {
   Serial.begin(115200);
-  delay(1000);
+  cpuMhz = ESP.getCpuFreqMHz();
+  eventTrace.begin(&traceBuffer, esp_timer_get_time(), esp_reset_reason());
   
   // Initialize GPIO pins
-  pinMode(TRIG_PIN, OUTPUT);
-  pinMode(ECHO_PIN, INPUT);
-  pinMode(PIR_PIN, INPUT);
-  pinMode(LED_RED_PIN, OUTPUT);
-  pinMode(LED_GREEN_PIN, OUTPUT);
-  pinMode(LED_BLUE_PIN, OUTPUT);
-  pinMode(BUZZER_PIN, OUTPUT);
-  pinMode(KEYPAD_BUTTON1_PIN, INPUT_PULLUP);
-  pinMode(KEYPAD_BUTTON2_PIN, INPUT_PULLUP);
+  pinMode(Board::TRIG_PIN, OUTPUT);
+  pinMode(Board::ECHO_PIN, INPUT);
+  pinMode(Board::PIR_PIN, INPUT);
+  if (Board::HAS_KEYPAD) {
+    pinMode(Board::KEYPAD_BUTTON1_PIN, INPUT_PULLUP);
+    pinMode(Board::KEYPAD_BUTTON2_PIN, INPUT_PULLUP);
+  }
+  
+  // Initialize LEDs and buzzer
+  setupIndicators();
   
   // Initialize Servos
-  servoOrganic.attach(SERVO_ORGANIC_PIN);
-  servoNonOrganic.attach(SERVO_NON_ORGANIC_PIN);
-  servoOrganic.write(0); // Close position
-  servoNonOrganic.write(0); // Close position
+  lidServos[0].attach(Board::SERVO_ORGANIC_PIN);
+  if (Board::LID_SERVOS == 2) {
+    lidServos[Board::LID_SERVOS - 1].attach(Board::SERVO_NON_ORGANIC_PIN);
+  }
+  for (uint8_t i = 0; i < Board::LID_SERVOS; i++) {
+    lidServos[i].write(Board::lidAngle(i, false)); // Close position
+  }
   
   // Initialize Load Cell
-  scale.begin(LOAD_CELL_DOUT_PIN, LOAD_CELL_SCK_PIN);
-  scale.set_scale(2280.f); // Calibration factor (adjust based on your load cell)
-  scale.tare();
+  if (Board::HAS_LOAD_CELL) {
+    setupScale();
+  }
   
-  // Initialize WiFi
-  setupWiFi();
+  snprintf(binUpdateUrl, sizeof(binUpdateUrl), "%s/api/bins/update", backend_url);
+  webArena.beginPreferPsram(WEB_ARENA_PSRAM, WEB_ARENA_INTERNAL);
+  loopArena.beginPreferPsram(LOOP_ARENA_PSRAM, LOOP_ARENA_INTERNAL);
   
-  // Initialize CAN
-  setupCAN();
+  // Flash filesystem for input recordings and the fill history
+  LittleFS.begin(true);
   
-  // Initialize Web Server
-  setupWebServer();
+  // Usage totals from NVS, plus whatever RTC memory carried over the reset
+  usageCounters.begin(&usageStage, millis());
   
-  // Initialize WebSocket
-  setupWebSocket();
+  manualCommands = xQueueCreate(MANUAL_QUEUE_LENGTH, sizeof(ManualCommand));
+  
+  // Fill history index from the blocks on flash
+  historyMutex = xSemaphoreCreateMutex();
+  fillHistory.begin();
+  
+  // Start WiFi; updateWiFi() finishes the job from the loop. Leaves only
+  // use the radio for ESP-NOW.
+  if (UPLINK_ROLE != ROLE_LEAF) {
+    setupWiFi();
+  }
+  setupUplink();
+  
+  // Initialize CAN
+  setupCAN(Board::CAN_TX_PIN, Board::CAN_RX_PIN);
+  
+  if (UPLINK_ROLE != ROLE_LEAF) {
+    // Rate limits go in front of every other handler
+    server.addHandler(&requestGuard);
+    
+    // Initialize WebSocket (served by the web server on /ws)
+    setupWebSocket();
+    
+    // Initialize Server-Sent Events (/api/events)
+    setupEvents();
+    
+    // Initialize Web Server
+    setupWebServer();
+  }
   
   Serial.println("Smart Waste Bin System Initialized");
   updateLEDs();
+  bootReadyUs = esp_timer_get_time();
 }
 
 // ==================== MAIN LOOP ====================
 void loop() {
-  webSocket.loop();
+  uint32_t loopStart = ESP.getCycleCount();
   
   // Check keypad for manual override
-  checkKeypad();
+  if (Board::HAS_KEYPAD) {
+    PhaseTimer t(phaseHistograms[PHASE_KEYPAD]);
+    controller.checkKeypad();
+  }
   
   // Update bin levels
-  updateBinLevel();
+  {
+    PhaseTimer t(phaseHistograms[PHASE_BIN_LEVEL]);
+    controller.updateBinLevel();
+    updateForecasts();
+    updateFillHistory();
+  }
   
   // State Machine
-  switch(currentState) {
-    case IDLE:
-      handleMotionDetection();
-      updateLEDs();
-      break;
-      
-    case DETECTING_MOTION:
-      if (millis() - lastMotionTime > MOTION_TIMEOUT) {
-        currentState = IDLE;
-      } else {
-        currentState = ANALYZING_MATERIAL;
-        materialDetectionStartTime = millis();
-        // Request material detection from ESP32-CAM via CAN
-        sendCANMessage(0x100, "DETECT_MATERIAL");
-      }
-      break;
-      
-    case ANALYZING_MATERIAL:
-      handleMaterialDetection();
-      if (materialDetectionComplete) {
-        if (detectedMaterial == "ORGANIC") {
-          selectedBin = BIN_ORGANIC_ID;
-        } else if (detectedMaterial == "NON_ORGANIC") {
-          selectedBin = BIN_NON_ORGANIC_ID;
-        }
-        currentState = OPENING_BIN;
-        materialDetectionComplete = false;
-      }
-      // Timeout after 5 seconds
-      if (millis() - materialDetectionStartTime > 5000) {
-        detectedMaterial = "UNKNOWN";
-        selectedBin = BIN_ORGANIC_ID; // Default to organic
-        currentState = OPENING_BIN;
-      }
-      break;
-      
-    case OPENING_BIN:
-      if (selectedBin == BIN_ORGANIC_ID && !isOrganicBinFull) {
-        openBin(0); // 0 = organic
-        currentState = BIN_OPEN;
-        binOpenTime = millis();
-      } else if (selectedBin == BIN_NON_ORGANIC_ID && !isNonOrganicBinFull) {
-        openBin(1); // 1 = non-organic
-        currentState = BIN_OPEN;
-        binOpenTime = millis();
-      } else {
-        // Bin is full, cannot open
-        digitalWrite(BUZZER_PIN, HIGH);
-        delay(500);
-        digitalWrite(BUZZER_PIN, LOW);
-        currentState = BIN_FULL;
-        delay(2000);
-        currentState = IDLE;
-      }
-      break;
-      
-    case BIN_OPEN:
-      updateLEDs();
-      // Check if motion is still detected
-      if (digitalRead(PIR_PIN) == LOW || millis() - lastMotionTime > MOTION_TIMEOUT) {
-        if (millis() - binOpenTime > BIN_CLOSE_DELAY) {
-          currentState = CLOSING_BIN;
-        }
-      } else {
-        lastMotionTime = millis();
-      }
-      break;
-      
-    case CLOSING_BIN:
-      if (selectedBin == BIN_ORGANIC_ID) {
-        closeBin(0);
-      } else {
-        closeBin(1);
-      }
-      currentState = IDLE;
-      // Send data to backend
-      sendBinDataToBackend();
-      break;
-      
-    case BIN_FULL:
-      updateLEDs();
-      break;
-      
-    case MAINTENANCE_MODE:
-      // Manual override mode
-      break;
+  {
+    PhaseTimer t(phaseHistograms[PHASE_STATE_MACHINE]);
+    PhaseTimer stateTimer(stateHistograms[controller.state()]);
+    controller.runStateMachine();
   }
   
+  {
+    PhaseTimer t(phaseHistograms[PHASE_OUTPUTS]);
+    // Only changes the pattern when the state calls for a different one
+    updateLEDs();
+    
+    // Bump the status version and push deltas to SSE clients if anything changed
+    updateStatusVersion();
+    
+    // Start/stop input recording and flush it to flash
+    updateInputRecording();
+    
+    // Station status on the CAN bus
+    updateHeartbeat();
+    
+    // Keep the camera's clock aligned with ours
+    updateTimeSync();
+    
+    // Background WiFi and load cell calibration requests
+    if (UPLINK_ROLE != ROLE_LEAF) {
+      updateWiFi();
+    }
+    updateScaleCalibration();
+    
+    // Gateway batches and leaf reports over ESP-NOW
+    updateUplink();
+    
+    // Persist usage counters between lid cycles
+    updateUsageCounters();
+    
+    // Reboot into a verified update once the lids are at rest
+    updateFirmwareUpdate();
+  }
+  
+  phaseHistograms[PHASE_LOOP].record((ESP.getCycleCount() - loopStart) / cpuMhz);
+  
   delay(50);
 }
 
 // ==================== WIFI SETUP ====================
 void setupWiFi() {
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  
-  Serial.print("Connecting to WiFi");
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
+  wifiLink.begin(WIFI_CONFIG, millis());
+}
+
+void updateWiFi() {
+  if (wifiLink.update(millis())) {
+    Serial.print("WiFi Connected! IP Address: ");
+    Serial.println(WiFi.localIP());
+    if (bootOnlineUs == 0) {
+      bootOnlineUs = esp_timer_get_time();
+      // Wall clock is only needed for the hour-of-day usage profile
+      configTime(GMT_OFFSET_SEC, 0, ntpServer);
+    }
+    if (wifiApStarted) {
+      WiFi.softAPdisconnect(true);   // Back to station only
+      wifiApStarted = false;
+    }
   }
   
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi Connected!");
-    Serial.print("IP Address: ");
-    Serial.println(WiFi.localIP());
-  } else {
-    Serial.println("\nWiFi Connection Failed - Operating in AP Mode");
-    WiFi.mode(WIFI_AP);
+  // Setup AP alongside the station, which keeps trying
+  if (!wifiLink.online() && !wifiApStarted && bootOnlineUs == 0 && millis() > WIFI_AP_FALLBACK_MS) {
+    Serial.println("WiFi not connected - Opening setup AP");
+    WiFi.mode(WIFI_AP_STA);
     WiFi.softAP("SmartBin_AP", "12345678");
     Serial.print("AP IP: ");
     Serial.println(WiFi.softAPIP());
+    wifiApStarted = true;
   }
 }
 
-// ==================== CAN SETUP ====================
-void setupCAN() {
-  // Initialize TWAI (CAN) on ESP32
-  // Note: ESP32 uses TWAI instead of traditional CAN
-  // This is a simplified implementation
-  Serial.println("CAN/TWAI initialized");
+// ==================== LOAD CELL ====================
+// A stored tare is trusted over a fresh one: after a power blip the bin is
+// rarely empty. Only a board that has never been tared zeroes at boot.
+void setupScale() {
+  scale.begin(Board::LOAD_CELL_DOUT_PIN, Board::LOAD_CELL_SCK_PIN);
+  Preferences prefs;
+  prefs.begin(SCALE_PREFS, true);
+  float factor = prefs.getFloat("factor", Board::LOAD_CELL_SCALE);
+  int32_t offset = prefs.getInt("offset", INT32_MIN);
+  prefs.end();
+  
+  scale.set_scale(factor); // Counts per gram, so get_units() returns grams
+  if (offset != INT32_MIN) {
+    scale.set_offset(offset);
+  } else {
+    scale.tare(SCALE_SAMPLES);
+    saveScaleCalibration();
+  }
 }
 
-void sendCANMessage(uint32_t id, String message) {
-  // Simplified CAN message sending
-  // In real implementation, use ESP32 TWAI library
-  Serial.printf("CAN TX: ID=0x%03X, Message=%s\n", id, message.c_str());
+void saveScaleCalibration() {
+  Preferences prefs;
+  prefs.begin(SCALE_PREFS, false);
+  prefs.putFloat("factor", scale.get_scale());
+  prefs.putInt("offset", scale.get_offset());
+  prefs.end();
 }
 
-bool receiveCANMessage(uint32_t* id, String* message) {
-  // Simplified CAN message receiving
-  // In real implementation, use ESP32 TWAI library
-  return false;
+// Tare (bin empty) or calibrate (known weight in the bin), then persist
+void updateScaleCalibration() {
+  ScaleCommand command = scaleCommand;
+  scaleCommand = SCALE_NONE;
+  
+  if (command == SCALE_TARE) {
+    scale.tare(SCALE_SAMPLES);
+    saveScaleCalibration();
+    Serial.printf("Scale tared, offset %ld\n", (long)scale.get_offset());
+  } else if (command == SCALE_CALIBRATE) {
+    double counts = scale.get_value(SCALE_SAMPLES);   // Tared raw counts
+    float factor = counts / calibrationGrams;
+    if (factor > 0) {
+      scale.set_scale(factor);
+      saveScaleCalibration();
+      Serial.printf("Scale calibrated, %.2f counts/g\n", factor);
+    } else {
+      Serial.println("Scale calibration ignored: no weight on the scale");
+    }
+  }
+}
+
+// ==================== CAN ====================
+// Sends the packed status frame every interval and soon after a change
+void updateHeartbeat() {
+  ControllerStatus status;
+  status.state = controller.state();
+  for (uint8_t bin = 0; bin < 2; bin++) {
+    status.fillPercent[bin] = controller.fillEstimate(bin).fillPercent();
+    status.full[bin] = controller.isFull(bin);
+  }
+  status.errors = 0;
+  if (deviceHardware.distanceFault) status.errors |= CONTROLLER_ERR_DISTANCE;
+  if (deviceHardware.scaleFault) status.errors |= CONTROLLER_ERR_SCALE;
+  // Leaves keep WiFi off; a lost gateway shows up as an upload error
+  if (UPLINK_ROLE != ROLE_LEAF && WiFi.status() != WL_CONNECTED) status.errors |= CONTROLLER_ERR_WIFI;
+  if (controller.lastDetectionTimedOut()) status.errors |= CONTROLLER_ERR_CAMERA;
+  if (lastUploadFailed) status.errors |= CONTROLLER_ERR_UPLOAD;
+  uint32_t heapKb = ESP.getFreeHeap() / 1024;
+  status.freeHeapKb = heapKb > 255 ? 255 : heapKb;
+  status.uptimeS = millis() / 1000;
+  
+  CanMessage frame;
+  packControllerStatus(frame, CAN_NODE_ID, status);
+  if (canHeartbeat.due(millis(), frame)) {
+    sendCANMessage(frame);
+  }
+}
+
+// Two-step sync: the follow-up carries when SYNC actually left, so the
+// camera doesn't need to know how long we took to send it
+void updateTimeSync() {
+  if (millis() - lastTimeSyncMs < CAN_TIME_SYNC_INTERVAL_MS) {
+    return;
+  }
+  lastTimeSyncMs = millis();
+  timeSyncSeq++;
+  CanMessage frame;
+  makeTimeSync(frame, CAN_NODE_ID, timeSyncSeq);
+  sendCANMessage(frame);
+  uint64_t sentUs = esp_timer_get_time();
+  makeTimeFollowUp(frame, CAN_NODE_ID, timeSyncSeq, sentUs);
+  sendCANMessage(frame);
 }
 
 // ==================== WEB SERVER SETUP ====================
 void setupWebServer() {
   // Root endpoint
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
-    request->send(200, "text/html", "<html><body><h1>Smart Waste Bin API</h1><p>Use WebSocket on port 81 for real-time data</p></body></html>");
+    request->send(200, "text/html", "<html><body><h1>Smart Waste Bin API</h1><p>Use WebSocket on /ws for real-time data</p></body></html>");
   });
   
-  // Get bin status
+  // Get bin status (conditional on the status version); heap, usage,
+  // forecasts and the rest change all the time and live in /api/status/details
   server.on("/api/status", HTTP_GET, [](AsyncWebServerRequest *request){
-    DynamicJsonDocument doc(1024);
-    doc["organic_level"] = organicBinWeight;
-    doc["non_organic_level"] = nonOrganicBinWeight;
-    doc["organic_full"] = isOrganicBinFull;
-    doc["non_organic_full"] = isNonOrganicBinFull;
-    doc["state"] = currentState;
-    doc["bin_organic_id"] = BIN_ORGANIC_ID;
-    doc["bin_non_organic_id"] = BIN_NON_ORGANIC_ID;
+    char etag[32];
+    formatStatusETag(etag, sizeof(etag));
+    
+    if (request->hasHeader("If-None-Match") && request->header("If-None-Match") == etag) {
+      AsyncWebServerResponse* notModified = request->beginResponse(304);
+      notModified->addHeader("ETag", etag);
+      request->send(notModified);
+      return;
+    }
+    
+    ArenaScope scope(webArena);
+    ArenaJsonDocument doc(512, ArenaAllocator(webArena));
+    buildStatusCore(doc);
+    
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    serializeJson(doc, *response);
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+  });
+  
+  server.on("/api/status/details", HTTP_GET, [](AsyncWebServerRequest *request){
+    ArenaScope scope(webArena);
+    ArenaJsonDocument doc(2048, ArenaAllocator(webArena));
+    buildStatusDetails(doc);
     
-    String response;
-    serializeJson(doc, response);
-    request->send(200, "application/json", response);
+    AsyncResponseStream* response = request->beginResponseStream("application/json");
+    serializeJson(doc, *response);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response);
+  });
+  
+  // Prometheus metrics
+  server.on("/api/metrics", HTTP_GET, handleMetrics);
+  
+  // Binary event trace (decode with tools/trace_decode.py)
+  server.on("/api/trace", HTTP_GET, [](AsyncWebServerRequest *request){
+    AsyncWebServerResponse* response = request->beginResponse("application/octet-stream", sizeof(traceBuffer),
+      [](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        size_t len = sizeof(traceBuffer) - index;
+        if (len > maxLen) {
+          len = maxLen;
+        }
+        memcpy(buffer, (const uint8_t*)&traceBuffer + index, len);
+        return len;
+      });
+    response->addHeader("Content-Disposition", "attachment; filename=trace.bin");
+    request->send(response);
+  });
+  
+  // Fill and weight history kept on the bin
+  server.on("/api/history", HTTP_GET, handleHistory);
+  
+  // Load cell: POST /api/scale/tare with the bin empty, then
+  // POST /api/scale/calibrate grams=<n> with a known weight in it
+  if (Board::HAS_LOAD_CELL) {
+    server.on("/api/scale/tare", HTTP_POST, [](AsyncWebServerRequest *request){
+      scaleCommand = SCALE_TARE;
+      request->send(200, "application/json", "{\"status\":\"ok\"}");
+    });
+    
+    server.on("/api/scale/calibrate", HTTP_POST, [](AsyncWebServerRequest *request){
+      float grams = request->hasParam("grams", true) ? request->getParam("grams", true)->value().toFloat() : 0;
+      if (grams <= 0) {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Missing or invalid grams parameter\"}");
+        return;
+      }
+      calibrationGrams = grams;
+      scaleCommand = SCALE_CALIBRATE;
+      request->send(200, "application/json", "{\"status\":\"ok\"}");
+    });
+    
+    server.on("/api/scale", HTTP_GET, [](AsyncWebServerRequest *request){
+      char body[96];
+      snprintf(body, sizeof(body), "{\"factor\":%.3f,\"offset\":%ld}", scale.get_scale(), (long)scale.get_offset());
+      request->send(200, "application/json", body);
+    });
+  }
+  
+  // Input recording for host replay: POST action=start|stop, GET downloads
+  server.on("/api/record", HTTP_POST, [](AsyncWebServerRequest *request){
+    if (!request->hasParam("action", true)) {
+      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Missing action parameter\"}");
+      return;
+    }
+    const String& action = request->getParam("action", true)->value();
+    if (action == "start") {
+      recordCommand = RECORD_START;
+    } else if (action == "stop") {
+      recordCommand = RECORD_STOP;
+    } else {
+      request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid action\"}");
+      return;
+    }
+    request->send(200, "application/json", "{\"status\":\"ok\"}");
+  });
+  
+  server.on("/api/record", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (inputRecorder.recording() || !LittleFS.exists(INPUT_TRACE_PATH)) {
+      request->send(409, "application/json", "{\"status\":\"error\",\"message\":\"No finished recording\"}");
+      return;
+    }
+    request->send(LittleFS, INPUT_TRACE_PATH, "application/octet-stream", true);
   });
   
   // Open bin manually
   server.on("/api/open", HTTP_POST, [](AsyncWebServerRequest *request){
     if (request->hasParam("bin", true)) {
-      String binParam = request->getParam("bin", true)->value();
-      if (binParam == "organic" && !isOrganicBinFull) {
-        openBin(0);
-        request->send(200, "application/json", "{\"status\":\"opened\",\"bin\":\"organic\"}");
-      } else if (binParam == "non_organic" && !isNonOrganicBinFull) {
-        openBin(1);
-        request->send(200, "application/json", "{\"status\":\"opened\",\"bin\":\"non_organic\"}");
+      const String& binParam = request->getParam("bin", true)->value();
+      if (binParam == "organic" && !controller.isFull(BIN_ORGANIC)) {
+        sendManualCommand(request, MANUAL_OPEN_ORGANIC, "{\"status\":\"opened\",\"bin\":\"organic\"}");
+      } else if (binParam == "non_organic" && !controller.isFull(BIN_NON_ORGANIC)) {
+        sendManualCommand(request, MANUAL_OPEN_NON_ORGANIC, "{\"status\":\"opened\",\"bin\":\"non_organic\"}");
       } else {
         request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Bin full or invalid\"}");
       }
@@ -342,265 +869,1051 @@ void setupWebServer() {
   // Close bin manually
   server.on("/api/close", HTTP_POST, [](AsyncWebServerRequest *request){
     if (request->hasParam("bin", true)) {
-      String binParam = request->getParam("bin", true)->value();
+      const String& binParam = request->getParam("bin", true)->value();
       if (binParam == "organic") {
-        closeBin(0);
-        request->send(200, "application/json", "{\"status\":\"closed\",\"bin\":\"organic\"}");
+        sendManualCommand(request, MANUAL_CLOSE_ORGANIC, "{\"status\":\"closed\",\"bin\":\"organic\"}");
       } else if (binParam == "non_organic") {
-        closeBin(1);
-        request->send(200, "application/json", "{\"status\":\"closed\",\"bin\":\"non_organic\"}");
+        sendManualCommand(request, MANUAL_CLOSE_NON_ORGANIC, "{\"status\":\"closed\",\"bin\":\"non_organic\"}");
+      } else {
+        request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"Invalid bin\"}");
       }
     } else {
       request->send(400, "application/json", "{\"status\":\"error\"}");
     }
   });
   
-  // Maintenance mode
+  // Maintenance mode toggle; the direction is decided here so the reply
+  // matches what the loop will do
   server.on("/api/maintenance", HTTP_POST, [](AsyncWebServerRequest *request){
-    if (currentState == MAINTENANCE_MODE) {
-      currentState = IDLE;
-      request->send(200, "application/json", "{\"status\":\"normal_mode\"}");
+    if (controller.state() == MAINTENANCE_MODE) {
+      sendManualCommand(request, MANUAL_MAINTENANCE_OFF, "{\"status\":\"normal_mode\"}");
     } else {
-      currentState = MAINTENANCE_MODE;
-      request->send(200, "application/json", "{\"status\":\"maintenance_mode\"}");
+      sendManualCommand(request, MANUAL_MAINTENANCE_ON, "{\"status\":\"maintenance_mode\"}");
     }
   });
   
+  // Firmware updates, full image or delta patch (tools/ota_delta.py):
+  // POST /api/ota uploads, POST /api/ota/pull url=... downloads, GET /api/ota;
+  // both POSTs need a signature made with ota_key
+  addOtaRoutes(server, firmwareUpdate);
+  
   server.begin();
 }
 
+// ==================== REQUEST LIMITS ====================
+// Requests in flight are counted until their connection closes. Upgraded
+// connections (WebSocket, event stream) are handed off without that
+// callback, and the OTA upload handler sets its own, so those only pay
+// tokens; the upload has its own one-at-a-time lock.
+uint8_t rateClass(AsyncWebServerRequest* request, bool& tracked) {
+  const String& url = request->url();
+  tracked = true;
+  if (url == "/ws" || url == "/api/events") {
+    tracked = false;
+    return RATE_SOCKET;
+  }
+  if (url.startsWith("/api/ota")) {
+    // Progress polls while an update runs are ordinary reads
+    if (request->method() == HTTP_GET) {
+      return RATE_READ;
+    }
+    tracked = false;
+    return RATE_BULK;
+  }
+  if (url == "/api/trace" || url == "/api/history" || (url == "/api/record" && request->method() == HTTP_GET)) {
+    return RATE_BULK;
+  }
+  return request->method() == HTTP_GET ? RATE_READ : RATE_CONTROL;
+}
+
+bool RequestGuard::canHandle(AsyncWebServerRequest* request) {
+  bool tracked;
+  uint8_t cls = rateClass(request, tracked);
+  if (rateLimiter.admit(request->client()->remoteIP(), cls, millis(), tracked) != RATE_ALLOWED) {
+    return true;
+  }
+  if (tracked) {
+    request->onDisconnect([]{ rateLimiter.finished(); });
+  }
+  return false;
+}
+
+// Constant body from flash, no JSON document
+void RequestGuard::handleRequest(AsyncWebServerRequest* request) {
+  static const char BODY[] PROGMEM = "{\"status\":\"error\",\"message\":\"Too many requests\"}";
+  bool tracked;
+  uint32_t waitMs = rateLimiter.retryAfterMs(request->client()->remoteIP(), rateClass(request, tracked), millis());
+  char retryAfter[12];
+  snprintf(retryAfter, sizeof(retryAfter), "%u", (unsigned)(waitMs > 0 ? (waitMs + 999) / 1000 : 1));
+  AsyncWebServerResponse* response = request->beginResponse_P(429, "application/json", (const uint8_t*)BODY, sizeof(BODY) - 1);
+  response->addHeader("Retry-After", retryAfter);
+  request->send(response);
+}
+
+// Full snapshot for WebSocket and event stream clients
+void buildStatusJson(JsonDocument& doc) {
+  buildStatusCore(doc);
+  buildStatusDetails(doc);
+}
+
+// The versioned fields; /api/status
+void buildStatusCore(JsonDocument& doc) {
+  doc["organic_level"] = statusWeightKg(BIN_ORGANIC);
+  doc["non_organic_level"] = statusWeightKg(BIN_NON_ORGANIC);
+  doc["organic_full"] = controller.isFull(BIN_ORGANIC);
+  doc["non_organic_full"] = controller.isFull(BIN_NON_ORGANIC);
+  doc["organic_fill"] = controller.fillEstimate(BIN_ORGANIC).fillPercent();
+  doc["non_organic_fill"] = controller.fillEstimate(BIN_NON_ORGANIC).fillPercent();
+  doc["state"] = controller.state();
+  doc["bin_organic_id"] = controller.binId(BIN_ORGANIC);
+  doc["bin_non_organic_id"] = controller.binId(BIN_NON_ORGANIC);
+}
+
+// Weight in the same 10 g steps the status version tracks
+float statusWeightKg(uint8_t bin) {
+  return (controller.fillEstimate(bin).massGrams() / 10) / 100.0f;
+}
+
+// Diagnostics that change between any two requests; /api/status/details
+void buildStatusDetails(JsonDocument& doc) {
+  doc["free_heap"] = ESP.getFreeHeap();
+  // A shrinking largest block with steady free heap means fragmentation
+  JsonObject heap = doc.createNestedObject("heap");
+  heap["free"] = ESP.getFreeHeap();
+  heap["largest_block"] = ESP.getMaxAllocHeap();
+  heap["min_free"] = ESP.getMinFreeHeap();
+  doc["ws_clients"] = ws.count();
+  doc["recording_inputs"] = inputRecorder.recording();
+  doc["led_pattern"] = PatternEngine::ledName(patterns.led());
+
+  // Lifetime totals; `unflushed` of them are only in RTC memory so far
+  JsonObject usage = doc.createNestedObject("usage");
+  for (uint8_t c = 0; c < USAGE_COUNT; c++) {
+    usage[UsageCounters::name((UsageCounter)c)] = usageCounters.value((UsageCounter)c);
+  }
+  usage["unflushed"] = usageCounters.pending();
+  usage["flushes"] = usageCounters.flushes();
+  usage["flush_failures"] = usageCounters.flushFailures();
+  usage["recovered_at_boot"] = usageCounters.recovered();
+
+  JsonObject history = doc.createNestedObject("history");
+  history["samples"] = fillHistory.sampleCount();
+  history["oldest"] = fillHistory.oldestTime();
+  history["newest"] = fillHistory.newestTime();
+  history["bytes"] = fillHistory.storedBytes();
+
+  JsonObject uplink = doc.createNestedObject("uplink");
+  uplink["role"] = UPLINK_ROLE_NAMES[UPLINK_ROLE];
+  if (UPLINK_ROLE == ROLE_GATEWAY) {
+    uplink["stations"] = gateway.stations();
+    uplink["pending"] = gateway.pending();
+    uplink["uploads"] = gateway.uploads();
+    uplink["uploaded_reports"] = gateway.uploadedReports();
+  }
+
+  JsonObject sampling = doc.createNestedObject("sampling");
+  sampling["mode"] = SamplingPolicy::modeName(controller.sampling().mode());
+  sampling["interval_ms"] = controller.sampling().interval();
+  for (uint8_t m = 0; m < SAMPLING_MODE_COUNT; m++) {
+    sampling[SamplingPolicy::modeName((SamplingMode)m)] = controller.sampling().samples((SamplingMode)m);
+  }
+
+  const char* keys[2] = { "organic_forecast", "non_organic_forecast" };
+  for (uint8_t i = 0; i < 2; i++) {
+    JsonObject f = doc.createNestedObject(keys[i]);
+    f["rate_short"] = binForecasts[i].shortTerm.ratePerHour(); // %/hour
+    f["rate_long"] = binForecasts[i].longTerm.ratePerHour();
+    f["time_to_full"] = binForecasts[i].longTerm.secondsToFull(BIN_FULL_PERCENT);
+    JsonArray profile = f.createNestedArray("hourly_profile"); // tenths of % per hour
+    for (uint8_t h = 0; h < 24; h++) {
+      profile.add(binForecasts[i].profile.bucket(h));
+    }
+  }
+}
+
+// ==================== METRICS ====================
+void writeHistogram(AsyncResponseStream* out, const char* name, const char* label, const char* value, const LatencyHistogram& h) {
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    out->printf("%s_bucket{%s=\"%s\",le=\"%g\"} %u\n", name, label, value,
+                LATENCY_BOUNDS_US[i] / 1e6, (unsigned)h.cumulative(i));
+  }
+  out->printf("%s_bucket{%s=\"%s\",le=\"+Inf\"} %u\n", name, label, value, (unsigned)h.count());
+  out->printf("%s_sum{%s=\"%s\"} %g\n", name, label, value, h.sumMicros() / 1e6);
+  out->printf("%s_count{%s=\"%s\"} %u\n", name, label, value, (unsigned)h.count());
+}
+
+void writeCounter(AsyncResponseStream* out, const char* name, const char* help, uint32_t value) {
+  out->printf("# HELP %s %s\n# TYPE %s counter\n%s %u\n", name, help, name, name, (unsigned)value);
+}
+
+// Prometheus text exposition format
+void handleMetrics(AsyncWebServerRequest* request) {
+  AsyncResponseStream* out = request->beginResponseStream("text/plain; version=0.0.4");
+  
+  out->print("# HELP smartbin_loop_phase_seconds Time spent in each loop phase\n");
+  out->print("# TYPE smartbin_loop_phase_seconds histogram\n");
+  for (uint8_t i = 0; i < PHASE_COUNT; i++) {
+    writeHistogram(out, "smartbin_loop_phase_seconds", "phase", PHASE_NAMES[i], phaseHistograms[i]);
+  }
+  
+  out->print("# HELP smartbin_state_handler_seconds Time spent in each state handler\n");
+  out->print("# TYPE smartbin_state_handler_seconds histogram\n");
+  for (uint8_t i = 0; i < BIN_STATE_COUNT; i++) {
+    writeHistogram(out, "smartbin_state_handler_seconds", "state", STATE_NAMES[i], stateHistograms[i]);
+  }
+  
+  out->print("# HELP smartbin_loop_max_seconds Slowest loop iteration since boot\n# TYPE smartbin_loop_max_seconds gauge\n");
+  out->printf("smartbin_loop_max_seconds %g\n", phaseHistograms[PHASE_LOOP].maxMicros() / 1e6);
+  
+  writeCounter(out, "smartbin_motion_events_total", "PIR triggers that started a cycle", controller.counters.motionEvents);
+  writeCounter(out, "smartbin_detections_total", "Material detections received from the camera", controller.counters.detections);
+  writeCounter(out, "smartbin_detection_timeouts_total", "Material detections that timed out", controller.counters.detectionTimeouts);
+  writeCounter(out, "smartbin_empty_detections_total", "Detections the camera answered with an empty chute", controller.counters.emptyDetections);
+  writeCounter(out, "smartbin_presence_triggers_total", "Cycles started by the camera seeing an item", controller.counters.presenceTriggers);
+  writeCounter(out, "smartbin_lid_opens_total", "Lid open commands", controller.counters.lidOpens);
+  writeCounter(out, "smartbin_full_refusals_total", "Cycles refused because the bin was full", controller.counters.fullRefusals);
+  writeCounter(out, "smartbin_uploads_total", "Successful backend uploads", controller.counters.uploads);
+  writeCounter(out, "smartbin_upload_failures_total", "Failed backend uploads", controller.counters.uploadFailures);
+  writeCounter(out, "smartbin_can_heartbeats_total", "CAN status frames sent", canHeartbeat.sent());
+  
+  out->print("# HELP smartbin_detection_stage_seconds PIR-to-lid latency by segment, across controller and camera\n");
+  out->print("# TYPE smartbin_detection_stage_seconds histogram\n");
+  for (uint8_t i = 0; i < SEGMENT_COUNT; i++) {
+    writeHistogram(out, "smartbin_detection_stage_seconds", "segment", DetectionLatency::segmentName(i), detectionLatency.segment(i));
+  }
+  writeCounter(out, "smartbin_detection_traces_complete_total", "Detections traced through every stage", detectionLatency.complete());
+  writeCounter(out, "smartbin_detection_traces_partial_total", "Detections with missing or unsynced stages", detectionLatency.partial());
+  writeCounter(out, "smartbin_detection_stage_unsynced_total", "Camera stage reports sent before its clock synced", detectionLatency.unsyncedReports());
+  writeCounter(out, "smartbin_detection_stage_stale_total", "Camera stage reports for no open detection", detectionLatency.staleReports());
+  
+  out->print("# HELP smartbin_state Current controller state\n# TYPE smartbin_state gauge\n");
+  out->printf("smartbin_state %u\n", (unsigned)controller.state());
+  out->print("# HELP smartbin_free_heap_bytes Free heap\n# TYPE smartbin_free_heap_bytes gauge\n");
+  out->printf("smartbin_free_heap_bytes %u\n", (unsigned)ESP.getFreeHeap());
+  out->print("# HELP smartbin_heap_largest_block_bytes Largest allocatable heap block\n# TYPE smartbin_heap_largest_block_bytes gauge\n");
+  out->printf("smartbin_heap_largest_block_bytes %u\n", (unsigned)ESP.getMaxAllocHeap());
+  out->print("# HELP smartbin_heap_min_free_bytes Lowest free heap since boot\n# TYPE smartbin_heap_min_free_bytes gauge\n");
+  out->printf("smartbin_heap_min_free_bytes %u\n", (unsigned)ESP.getMinFreeHeap());
+  out->print("# HELP smartbin_arena_high_water_bytes Most per-request scratch memory used at once\n# TYPE smartbin_arena_high_water_bytes gauge\n");
+  out->printf("smartbin_arena_high_water_bytes{arena=\"web\"} %u\n", (unsigned)webArena.highWater());
+  out->printf("smartbin_arena_high_water_bytes{arena=\"loop\"} %u\n", (unsigned)loopArena.highWater());
+  out->print("# HELP smartbin_arena_size_bytes Per-request scratch memory reserved at boot\n# TYPE smartbin_arena_size_bytes gauge\n");
+  out->printf("smartbin_arena_size_bytes{arena=\"web\",psram=\"%u\"} %u\n", webArena.inPsram(), (unsigned)webArena.size());
+  out->printf("smartbin_arena_size_bytes{arena=\"loop\",psram=\"%u\"} %u\n", loopArena.inPsram(), (unsigned)loopArena.size());
+  out->print("# HELP smartbin_arena_failures_total Scratch allocations that did not fit\n# TYPE smartbin_arena_failures_total counter\n");
+  out->printf("smartbin_arena_failures_total{arena=\"web\"} %u\n", (unsigned)webArena.failedAllocations());
+  out->printf("smartbin_arena_failures_total{arena=\"loop\"} %u\n", (unsigned)loopArena.failedAllocations());
+  out->print("# HELP smartbin_boot_ready_seconds App start to the end of setup(), when PIR, lids and keypad are live\n# TYPE smartbin_boot_ready_seconds gauge\n");
+  out->printf("smartbin_boot_ready_seconds %g\n", bootReadyUs / 1e6);
+  if (bootOnlineUs != 0) {
+    out->print("# HELP smartbin_boot_online_seconds App start to the first WiFi connection\n# TYPE smartbin_boot_online_seconds gauge\n");
+    out->printf("smartbin_boot_online_seconds %g\n", bootOnlineUs / 1e6);
+  }
+  out->print("# HELP smartbin_http_requests_total Web API requests and WebSocket commands by rate class and outcome\n");
+  out->print("# TYPE smartbin_http_requests_total counter\n");
+  for (uint8_t i = 0; i < RATE_CLASS_COUNT; i++) {
+    out->printf("smartbin_http_requests_total{class=\"%s\",outcome=\"allowed\"} %u\n", RATE_CLASS_NAMES[i], (unsigned)rateLimiter.allowed(i));
+    out->printf("smartbin_http_requests_total{class=\"%s\",outcome=\"limited\"} %u\n", RATE_CLASS_NAMES[i], (unsigned)rateLimiter.limited(i));
+    out->printf("smartbin_http_requests_total{class=\"%s\",outcome=\"busy\"} %u\n", RATE_CLASS_NAMES[i], (unsigned)rateLimiter.busy(i));
+  }
+  out->print("# HELP smartbin_http_in_flight Web API requests being handled\n# TYPE smartbin_http_in_flight gauge\n");
+  out->printf("smartbin_http_in_flight %u\n", (unsigned)rateLimiter.inFlight());
+  out->print("# HELP smartbin_http_in_flight_max Most web API requests handled at once\n# TYPE smartbin_http_in_flight_max gauge\n");
+  out->printf("smartbin_http_in_flight_max %u\n", (unsigned)rateLimiter.peakInFlight());
+  writeCounter(out, "smartbin_http_client_evictions_total", "Clients dropped from the rate limit table to make room", rateLimiter.evictions());
+  writeCounter(out, "smartbin_history_rejected_total", "History samples dropped because the clock stepped back", fillHistory.rejected());
+  writeCounter(out, "smartbin_history_write_failures_total", "History block writes that failed", fillHistory.writeFailures());
+  if (UPLINK_ROLE == ROLE_GATEWAY) {
+    out->print("# HELP smartbin_gateway_stations Bins heard from in the last hour, this one included\n# TYPE smartbin_gateway_stations gauge\n");
+    out->printf("smartbin_gateway_stations %u\n", (unsigned)gateway.stations());
+    out->print("# HELP smartbin_gateway_pending Stations with news not yet uploaded\n# TYPE smartbin_gateway_pending gauge\n");
+    out->printf("smartbin_gateway_pending %u\n", (unsigned)gateway.pending());
+    writeCounter(out, "smartbin_gateway_reports_total", "Reports received from leaves and this bin", gateway.reports());
+    writeCounter(out, "smartbin_gateway_duplicates_total", "Leaf retransmissions acknowledged again", gateway.duplicates());
+    writeCounter(out, "smartbin_gateway_rejected_total", "Malformed frames, or leaves refused for want of a slot", gateway.rejected());
+    writeCounter(out, "smartbin_gateway_uploads_total", "Batched uploads", gateway.uploads());
+    writeCounter(out, "smartbin_gateway_upload_failures_total", "Batched uploads that failed", gateway.uploadFailures());
+    writeCounter(out, "smartbin_gateway_uploaded_reports_total", "Station reports carried by batched uploads", gateway.uploadedReports());
+    writeCounter(out, "smartbin_radio_frames_dropped_total", "ESP-NOW frames dropped with the queue full", radioFramesDropped);
+  }
+  writeCounter(out, "smartbin_wifi_connects_total", "WiFi connections, including reconnects", wifiLink.connects());
+  writeCounter(out, "smartbin_wifi_fast_connects_total", "WiFi connections to the cached AP without a scan", wifiLink.fastConnects());
+  out->print("# HELP smartbin_uptime_seconds Time since boot\n# TYPE smartbin_uptime_seconds gauge\n");
+  out->printf("smartbin_uptime_seconds %u\n", (unsigned)(millis() / 1000));
+  
+  request->send(out);
+}
+
+// ==================== STATUS EVENTS ====================
+void setupEvents() {
+  bootId = esp_random();
+  
+  events.onConnect([](AsyncEventSourceClient* client) {
+    // Full snapshot first; deltas follow as the status changes
+    ArenaScope scope(webArena);
+    ArenaJsonDocument doc(2048, ArenaAllocator(webArena));
+    buildStatusJson(doc);
+    doc["version"] = statusVersion;
+    
+    size_t len = measureJson(doc);
+    char* body = (char*)webArena.allocate(len + 1);
+    if (body) {
+      serializeJson(doc, body, len + 1);
+      client->send(body, "status", statusVersion);
+    }
+  });
+  server.addHandler(&events);
+}
+
+// Bumped whenever a field of buildStatusCore() changes
+void updateStatusVersion() {
+  StatusCore now;
+  now.state = controller.state();
+  now.organicFill = controller.fillEstimate(BIN_ORGANIC).fillPercent();
+  now.nonOrganicFill = controller.fillEstimate(BIN_NON_ORGANIC).fillPercent();
+  now.organicFull = controller.isFull(BIN_ORGANIC);
+  now.nonOrganicFull = controller.isFull(BIN_NON_ORGANIC);
+  now.organicWeight10g = controller.fillEstimate(BIN_ORGANIC).massGrams() / 10;
+  now.nonOrganicWeight10g = controller.fillEstimate(BIN_NON_ORGANIC).massGrams() / 10;
+  
+  static bool first = true;
+  StaticJsonDocument<256> delta;
+  if (first || now.state != lastStatus.state) delta["state"] = now.state;
+  if (first || now.organicFill != lastStatus.organicFill) delta["organic_fill"] = now.organicFill;
+  if (first || now.nonOrganicFill != lastStatus.nonOrganicFill) delta["non_organic_fill"] = now.nonOrganicFill;
+  if (first || now.organicFull != lastStatus.organicFull) delta["organic_full"] = now.organicFull;
+  if (first || now.nonOrganicFull != lastStatus.nonOrganicFull) delta["non_organic_full"] = now.nonOrganicFull;
+  if (first || now.organicWeight10g != lastStatus.organicWeight10g) delta["organic_level"] = statusWeightKg(BIN_ORGANIC);
+  if (first || now.nonOrganicWeight10g != lastStatus.nonOrganicWeight10g) delta["non_organic_level"] = statusWeightKg(BIN_NON_ORGANIC);
+  if (delta.size() == 0) {
+    return;
+  }
+  
+  lastStatus = now;
+  first = false;
+  statusVersion++;
+  
+  if (events.count() == 0) {
+    return;
+  }
+  delta["version"] = statusVersion;
+  char body[256];
+  serializeJson(delta, body, sizeof(body));
+  events.send(body, "delta", statusVersion);
+}
+
+void formatStatusETag(char* buf, size_t len) {
+  snprintf(buf, len, "W/\"%08x-%x\"", (unsigned)bootId, (unsigned)statusVersion);
+}
+
 // ==================== WEBSOCKET SETUP ====================
 void setupWebSocket() {
-  webSocket.begin();
-  webSocket.onEvent(webSocketEvent);
+  ws.onEvent(webSocketEvent);
+  server.addHandler(&ws);
 }
 
-void webSocketEvent(uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
+// Runs in the AsyncTCP task, not from loop()
+void webSocketEvent(AsyncWebSocket* server, AsyncWebSocketClient* client, AwsEventType type, void* arg, uint8_t* data, size_t length) {
   switch(type) {
-    case WStype_DISCONNECTED:
-      Serial.printf("Client [%u] disconnected\n", num);
+    case WS_EVT_DISCONNECT:
+      Serial.printf("Client [%u] disconnected\n", client->id());
       break;
       
-    case WStype_CONNECTED:
-      Serial.printf("Client [%u] connected from %s\n", num, payload);
+    case WS_EVT_CONNECT:
+      Serial.printf("Client [%u] connected from %s\n", client->id(), client->remoteIP().toString().c_str());
+      // Drop clients beyond the limit / stale ones
+      ws.cleanupClients();
       // Send initial status
-      sendWebSocketStatus(num);
+      sendWebSocketStatus(client);
       break;
       
-    case WStype_TEXT:
-      handleWebSocketMessage(num, (char*)payload);
+    case WS_EVT_DATA: {
+      // Commands are small; only handle complete single-frame text messages
+      AwsFrameInfo* info = (AwsFrameInfo*)arg;
+      if (rateLimiter.admit(client->remoteIP(), RATE_SOCKET, millis(), false) != RATE_ALLOWED) {
+        break;   // Dropped; counted with the shed requests
+      }
+      if (info->final && info->index == 0 && info->len == length && info->opcode == WS_TEXT) {
+        handleWebSocketMessage(client, (const char*)data, length);
+      }
       break;
+    }
       
     default:
       break;
   }
 }
 
-void sendWebSocketStatus(uint8_t clientNum) {
-  DynamicJsonDocument doc(1024);
-  doc["organic_level"] = organicBinWeight;
-  doc["non_organic_level"] = nonOrganicBinWeight;
-  doc["organic_full"] = isOrganicBinFull;
-  doc["non_organic_full"] = isNonOrganicBinFull;
-  doc["state"] = currentState;
-  doc["bin_organic_id"] = BIN_ORGANIC_ID;
-  doc["bin_non_organic_id"] = BIN_NON_ORGANIC_ID;
+void sendWebSocketStatus(AsyncWebSocketClient* client) {
+  ArenaScope scope(webArena);
+  ArenaJsonDocument doc(2048, ArenaAllocator(webArena));
+  buildStatusJson(doc);
   
-  String response;
-  serializeJson(doc, response);
-  webSocket.sendTXT(clientNum, response);
+  size_t len = measureJson(doc);
+  AsyncWebSocketMessageBuffer* buffer = ws.makeBuffer(len);
+  if (buffer) {
+    serializeJson(doc, (char*)buffer->get(), len + 1);
+    client->text(buffer);
+  }
 }
 
-void handleWebSocketMessage(uint8_t clientNum, String message) {
-  DynamicJsonDocument doc(1024);
-  deserializeJson(doc, message);
+void handleWebSocketMessage(AsyncWebSocketClient* client, const char* message, size_t length) {
+  StaticJsonDocument<256> doc;
+  if (deserializeJson(doc, message, length)) {
+    return;
+  }
   
-  String command = doc["command"];
+  const char* name = doc["command"] | "";
+  uint8_t command = 0;
+  while (command < WS_COMMAND_COUNT && strcmp(name, WS_COMMAND_NAMES[command]) != 0) {
+    command++;
+  }
   
-  if (command == "open_organic" && !isOrganicBinFull) {
-    openBin(0);
-  } else if (command == "open_non_organic" && !isNonOrganicBinFull) {
-    openBin(1);
-  } else if (command == "close_organic") {
-    closeBin(0);
-  } else if (command == "close_non_organic") {
-    closeBin(1);
-  } else if (command == "get_status") {
-    sendWebSocketStatus(clientNum);
+  // Lid commands wait for the loop; a full queue drops them like a full bin
+  ManualCommand manual;
+  switch (command) {
+    case WS_OPEN_ORGANIC:
+    case WS_OPEN_NON_ORGANIC:
+    case WS_CLOSE_ORGANIC:
+    case WS_CLOSE_NON_ORGANIC:
+      manual = command == WS_OPEN_ORGANIC ? MANUAL_OPEN_ORGANIC
+             : command == WS_OPEN_NON_ORGANIC ? MANUAL_OPEN_NON_ORGANIC
+             : command == WS_CLOSE_ORGANIC ? MANUAL_CLOSE_ORGANIC
+             : MANUAL_CLOSE_NON_ORGANIC;
+      xQueueSend(manualCommands, &manual, 0);
+      break;
+    case WS_GET_STATUS:
+      sendWebSocketStatus(client);
+      break;
+  }
+}
+
+// ==================== MANUAL COMMANDS ====================
+// Web server task: queue for the loop, 503 if it has fallen behind
+void sendManualCommand(AsyncWebServerRequest* request, ManualCommand command, const char* body) {
+  if (xQueueSend(manualCommands, &command, 0) == pdTRUE) {
+    request->send(200, "application/json", body);
+  } else {
+    request->send(503, "application/json", "{\"status\":\"error\",\"message\":\"Busy\"}");
+  }
+}
+
+// ==================== HARDWARE ====================
+int32_t DeviceHardware::massGrams() {
+  if (!Board::HAS_LOAD_CELL) {
+    return FillEstimator::INVALID;   // Fill comes from the ultrasonic alone
+  }
+  scaleFault = !scale.is_ready();
+  if (scaleFault) {
+    return FillEstimator::INVALID;
+  }
+  return (int32_t)scale.get_units(5);
+}
+
+int32_t DeviceHardware::distanceMm() {
+  float distance = getDistance();
+  distanceFault = distance <= 0;
+  return distanceFault ? FillEstimator::INVALID : (int32_t)(distance * 10);
+}
+
+void DeviceHardware::setLid(uint8_t bin, bool open) {
+  // A flap board has one servo; the angle picks the bin
+  Servo& servo = lidServos[Board::LID_SERVOS == 2 ? bin : 0];
+  servo.write(Board::lidAngle(bin, open));
+}
+
+void DeviceHardware::sendCan(const CanMessage& msg) {
+  // Only controller traffic is traced; heartbeats would flood the ring
+  ::trace(TRACE_CAN_TX, msg.length, msg.id);
+  sendCANMessage(msg);
+  uint16_t traceId;
+  if (parseDetectRequest(msg, traceId)) {
+    detectionLatency.requestSent(traceId, (uint32_t)esp_timer_get_time());
   }
 }
 
-// ==================== MOTION DETECTION ====================
-void handleMotionDetection() {
-  if (digitalRead(PIR_PIN) == HIGH) {
-    lastMotionTime = millis();
-    if (currentState == IDLE) {
-      currentState = DETECTING_MOTION;
-      Serial.println("Motion detected!");
+// Camera stage reports go to the latency tracer, not the controller. They
+// carry their own timestamps, so it doesn't matter when they are drained.
+bool DeviceHardware::receiveCan(CanMessage& msg) {
+  while (receiveCANMessage(msg)) {
+    uint8_t node;
+    uint16_t traceId;
+    DetectStage stage;
+    uint32_t timeUs;
+    bool synced;
+    if (!parseStageReport(msg, node, traceId, stage, timeUs, synced)) {
+      return true;
+    }
+    if (node == CAN_NODE_ID) {
+      detectionLatency.remoteStage(traceId, stage, timeUs, synced);
     }
   }
+  return false;
 }
 
-// ==================== MATERIAL DETECTION ====================
-void handleMaterialDetection() {
-  uint32_t canId;
-  String canMessage;
-  
-  if (receiveCANMessage(&canId, &canMessage)) {
-    if (canId == 0x200) { // Response from ESP32-CAM
-      if (canMessage.startsWith("MATERIAL:")) {
-        detectedMaterial = canMessage.substring(9);
-        materialDetectionComplete = true;
-        Serial.printf("Material detected: %s\n", detectedMaterial.c_str());
+// The controller's trace points double as its latency stages
+void DeviceHardware::trace(uint8_t event, uint8_t a, uint16_t b) {
+  ::trace(event, a, b);
+  uint32_t nowUs = (uint32_t)esp_timer_get_time();
+  switch (event) {
+    case TRACE_MOTION:
+      detectionLatency.motion(nowUs);
+      break;
+    case TRACE_DETECTION:
+      detectionLatency.mark(STAGE_RESULT_RX, nowUs);
+      usageCounters.increment(a == MATERIAL_ORGANIC ? USAGE_ITEMS_ORGANIC
+                            : a == MATERIAL_NON_ORGANIC ? USAGE_ITEMS_NON_ORGANIC
+                            : a == MATERIAL_NONE ? USAGE_EMPTY_DETECTIONS
+                            : USAGE_ITEMS_UNKNOWN);
+      break;
+    case TRACE_DETECTION_TIMEOUT:
+      usageCounters.increment(USAGE_DETECTION_TIMEOUTS);
+      break;
+    case TRACE_LID_OPEN:
+      detectionLatency.lidOpened(nowUs);
+      usageCounters.increment(a == BIN_ORGANIC ? USAGE_LID_OPENS_ORGANIC : USAGE_LID_OPENS_NON_ORGANIC);
+      break;
+    case TRACE_STATE:
+      if (b == BIN_FULL) {
+        usageCounters.increment(USAGE_FULL_EVENTS);
       }
+      break;
+  }
+}
+
+void DeviceHardware::uploadBinData() {
+  sendBinDataToBackend();
+}
+
+// ==================== BIN LEVEL MONITORING ====================
+void updateForecasts() {
+  static unsigned long lastSample = 0;
+  if (lastSample != 0 && millis() - lastSample < FORECAST_SAMPLE_INTERVAL) {
+    return;
+  }
+  lastSample = millis();
+
+  uint32_t now = millis() / 1000;
+  float fills[2] = { controller.fillEstimate(BIN_ORGANIC).fillPermille() / 10.0f, controller.fillEstimate(BIN_NON_ORGANIC).fillPermille() / 10.0f };
+
+  // Hour of day only once NTP has synced
+  struct tm timeinfo;
+  bool haveTime = getLocalTime(&timeinfo, 0);
+
+  for (uint8_t i = 0; i < 2; i++) {
+    binForecasts[i].shortTerm.addSample(now, fills[i]);
+    binForecasts[i].longTerm.addSample(now, fills[i]);
+    if (haveTime) {
+      binForecasts[i].profile.addSample(timeinfo.tm_hour, fills[i]);
     }
   }
 }
 
-// ==================== BIN CONTROL ====================
-void openBin(uint8_t binType) {
-  if (binType == 0) { // Organic
-    servoOrganic.write(90); // Open position
-    Serial.println("Organic bin opened");
-  } else { // Non-organic
-    servoNonOrganic.write(90); // Open position
-    Serial.println("Non-organic bin opened");
+// ==================== FILL HISTORY ====================
+void updateFillHistory() {
+  static unsigned long lastSample = 0;
+  static unsigned long lastCheckpoint = 0;
+  if (lastSample != 0 && millis() - lastSample < HISTORY_STEP_S * 1000UL) {
+    return;
   }
-  digitalWrite(BUZZER_PIN, HIGH);
-  delay(100);
-  digitalWrite(BUZZER_PIN, LOW);
+  // Wall-clock timestamps only; nothing is kept until NTP has synced
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo, 0)) {
+    return;
+  }
+  lastSample = millis();
+
+  int32_t values[HISTORY_CHANNELS];
+  for (uint8_t i = 0; i < 2; i++) {
+    const FillEstimator& fill = controller.fillEstimate(i);
+    values[HISTORY_FILL_ORGANIC + i] = fill.fillPermille();
+    values[HISTORY_WEIGHT_ORGANIC + i] = fill.hasMass() ? fill.massGrams() / 10 : HISTORY_MISSING;
+  }
+
+  // Checkpoints wait for the lids to be at rest, like the usage counters
+  BinState state = controller.state();
+  bool atRest = state == IDLE || state == BIN_FULL || state == MAINTENANCE_MODE;
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  fillHistory.append(time(nullptr), values);
+  if (atRest && millis() - lastCheckpoint >= HISTORY_CHECKPOINT_MS) {
+    fillHistory.checkpoint();
+    lastCheckpoint = millis();
+  }
+  xSemaphoreGive(historyMutex);
 }
 
-void closeBin(uint8_t binType) {
-  if (binType == 0) { // Organic
-    servoOrganic.write(0); // Close position
-    Serial.println("Organic bin closed");
-  } else { // Non-organic
-    servoNonOrganic.write(0); // Close position
-    Serial.println("Non-organic bin closed");
+// Fill is sent in percent and weight in kg, like /api/status
+size_t formatHistoryPoint(char* buf, size_t len, const HistoryPoint& p, bool first) {
+  int n = snprintf(buf, len, "%s[%lu", first ? "" : ",", (unsigned long)p.time);
+  for (uint8_t c = 0; c < HISTORY_CHANNELS; c++) {
+    if (p.values[c] == HISTORY_MISSING) {
+      n += snprintf(buf + n, len - n, ",null");
+    } else if (c < HISTORY_WEIGHT_ORGANIC) {
+      n += snprintf(buf + n, len - n, ",%.1f", p.values[c] / 10.0f);
+    } else {
+      n += snprintf(buf + n, len - n, ",%.2f", p.values[c] / 100.0f);
+    }
   }
+  n += snprintf(buf + n, len - n, "]");
+  return n;
 }
 
-// ==================== BIN LEVEL MONITORING ====================
-void updateBinLevel() {
-  // Read load cell (simplified - in real implementation, you'd have separate load cells)
-  float weight = scale.get_units(5);
-  
-  // For demonstration, we'll use ultrasonic sensor to estimate bin level
-  float distance = getDistance();
-  float level = map(distance, 5, 50, 100, 0); // Adjust based on your bin dimensions
-  level = constrain(level, 0, 100);
-  
-  // Estimate weight based on level (simplified)
-  organicBinWeight = (level / 100.0) * MAX_BIN_CAPACITY;
-  nonOrganicBinWeight = (level / 100.0) * MAX_BIN_CAPACITY;
-  
-  // Check if bins are full
-  isOrganicBinFull = organicBinWeight >= BIN_FULL_THRESHOLD;
-  isNonOrganicBinFull = nonOrganicBinWeight >= BIN_FULL_THRESHOLD;
+// Chunk filler for /api/history; runs in the AsyncTCP task
+size_t fillHistoryChunk(uint32_t generation, uint8_t* buffer, size_t maxLen) {
+  HistoryStream& s = historyStream;
+  if (!s.active || s.generation != generation) {
+    return 0;   // Ended, or a newer request took the cursor
+  }
+  s.lastPullMs = millis();
+  size_t out = 0;
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  while (out < maxLen) {
+    if (s.lineSent == s.lineLen) {
+      HistoryPoint p;
+      if (s.ended) {
+        break;
+      }
+      if (s.cursor.next(p)) {
+        s.lineLen = formatHistoryPoint(s.line, sizeof(s.line), p, s.first);
+        s.first = false;
+      } else {
+        s.lineLen = snprintf(s.line, sizeof(s.line), "]}");
+        s.ended = true;
+      }
+      s.lineSent = 0;
+    }
+    size_t n = s.lineLen - s.lineSent;
+    if (n > maxLen - out) {
+      n = maxLen - out;
+    }
+    memcpy(buffer + out, s.line + s.lineSent, n);
+    s.lineSent += n;
+    out += n;
+  }
+  xSemaphoreGive(historyMutex);
+  if (out == 0) {
+    s.active = false;
+  }
+  return out;
+}
+
+// GET /api/history?from=&to=&resolution=  Unix seconds; the last day at
+// full resolution by default. Points are averaged into `resolution`-second
+// buckets and streamed straight from the cursor.
+void handleHistory(AsyncWebServerRequest* request) {
+  uint32_t now = time(nullptr);
+  uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), nullptr, 10) : now;
+  uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), nullptr, 10)
+                                            : (to > 86400 ? to - 86400 : 0);
+  uint32_t resolution = request->hasParam("resolution") ? strtoul(request->getParam("resolution")->value().c_str(), nullptr, 10) : 0;
+  if (from > to) {
+    request->send(400, "application/json", "{\"status\":\"error\",\"message\":\"from is after to\"}");
+    return;
+  }
+  HistoryStream& s = historyStream;
+  if (s.active && millis() - s.lastPullMs < HISTORY_STREAM_IDLE_MS) {
+    AsyncWebServerResponse* busy = request->beginResponse(503, "application/json", "{\"status\":\"error\",\"message\":\"History busy\"}");
+    busy->addHeader("Retry-After", "1");
+    request->send(busy);
+    return;
+  }
+
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  s.cursor.begin(fillHistory, from, to, resolution);
+  xSemaphoreGive(historyMutex);
+  s.generation++;
+  s.active = true;
+  s.ended = false;
+  s.first = true;
+  s.lastPullMs = millis();
+  s.lineLen = snprintf(s.line, sizeof(s.line),
+                       "{\"step\":%u,\"resolution\":%lu,\"from\":%lu,\"to\":%lu,"
+                       "\"columns\":[\"time\",\"organic_fill\",\"non_organic_fill\",\"organic_level\",\"non_organic_level\"],"
+                       "\"points\":[",
+                       HISTORY_STEP_S, (unsigned long)resolution, (unsigned long)from, (unsigned long)to);
+  s.lineSent = 0;
+
+  uint32_t generation = s.generation;
+  AsyncWebServerResponse* response = request->beginChunkedResponse("application/json",
+    [generation](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      return fillHistoryChunk(generation, buffer, maxLen);
+    });
+  response->addHeader("Cache-Control", "no-cache");
+  request->send(response);
+}
+
+// ==================== FIRMWARE UPDATE ====================
+void updateFirmwareUpdate() {
+  if (!firmwareUpdate.rebootDue(millis())) {
+    return;
+  }
+  BinState state = controller.state();
+  if (state != IDLE && state != BIN_FULL && state != MAINTENANCE_MODE) {
+    return;   // Never restart with a lid open or moving
+  }
+  if (inputRecorder.recording()) {
+    flushInputRecording();
+  }
+  usageCounters.flush(millis());
+  xSemaphoreTake(historyMutex, portMAX_DELAY);
+  fillHistory.checkpoint();
+  xSemaphoreGive(historyMutex);
+  Serial.println("Rebooting into the new firmware");
+  ESP.restart();
+}
+
+// ==================== USAGE COUNTERS ====================
+// Flushes when a batch or the interval is due, and straight away when the
+// bin locks out as full or goes into maintenance; only with the lids at rest
+void updateUsageCounters() {
+  static BinState lastState = IDLE;
+  BinState state = controller.state();
+  bool entered = state != lastState && (state == BIN_FULL || state == MAINTENANCE_MODE);
+  lastState = state;
+  if (state != IDLE && state != BIN_FULL && state != MAINTENANCE_MODE) {
+    return;
+  }
+  if (usageCounters.flushDue(millis()) || (entered && usageCounters.pending() > 0)) {
+    usageCounters.flush(millis());
+  }
+}
+
+// ==================== INPUT RECORDING ====================
+void flushInputRecording() {
+  if (inputRecorder.size() == 0) {
+    return;
+  }
+  File f = LittleFS.open(INPUT_TRACE_PATH, FILE_APPEND);
+  if (f) {
+    f.write(inputRecorder.data(), inputRecorder.size());
+    f.close();
+  }
+  inputRecorder.drain();
+}
+
+// Runs from the loop so the recorder is only touched by one task
+void updateInputRecording() {
+  RecordCommand command = recordCommand;
+  recordCommand = RECORD_NONE;
   
-  if (isOrganicBinFull || isNonOrganicBinFull) {
-    currentState = BIN_FULL;
+  if (command == RECORD_START && !inputRecorder.recording()) {
+    LittleFS.remove(INPUT_TRACE_PATH);
+    inputRecorder.begin(inputTraceBuffer, sizeof(inputTraceBuffer), millis());
+  } else if (command == RECORD_STOP && inputRecorder.recording()) {
+    inputRecorder.stop();
+    flushInputRecording();
+  } else if (inputRecorder.recording() && inputRecorder.size() > sizeof(inputTraceBuffer) * 3 / 4) {
+    flushInputRecording();
   }
 }
 
 float getDistance() {
-  digitalWrite(TRIG_PIN, LOW);
+  digitalWrite(Board::TRIG_PIN, LOW);
   delayMicroseconds(2);
-  digitalWrite(TRIG_PIN, HIGH);
+  digitalWrite(Board::TRIG_PIN, HIGH);
   delayMicroseconds(10);
-  digitalWrite(TRIG_PIN, LOW);
+  digitalWrite(Board::TRIG_PIN, LOW);
   
-  long duration = pulseIn(ECHO_PIN, HIGH);
+  long duration = pulseIn(Board::ECHO_PIN, HIGH, ECHO_TIMEOUT_US);
+  if (duration == 0) {
+    return -1; // No echo
+  }
   float distance = (duration * 0.034) / 2; // Speed of sound in cm
   
   return distance;
 }
 
 // ==================== LED CONTROL ====================
-void updateLEDs() {
-  if (currentState == BIN_FULL) {
-    // Red blinking
-    digitalWrite(LED_RED_PIN, HIGH);
-    digitalWrite(LED_GREEN_PIN, LOW);
-    digitalWrite(LED_BLUE_PIN, LOW);
-  } else if (currentState == BIN_OPEN) {
-    // Green solid
-    digitalWrite(LED_RED_PIN, LOW);
-    digitalWrite(LED_GREEN_PIN, HIGH);
-    digitalWrite(LED_BLUE_PIN, LOW);
-  } else if (isOrganicBinFull || isNonOrganicBinFull) {
-    // Yellow/Orange (Red + Green)
-    digitalWrite(LED_RED_PIN, HIGH);
-    digitalWrite(LED_GREEN_PIN, HIGH);
-    digitalWrite(LED_BLUE_PIN, LOW);
-  } else {
-    // Blue (normal operation)
-    digitalWrite(LED_RED_PIN, LOW);
-    digitalWrite(LED_GREEN_PIN, LOW);
-    digitalWrite(LED_BLUE_PIN, HIGH);
-  }
+void setupIndicators() {
+  ledcSetup(LEDC_RED_CHANNEL, LED_PWM_FREQ, LED_PWM_RESOLUTION);
+  ledcSetup(LEDC_GREEN_CHANNEL, LED_PWM_FREQ, LED_PWM_RESOLUTION);
+  ledcSetup(LEDC_BLUE_CHANNEL, LED_PWM_FREQ, LED_PWM_RESOLUTION);
+  ledcSetup(LEDC_BUZZER_CHANNEL, 2000, LED_PWM_RESOLUTION);
+  ledcAttachPin(Board::LED_RED_PIN, LEDC_RED_CHANNEL);
+  ledcAttachPin(Board::LED_GREEN_PIN, LEDC_GREEN_CHANNEL);
+  ledcAttachPin(Board::LED_BLUE_PIN, LEDC_BLUE_CHANNEL);
+  ledcAttachPin(Board::BUZZER_PIN, LEDC_BUZZER_CHANNEL);
+  ledcWriteTone(LEDC_BUZZER_CHANNEL, 0);
+
+  esp_timer_create_args_t args = {};
+  args.callback = &patternTick;
+  args.name = "patterns";
+  esp_timer_create(&args, &patternTimer);
+  esp_timer_start_periodic(patternTimer, PATTERN_TICK_US);
 }
 
-// ==================== KEYPAD CONTROL ====================
-void checkKeypad() {
-  static unsigned long lastDebounceTime = 0;
-  const unsigned long debounceDelay = 200;
-  
-  if (millis() - lastDebounceTime > debounceDelay) {
-    if (digitalRead(KEYPAD_BUTTON1_PIN) == LOW) {
-      // Button 1: Open organic bin (if not full)
-      if (!isOrganicBinFull) {
-        openBin(0);
-        delay(3000);
-        closeBin(0);
-      }
-      lastDebounceTime = millis();
-    }
-    
-    if (digitalRead(KEYPAD_BUTTON2_PIN) == LOW) {
-      // Button 2: Open non-organic bin (if not full)
-      if (!isNonOrganicBinFull) {
-        openBin(1);
-        delay(3000);
-        closeBin(1);
-      }
-      lastDebounceTime = millis();
-    }
+// Runs in the esp_timer task; only touches the PWM channels that changed
+void patternTick(void* arg) {
+  static PatternFrame last = { 0, 0, 0, 0 };
+  static bool first = true;
+  PatternFrame f;
+  patterns.frame(millis(), f);
+
+  if (first || f.red != last.red) ledcWrite(LEDC_RED_CHANNEL, f.red);
+  if (first || f.green != last.green) ledcWrite(LEDC_GREEN_CHANNEL, f.green);
+  if (first || f.blue != last.blue) ledcWrite(LEDC_BLUE_CHANNEL, f.blue);
+  if (first || f.toneHz != last.toneHz) ledcWriteTone(LEDC_BUZZER_CHANNEL, f.toneHz);
+
+  last = f;
+  first = false;
+}
+
+void updateLEDs() {
+  BinState state = controller.state();
+  LedPattern pattern;
+  if (state == BIN_FULL) {
+    pattern = LED_FULL;            // Red blinking
+  } else if (state == MAINTENANCE_MODE) {
+    pattern = LED_MAINTENANCE;     // Amber breathing
+  } else if (state == BIN_OPEN) {
+    pattern = LED_OPEN;            // Green solid
+  } else if (state == ANALYZING_MATERIAL) {
+    pattern = LED_ANALYZING;       // Blue breathing
+  } else if (controller.isFull(BIN_ORGANIC) || controller.isFull(BIN_NON_ORGANIC)) {
+    pattern = LED_NEARLY_FULL;     // Yellow/Orange (Red + Green)
+  } else {
+    pattern = LED_IDLE;            // Blue (normal operation)
   }
+  patterns.setLed(pattern, millis());
+  patterns.expireTone(millis());
 }
 
 // ==================== BACKEND COMMUNICATION ====================
 void sendBinDataToBackend() {
+  if (UPLINK_ROLE != ROLE_STANDALONE) {
+    LeafReport report;
+    makeLocalReport(report);
+    if (UPLINK_ROLE == ROLE_GATEWAY) {
+      gateway.submit(report, millis());
+    } else {
+      leafLink.report(report, millis());
+      lastLeafReportMs = millis();
+    }
+    return;
+  }
   if (WiFi.status() != WL_CONNECTED) {
     return;
   }
   
-  DynamicJsonDocument doc(1024);
-  doc["bin_organic_id"] = BIN_ORGANIC_ID;
-  doc["bin_non_organic_id"] = BIN_NON_ORGANIC_ID;
-  doc["organic_weight"] = organicBinWeight;
-  doc["non_organic_weight"] = nonOrganicBinWeight;
-  doc["organic_full"] = isOrganicBinFull;
-  doc["non_organic_full"] = isNonOrganicBinFull;
+  ArenaScope scope(loopArena);
+  ArenaJsonDocument doc(2048, ArenaAllocator(loopArena));
+  doc["bin_organic_id"] = controller.binId(BIN_ORGANIC);
+  doc["bin_non_organic_id"] = controller.binId(BIN_NON_ORGANIC);
+  doc["organic_weight"] = controller.weightKg(BIN_ORGANIC);
+  doc["non_organic_weight"] = controller.weightKg(BIN_NON_ORGANIC);
+  doc["organic_full"] = controller.isFull(BIN_ORGANIC);
+  doc["non_organic_full"] = controller.isFull(BIN_NON_ORGANIC);
+  doc["organic_rate"] = binForecasts[0].longTerm.ratePerHour();
+  doc["non_organic_rate"] = binForecasts[1].longTerm.ratePerHour();
+  doc["organic_time_to_full"] = binForecasts[0].longTerm.secondsToFull(BIN_FULL_PERCENT);
+  doc["non_organic_time_to_full"] = binForecasts[1].longTerm.secondsToFull(BIN_FULL_PERCENT);
+  JsonArray organicProfile = doc.createNestedArray("organic_profile");
+  JsonArray nonOrganicProfile = doc.createNestedArray("non_organic_profile");
+  for (uint8_t h = 0; h < 24; h++) {
+    organicProfile.add(binForecasts[0].profile.bucket(h));
+    nonOrganicProfile.add(binForecasts[1].profile.bucket(h));
+  }
   doc["timestamp"] = millis();
   
-  String json;
-  serializeJson(doc, json);
+  size_t len = measureJson(doc);
+  char* json = (char*)loopArena.allocate(len + 1);
+  if (!json) {
+    controller.counters.uploadFailures++;
+    return;
+  }
+  serializeJson(doc, json, len + 1);
   
   // Send HTTP POST to backend
   WiFiClient client;
   HTTPClient http;
   
-  http.begin(client, String(backend_url) + "/api/bins/update");
+  http.begin(client, binUpdateUrl);
   http.addHeader("Content-Type", "application/json");
   
-  int httpResponseCode = http.POST(json);
+  int httpResponseCode = http.POST((uint8_t*)json, len);
+  lastUploadFailed = httpResponseCode <= 0;
   if (httpResponseCode > 0) {
-    Serial.printf("Backend response: %d\n", httpResponseCode);
+    controller.counters.uploads++;
+    trace(TRACE_UPLOAD, 1, httpResponseCode);
+  } else {
+    controller.counters.uploadFailures++;
+    trace(TRACE_UPLOAD, 0, (uint16_t)httpResponseCode); // Negative HTTPClient error code
+  }
+  
+  http.end();
+}
+
+// ==================== STATION GATEWAY ====================
+void onRadioReceive(const uint8_t* mac, const uint8_t* data, int len) {
+  RadioFrame frame;
+  if (len <= 0 || len > (int)sizeof(frame.data)) {
+    return;
+  }
+  memcpy(frame.peer, mac, RADIO_ADDRESS_SIZE);
+  frame.len = len;
+  memcpy(frame.data, data, len);
+  if (xQueueSend(radioFrames, &frame, 0) != pdTRUE) {
+    radioFramesDropped++;
+  }
+}
+
+void EspNowTransport::power(bool on, uint8_t channel) {
+  if (!on) {
+    if (started) {
+      esp_now_deinit();
+      WiFi.mode(WIFI_OFF);
+      started = false;
+    }
+    return;
+  }
+  if (!started) {
+    if (WiFi.getMode() == WIFI_OFF) {
+      WiFi.mode(WIFI_STA);
+    }
+    if (esp_now_init() != ESP_OK) {
+      return;
+    }
+    esp_now_register_recv_cb(onRadioReceive);
+    started = true;
+  }
+  if (channel != 0) {
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  }
+}
+
+bool EspNowTransport::send(const uint8_t* peer, const uint8_t* data, size_t len) {
+  if (!started) {
+    return false;
+  }
+  if (broadcastOnly) {
+    peer = RADIO_BROADCAST;
+  }
+  // Peers go with esp_now_deinit(), so a leaf re-adds its gateway per report
+  if (!esp_now_is_peer_exist(peer)) {
+    esp_now_peer_info_t info = {};
+    memcpy(info.peer_addr, peer, RADIO_ADDRESS_SIZE);
+    info.channel = 0;   // Whatever the radio is on
+    info.ifidx = WIFI_IF_STA;
+    if (esp_now_add_peer(&info) != ESP_OK) {
+      return false;
+    }
+  }
+  return esp_now_send(peer, data, len) == ESP_OK;
+}
+
+void setupUplink() {
+  if (UPLINK_ROLE == ROLE_STANDALONE) {
+    return;
+  }
+  radioFrames = xQueueCreate(RADIO_QUEUE_LENGTH, sizeof(RadioFrame));
+  if (UPLINK_ROLE == ROLE_GATEWAY) {
+    espNow.power(true, 0);   // Stays on, on the site AP's channel
   } else {
-    Serial.printf("Backend error: %s\n", http.errorToString(httpResponseCode).c_str());
+    WiFi.mode(WIFI_OFF);
+  }
+}
+
+void makeLocalReport(LeafReport& report) {
+  memset(&report, 0, sizeof(report));
+  report.state = controller.state();
+  for (uint8_t b = 0; b < 2; b++) {
+    const FillEstimator& fill = controller.fillEstimate(b);
+    report.binIds[b] = controller.binId(b);
+    report.grams[b] = fill.hasMass() ? fill.massGrams() : LEAF_NO_READING;
+    report.fillPermille[b] = fill.fillPermille();
+    report.ratePerHour[b] = (int16_t)constrain(binForecasts[b].longTerm.ratePerHour() * 100, -32768, 32767);
+    report.secondsToFull[b] = binForecasts[b].longTerm.secondsToFull(BIN_FULL_PERCENT);
+    if (controller.isFull(b)) {
+      report.flags |= b == BIN_ORGANIC ? LEAF_FLAG_ORGANIC_FULL : LEAF_FLAG_NON_ORGANIC_FULL;
+    }
+  }
+}
+
+// One request for up to MAX_BATCH stations; what the arena can't hold
+// waits for the next one
+void uploadGatewayBatch() {
+  if (!gateway.uploadDue(millis()) || WiFi.status() != WL_CONNECTED) {
+    return;
+  }
+  ArenaScope scope(loopArena);
+  size_t room = loopArena.size() - loopArena.inUse();
+  size_t fits = room > 64 ? (room - 64) / GATEWAY_BIN_JSON_MAX : 0;
+  uint8_t maxCount = fits < BinGateway::MAX_BATCH ? fits : BinGateway::MAX_BATCH;
+  if (maxCount == 0) {
+    return;
+  }
+  size_t maxLen = 64 + maxCount * GATEWAY_BIN_JSON_MAX;
+  char* body = (char*)loopArena.allocate(maxLen);
+  GatewayEntry batch[BinGateway::MAX_BATCH];
+  uint8_t count = gateway.takeBatch(batch, maxCount, millis());
+  size_t len = body ? BinGateway::formatBatch(body, maxLen, controller.binId(BIN_ORGANIC), batch, count) : 0;
+  if (len == 0) {
+    controller.counters.uploadFailures++;
+    gateway.uploaded(false, millis());
+    return;
   }
   
+  WiFiClient client;
+  HTTPClient http;
+  http.begin(client, binUpdateUrl);
+  http.addHeader("Content-Type", "application/json");
+  int httpResponseCode = http.POST((uint8_t*)body, len);
   http.end();
+  
+  // Anything but 2xx keeps the batch pending; only newer reports replace it
+  bool ok = httpResponseCode >= 200 && httpResponseCode < 300;
+  gateway.uploaded(ok, millis());
+  lastUploadFailed = !ok;
+  if (ok) {
+    controller.counters.uploads++;
+    trace(TRACE_UPLOAD, 1, httpResponseCode);
+  } else {
+    controller.counters.uploadFailures++;
+    trace(TRACE_UPLOAD, 0, (uint16_t)httpResponseCode);
+  }
+}
+
+void updateUplink() {
+  if (UPLINK_ROLE == ROLE_STANDALONE) {
+    return;
+  }
+  RadioFrame frame;
+  if (UPLINK_ROLE == ROLE_GATEWAY) {
+    // Leaves set their clocks from our acks, so only hand out a synced one
+    struct tm timeinfo;
+    uint32_t unixTime = getLocalTime(&timeinfo, 0) ? (uint32_t)time(nullptr) : 0;
+    while (xQueueReceive(radioFrames, &frame, 0) == pdTRUE) {
+      gateway.receive(frame.peer, frame.data, frame.len, millis(), unixTime);
+    }
+    uploadGatewayBatch();
+    return;
+  }
+  
+  while (xQueueReceive(radioFrames, &frame, 0) == pdTRUE) {
+    leafLink.receive(frame.peer, frame.data, frame.len, millis());
+  }
+  leafLink.update(millis());
+  // Upload error on the CAN heartbeat means the last report went unanswered
+  static uint32_t seenDelivered = 0;
+  static uint32_t seenFailed = 0;
+  if (leafLink.failed() != seenFailed) {
+    seenFailed = leafLink.failed();
+    lastUploadFailed = true;
+  }
+  if (leafLink.delivered() != seenDelivered) {
+    seenDelivered = leafLink.delivered();
+    lastUploadFailed = false;
+  }
+  
+  // No NTP out here: take the gateway's clock from each fresh ack
+  static uint32_t clockFromAckMs = 0;
+  if (leafLink.gatewayTime() != 0 && leafLink.gatewayTimeAtMs() != clockFromAckMs) {
+    clockFromAckMs = leafLink.gatewayTimeAtMs();
+    struct timeval tv = { (time_t)(leafLink.gatewayTime() + (millis() - clockFromAckMs) / 1000), 0 };
+    settimeofday(&tv, nullptr);
+  }
+  
+  if (!leafLink.busy() && millis() - lastLeafReportMs >= LEAF_REPORT_INTERVAL_MS) {
+    sendBinDataToBackend();
+  }
 }
@@ -0,0 +1,143 @@
+"""
+Decode smart bin CAN traffic from a candump capture.
+
+    candump -L can0 > bus.log        # or plain `candump can0`
+    python can_decode.py bus.log
+    candump can0 | python can_decode.py - --summary
+
+Controller status (0x300 + node), camera health (0x380 + node), time sync
+(0x080/0x180 + node), detection stage (0x280 + node) and chute presence
+(0x400 + node) frames follow the layout in lib/BinProtocol/BinProtocol.h;
+detection requests and results are printed as text, including their "@id"
+trace tag. --summary prints the last known state of every node instead of
+each frame.
+"""
+import argparse
+import re
+import sys
+
+TIME_SYNC = 0x080
+TIME_FOLLOW_UP = 0x180
+STAGE_REPORT = 0x280
+CONTROLLER_STATUS = 0x300
+CAMERA_HEALTH = 0x380
+PRESENCE = 0x400
+NODE_MASK = 0x7F
+VERSION = 1
+
+STATES = ["IDLE", "DETECTING_MOTION", "ANALYZING_MATERIAL", "OPENING_BIN",
+          "BIN_OPEN", "CLOSING_BIN", "BIN_FULL", "MAINTENANCE_MODE"]
+MATERIALS = ["UNKNOWN", "ORGANIC", "NON_ORGANIC", "NONE"]
+CONTROLLER_ERRORS = ["distance", "scale", "wifi", "camera", "upload"]
+CAMERA_FLAGS = ["ready", "wifi", "detecting", "psram"]
+CAMERA_ERRORS = ["capture", "backend", "response"]
+STAGES = ["pir", "request_tx", "capture_start", "capture_end", "upload_start",
+          "upload_end", "result_tx", "result_rx", "lid_open"]
+
+# `can0  305   [8]  56 5D ...` (candump) or `(ts) can0 305#565D...` (candump -L)
+PLAIN = re.compile(r"^\s*\S+\s+([0-9A-Fa-f]+)\s+\[(\d+)\]\s*((?:[0-9A-Fa-f]{2}\s*)*)$")
+LOGGED = re.compile(r"^\s*(?:\(([\d.]+)\)\s+)?\S+\s+([0-9A-Fa-f]+)#([0-9A-Fa-f]*)\s*$")
+
+
+def name(table, index):
+    return table[index] if 0 <= index < len(table) else str(index)
+
+
+def bits(table, value):
+    return ",".join(n for i, n in enumerate(table) if value & (1 << i)) or "-"
+
+
+def parse_line(line):
+    """Return (timestamp or None, can id, payload bytes), or None."""
+    m = LOGGED.match(line)
+    if m:
+        return (float(m.group(1)) if m.group(1) else None, int(m.group(2), 16), bytes.fromhex(m.group(3)))
+    m = PLAIN.match(line)
+    if m:
+        return None, int(m.group(1), 16), bytes.fromhex(m.group(3).replace(" ", ""))[:int(m.group(2))]
+    return None
+
+
+def uptime(data):
+    return data[5] | data[6] << 8 | data[7] << 16
+
+
+def decode(can_id, data):
+    """Return (kind, node, fields dict) for a known frame, else None."""
+    base = can_id & ~NODE_MASK
+    node = can_id & NODE_MASK
+    if len(data) == 8 and data[0] >> 6 == VERSION and base == CONTROLLER_STATUS:
+        return "controller", node, {
+            "state": name(STATES, data[0] & 0x0F),
+            "organic": f"{data[1]}%{' FULL' if data[0] & 0x10 else ''}",
+            "non_organic": f"{data[2]}%{' FULL' if data[0] & 0x20 else ''}",
+            "errors": bits(CONTROLLER_ERRORS, data[3]),
+            "heap_kb": data[4],
+            "uptime_s": uptime(data),
+        }
+    if len(data) == 8 and data[0] >> 6 == VERSION and base == CAMERA_HEALTH:
+        return "camera", node, {
+            "flags": bits(CAMERA_FLAGS, data[0] & 0x0F),
+            "material": name(MATERIALS, data[1]),
+            "detect_s": data[2] / 10,
+            "errors": bits(CAMERA_ERRORS, data[3]),
+            "heap_kb": data[4],
+            "uptime_s": uptime(data),
+        }
+    if base == TIME_SYNC and len(data) == 1:
+        return "sync", node, {"seq": data[0]}
+    if base == TIME_FOLLOW_UP and len(data) == 8:
+        return "follow_up", node, {"seq": data[0], "master_us": int.from_bytes(data[1:8], "little")}
+    if base == STAGE_REPORT and len(data) == 8:
+        return "stage", node, {
+            "trace": f"{data[0] | data[1] << 8:04x}",
+            "stage": name(STAGES, data[2]),
+            "time_us": int.from_bytes(data[4:8], "little"),
+            "clock": "controller" if data[3] & 1 else "camera",
+        }
+    if base == PRESENCE and len(data) == 3:
+        return "presence", node, {
+            "present": bool(data[0] & 1),
+            "ready": bool(data[0] & 2),
+            "changed": f"{(data[1] | data[2] << 8) / 10:.1f}%",
+        }
+    if can_id in (0x100, 0x200):
+        return "detect", None, {"payload": data.decode("ascii", "replace")}
+    return None
+
+
+def fmt(fields):
+    return " ".join(f"{k}={v}" for k, v in fields.items())
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode smart bin CAN frames from candump output")
+    parser.add_argument("file", help="candump capture ('-' for stdin)")
+    parser.add_argument("--summary", action="store_true", help="Only print the last state of each node")
+    args = parser.parse_args()
+
+    stream = sys.stdin if args.file == "-" else open(args.file)
+    latest = {}
+    for line in stream:
+        frame = parse_line(line)
+        if not frame:
+            continue
+        ts, can_id, data = frame
+        decoded = decode(can_id, data)
+        if not decoded:
+            continue
+        kind, node, fields = decoded
+        if kind in ("controller", "camera"):
+            latest[(node, kind)] = fields
+        if not args.summary:
+            stamp = f"{ts:.3f} " if ts is not None else ""
+            who = f"node {node:<3}" if node is not None else "        "
+            print(f"{stamp}0x{can_id:03X} {who} {kind:<10} {fmt(fields)}")
+
+    if args.summary:
+        for (node, kind), fields in sorted(latest.items()):
+            print(f"node {node:<3} {kind:<10} {fmt(fields)}")
+
+
+if __name__ == "__main__":
+    main()
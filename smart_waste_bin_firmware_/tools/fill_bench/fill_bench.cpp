@@ -0,0 +1,201 @@
+// Times FillEstimator::update on a host and checks the behaviour the bin
+// relies on: outliers are rejected without moving the estimate, the bin is
+// full when either sensor says so even if the other disagrees, and the
+// full flag switches on at fullOnPermille and only clears below
+// fullOffPermille.
+//
+// Build and run from smart_waste_bin_firmware_/:
+//   g++ -std=c++11 -O2 -Ilib/FillEstimator -Ilib/BinController -Ilib/BinProtocol
+//       -Ilib/SamplingPolicy -Ilib/PatternEngine -Ilib/EventTrace -Ilib/BoardConfig
+//       -Ilib/StationConfig tools/fill_bench/fill_bench.cpp
+//       lib/FillEstimator/FillEstimator.cpp -o fill_bench
+//   ./fill_bench                      # checks, then 10M timed updates
+//   ./fill_bench --updates 100000000
+//
+// Exits nonzero if a check fails.
+
+#include <FillEstimator.h>
+#include <StationConfig.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// FILL_CONFIG is the firmware's (lib/StationConfig)
+
+// Enough updates at one level for the estimate to settle
+static const uint32_t SETTLE_UPDATES = 200;
+
+static bool failed = false;
+
+static void check(bool ok, const char* what) {
+  printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+  if (!ok) {
+    failed = true;
+  }
+}
+
+// Sensor readings for a bin at `permille`, both sensors agreeing
+static int32_t distanceAt(int32_t permille) {
+  return FILL_CONFIG.emptyDistanceMm -
+         (FILL_CONFIG.emptyDistanceMm - FILL_CONFIG.fullDistanceMm) * permille / 1000;
+}
+static int32_t massAt(int32_t permille) {
+  return FILL_CONFIG.capacityGrams * permille / 1000;
+}
+
+// ==================== CHECKS ====================
+static void checkOutliers() {
+  FillEstimator est(FILL_CONFIG);
+  for (uint32_t i = 0; i < SETTLE_UPDATES; i++) {
+    est.update(distanceAt(400), massAt(400));
+  }
+  uint16_t settled = est.fillPermille();
+  check(abs(settled - 400) <= 10, "settles on agreeing readings");
+
+  // Readings outside the physical range are counted and dropped
+  uint32_t rejected = est.rejectedSamples();
+  est.update(5 * FILL_CONFIG.emptyDistanceMm, massAt(400));
+  est.update(distanceAt(400), 5 * FILL_CONFIG.capacityGrams);
+  est.update(-1, -FILL_CONFIG.capacityGrams);
+  check(est.rejectedSamples() == rejected + 4, "out-of-range readings counted as rejected");
+  check(abs(est.fillPermille() - settled) <= 2, "out-of-range readings leave the fill alone");
+
+  // A single in-range spike on both sensors is held back by the median
+  est.update(distanceAt(1000), massAt(1000));
+  check(abs(est.fillPermille() - settled) <= 2, "single full-scale spike absorbed by the median");
+  check(!est.isFull(), "single spike does not mark the bin full");
+
+  // Lost readings keep the estimate where it was
+  for (uint8_t i = 0; i < 10; i++) {
+    est.update(FillEstimator::INVALID, FillEstimator::INVALID);
+  }
+  check(abs(est.fillPermille() - settled) <= 2, "missing readings leave the fill alone");
+  check(!est.hasMass(), "mass goes stale without readings");
+}
+
+// Steps the bin through `levels`, returning the fill at which the full
+// flag changed each way (-1 if it never did)
+static void sweep(FillEstimator& est, const int32_t* levels, size_t count, int32_t& onAt, int32_t& offAt) {
+  onAt = offAt = -1;
+  bool wasFull = est.isFull();
+  for (size_t l = 0; l < count; l++) {
+    for (uint32_t i = 0; i < SETTLE_UPDATES; i++) {
+      est.update(distanceAt(levels[l]), massAt(levels[l]));
+      if (est.isFull() != wasFull) {
+        wasFull = est.isFull();
+        (wasFull ? onAt : offAt) = est.peakPermille();
+      }
+    }
+  }
+}
+
+static void checkHysteresis() {
+  FillEstimator est(FILL_CONFIG);
+  int32_t onAt, offAt;
+
+  const int32_t filling[] = { 300, 600, 850, 890 };
+  sweep(est, filling, 4, onAt, offAt);
+  check(onAt < 0 && !est.isFull(), "not full below fullOnPermille");
+
+  const int32_t full[] = { 950 };
+  sweep(est, full, 1, onAt, offAt);
+  check(est.isFull() && onAt >= FILL_CONFIG.fullOnPermille, "full at fullOnPermille");
+
+  // Between the thresholds the flag holds, even when the level wanders
+  const int32_t between[] = { 880, 820, 870, 810 };
+  sweep(est, between, 4, onAt, offAt);
+  check(offAt < 0 && est.isFull(), "stays full between fullOffPermille and fullOnPermille");
+
+  const int32_t emptied[] = { 100 };
+  sweep(est, emptied, 1, onAt, offAt);
+  check(!est.isFull() && offAt >= 0 && offAt < FILL_CONFIG.fullOffPermille, "cleared below fullOffPermille");
+
+  // And back up to between the thresholds: still not full
+  const int32_t refill[] = { 850 };
+  sweep(est, refill, 1, onAt, offAt);
+  check(onAt < 0 && !est.isFull(), "not full again until fullOnPermille");
+}
+
+static void settle(FillEstimator& est, int32_t distanceMm, int32_t massGrams) {
+  for (uint32_t i = 0; i < SETTLE_UPDATES; i++) {
+    est.update(distanceMm, massGrams);
+  }
+}
+
+// Light waste fills the volume long before the capacity mass, dense waste
+// the other way round; either has to lock the lid
+static void checkMismatchedSensors() {
+  FillEstimator light(FILL_CONFIG);
+  settle(light, FILL_CONFIG.fullDistanceMm, massAt(150));
+  check(light.isFull(), "full by volume with light waste");
+  settle(light, distanceAt(850), massAt(150));
+  check(light.isFull(), "light waste stays full between the thresholds");
+  settle(light, distanceAt(100), massAt(50));
+  check(!light.isFull(), "light waste cleared once emptied");
+
+  FillEstimator dense(FILL_CONFIG);
+  settle(dense, distanceAt(300), massAt(950));
+  check(dense.isFull(), "full by mass with dense waste");
+
+  // A scale that stops answering must not hold the bin full
+  settle(dense, distanceAt(300), FillEstimator::INVALID);
+  check(!dense.isFull(), "stale mass no longer counts toward full");
+
+  FillEstimator noScale(FILL_CONFIG);
+  settle(noScale, distanceAt(500), FillEstimator::INVALID);
+  check(!noScale.isFull(), "half full by volume without a scale is not full");
+  settle(noScale, FILL_CONFIG.fullDistanceMm, FillEstimator::INVALID);
+  check(noScale.isFull(), "full by volume without a scale");
+}
+
+// ==================== BENCHMARK ====================
+// Noisy readings around a slowly filling bin, with occasional dropouts
+// and outliers, generated up front so only update() is timed
+static void benchmark(uint32_t updates) {
+  const uint32_t SAMPLES = 4096;
+  std::vector<int32_t> distance(SAMPLES), mass(SAMPLES);
+  uint32_t seed = 1;
+  for (uint32_t i = 0; i < SAMPLES; i++) {
+    seed = seed * 1664525 + 1013904223;
+    int32_t permille = (int32_t)(i * 1000 / SAMPLES);
+    distance[i] = distanceAt(permille) + (int32_t)(seed >> 28) - 8;
+    mass[i] = massAt(permille) + (int32_t)((seed >> 16) & 0xff) - 128;
+    if ((seed >> 8) % 50 == 0) distance[i] = FillEstimator::INVALID;
+    if ((seed >> 12) % 100 == 0) mass[i] = 10 * FILL_CONFIG.capacityGrams;
+  }
+
+  FillEstimator est(FILL_CONFIG);
+  uint64_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < updates; i++) {
+    uint32_t s = i % SAMPLES;
+    est.update(distance[s], mass[s]);
+    sink += est.fillPermille();
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  printf("\n%u updates in %.3f ms, %.1f ns/update, %u rejected (checksum %llu)\n",
+         updates, wall * 1000, wall * 1e9 / updates, est.rejectedSamples(), (unsigned long long)sink);
+}
+
+int main(int argc, char** argv) {
+  uint32_t updates = 10000000;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--updates") == 0 && i + 1 < argc) {
+      updates = (uint32_t)atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--updates N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  checkOutliers();
+  checkHysteresis();
+  checkMismatchedSensors();
+  if (updates) {
+    benchmark(updates);
+  }
+  return failed ? 1 : 0;
+}
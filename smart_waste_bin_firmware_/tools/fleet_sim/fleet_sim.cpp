@@ -0,0 +1,757 @@
+// Virtual fleet: runs many bin controllers, each paired with a camera
+// stand-in, in one process and points their backend traffic at a real
+// server to load-test the ingest path.
+//
+// Every virtual bin runs the firmware's BinController against a simulated
+// PIR, load cell and ultrasonic sensor driven by a stochastic usage model
+// (Poisson deposits with a per-bin rate spread, random deposit weights and
+// materials, collection some time after the bin reports full). The camera
+// stand-in answers DETECT_MATERIAL by posting a frame to /api/detect and
+// replying over "CAN" with the material it got back, like
+// esp32cam_main.cpp; closed lid cycles post to /api/bins/update like
+// sendBinDataToBackend(). Bins are stepped from a timer queue, so idle
+// bins cost nothing between samples and thousands fit on a few threads.
+//
+// Build and run from smart_waste_bin_firmware_/:
+//   g++ -std=c++11 -O2 -pthread -Ilib/BinController -Ilib/BinProtocol
+//       -Ilib/FillEstimator -Ilib/SamplingPolicy -Ilib/PatternEngine -Ilib/EventTrace
+//       -Ilib/BoardConfig -Ilib/StationConfig tools/fleet_sim/fleet_sim.cpp lib/BinController/BinController.cpp
+//       lib/BinProtocol/BinProtocol.cpp lib/FillEstimator/FillEstimator.cpp
+//       lib/SamplingPolicy/SamplingPolicy.cpp -o fleet_sim
+//   ./fleet_sim --port 8000 --bins 2000 --threads 4 --duration 120 --image frame.jpg
+//
+// A frame can be saved from a camera with curl -o frame.jpg http://<cam-ip>/capture.
+// Without --image the camera stand-in answers locally after a modelled
+// delay and only /api/bins/update is loaded. --rate is in deposits per bin
+// per hour; raise it to compress a day of use into a short run. Large
+// fleets need more descriptors than the default limit (ulimit -n).
+
+#include <BinController.h>
+#include <StationConfig.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// CONTROLLER_CONFIG is the firmware's (lib/StationConfig). The camera
+// stand-in sends no presence frames, so every cycle starts from the PIR.
+
+static const uint32_t LOOP_MS = 50;          // Firmware loop period while busy
+static const uint32_t PIR_HOLD_MS = 2000;    // PIR output stays high this long per visit
+
+struct Options {
+  const char* host = "127.0.0.1";
+  const char* port = "8000";
+  uint32_t bins = 100;
+  uint32_t threads = 2;
+  uint32_t durationS = 60;
+  double ratePerHour = 12;          // Mean deposits per bin per hour
+  double collectMinutes = 30;       // Mean delay from full to emptied
+  uint32_t timeoutMs = 10000;       // HTTPClient default is 5000; keep some headroom
+  uint32_t maxInflight = 256;       // Open connections per thread
+  const char* image = nullptr;
+  bool rawDetect = false;           // image/jpeg body instead of multipart
+  uint64_t seed = 1;
+};
+
+// ==================== RANDOM ====================
+class Rng {
+public:
+  explicit Rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull + 1) {}
+  uint64_t next() {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545F4914F6CDD1Dull;
+  }
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+  double exponential(double mean) { return -mean * std::log(1.0 - uniform()); }
+  double normal() { return std::sqrt(-2.0 * std::log(1.0 - uniform())) * std::cos(6.283185307179586 * uniform()); }
+private:
+  uint64_t s;
+};
+
+// ==================== STATISTICS ====================
+enum Endpoint { EP_BIN_UPDATE, EP_DETECT, EP_COUNT };
+static const char* const ENDPOINT_PATHS[EP_COUNT] = { "/api/bins/update", "/api/detect" };
+
+struct EndpointStats {
+  std::vector<uint32_t> latencyUs;  // Completed responses, any status
+  uint64_t ok = 0;
+  uint64_t client4xx = 0;
+  uint64_t server5xx = 0;
+  uint64_t transport = 0;           // Connect/read/write failures
+  uint64_t timeouts = 0;
+  uint64_t queued = 0;              // Had to wait for a free connection slot
+
+  void merge(const EndpointStats& o) {
+    latencyUs.insert(latencyUs.end(), o.latencyUs.begin(), o.latencyUs.end());
+    ok += o.ok;
+    client4xx += o.client4xx;
+    server5xx += o.server5xx;
+    transport += o.transport;
+    timeouts += o.timeouts;
+    queued += o.queued;
+  }
+};
+
+static std::atomic<uint64_t> completedRequests(0);
+static std::atomic<uint64_t> failedRequests(0);
+static std::atomic<int64_t> inflightRequests(0);
+
+static uint64_t monotonicUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class Shard;
+
+// ==================== VIRTUAL BIN ====================
+class VirtualBin : public BinHardware {
+public:
+  VirtualBin(Shard& owner, uint32_t number, Rng& rng, const Options& opt);
+
+  // Advances the usage model and runs one controller pass; returns the
+  // next time the bin needs attention
+  uint64_t step(uint64_t nowMs);
+
+  // Camera stand-in finished
+  void deliverMaterial(Material material);
+
+  uint32_t number;
+  char organicId[24];
+  char nonOrganicId[24];
+  BinController controller;
+
+  uint32_t millis() override { return (uint32_t)now; }
+  bool motion() override { return pir; }
+  bool keypadPressed(uint8_t) override { return false; }
+  int32_t distanceMm() override;
+  int32_t massGrams() override { return mass + (int32_t)(rng.normal() * 5); }
+  bool receiveCan(CanMessage& msg) override;
+  bool receiveCommand(ManualCommand&) override { return false; }
+  void setLid(uint8_t bin, bool open) override;
+  void sendCan(const CanMessage& msg) override;
+  void playTone(TonePattern) override {}
+  void uploadBinData() override;
+  void trace(uint8_t, uint8_t, uint16_t) override {}
+
+private:
+  Shard& shard;
+  Rng rng;
+  uint64_t now;
+  double ratePerHour;
+  double collectMinutes;
+
+  bool pir;
+  uint64_t pirUntil;
+  uint64_t nextVisit;
+  int32_t mass;
+  int32_t pendingDeposit;
+  Material pendingMaterial;
+  uint64_t collectAt;
+
+  bool canReady;
+  uint64_t canReadyAt;
+  uint16_t canTraceId;   // Echoed in the reply, as the camera does
+  CanMessage canReply;
+};
+
+// ==================== HTTP ====================
+struct Request {
+  int fd;
+  Endpoint endpoint;
+  VirtualBin* bin;
+  std::string own;
+  const std::string* out;           // own, or a request shared by the shard
+  size_t written;
+  std::string in;
+  uint64_t startUs;
+  bool connected;
+};
+
+class Shard {
+public:
+  Shard(const Options& options, const sockaddr_storage& address, socklen_t addressLen,
+        const std::string* detectRequest, uint32_t first, uint32_t count);
+  ~Shard();
+
+  void run(uint64_t startUs, uint64_t endUs);
+
+  void postBinUpdate(VirtualBin& bin);
+  // Returns false when there is no frame to post
+  bool postDetect(VirtualBin& bin);
+
+  uint64_t nowMs() const { return (monotonicUs() - startUs) / 1000; }
+
+  std::vector<VirtualBin*> bins;
+  EndpointStats stats[EP_COUNT];
+  Rng rng;
+
+private:
+  void submit(Request* req);
+  void start(Request* req);
+  void onWritable(Request* req);
+  void onReadable(Request* req);
+  void finish(Request* req, int status);
+  void expire(uint64_t nowUs);
+
+  const Options& opt;
+  sockaddr_storage addr;
+  socklen_t addrLen;
+  const std::string* detectRequest;
+  int epfd;
+  uint64_t startUs;
+  std::vector<Request*> inflight;
+  std::deque<Request*> backlog;
+};
+
+// ==================== VIRTUAL BIN ====================
+VirtualBin::VirtualBin(Shard& owner, uint32_t id, Rng& seedRng, const Options& opt)
+    : number(id),
+      controller(CONTROLLER_CONFIG, *this),
+      shard(owner),
+      rng(seedRng.next()),
+      now(0),
+      pir(false),
+      pirUntil(0),
+      pendingDeposit(0),
+      pendingMaterial(MATERIAL_ORGANIC),
+      collectAt(0),
+      canReady(false),
+      canReadyAt(0),
+      canTraceId(0) {
+  snprintf(organicId, sizeof(organicId), "sim-%05u-organic", id);
+  snprintf(nonOrganicId, sizeof(nonOrganicId), "sim-%05u-non-organic", id);
+  // Busy and quiet sites: spread rates log-normally around the mean
+  ratePerHour = opt.ratePerHour * std::exp(0.5 * rng.normal() - 0.125);
+  collectMinutes = opt.collectMinutes;
+  mass = (int32_t)(rng.uniform() * 0.6 * CONTROLLER_CONFIG.fill.capacityGrams);
+  nextVisit = (uint64_t)rng.exponential(3600000.0 / ratePerHour);
+}
+
+int32_t VirtualBin::distanceMm() {
+  const FillEstimatorConfig& f = CONTROLLER_CONFIG.fill;
+  int32_t level = (int32_t)((int64_t)(f.emptyDistanceMm - f.fullDistanceMm) * mass / f.capacityGrams);
+  int32_t distance = f.emptyDistanceMm - level + (int32_t)(rng.normal() * 8);
+  return distance < f.fullDistanceMm / 2 ? f.fullDistanceMm / 2 : distance;
+}
+
+bool VirtualBin::receiveCan(CanMessage& msg) {
+  if (!canReady || now < canReadyAt) {
+    return false;
+  }
+  canReady = false;
+  msg = canReply;
+  return true;
+}
+
+void VirtualBin::setLid(uint8_t, bool open) {
+  // The visitor drops their item once the lid is open
+  if (open) {
+    mass += pendingDeposit;
+    pendingDeposit = 0;
+  }
+}
+
+void VirtualBin::sendCan(const CanMessage& msg) {
+  if (!parseDetectRequest(msg, canTraceId)) {
+    return;
+  }
+  canReady = false;  // Drop a late answer to an earlier request
+  if (!shard.postDetect(*this)) {
+    // No frame to post: answer as the classifier would after a typical delay
+    makeMaterialResult(canReply, pendingMaterial, canTraceId);
+    canReady = true;
+    canReadyAt = now + 300 + (uint64_t)(rng.uniform() * 900);
+  }
+}
+
+void VirtualBin::deliverMaterial(Material material) {
+  makeMaterialResult(canReply, material, canTraceId);
+  canReady = true;
+  canReadyAt = 0;
+}
+
+void VirtualBin::uploadBinData() {
+  shard.postBinUpdate(*this);
+}
+
+uint64_t VirtualBin::step(uint64_t nowMs) {
+  now = nowMs;
+
+  if (now >= nextVisit) {
+    pir = true;
+    pirUntil = now + PIR_HOLD_MS;
+    pendingDeposit = 50 + (int32_t)rng.exponential(200);
+    pendingMaterial = rng.uniform() < 0.55 ? MATERIAL_ORGANIC : MATERIAL_NON_ORGANIC;
+    nextVisit = now + (uint64_t)rng.exponential(3600000.0 / ratePerHour);
+  }
+  if (pir && now >= pirUntil) {
+    pir = false;
+  }
+  if (collectAt && now >= collectAt) {
+    mass = 0;
+    collectAt = 0;
+  }
+
+  controller.checkKeypad();
+  controller.updateBinLevel();
+  controller.runStateMachine();
+
+  BinState state = controller.state();
+  if (state == BIN_FULL && !collectAt) {
+    collectAt = now + (uint64_t)rng.exponential(collectMinutes * 60000.0);
+  }
+
+  // Busy controllers run at the loop period; idle ones sleep until the
+  // next sample or the next thing that happens to them
+  if (state != IDLE && state != BIN_FULL) {
+    return now + LOOP_MS;
+  }
+  uint64_t wake = now + std::max<uint32_t>(controller.sampling().interval(), LOOP_MS);
+  wake = std::min(wake, nextVisit);
+  if (pir) {
+    wake = std::min(wake, pirUntil);
+  }
+  if (collectAt) {
+    wake = std::min(wake, collectAt);
+  }
+  return wake;
+}
+
+// ==================== SHARD ====================
+Shard::Shard(const Options& options, const sockaddr_storage& address, socklen_t addressLen,
+             const std::string* detect, uint32_t first, uint32_t count)
+    : rng(options.seed + first), opt(options), addr(address), addrLen(addressLen),
+      detectRequest(detect), epfd(epoll_create1(0)), startUs(0) {
+  for (uint32_t i = 0; i < count; i++) {
+    bins.push_back(new VirtualBin(*this, first + i, rng, opt));
+  }
+}
+
+Shard::~Shard() {
+  for (Request* req : inflight) {
+    close(req->fd);
+    delete req;
+  }
+  for (Request* req : backlog) {
+    delete req;
+  }
+  for (VirtualBin* bin : bins) {
+    delete bin;
+  }
+  close(epfd);
+}
+
+void Shard::postBinUpdate(VirtualBin& bin) {
+  BinController& c = bin.controller;
+  char body[320];
+  int len = snprintf(body, sizeof(body),
+      "{\"bin_organic_id\":\"%s\",\"bin_non_organic_id\":\"%s\","
+      "\"organic_weight\":%.3f,\"non_organic_weight\":%.3f,"
+      "\"organic_full\":%s,\"non_organic_full\":%s,\"timestamp\":%u}",
+      bin.organicId, bin.nonOrganicId,
+      c.weightKg(BIN_ORGANIC), c.weightKg(BIN_NON_ORGANIC),
+      c.isFull(BIN_ORGANIC) ? "true" : "false", c.isFull(BIN_NON_ORGANIC) ? "true" : "false",
+      bin.millis());
+
+  Request* req = new Request();
+  req->endpoint = EP_BIN_UPDATE;
+  req->bin = &bin;
+  char head[256];
+  snprintf(head, sizeof(head),
+      "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/json\r\n"
+      "Content-Length: %d\r\nConnection: close\r\n\r\n",
+      ENDPOINT_PATHS[EP_BIN_UPDATE], opt.host, len);
+  req->own = head;
+  req->own.append(body, len);
+  req->out = &req->own;
+  submit(req);
+}
+
+bool Shard::postDetect(VirtualBin& bin) {
+  if (!detectRequest) {
+    return false;
+  }
+  Request* req = new Request();
+  req->endpoint = EP_DETECT;
+  req->bin = &bin;
+  req->out = detectRequest;
+  submit(req);
+  return true;
+}
+
+void Shard::submit(Request* req) {
+  req->fd = -1;
+  req->written = 0;
+  req->connected = false;
+  if (inflight.size() >= opt.maxInflight) {
+    stats[req->endpoint].queued++;
+    backlog.push_back(req);
+    return;
+  }
+  start(req);
+}
+
+void Shard::start(Request* req) {
+  inflightRequests++;
+  req->startUs = monotonicUs();
+  req->fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (req->fd < 0 || (connect(req->fd, (const sockaddr*)&addr, addrLen) < 0 && errno != EINPROGRESS)) {
+    inflight.push_back(req);
+    finish(req, -1);
+    return;
+  }
+  epoll_event ev;
+  ev.events = EPOLLOUT;
+  ev.data.ptr = req;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, req->fd, &ev);
+  inflight.push_back(req);
+}
+
+void Shard::onWritable(Request* req) {
+  if (!req->connected) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(req->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    if (err) {
+      finish(req, -1);
+      return;
+    }
+    req->connected = true;
+  }
+  while (req->written < req->out->size()) {
+    ssize_t n = send(req->fd, req->out->data() + req->written, req->out->size() - req->written, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN) {
+        return;
+      }
+      finish(req, -1);
+      return;
+    }
+    req->written += n;
+  }
+  epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.ptr = req;
+  epoll_ctl(epfd, EPOLL_CTL_MOD, req->fd, &ev);
+}
+
+// Returns the status once the response is complete, 0 if more is needed
+static int responseStatus(const std::string& in, bool eof) {
+  size_t headerEnd = in.find("\r\n\r\n");
+  if (headerEnd == std::string::npos) {
+    return eof ? -1 : 0;
+  }
+  int status = 0;
+  if (sscanf(in.c_str(), "HTTP/%*s %d", &status) != 1) {
+    return -1;
+  }
+  const char* cl = strcasestr(in.c_str(), "\r\ncontent-length:");
+  if (cl && cl < in.c_str() + headerEnd) {
+    size_t length = strtoul(cl + 17, nullptr, 10);
+    return in.size() - headerEnd - 4 >= length ? status : (eof ? -1 : 0);
+  }
+  return eof ? status : 0;
+}
+
+void Shard::onReadable(Request* req) {
+  char buf[4096];
+  for (;;) {
+    ssize_t n = recv(req->fd, buf, sizeof(buf), 0);
+    if (n < 0) {
+      if (errno != EAGAIN) {
+        finish(req, -1);
+      }
+      return;
+    }
+    if (n > 0) {
+      req->in.append(buf, n);
+    }
+    int status = responseStatus(req->in, n == 0);
+    if (status != 0) {
+      finish(req, status);
+      return;
+    }
+    if (n == 0) {
+      return;
+    }
+  }
+}
+
+// status: HTTP status, -1 transport failure, -2 timeout
+void Shard::finish(Request* req, int status) {
+  EndpointStats& s = stats[req->endpoint];
+  if (status > 0) {
+    s.latencyUs.push_back((uint32_t)std::min<uint64_t>(monotonicUs() - req->startUs, UINT32_MAX));
+  }
+  if (status >= 200 && status < 300) {
+    s.ok++;
+  } else if (status >= 400 && status < 500) {
+    s.client4xx++;
+  } else if (status >= 500) {
+    s.server5xx++;
+  } else if (status == -2) {
+    s.timeouts++;
+  } else {
+    s.transport++;
+  }
+  completedRequests++;
+  if (status < 200 || status >= 300) {
+    failedRequests++;
+  }
+  inflightRequests--;
+
+  // The camera forwards whatever material the backend named, or UNKNOWN
+  if (req->endpoint == EP_DETECT) {
+    Material material = MATERIAL_UNKNOWN;
+    size_t body = req->in.find("\r\n\r\n");
+    const char* key = body == std::string::npos ? nullptr : strstr(req->in.c_str() + body, "\"material\"");
+    char name[20];
+    if (status >= 200 && status < 300 && key && sscanf(key, "\"material\" : \"%19[^\"]\"", name) == 1) {
+      material = materialFromName(name);
+    }
+    req->bin->deliverMaterial(material);
+  }
+
+  if (req->fd >= 0) {
+    close(req->fd);
+  }
+  inflight.erase(std::find(inflight.begin(), inflight.end(), req));
+  delete req;
+
+  if (!backlog.empty()) {
+    Request* next = backlog.front();
+    backlog.pop_front();
+    start(next);
+  }
+}
+
+void Shard::expire(uint64_t nowUs) {
+  for (size_t i = 0; i < inflight.size();) {
+    Request* req = inflight[i];
+    if (nowUs - req->startUs > opt.timeoutMs * 1000ull) {
+      finish(req, -2);  // Removes it from inflight
+    } else {
+      i++;
+    }
+  }
+}
+
+void Shard::run(uint64_t start, uint64_t endUs) {
+  startUs = start;
+  typedef std::pair<uint64_t, uint32_t> Wake;
+  std::priority_queue<Wake, std::vector<Wake>, std::greater<Wake>> wakes;
+  for (uint32_t i = 0; i < bins.size(); i++) {
+    wakes.push(Wake(rng.next() % CONTROLLER_CONFIG.sampling.idleIntervalMs, i));
+  }
+
+  epoll_event events[64];
+  uint64_t lastExpire = 0;
+  while (monotonicUs() < endUs) {
+    uint64_t now = nowMs();
+    while (!wakes.empty() && wakes.top().first <= now) {
+      uint32_t i = wakes.top().second;
+      wakes.pop();
+      wakes.push(Wake(bins[i]->step(now), i));
+    }
+
+    int timeout = wakes.empty() ? 100 : (int)std::min<uint64_t>(wakes.top().first - now, 100);
+    int n = epoll_wait(epfd, events, 64, timeout);
+    for (int i = 0; i < n; i++) {
+      Request* req = (Request*)events[i].data.ptr;
+      if (events[i].events & EPOLLOUT) {
+        onWritable(req);
+      } else {
+        onReadable(req);
+      }
+    }
+
+    uint64_t nowUs = monotonicUs();
+    if (nowUs - lastExpire > 100000) {
+      expire(nowUs);
+      lastExpire = nowUs;
+    }
+  }
+}
+
+// ==================== MAIN ====================
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+  return sorted[i];
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+      "usage: %s [--host H] [--port P] [--bins N] [--threads N] [--duration S]\n"
+      "          [--rate DEPOSITS_PER_HOUR] [--collect-minutes M] [--timeout-ms MS]\n"
+      "          [--max-inflight N] [--image frame.jpg] [--raw-detect] [--seed N]\n", prog);
+}
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (strcmp(a, "--raw-detect") == 0) { opt.rawDetect = true; continue; }
+    if (!v) { usage(argv[0]); return 2; }
+    if (strcmp(a, "--host") == 0) opt.host = v;
+    else if (strcmp(a, "--port") == 0) opt.port = v;
+    else if (strcmp(a, "--bins") == 0) opt.bins = (uint32_t)atoi(v);
+    else if (strcmp(a, "--threads") == 0) opt.threads = (uint32_t)std::max(1, atoi(v));
+    else if (strcmp(a, "--duration") == 0) opt.durationS = (uint32_t)atoi(v);
+    else if (strcmp(a, "--rate") == 0) opt.ratePerHour = atof(v);
+    else if (strcmp(a, "--collect-minutes") == 0) opt.collectMinutes = atof(v);
+    else if (strcmp(a, "--timeout-ms") == 0) opt.timeoutMs = (uint32_t)atoi(v);
+    else if (strcmp(a, "--max-inflight") == 0) opt.maxInflight = (uint32_t)std::max(1, atoi(v));
+    else if (strcmp(a, "--image") == 0) opt.image = v;
+    else if (strcmp(a, "--seed") == 0) opt.seed = strtoull(v, nullptr, 10);
+    else { usage(argv[0]); return 2; }
+    i++;
+  }
+
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* res = nullptr;
+  if (getaddrinfo(opt.host, opt.port, &hints, &res) != 0 || !res) {
+    fprintf(stderr, "cannot resolve %s:%s\n", opt.host, opt.port);
+    return 1;
+  }
+  sockaddr_storage addr;
+  socklen_t addrLen = res->ai_addrlen;
+  memcpy(&addr, res->ai_addr, addrLen);
+  freeaddrinfo(res);
+
+  // One detect request shared by every camera stand-in
+  std::string detectRequest;
+  if (opt.image) {
+    FILE* f = fopen(opt.image, "rb");
+    if (!f) {
+      perror(opt.image);
+      return 1;
+    }
+    std::string jpeg;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+      jpeg.append(chunk, n);
+    }
+    fclose(f);
+
+    std::string body;
+    const char* contentType = "image/jpeg";
+    if (opt.rawDetect) {
+      body = jpeg;
+    } else {
+      contentType = "multipart/form-data; boundary=fleetsimboundary";
+      body = "--fleetsimboundary\r\nContent-Disposition: form-data; name=\"file\"; filename=\"capture.jpg\"\r\n"
+             "Content-Type: image/jpeg\r\n\r\n" + jpeg + "\r\n--fleetsimboundary--\r\n";
+    }
+    char head[256];
+    snprintf(head, sizeof(head),
+        "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        ENDPOINT_PATHS[EP_DETECT], opt.host, contentType, body.size());
+    detectRequest = head + body;
+  }
+
+  std::vector<Shard*> shards;
+  for (uint32_t t = 0; t < opt.threads; t++) {
+    uint32_t first = (uint32_t)((uint64_t)opt.bins * t / opt.threads);
+    uint32_t last = (uint32_t)((uint64_t)opt.bins * (t + 1) / opt.threads);
+    shards.push_back(new Shard(opt, addr, addrLen, opt.image ? &detectRequest : nullptr, first, last - first));
+  }
+
+  printf("%u bins on %u threads for %u s against %s:%s (%s)\n", opt.bins, opt.threads, opt.durationS,
+         opt.host, opt.port, opt.image ? "bin updates + detect" : "bin updates only");
+
+  uint64_t startUs = monotonicUs();
+  uint64_t endUs = startUs + opt.durationS * 1000000ull;
+  std::vector<std::thread> workers;
+  for (Shard* shard : shards) {
+    workers.emplace_back([shard, startUs, endUs] { shard->run(startUs, endUs); });
+  }
+
+  uint64_t lastCompleted = 0;
+  uint64_t lastReport = startUs;
+  while (monotonicUs() + 5000000 < endUs) {
+    std::this_thread::sleep_for(std::chrono::seconds(5));
+    uint64_t completed = completedRequests;
+    uint64_t nowUs = monotonicUs();
+    printf("%6.0f s  %8.1f req/s  inflight %4lld  failed %llu\n",
+           (nowUs - startUs) / 1e6, (completed - lastCompleted) * 1e6 / (nowUs - lastReport),
+           (long long)inflightRequests.load(), (unsigned long long)failedRequests.load());
+    fflush(stdout);
+    lastCompleted = completed;
+    lastReport = nowUs;
+  }
+  for (std::thread& w : workers) {
+    w.join();
+  }
+  double elapsed = (monotonicUs() - startUs) / 1e6;
+
+  EndpointStats total[EP_COUNT];
+  ControllerCounters counters;
+  memset(&counters, 0, sizeof(counters));
+  uint32_t full = 0;
+  for (Shard* shard : shards) {
+    for (int e = 0; e < EP_COUNT; e++) {
+      total[e].merge(shard->stats[e]);
+    }
+    for (VirtualBin* bin : shard->bins) {
+      const ControllerCounters& c = bin->controller.counters;
+      counters.motionEvents += c.motionEvents;
+      counters.detections += c.detections;
+      counters.detectionTimeouts += c.detectionTimeouts;
+      counters.lidOpens += c.lidOpens;
+      counters.fullRefusals += c.fullRefusals;
+      full += bin->controller.state() == BIN_FULL;
+    }
+  }
+
+  printf("\n%-18s %8s %8s %7s %7s %7s %7s %6s %8s %8s %8s %8s\n", "endpoint", "requests", "req/s",
+         "2xx", "4xx", "5xx", "conn", "tmo", "p50 ms", "p90 ms", "p99 ms", "max ms");
+  for (int e = 0; e < EP_COUNT; e++) {
+    EndpointStats& s = total[e];
+    std::sort(s.latencyUs.begin(), s.latencyUs.end());
+    uint64_t requests = s.ok + s.client4xx + s.server5xx + s.transport + s.timeouts;
+    printf("%-18s %8llu %8.1f %7llu %7llu %7llu %7llu %6llu %8.1f %8.1f %8.1f %8.1f\n",
+           ENDPOINT_PATHS[e], (unsigned long long)requests, requests / elapsed,
+           (unsigned long long)s.ok, (unsigned long long)s.client4xx, (unsigned long long)s.server5xx,
+           (unsigned long long)s.transport, (unsigned long long)s.timeouts,
+           percentile(s.latencyUs, 0.50) / 1000.0, percentile(s.latencyUs, 0.90) / 1000.0,
+           percentile(s.latencyUs, 0.99) / 1000.0,
+           (s.latencyUs.empty() ? 0 : s.latencyUs.back()) / 1000.0);
+    if (s.queued) {
+      printf("  %llu requests waited for a connection slot; raise --max-inflight or --threads\n",
+             (unsigned long long)s.queued);
+    }
+  }
+  printf("\nfleet: visits=%u detections=%u detection_timeouts=%u lid_opens=%u full_refusals=%u full_now=%u\n",
+         counters.motionEvents, counters.detections, counters.detectionTimeouts, counters.lidOpens,
+         counters.fullRefusals, full);
+
+  for (Shard* shard : shards) {
+    delete shard;
+  }
+  return 0;
+}
@@ -0,0 +1,452 @@
+// Gateway mode on a simulated radio: many leaf bins reporting to gateways
+// through a lossy link, run in simulated time to check the aggregation
+// logic in lib/BinGateway without hardware.
+//
+// The site is split into cells, each one gateway on its own channel and
+// the leaves in its range; leaves start on a random channel and have to
+// find their gateway. Frames take a few milliseconds and each receiver
+// drops them independently with probability --loss. Leaves report every
+// --interval seconds, plus after lid cycles at --rate per hour, and now and
+// then turn full. Gateways run the firmware loop's upload check every
+// 50 ms; an upload fails with probability --upload-loss and the "backend"
+// keeps the newest sequence it got from each station.
+//
+// At the end every gateway is drained and the run fails unless the
+// backend holds each leaf's newest acknowledged report and never got the
+// same report twice.
+//
+// Build and run from smart_waste_bin_firmware_/:
+//   g++ -std=c++11 -O2 -Ilib/BinGateway tools/gateway_sim/gateway_sim.cpp
+//       lib/BinGateway/BinGateway.cpp -o gateway_sim
+//   ./gateway_sim --leaves 500 --per-gateway 40 --hours 24 --loss 0.1
+//
+// --dump FILE writes every upload body, one per line, for replaying
+// against a backend:
+//   while read -r b; do
+//     curl -s -H 'Content-Type: application/json' -d "$b" http://localhost:8000/api/bins/update
+//   done < batches.jsonl
+
+#include <BinGateway.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <queue>
+#include <vector>
+
+struct Options {
+  uint32_t leaves = 200;
+  uint32_t perGateway = 40;         // Leaves in range of each gateway
+  double hours = 6;
+  double loss = 0.05;               // Per frame and receiver
+  double uploadLoss = 0.05;
+  uint32_t intervalS = 300;         // Leaf heartbeat report
+  double ratePerHour = 6;           // Lid cycles per leaf per hour, each reported
+  const char* dump = nullptr;
+  uint64_t seed = 1;
+};
+
+// Same settings as main.cpp
+static const GatewayConfig GATEWAY_CONFIG = { 16, 30000, 10000, 3600000 };
+static const LeafConfig LEAF_CONFIG = { 30, 3, 1 };
+static const uint32_t LOOP_MS = 50;
+static const uint32_t UNIX_START = 1700000000;
+
+// ==================== RANDOM ====================
+class Rng {
+public:
+  explicit Rng(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ull + 1) {}
+  uint64_t next() {
+    s ^= s >> 12;
+    s ^= s << 25;
+    s ^= s >> 27;
+    return s * 0x2545F4914F6CDD1Dull;
+  }
+  double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+  double exponential(double mean) { return -mean * std::log(1.0 - uniform()); }
+private:
+  uint64_t s;
+};
+
+// ==================== SIMULATED AIR ====================
+struct Event {
+  uint64_t atMs;
+  uint64_t order;
+  std::function<void()> run;
+  bool operator>(const Event& o) const { return atMs != o.atMs ? atMs > o.atMs : order > o.order; }
+};
+
+class Simulation;
+
+class SimRadio : public RadioTransport {
+public:
+  SimRadio(Simulation& sim, uint32_t cell, uint32_t node) : sim(sim), cell(cell), node(node) {
+    address[0] = 0x02;   // Locally administered
+    for (uint8_t i = 0; i < 4; i++) {
+      address[2 + i] = node >> (8 * (3 - i));
+    }
+  }
+  void power(bool on, uint8_t ch) override {
+    if (on && !powered) {
+      switches++;
+    }
+    powered = on;
+    channel = ch;
+  }
+  bool send(const uint8_t* peer, const uint8_t* data, size_t len) override;
+
+  Simulation& sim;
+  uint32_t cell;
+  uint32_t node;
+  uint8_t address[RADIO_ADDRESS_SIZE] = {};
+  bool powered = false;
+  uint8_t channel = 1;
+  uint32_t switches = 0;
+  std::function<void(const uint8_t*, const uint8_t*, size_t)> deliver;
+};
+
+class Simulation {
+public:
+  explicit Simulation(const Options& opt) : opt(opt), rng(opt.seed) {}
+
+  void at(uint64_t ms, std::function<void()> run) { events.push(Event{ ms, order++, run }); }
+  uint32_t millis() const { return (uint32_t)now; }
+
+  // Delivered after the airtime to every radio in the cell that is on, on
+  // the same channel and addressed, unless that receiver loses it
+  void transmit(SimRadio& from, const uint8_t* peer, const uint8_t* data, size_t len) {
+    framesOnAir++;
+    std::vector<uint8_t> frame(data, data + len);
+    uint8_t dest[RADIO_ADDRESS_SIZE];
+    memcpy(dest, peer, RADIO_ADDRESS_SIZE);
+    uint8_t channel = from.channel;
+    uint8_t src[RADIO_ADDRESS_SIZE];
+    memcpy(src, from.address, RADIO_ADDRESS_SIZE);
+    uint64_t airtime = 2 + rng.next() % 4;
+    for (SimRadio* r : cells[from.cell]) {
+      if (r == &from) {
+        continue;
+      }
+      bool broadcast = memcmp(dest, RADIO_BROADCAST, RADIO_ADDRESS_SIZE) == 0;
+      if (!broadcast && memcmp(dest, r->address, RADIO_ADDRESS_SIZE) != 0) {
+        continue;
+      }
+      bool lost = rng.uniform() < opt.loss;
+      at(now + airtime, [this, r, frame, channel, lost, src]() {
+        if (!r->powered || r->channel != channel) {
+          return;
+        }
+        if (lost) {
+          framesLost++;
+          return;
+        }
+        r->deliver(src, frame.data(), frame.size());
+      });
+    }
+  }
+
+  void run(uint64_t untilMs) {
+    while (!events.empty() && events.top().atMs <= untilMs) {
+      Event e = events.top();
+      events.pop();
+      now = e.atMs;
+      e.run();
+    }
+    now = untilMs;
+  }
+
+  const Options& opt;
+  Rng rng;
+  uint64_t now = 0;
+  uint64_t order = 0;
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+  std::vector<std::vector<SimRadio*>> cells;
+  uint64_t framesOnAir = 0;
+  uint64_t framesLost = 0;
+};
+
+bool SimRadio::send(const uint8_t* peer, const uint8_t* data, size_t len) {
+  if (!powered) {
+    return false;
+  }
+  sim.transmit(*this, peer, data, len);
+  return true;
+}
+
+// ==================== BACKEND ====================
+struct Backend {
+  std::map<uint32_t, uint16_t> newest;   // Station -> sequence
+  std::map<std::pair<uint32_t, uint16_t>, uint32_t> seen;
+  uint64_t requests = 0;
+  uint64_t bytes = 0;
+  uint64_t bins = 0;
+  uint64_t repeats = 0;
+  FILE* dump = nullptr;
+
+  void accept(const GatewayEntry* entries, uint8_t count, const char* body, size_t len) {
+    requests++;
+    bytes += len;
+    for (uint8_t i = 0; i < count; i++) {
+      const LeafReport& r = entries[i].report;
+      if (seen[std::make_pair(r.binIds[0], r.sequence)]++) {
+        repeats++;
+      }
+      newest[r.binIds[0]] = r.sequence;
+      bins++;
+    }
+    if (dump) {
+      fwrite(body, 1, len, dump);
+      fputc('\n', dump);
+    }
+  }
+};
+
+// ==================== NODES ====================
+static LeafReport makeReport(uint32_t station, Rng& rng, bool full) {
+  LeafReport r;
+  memset(&r, 0, sizeof(r));
+  r.binIds[0] = station;
+  r.binIds[1] = station + 1;
+  for (uint8_t b = 0; b < 2; b++) {
+    int32_t grams = (int32_t)(rng.next() % 9000);
+    r.grams[b] = station % 8 == 1 ? LEAF_NO_READING : grams;   // Boards without a load cell
+    r.fillPermille[b] = (uint16_t)(grams / 9);
+    r.ratePerHour[b] = (int16_t)(rng.next() % 500);
+    r.secondsToFull[b] = -1;
+  }
+  if (full) {
+    r.flags = LEAF_FLAG_ORGANIC_FULL;
+    r.state = 6;   // BIN_FULL
+  }
+  return r;
+}
+
+class Leaf {
+public:
+  Leaf(Simulation& sim, uint32_t cell, uint32_t node, uint32_t station)
+      : sim(sim), radio(sim, cell, node), link(radio, LEAF_CONFIG, (uint16_t)sim.rng.next()), station(station) {
+    radio.deliver = [this](const uint8_t* peer, const uint8_t* data, size_t len) {
+      link.receive(peer, data, len, this->sim.millis());
+    };
+  }
+
+  void start() {
+    sim.at(sim.rng.next() % (sim.opt.intervalS * 1000ull), [this]() { heartbeat(); });
+    if (sim.opt.ratePerHour > 0) {
+      sim.at(nextCycle(), [this]() { cycle(); });
+    }
+  }
+
+  Simulation& sim;
+  SimRadio radio;
+  LeafLink link;
+  uint32_t station;
+  uint32_t reports = 0;
+
+private:
+  uint64_t nextCycle() { return sim.now + (uint64_t)sim.rng.exponential(3600000.0 / sim.opt.ratePerHour); }
+
+  void send(bool full) {
+    bool idle = !link.busy();
+    link.report(makeReport(station, sim.rng, full), sim.millis());
+    reports++;
+    if (idle) {
+      sim.at(sim.now + LOOP_MS, [this]() { poll(); });
+    }
+  }
+  // The firmware loop while a report is out
+  void poll() {
+    link.update(sim.millis());
+    if (link.busy()) {
+      sim.at(sim.now + LOOP_MS, [this]() { poll(); });
+    }
+  }
+  void heartbeat() {
+    send(false);
+    sim.at(sim.now + sim.opt.intervalS * 1000ull, [this]() { heartbeat(); });
+  }
+  void cycle() {
+    send(sim.rng.uniform() < 0.02);
+    sim.at(nextCycle(), [this]() { cycle(); });
+  }
+};
+
+class Gateway {
+public:
+  Gateway(Simulation& sim, Backend& backend, uint32_t cell, uint32_t node, uint32_t station)
+      : sim(sim), backend(backend), radio(sim, cell, node), gateway(radio, GATEWAY_CONFIG), station(station) {
+    radio.deliver = [this](const uint8_t* peer, const uint8_t* data, size_t len) {
+      gateway.receive(peer, data, len, this->sim.millis(), UNIX_START + this->sim.millis() / 1000);
+    };
+    radio.power(true, 1 + cell * 5 % LeafLink::CHANNELS);   // Whatever channel its AP is on
+  }
+
+  void start() {
+    sim.at(sim.rng.next() % LOOP_MS, [this]() { loop(); });
+  }
+
+  // Uploads until nothing is due; with `drain`, until nothing is pending
+  void upload(bool drain) {
+    while (drain ? gateway.pending() > 0 : gateway.uploadDue(sim.millis())) {
+      GatewayEntry batch[BinGateway::MAX_BATCH];
+      uint8_t n = gateway.takeBatch(batch, BinGateway::MAX_BATCH, sim.millis());
+      static char body[8192];
+      size_t len = BinGateway::formatBatch(body, sizeof(body), station, batch, n);
+      bool ok = len > 0 && (drain || sim.rng.uniform() >= sim.opt.uploadLoss);
+      if (ok) {
+        backend.accept(batch, n, body, len);
+      } else {
+        oversize += len == 0;
+      }
+      gateway.uploaded(ok, sim.millis());
+      if (!ok) {
+        break;
+      }
+    }
+  }
+
+  Simulation& sim;
+  Backend& backend;
+  SimRadio radio;
+  BinGateway gateway;
+  uint32_t station;
+  uint32_t oversize = 0;
+
+private:
+  // Firmware loop: own report on the heartbeat interval, upload check each pass
+  void loop() {
+    if (sim.now - lastOwnMs >= sim.opt.intervalS * 1000ull) {
+      gateway.submit(makeReport(station, sim.rng, false), sim.millis());
+      lastOwnMs = sim.now;
+    }
+    upload(false);
+    sim.at(sim.now + LOOP_MS, [this]() { loop(); });
+  }
+
+  uint64_t lastOwnMs = 0;
+};
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--leaves N] [--per-gateway N] [--hours H] [--loss P] [--upload-loss P]\n"
+          "          [--interval S] [--rate PER_HOUR] [--dump FILE] [--seed N]\n", argv0);
+}
+
+int main(int argc, char** argv) {
+  Options opt;
+  for (int i = 1; i < argc; i++) {
+    const char* a = argv[i];
+    const char* v = i + 1 < argc ? argv[i + 1] : nullptr;
+    if (!v) { usage(argv[0]); return 2; }
+    if (strcmp(a, "--leaves") == 0) opt.leaves = (uint32_t)atoi(v);
+    else if (strcmp(a, "--per-gateway") == 0) opt.perGateway = (uint32_t)std::max(1, atoi(v));
+    else if (strcmp(a, "--hours") == 0) opt.hours = atof(v);
+    else if (strcmp(a, "--loss") == 0) opt.loss = atof(v);
+    else if (strcmp(a, "--upload-loss") == 0) opt.uploadLoss = atof(v);
+    else if (strcmp(a, "--interval") == 0) opt.intervalS = (uint32_t)std::max(1, atoi(v));
+    else if (strcmp(a, "--rate") == 0) opt.ratePerHour = atof(v);
+    else if (strcmp(a, "--dump") == 0) opt.dump = v;
+    else if (strcmp(a, "--seed") == 0) opt.seed = strtoull(v, nullptr, 10);
+    else { usage(argv[0]); return 2; }
+    i++;
+  }
+  if (opt.perGateway >= BinGateway::MAX_STATIONS) {
+    fprintf(stderr, "--per-gateway must leave a slot for the gateway's own bins (below %u)\n",
+            (unsigned)BinGateway::MAX_STATIONS);
+    return 2;
+  }
+
+  Simulation sim(opt);
+  Backend backend;
+  if (opt.dump) {
+    backend.dump = fopen(opt.dump, "w");
+    if (!backend.dump) {
+      perror(opt.dump);
+      return 1;
+    }
+  }
+
+  uint32_t cellCount = (opt.leaves + opt.perGateway - 1) / opt.perGateway;
+  sim.cells.resize(cellCount);
+  std::vector<Gateway*> gateways;
+  std::vector<Leaf*> leaves;
+  uint32_t node = 1;
+  for (uint32_t c = 0; c < cellCount; c++) {
+    gateways.push_back(new Gateway(sim, backend, c, node++, 0x10000 + 2 * c));
+    sim.cells[c].push_back(&gateways.back()->radio);
+  }
+  for (uint32_t i = 0; i < opt.leaves; i++) {
+    uint32_t c = i / opt.perGateway;
+    leaves.push_back(new Leaf(sim, c, node++, 2 * i + 1));
+    sim.cells[c].push_back(&leaves.back()->radio);
+  }
+  for (Gateway* g : gateways) {
+    g->start();
+  }
+  for (Leaf* l : leaves) {
+    l->start();
+  }
+
+  uint64_t endMs = (uint64_t)(opt.hours * 3600000.0);
+  printf("%u leaves, %u gateways, %.1f h, %.0f%% frame loss, %.0f%% upload failures\n",
+         opt.leaves, cellCount, opt.hours, opt.loss * 100, opt.uploadLoss * 100);
+  sim.run(endMs);
+  // Let reports still on the air finish, then drain the gateways
+  sim.run(endMs + 2000);
+  for (Gateway* g : gateways) {
+    g->upload(true);
+  }
+
+  uint64_t reports = 0, delivered = 0, failed = 0, sent = 0, hops = 0, radioOn = 0, clocks = 0;
+  uint32_t behind = 0;
+  for (Leaf* l : leaves) {
+    reports += l->reports;
+    delivered += l->link.delivered();
+    failed += l->link.failed();
+    sent += l->link.sent();
+    hops += l->link.channelChanges();
+    radioOn += l->link.radioOnMs(sim.millis());
+    clocks += l->link.gatewayTime() != 0;
+    if (l->link.delivered() > 0) {
+      std::map<uint32_t, uint16_t>::const_iterator it = backend.newest.find(l->station);
+      if (it == backend.newest.end() || (int16_t)(it->second - l->link.lastDelivered()) < 0) {
+        behind++;
+      }
+    }
+  }
+  uint64_t duplicates = 0, rejected = 0, uploads = 0, uploadFailures = 0, oversize = 0;
+  for (Gateway* g : gateways) {
+    duplicates += g->gateway.duplicates();
+    rejected += g->gateway.rejected();
+    uploads += g->gateway.uploads();
+    uploadFailures += g->gateway.uploadFailures();
+    oversize += g->oversize;
+  }
+
+  printf("\nleaves:   %llu reports, %llu acknowledged (%.2f%%), %llu given up, %llu frames sent\n",
+         (unsigned long long)reports, (unsigned long long)delivered, reports ? 100.0 * delivered / reports : 0.0,
+         (unsigned long long)failed, (unsigned long long)sent);
+  printf("          radio on %.3f%% of the time, %llu channel changes, %llu/%u clocks set by a gateway\n",
+         100.0 * radioOn / ((double)sim.millis() * std::max<size_t>(1, leaves.size())),
+         (unsigned long long)hops, (unsigned long long)clocks, opt.leaves);
+  printf("air:      %llu frames, %llu lost\n", (unsigned long long)sim.framesOnAir, (unsigned long long)sim.framesLost);
+  printf("gateways: %llu retransmissions acknowledged again, %llu rejected, %llu uploads, %llu failed, %llu too large\n",
+         (unsigned long long)duplicates, (unsigned long long)rejected, (unsigned long long)uploads,
+         (unsigned long long)uploadFailures, (unsigned long long)oversize);
+  printf("backend:  %llu requests carrying %llu station updates (%.1f per request, %.0f bytes each)\n",
+         (unsigned long long)backend.requests, (unsigned long long)backend.bins,
+         backend.requests ? (double)backend.bins / backend.requests : 0.0,
+         backend.requests ? (double)backend.bytes / backend.requests : 0.0);
+  printf("          %llu requests if every bin posted its own reports\n", (unsigned long long)reports);
+  if (backend.dump) {
+    fclose(backend.dump);
+  }
+
+  bool ok = behind == 0 && backend.repeats == 0;
+  printf("\n%s: %u stations behind their newest acknowledged report, %llu reports uploaded twice\n",
+         ok ? "PASS" : "FAIL", behind, (unsigned long long)backend.repeats);
+  return ok ? 0 : 1;
+}
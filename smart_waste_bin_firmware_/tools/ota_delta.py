@@ -0,0 +1,277 @@
+"""
+Make and check firmware delta patches for the OTA endpoint.
+
+    python ota_delta.py make old.bin new.bin -o update.patch
+    python ota_delta.py apply old.bin update.patch -o check.bin
+    python ota_delta.py info update.patch
+    python ota_delta.py sign new.bin
+
+old.bin must be exactly the image the bin is running (.pio/build/<env>/
+firmware.bin of that build); the bin refuses a patch whose source hash
+doesn't match.
+
+Every update needs the signature of the new image, an HMAC-SHA256 of its
+SHA-256 keyed with the site's OTA key (`ota_key` in the firmware). `sign`
+prints it, and so does `make` when it has the key; pass the key with --key
+or in SMARTBIN_OTA_KEY. Push the patch, or a full image, to a bin:
+
+    curl -F image=@update.patch "http://<bin-ip>/api/ota?signature=<hex>"
+
+or let the bin pull it from a local file server, which keeps the upload off
+the bin's web server:
+
+    python -m http.server 8000
+    curl -X POST -d url=http://<host-ip>:8000/update.patch -d signature=<hex> \
+        http://<bin-ip>/api/ota/pull
+    curl http://<bin-ip>/api/ota       # progress; the bin reboots when done
+
+The format is described in lib/DeltaPatch/DeltaPatch.h. Matches are found
+by indexing the old image every few bytes and growing each hit, first
+exactly and then loosely, so code that moved and has a few shifted
+addresses becomes one add op with short difference runs.
+"""
+import argparse
+import hashlib
+import hmac
+import os
+import struct
+import sys
+
+MAGIC = b"SBDP"
+VERSION = 1
+HEADER = struct.Struct("<4sB3xII32s32s")
+
+OP_END = 0x00
+OP_ADD = 0x01
+OP_INSERT = 0x02
+
+KEY = 12          # Bytes hashed per index entry
+STEP = 4          # Index spacing in the old image
+MIN_MATCH = 24    # Shorter exact matches are cheaper as literals
+GIVE_UP = 48      # Loose extension stops this far below its best score
+
+
+def varint(value):
+    out = bytearray()
+    while True:
+        b = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(b | 0x80)
+        else:
+            out.append(b)
+            return bytes(out)
+
+
+def read_varint(data, pos):
+    value = shift = 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7F) << shift
+        shift += 7
+        if not b & 0x80:
+            return value, pos
+
+
+def index_source(src):
+    index = {}
+    for i in range(0, len(src) - KEY + 1, STEP):
+        index.setdefault(src[i:i + KEY], i)
+    return index
+
+
+def loose_length(src, s, tgt, t, limit):
+    """Length past an exact match worth covering with difference runs."""
+    best = score = length = 0
+    n = min(limit, len(src) - s, len(tgt) - t)
+    for i in range(n):
+        score += 1 if src[s + i] == tgt[t + i] else -1
+        if score > best:
+            best, length = score, i + 1
+        elif score < best - GIVE_UP:
+            break
+    return length
+
+
+def add_op(src, s, tgt, t, length):
+    out = bytearray([OP_ADD]) + varint(s) + varint(length)
+    i = 0
+    while i < length:
+        same = 0
+        while i + same < length and src[s + i + same] == tgt[t + i + same]:
+            same += 1
+        i += same
+        changed = 0
+        # Short equal stretches stay inside a changed run; a new run costs two varints
+        while i + changed < length:
+            j = i + changed
+            k = 0
+            while j + k < length and k < 3 and src[s + j + k] == tgt[t + j + k]:
+                k += 1
+            if k == 3 or j + k == length:
+                break
+            changed += k + 1
+        out += varint(same) + varint(changed)
+        out += bytes((tgt[t + i + k] - src[s + i + k]) & 0xFF for k in range(changed))
+        i += changed
+    return out
+
+
+def insert_op(data):
+    return bytes([OP_INSERT]) + varint(len(data)) + data if data else b""
+
+
+def make(src, tgt):
+    index = index_source(src)
+    body = bytearray()
+    stats = {"add": 0, "insert": 0, "copied": 0, "literal": 0}
+    lit = t = 0
+    while t + KEY <= len(tgt):
+        s = index.get(tgt[t:t + KEY])
+        if s is None:
+            t += 1
+            continue
+        # Grow the hit backwards into pending literals, then forwards
+        back = 0
+        while t - back > lit and s - back > 0 and tgt[t - back - 1] == src[s - back - 1]:
+            back += 1
+        exact = KEY
+        while s + exact < len(src) and t + exact < len(tgt) and src[s + exact] == tgt[t + exact]:
+            exact += 1
+        if back + exact < MIN_MATCH:
+            t += 1
+            continue
+        t -= back
+        s -= back
+        exact += back
+        length = exact + loose_length(src, s + exact, tgt, t + exact, len(tgt))
+        body += insert_op(tgt[lit:t])
+        stats["literal"] += t - lit
+        body += add_op(src, s, tgt, t, length)
+        stats["add"] += 1
+        stats["copied"] += length
+        if t > lit:
+            stats["insert"] += 1
+        t += length
+        lit = t
+    body += insert_op(tgt[lit:])
+    if lit < len(tgt):
+        stats["insert"] += 1
+        stats["literal"] += len(tgt) - lit
+    body.append(OP_END)
+    header = HEADER.pack(MAGIC, VERSION, len(src), len(tgt),
+                         hashlib.sha256(src).digest(), hashlib.sha256(tgt).digest())
+    return header + bytes(body), stats
+
+
+def apply(src, patch):
+    """Reference decoder; raises ValueError on a bad patch."""
+    magic, version, src_size, tgt_size, src_sha, tgt_sha = HEADER.unpack_from(patch)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a delta patch")
+    if src_size != len(src) or hashlib.sha256(src).digest() != src_sha:
+        raise ValueError("patch was made against a different image")
+    try:
+        out = rebuild(src, patch)
+    except IndexError:
+        raise ValueError("patch is truncated")
+    if len(out) != tgt_size or hashlib.sha256(out).digest() != tgt_sha:
+        raise ValueError("rebuilt image does not match the target hash")
+    return bytes(out)
+
+
+def rebuild(src, patch):
+    out = bytearray()
+    pos = HEADER.size
+    while True:
+        op = patch[pos]
+        pos += 1
+        if op == OP_END:
+            break
+        if op == OP_ADD:
+            s, pos = read_varint(patch, pos)
+            length, pos = read_varint(patch, pos)
+            end = len(out) + length
+            while len(out) < end:
+                same, pos = read_varint(patch, pos)
+                changed, pos = read_varint(patch, pos)
+                out += src[s:s + same]
+                s += same
+                out += bytes((src[s + k] + patch[pos + k]) & 0xFF for k in range(changed))
+                s += changed
+                pos += changed
+        elif op == OP_INSERT:
+            length, pos = read_varint(patch, pos)
+            out += patch[pos:pos + length]
+            pos += length
+        else:
+            raise ValueError(f"bad op 0x{op:02x} at {pos - 1}")
+    return out
+
+
+def signature(key, image):
+    """What the bin checks before it boots `image`."""
+    return hmac.new(key.encode(), hashlib.sha256(image).digest(), hashlib.sha256).hexdigest()
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Firmware delta patches for the smart bin OTA endpoint")
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("make", help="Make a patch from the running image to a new one")
+    p.add_argument("old")
+    p.add_argument("new")
+    p.add_argument("-o", "--output", required=True)
+    p.add_argument("--key", default=os.environ.get("SMARTBIN_OTA_KEY"), help="OTA key, to print the signature")
+    p = sub.add_parser("apply", help="Rebuild the new image from a patch and check its hash")
+    p.add_argument("old")
+    p.add_argument("patch")
+    p.add_argument("-o", "--output")
+    p = sub.add_parser("info", help="Print a patch header")
+    p.add_argument("patch")
+    p = sub.add_parser("sign", help="Print the signature the bin needs for an image")
+    p.add_argument("image", help="The full new image, also for updates sent as a patch")
+    p.add_argument("--key", default=os.environ.get("SMARTBIN_OTA_KEY"), help="OTA key (default: $SMARTBIN_OTA_KEY)")
+    args = parser.parse_args()
+
+    if args.command == "make":
+        src, tgt = read(args.old), read(args.new)
+        patch, stats = make(src, tgt)
+        apply(src, patch)   # Never ship a patch that doesn't round trip
+        with open(args.output, "wb") as f:
+            f.write(patch)
+        print(f"{len(tgt)} byte image -> {len(patch)} byte patch ({100 * len(patch) / len(tgt):.1f}%)")
+        print(f"{stats['add']} adds covering {stats['copied']} bytes, "
+              f"{stats['insert']} inserts with {stats['literal']} literal bytes")
+        print(f"sha256 {hashlib.sha256(tgt).hexdigest()}")
+        if args.key:
+            print(f"signature {signature(args.key, tgt)}")
+    elif args.command == "sign":
+        if not args.key:
+            sys.exit("error: no key; pass --key or set SMARTBIN_OTA_KEY")
+        print(signature(args.key, read(args.image)))
+    elif args.command == "apply":
+        try:
+            image = apply(read(args.old), read(args.patch))
+        except ValueError as e:
+            sys.exit(f"error: {e}")
+        if args.output:
+            with open(args.output, "wb") as f:
+                f.write(image)
+        print(f"ok, {len(image)} bytes, sha256 {hashlib.sha256(image).hexdigest()}")
+    else:
+        magic, version, src_size, tgt_size, src_sha, tgt_sha = HEADER.unpack_from(read(args.patch))
+        if magic != MAGIC:
+            sys.exit("error: not a delta patch")
+        print(f"version {version}")
+        print(f"source {src_size} bytes sha256 {src_sha.hex()}")
+        print(f"target {tgt_size} bytes sha256 {tgt_sha.hex()}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,243 @@
+// Replays a recorded input trace through the controller logic on a host.
+//
+// Record on a bin:
+//   curl -X POST -d action=start http://<ip>/api/record
+//   ... let it run ...
+//   curl -X POST -d action=stop http://<ip>/api/record
+//   curl -o inputs.bin http://<ip>/api/record
+//
+// Build and run from smart_waste_bin_firmware_/:
+//   g++ -std=c++11 -O2 -Ilib/BinController -Ilib/BinProtocol -Ilib/InputTrace
+//       -Ilib/FillEstimator -Ilib/SamplingPolicy -Ilib/PatternEngine -Ilib/EventTrace
+//       -Ilib/BoardConfig -Ilib/StationConfig tools/replay/replay.cpp lib/BinController/BinController.cpp
+//       lib/BinProtocol/BinProtocol.cpp lib/InputTrace/InputTrace.cpp
+//       lib/FillEstimator/FillEstimator.cpp lib/SamplingPolicy/SamplingPolicy.cpp -o replay
+//   ./replay inputs.bin                 # state/actuator timeline
+//   ./replay inputs.bin --repeat 100    # benchmark, timeline suppressed
+//
+// Simulated time advances in loop-period steps (--loop-ms, default 50 to
+// match the firmware's delay), feeding each recorded input once its
+// timestamp is reached. The controller configuration is the firmware's
+// (lib/StationConfig), for the default board unless built with
+// -DSMARTBIN_BOARD=<variant>.
+
+#include <BinController.h>
+#include <InputTrace.h>
+#include <StationConfig.h>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Keep the controller running this long after the last input
+static const uint32_t TAIL_MS = 30000;
+
+static const char* const STATE_NAMES[BIN_STATE_COUNT] = {
+  "IDLE", "DETECTING_MOTION", "ANALYZING_MATERIAL", "OPENING_BIN",
+  "BIN_OPEN", "CLOSING_BIN", "BIN_FULL", "MAINTENANCE_MODE"
+};
+static const char* const BIN_NAMES[2] = { "organic", "non_organic" };
+static const char* const COMMAND_NAMES[MANUAL_COMMAND_COUNT] = {
+  "open organic", "open non_organic", "close organic", "close non_organic",
+  "maintenance on", "maintenance off"
+};
+
+class ReplayHardware : public BinHardware {
+public:
+  explicit ReplayHardware(bool printTimeline)
+      : now(0), print(printTimeline), canHead(0), canTail(0), commandHead(0), commandTail(0) {
+    pir = false;
+    keypad[0] = keypad[1] = false;
+    distance = FillEstimator::INVALID;
+    mass = FillEstimator::INVALID;
+  }
+
+  void apply(const InputEvent& e) {
+    switch (e.type) {
+      case INPUT_PIR: pir = e.value != 0; break;
+      case INPUT_KEYPAD_1: keypad[0] = e.value != 0; break;
+      case INPUT_KEYPAD_2: keypad[1] = e.value != 0; break;
+      case INPUT_DISTANCE: distance = e.value; break;
+      case INPUT_MASS: mass = e.value; break;
+      case INPUT_CAN_RX:
+        if ((uint8_t)(canTail - canHead) < CAN_QUEUE) {
+          canQueue[canTail++ % CAN_QUEUE] = e;
+        }
+        break;
+      case INPUT_COMMAND:
+        if (e.value >= 0 && e.value < MANUAL_COMMAND_COUNT && (uint8_t)(commandTail - commandHead) < COMMAND_QUEUE) {
+          commandQueue[commandTail++ % COMMAND_QUEUE] = (ManualCommand)e.value;
+        }
+        break;
+    }
+  }
+
+  uint32_t now;
+
+  uint32_t millis() override { return now; }
+  bool motion() override { return pir; }
+  bool keypadPressed(uint8_t button) override { return keypad[button ? 1 : 0]; }
+  int32_t distanceMm() override { return distance; }
+  int32_t massGrams() override { return mass; }
+
+  bool receiveCan(CanMessage& msg) override {
+    if (canHead == canTail) {
+      return false;
+    }
+    const InputEvent& e = canQueue[canHead++ % CAN_QUEUE];
+    msg.id = (uint32_t)e.value;
+    msg.length = e.length;
+    memcpy(msg.data, e.payload, e.length);
+    return true;
+  }
+  bool receiveCommand(ManualCommand& command) override {
+    if (commandHead == commandTail) {
+      return false;
+    }
+    command = commandQueue[commandHead++ % COMMAND_QUEUE];
+    log("COMMAND", "%s", COMMAND_NAMES[command]);
+    return true;
+  }
+
+  void setLid(uint8_t bin, bool open) override {
+    log("LID", "%s %s", BIN_NAMES[bin ? 1 : 0], open ? "open" : "closed");
+  }
+  void sendCan(const CanMessage& msg) override {
+    log("CAN_TX", "0x%03X %.*s", (unsigned)msg.id, msg.length, (const char*)msg.data);
+  }
+  void playTone(TonePattern tone) override {
+    log("TONE", "%s", tone == TONE_CHIRP ? "chirp" : tone == TONE_ERROR ? "error" : "none");
+  }
+  void uploadBinData() override {
+    log("UPLOAD", "bin data");
+  }
+  void trace(uint8_t event, uint8_t a, uint16_t b) override {
+    if (event == TRACE_STATE) {
+      log("STATE", "%s -> %s", STATE_NAMES[a], STATE_NAMES[b]);
+    } else if (event == TRACE_DETECTION) {
+      log("DETECTION", "%s after %u ms", materialName((Material)a), b);
+    } else if (event == TRACE_DETECTION_TIMEOUT) {
+      log("DETECTION", "timeout after %u ms", b);
+    }
+  }
+
+private:
+  static const uint8_t CAN_QUEUE = 8;
+  static const uint8_t COMMAND_QUEUE = 8;   // MANUAL_QUEUE_LENGTH in main.cpp
+
+  void log(const char* what, const char* fmt, ...) __attribute__((format(printf, 3, 4))) {
+    if (!print) {
+      return;
+    }
+    char detail[96];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(detail, sizeof(detail), fmt, args);
+    va_end(args);
+    printf("%10.3fs  %-10s %s\n", now / 1000.0, what, detail);
+  }
+
+  bool print;
+  bool pir;
+  bool keypad[2];
+  int32_t distance;
+  int32_t mass;
+  InputEvent canQueue[CAN_QUEUE];
+  uint8_t canHead;
+  uint8_t canTail;
+  ManualCommand commandQueue[COMMAND_QUEUE];
+  uint8_t commandHead;
+  uint8_t commandTail;
+};
+
+// Runs one replay; returns the number of loop passes
+static uint32_t replay(const std::vector<uint8_t>& data, uint32_t loopMs, bool printTimeline, BinController** out, ReplayHardware** outHw) {
+  InputTraceReader reader;
+  reader.begin(data.data(), data.size());
+
+  ReplayHardware* hw = new ReplayHardware(printTimeline);
+  BinController* controller = new BinController(CONTROLLER_CONFIG, *hw);
+
+  InputEvent next;
+  bool haveNext = reader.next(next);
+  uint32_t lastInput = 0;
+  uint32_t passes = 0;
+
+  while (haveNext || hw->now <= lastInput + TAIL_MS) {
+    while (haveNext && next.timeMs <= hw->now) {
+      hw->apply(next);
+      lastInput = next.timeMs;
+      haveNext = reader.next(next);
+    }
+    controller->checkKeypad();
+    controller->updateBinLevel();
+    controller->runStateMachine();
+    passes++;
+    hw->now += loopMs;
+  }
+
+  *out = controller;
+  *outHw = hw;
+  return passes;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s inputs.bin [--loop-ms N] [--repeat N]\n", argv[0]);
+    return 2;
+  }
+  uint32_t loopMs = 50;
+  uint32_t repeat = 0;
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--loop-ms") == 0) {
+      loopMs = (uint32_t)atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--repeat") == 0) {
+      repeat = (uint32_t)atoi(argv[i + 1]);
+    }
+  }
+
+  FILE* f = fopen(argv[1], "rb");
+  if (!f) {
+    perror(argv[1]);
+    return 1;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    data.insert(data.end(), chunk, chunk + n);
+  }
+  fclose(f);
+
+  InputTraceReader check;
+  if (!check.begin(data.data(), data.size())) {
+    fprintf(stderr, "%s: not an input trace\n", argv[1]);
+    return 1;
+  }
+
+  BinController* controller;
+  ReplayHardware* hw;
+  uint32_t runs = repeat ? repeat : 1;
+  uint32_t passes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t r = 0; r < runs; r++) {
+    passes = replay(data, loopMs, repeat == 0, &controller, &hw);
+    if (r + 1 < runs) {
+      delete controller;
+      delete hw;
+    }
+  }
+  double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+  const ControllerCounters& c = controller->counters;
+  printf("\nsimulated %.1f s in %.3f ms (%.0fx real time), %u loop passes, %.2f us/pass\n",
+         hw->now / 1000.0, wall * 1000, hw->now / 1000.0 / wall, passes, wall * 1e6 / passes);
+  printf("motion=%u detections=%u timeouts=%u lid_opens=%u full_refusals=%u final_state=%s\n",
+         c.motionEvents, c.detections, c.detectionTimeouts, c.lidOpens, c.fullRefusals,
+         STATE_NAMES[controller->state()]);
+  delete controller;
+  delete hw;
+  return 0;
+}
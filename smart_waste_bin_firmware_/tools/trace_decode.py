@@ -0,0 +1,104 @@
+"""
+Decode the controller's binary event trace into a timeline.
+
+    curl -o trace.bin http://<controller-ip>/api/trace
+    python trace_decode.py trace.bin
+
+The layout matches lib/EventTrace/EventTrace.h: a 16-byte header followed by
+`capacity` 8-byte records, all little-endian. Records are ordered by their
+sequence number; times restart at every BOOT record.
+"""
+import argparse
+import struct
+import sys
+
+HEADER = struct.Struct("<IHHII")
+RECORD = struct.Struct("<IBBH")
+MAGIC = 0x52544253
+VERSION = 1
+
+EVENTS = {
+    1: "BOOT",
+    2: "CLOCK",
+    3: "STATE",
+    4: "CAN_TX",
+    5: "CAN_RX",
+    6: "DETECTION",
+    7: "DETECTION_TIMEOUT",
+    8: "LID_OPEN",
+    9: "LID_CLOSE",
+    10: "UPLOAD",
+    11: "MOTION",
+}
+
+STATES = ["IDLE", "DETECTING_MOTION", "ANALYZING_MATERIAL", "OPENING_BIN",
+          "BIN_OPEN", "CLOSING_BIN", "BIN_FULL", "MAINTENANCE_MODE"]
+MATERIALS = ["UNKNOWN", "ORGANIC", "NON_ORGANIC", "NONE"]
+BINS = ["organic", "non_organic"]
+
+# esp_reset_reason_t
+RESET_REASONS = ["UNKNOWN", "POWERON", "EXT", "SW", "PANIC", "INT_WDT",
+                 "TASK_WDT", "WDT", "DEEPSLEEP", "BROWNOUT", "SDIO"]
+
+
+def name(table, index):
+    return table[index] if 0 <= index < len(table) else str(index)
+
+
+def describe(event, a, b):
+    if event == 1:
+        return f"reset={name(RESET_REASONS, a)} boot={b}"
+    if event == 3:
+        return f"{name(STATES, a)} -> {name(STATES, b)}"
+    if event in (4, 5):
+        return f"id=0x{b:03X} len={a}"
+    if event == 6:
+        return f"material={name(MATERIALS, a)} after {b} ms"
+    if event == 7:
+        return f"after {b} ms"
+    if event in (8, 9):
+        return f"bin={name(BINS, a)}"
+    if event == 11:
+        return "camera" if a else "pir"
+    if event == 10:
+        return f"{'ok' if a else 'failed'} code={struct.unpack('<h', struct.pack('<H', b))[0]}"
+    return f"a={a} b={b}"
+
+
+def decode(data):
+    magic, version, capacity, sequence, boot_count = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not a trace buffer (bad magic or version)")
+
+    count = min(sequence, capacity)
+    first = sequence - count
+    records = []
+    for seq in range(first, sequence):
+        offset = HEADER.size + (seq % capacity) * RECORD.size
+        records.append((seq,) + RECORD.unpack_from(data, offset))
+
+    high = 0
+    for seq, time_us, event, a, b in records:
+        if event == 1:
+            high = 0
+        elif event == 2:
+            high = b
+            continue
+        yield seq, (high << 32) | time_us, EVENTS.get(event, f"EVENT_{event}"), describe(event, a, b)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a smart bin event trace")
+    parser.add_argument("file", help="Binary trace from /api/trace ('-' for stdin)")
+    args = parser.parse_args()
+
+    data = sys.stdin.buffer.read() if args.file == "-" else open(args.file, "rb").read()
+    last = None
+    for seq, time_us, event, detail in decode(data):
+        delta = "" if last is None or event == "BOOT" else f"+{(time_us - last) / 1000:.3f} ms"
+        print(f"{seq:>8} {time_us / 1e6:>14.6f}s {delta:>14} {event:<18} {detail}")
+        last = time_us
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+"""
+WebSocket load check for the bin controller.
+
+Opens many WebSocket clients against a controller, sends `get_status` from
+each of them in rounds and reports round-trip latency percentiles, together
+with the controller's free heap before, during and after the run.
+
+    pip install websockets
+    python ws_bench.py 192.168.1.50 --clients 8 --rounds 50
+
+Free heap is read from the first of these that answers: `free_heap` in
+/api/status/details, `free_heap` in /api/status (firmware from before the
+status split), and the smartbin_free_heap_bytes gauge on /api/metrics.
+--heap-url and --heap-field pick another source; a URL ending in /metrics
+is read as Prometheus text.
+
+Use --url to point at a different endpoint, e.g. ws://<ip>:81/ for
+firmware that still runs the standalone WebSocket server. That firmware
+reports no heap at all; for the before half of a comparison build it with
+
+    doc["free_heap"] = ESP.getFreeHeap();
+
+added to buildStatusJson(), which the /api/status fallback then finds:
+
+    python ws_bench.py 192.168.1.50 --url ws://192.168.1.50:81/ --clients 8
+    python ws_bench.py 192.168.1.50 --clients 8
+"""
+import argparse
+import asyncio
+import json
+import statistics
+import time
+import urllib.request
+
+import websockets
+
+
+HEAP_SOURCES = [
+    ("/api/status/details", "free_heap"),
+    ("/api/status", "free_heap"),
+    ("/api/metrics", "smartbin_free_heap_bytes"),
+]
+
+
+def read_heap(url, field):
+    """Read one heap value from a JSON or Prometheus endpoint, None if absent."""
+    try:
+        with urllib.request.urlopen(url, timeout=5) as resp:
+            body = resp.read().decode()
+    except Exception:
+        return None
+    if url.rstrip("/").endswith("/metrics"):
+        for line in body.splitlines():
+            parts = line.split()
+            if len(parts) == 2 and parts[0] == field:
+                return int(float(parts[1]))
+        return None
+    try:
+        return json.loads(body).get(field)
+    except ValueError:
+        return None
+
+
+def heap_source(args):
+    """Pick the heap URL and field to sample, None if the firmware has none."""
+    if args.heap_url:
+        return args.heap_url, args.heap_field
+    for path, field in HEAP_SOURCES:
+        url = f"http://{args.host}{path}"
+        if read_heap(url, field) is not None:
+            return url, field
+    return None
+
+
+def free_heap(source):
+    return read_heap(*source) if source else None
+
+
+async def client(url, rounds, latencies, errors):
+    try:
+        async with websockets.connect(url, open_timeout=10) as ws:
+            await ws.recv()  # Initial status pushed on connect
+            for _ in range(rounds):
+                start = time.perf_counter()
+                await ws.send(json.dumps({"command": "get_status"}))
+                await asyncio.wait_for(ws.recv(), timeout=10)
+                latencies.append((time.perf_counter() - start) * 1000)
+    except Exception as e:
+        errors.append(str(e))
+
+
+async def run(args):
+    url = args.url or f"ws://{args.host}/ws"
+    latencies, errors = [], []
+
+    source = heap_source(args)
+    heap_before = free_heap(source)
+    tasks = [asyncio.create_task(client(url, args.rounds, latencies, errors))
+             for _ in range(args.clients)]
+    await asyncio.sleep(1)
+    heap_during = free_heap(source)
+    await asyncio.gather(*tasks)
+    heap_after = free_heap(source)
+
+    print(f"endpoint      {url}")
+    print(f"clients       {args.clients} x {args.rounds} rounds")
+    print(f"errors        {len(errors)}")
+    if latencies:
+        latencies.sort()
+        pct = lambda p: latencies[min(len(latencies) - 1, int(len(latencies) * p))]
+        print(f"rtt ms        median {statistics.median(latencies):.1f}  "
+              f"p90 {pct(0.90):.1f}  p99 {pct(0.99):.1f}  max {latencies[-1]:.1f}")
+    if source:
+        print(f"free heap     before {heap_before}  during {heap_during}  after {heap_after}"
+              f"  ({source[1]} from {source[0]})")
+    else:
+        print("free heap     not reported by this firmware (see --heap-url)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[1])
+    parser.add_argument("host", help="Controller IP or hostname")
+    parser.add_argument("--clients", type=int, default=8)
+    parser.add_argument("--rounds", type=int, default=50)
+    parser.add_argument("--url", help="Override WebSocket URL")
+    parser.add_argument("--heap-url", help="Read free heap from this URL instead")
+    parser.add_argument("--heap-field", default="free_heap",
+                        help="JSON field or metric name at --heap-url")
+    asyncio.run(run(parser.parse_args()))
+
+
+if __name__ == "__main__":
+    main()